@@ -0,0 +1,82 @@
+// Compare the compiled chat templates with the hand-written renderers,
+// and with rendering only the last turn incrementally
+
+#include <zinc/hodgepodge.hpp>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace zinc;
+using Message = HodgePodge::Message;
+
+std::vector<Message> conversation(size_t turns, size_t content_size)
+{
+    std::vector<Message> messages;
+    messages.emplace_back(Message{.role = "system", .content = "You are a helpful assistant."});
+    for (size_t turn = 0; turn < turns; ++ turn) {
+        messages.emplace_back(Message{.role = "user", .content = std::string(content_size, 'u')});
+        messages.emplace_back(Message{.role = "assistant", .content = std::string(content_size, 'a')});
+    }
+    return messages;
+}
+
+// Microseconds per call, repeating for about a quarter second
+template <typename Render>
+double time_per_call(Render render)
+{
+    using clock = std::chrono::steady_clock;
+    size_t bytes = render(); // warm up
+    size_t calls = 0;
+    auto start = clock::now(), now = start;
+    while (now - start < std::chrono::milliseconds(250)) {
+        for (size_t idx = 0; idx < 16; ++ idx) {
+            bytes += render();
+        }
+        calls += 16;
+        now = clock::now();
+    }
+    if (bytes == 0) {
+        std::cerr << "nothing rendered" << std::endl;
+    }
+    return std::chrono::duration<double, std::micro>(now - start).count() / (double)calls;
+}
+
+int main()
+{
+    JSON builtin_tools[] = {"code_interpreter", "brave_search", "wolfram_alpha"};
+    std::vector<KeyJSONPair> llama_variables{
+        {"builtin_tools", JSON::Array(builtin_tools)},
+        {"date_string", "26 Jul 2024"},
+    };
+    auto & deepseek3 = HodgePodge::ChatTemplate::deepseek3();
+    auto & llama31 = HodgePodge::ChatTemplate::llama31();
+    std::string buffer;
+
+    std::cout << std::setw(9) << "messages" << std::setw(14) << "template"
+              << std::setw(16) << "hand-written us" << std::setw(14) << "compiled us"
+              << std::setw(12) << "buffer us" << std::setw(16) << "incremental us" << std::endl;
+    for (size_t turns : {size_t(4), size_t(64), size_t(1024)}) {
+        auto messages = conversation(turns, 256);
+        HodgePodge::IncrementalPrompt deepseek3_incremental(deepseek3);
+        HodgePodge::IncrementalPrompt llama31_incremental(llama31, llama_variables);
+        std::cout << std::fixed << std::setprecision(2);
+
+        std::cout << std::setw(9) << messages.size() << std::setw(14) << "deepseek3"
+            << std::setw(16) << time_per_call([&]{ return HodgePodge::prompt_deepseek3(messages, true).size(); })
+            << std::setw(14) << time_per_call([&]{ return deepseek3.render(messages, true).size(); })
+            << std::setw(12) << time_per_call([&]{ buffer.clear(); deepseek3.render(buffer, messages, true); return buffer.size(); })
+            << std::setw(16) << time_per_call([&]{ deepseek3_incremental.update(messages, true); return deepseek3_incremental.suffix().size(); })
+            << std::endl;
+
+        std::cout << std::setw(9) << messages.size() << std::setw(14) << "llama31"
+            << std::setw(16) << time_per_call([&]{ return HodgePodge::prompt_llama31_hf(messages, true).size(); })
+            << std::setw(14) << time_per_call([&]{ return llama31.render(messages, true, llama_variables).size(); })
+            << std::setw(12) << time_per_call([&]{ buffer.clear(); llama31.render(buffer, messages, true, llama_variables); return buffer.size(); })
+            << std::setw(16) << time_per_call([&]{ llama31_incremental.update(messages, true); return llama31_incremental.suffix().size(); })
+            << std::endl;
+    }
+    return 0;
+}
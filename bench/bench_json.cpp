@@ -0,0 +1,227 @@
+// Compare release and checked JSON parsing as documents grow, and time lookups, comparison, encoding, building, binding and paths
+
+#include <zinc/json.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace zinc;
+
+// Every allocation in the program is counted, for allocations per request
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++ allocations;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// The fields of a streamed chat chunk that a client reads
+struct Delta {
+    std::string_view content;
+    static constexpr auto json_fields() { return std::array{JSON::field<&Delta::content>("content")}; }
+};
+struct Choice {
+    Delta delta;
+    std::string_view finish_reason;
+    static constexpr auto json_fields()
+    { return std::array{JSON::field<&Choice::delta>("delta"), JSON::field<&Choice::finish_reason>("finish_reason")}; }
+};
+struct Chunk {
+    std::vector<Choice> choices;
+    static constexpr auto json_fields() { return std::array{JSON::field<&Chunk::choices>("choices")}; }
+};
+
+// An array of small objects, like a log or a list of tool schemas
+std::string document(size_t elements)
+{
+    std::string text = "[";
+    for (size_t idx = 0; idx < elements; ++ idx) {
+        text += R"({"id":)" + std::to_string(idx) + R"(,"name":"element","tags":["a","b"],"score":0.5},)";
+    }
+    text.back() = ']';
+    return text;
+}
+
+// Microseconds per call, repeating for about a quarter second
+template <typename Parse>
+double time_per_call(Parse parse)
+{
+    using clock = std::chrono::steady_clock;
+    size_t calls = 0;
+    auto start = clock::now(), now = start;
+    do {
+        parse();
+        ++ calls;
+        now = clock::now();
+    } while (now - start < std::chrono::milliseconds(250));
+    return std::chrono::duration<double, std::micro>(now - start).count() / (double)calls;
+}
+
+int main()
+{
+    char const* backend = std::getenv("ZINC_JSON_BACKEND");
+    std::cout << "backend: " << (backend ? backend : "default") << std::endl;
+    std::cout << std::setw(9) << "elements" << std::setw(14) << "release us" << std::setw(14) << "checked us"
+              << std::setw(16) << "release ns/el" << std::setw(16) << "checked ns/el" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t elements : {size_t(64), size_t(256), size_t(1024), size_t(4096), size_t(65536)}) {
+        std::string text = document(elements);
+        double release = time_per_call([&]{ JSON::decode(text); });
+        std::cout << std::setw(9) << elements << std::setw(14) << release;
+        // checked parsing is quadratic; past a few thousand elements it takes minutes
+        if (elements <= 4096) {
+            double checked = time_per_call([&]{ JSON::decode_checked(text); });
+            std::cout << std::setw(14) << checked << std::setw(16) << release * 1000 / (double)elements
+                      << std::setw(16) << checked * 1000 / (double)elements << std::endl;
+        } else {
+            std::cout << std::setw(14) << "-" << std::setw(16) << release * 1000 / (double)elements
+                      << std::setw(16) << "-" << "   " << (double)text.size() / release << " MB/s" << std::endl;
+        }
+    }
+
+    // lookups by key in a parsed object, which is indexed, and in a copy built by hand, which is scanned
+    std::cout << std::endl << std::setw(9) << "keys" << std::setw(14) << "indexed ns" << std::setw(14) << "scanned ns" << std::endl;
+    for (size_t keys : {size_t(4), size_t(16), size_t(64), size_t(1024)}) {
+        std::string text = "{";
+        for (size_t idx = 0; idx < keys; ++ idx) {
+            text += R"("property_)" + std::to_string(idx) + R"(":)" + std::to_string(idx) + ",";
+        }
+        text.back() = '}';
+        JSON::Doc doc = JSON::decode(text);
+        std::vector<KeyJSONPair> pairs((*doc).object().begin(), (*doc).object().end());
+        JSON scanned = std::span<KeyJSONPair>(pairs);
+        std::string last = "property_" + std::to_string(keys - 1);
+        JSON const* sink = nullptr;
+        double indexed_ns = time_per_call([&]{ for (int i = 0; i < 1000; ++ i) sink = (*doc).find(last); });
+        double scanned_ns = time_per_call([&]{ for (int i = 0; i < 1000; ++ i) sink = scanned.find(last); });
+        std::cout << std::setw(9) << keys << std::setw(14) << indexed_ns << std::setw(14) << scanned_ns << std::endl;
+        if (sink == nullptr) return 1;
+    }
+
+    // comparing equal nested objects with keys in another order, parsed and built by hand
+    std::cout << std::endl << std::setw(9) << "keys" << std::setw(14) << "indexed us" << std::setw(14) << "unindexed us" << std::endl;
+    for (size_t keys : {size_t(8), size_t(64), size_t(256)}) {
+        std::string forward = "{", backward = "{";
+        for (size_t idx = 0; idx < keys; ++ idx) {
+            forward += R"("key_)" + std::to_string(idx) + R"(":{"id":)" + std::to_string(idx) + R"(,"tags":["a","b"],"nested":{"x":1,"y":2}},)";
+            backward += R"("key_)" + std::to_string(keys - 1 - idx) + R"(":{"nested":{"y":2,"x":1},"tags":["a","b"],"id":)" + std::to_string(keys - 1 - idx) + "},";
+        }
+        forward.back() = backward.back() = '}';
+        JSON::Doc lhs = JSON::decode(forward), rhs = JSON::decode(backward);
+        std::vector<KeyJSONPair> lpairs((*lhs).object().begin(), (*lhs).object().end());
+        std::vector<KeyJSONPair> rpairs((*rhs).object().begin(), (*rhs).object().end());
+        JSON lbuilt = std::span<KeyJSONPair>(lpairs), rbuilt = std::span<KeyJSONPair>(rpairs);
+        bool equal = true;
+        double indexed = time_per_call([&]{ equal = equal && *lhs == *rhs; });
+        double unindexed = time_per_call([&]{ equal = equal && lbuilt == rbuilt; });
+        std::cout << std::setw(9) << keys << std::setw(14) << indexed << std::setw(14) << unindexed << std::endl;
+        if (!equal) return 1;
+    }
+
+    // encoding to the thread's string and in pieces to a sink that only counts them
+    std::cout << std::endl << std::setw(9) << "elements" << std::setw(14) << "string us" << std::setw(14) << "sink us"
+              << std::setw(16) << "string MB/s" << std::endl;
+    for (size_t elements : {size_t(64), size_t(4096), size_t(65536)}) {
+        JSON::Doc doc = JSON::decode(document(elements));
+        size_t encoded = 0, counted = 0;
+        double string = time_per_call([&]{ encoded = (*doc).encode().size(); });
+        double sink = time_per_call([&]{ counted = 0; (*doc).encode([&](std::string_view chunk) { counted += chunk.size(); }); });
+        std::cout << std::setw(9) << elements << std::setw(14) << string << std::setw(14) << sink
+                  << std::setw(16) << (double)encoded / string << std::endl;
+        if (counted != encoded) return 1;
+    }
+
+    // a chat request body, from vectors of pairs made per request and from a builder kept between requests
+    std::cout << std::endl << std::setw(9) << "messages" << std::setw(14) << "vectors us" << std::setw(14) << "builder us"
+              << std::setw(16) << "vectors allocs" << std::setw(16) << "builder allocs" << std::endl;
+    for (size_t count : {size_t(2), size_t(16), size_t(128)}) {
+        std::vector<std::pair<std::string, std::string>> messages;
+        for (size_t idx = 0; idx < count; ++ idx) {
+            messages.emplace_back(idx % 2 ? "assistant" : "user", std::string(200, 'm'));
+        }
+        size_t encoded = 0;
+        auto with_vectors = [&]{
+            std::vector<KeyJSONPair> params{{"model", "model"}, {"temperature", 0.5}, {"stream", true}};
+            std::vector<JSON> list;
+            std::vector<KeyJSONPair> inner;
+            inner.reserve(messages.size() * 2);
+            for (auto & [role, content] : messages) {
+                auto start = inner.end();
+                inner.emplace_back("role", role);
+                inner.emplace_back("content", content);
+                list.emplace_back(std::span(start, inner.end()));
+            }
+            params.emplace_back("messages", list);
+            encoded += JSON(params).encode().size();
+        };
+        JSON::Builder builder(true);
+        auto with_builder = [&]{
+            builder.begin_object().insert("model", "model").insert("temperature", 0.5).insert("stream", true);
+            builder.key("messages").begin_array();
+            for (auto & [role, content] : messages) {
+                builder.begin_object().insert("role", role).insert("content", content).end();
+            }
+            encoded += (*builder.end().end().finish()).encode().size();
+        };
+        double vectors = time_per_call(with_vectors), built = time_per_call(with_builder);
+        size_t before = allocations;
+        with_vectors();
+        size_t vectors_allocs = allocations - before;
+        before = allocations;
+        with_builder();
+        size_t builder_allocs = allocations - before;
+        std::cout << std::setw(9) << count << std::setw(14) << vectors << std::setw(14) << built
+                  << std::setw(16) << vectors_allocs << std::setw(16) << builder_allocs << std::endl;
+        if (!encoded) return 1;
+    }
+
+    // reading the delta of a streamed chat chunk, from a whole parsed tree and bound to structs
+    std::string chunk_line = R"({"id":"chatcmpl-0123456789","object":"chat.completion.chunk","created":1700000000,)"
+        R"("model":"some-model","system_fingerprint":"fp_0123456789","choices":[{"index":0,"delta":{"role":"assistant",)"
+        R"("content":" word"},"logprobs":null,"finish_reason":null}],"usage":null})";
+    size_t read = 0;
+    double tree = time_per_call([&]{
+        for (int i = 0; i < 100; ++ i) {
+            JSON::Doc doc = JSON::decode(chunk_line, true);
+            read += (*doc)["choices"][0]["delta"]["content"].size();
+        }
+    });
+    JSON::Binder binder;
+    Chunk chunk;
+    double bound = time_per_call([&]{
+        for (int i = 0; i < 100; ++ i) {
+            binder.bind(chunk_line, chunk);
+            read += chunk.choices[0].delta.content.size();
+        }
+    });
+    std::cout << std::endl << "chat chunk: tree " << tree * 10 << " ns, bound " << bound * 10 << " ns" << std::endl;
+    if (!read) return 1;
+
+    // the delta of parsed chunks by chained operator[] and by a compiled path
+    JSON::Doc chunk_doc = JSON::decode(chunk_line, true);
+    JSON::Path content_path("/choices/0/delta/content");
+    double chained = time_per_call([&]{ for (int i = 0; i < 1000; ++ i) read += (*chunk_doc)["choices"][0]["delta"]["content"].size(); });
+    double compiled = time_per_call([&]{ for (int i = 0; i < 1000; ++ i) read += content_path.find(*chunk_doc)->size(); });
+    std::cout << "chat chunk content: chained " << chained << " ns, path " << compiled << " ns" << std::endl;
+    return 0;
+}
@@ -0,0 +1,211 @@
+// Differential fuzz of the simd JSON backend against boost's parser, on random and partly corrupted documents
+//
+//     fuzz_json [documents [seed]]
+//
+// JSON::decode runs the simd backend, and Parser::write, which always goes
+// through boost, parses the same text.  Both must accept or reject each
+// document alike and build the same tree.  A difference is printed and
+// fails the run.
+
+#include <zinc/json.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+using namespace zinc;
+
+class Generator
+{
+public:
+    explicit Generator(unsigned long seed)
+    : random_(seed)
+    { }
+
+    std::string document()
+    {
+        std::string text;
+        value(text, 0);
+        // corrupt a quarter of them with a few edits, mostly of syntax
+        if (pick(4) == 0) {
+            for (size_t edits = 1 + pick(3); edits --;) {
+                static constexpr std::string_view bytes = "{}[]\":,\\ 0-1.e+ut\x01\x7f\xc3\xa9\xed\xa0\xff";
+                size_t at = pick(text.size() + 1);
+                switch (pick(3)) {
+                case 0:
+                    text.insert(at, 1, bytes[pick(bytes.size())]);
+                    break;
+                case 1:
+                    if (at < text.size()) {
+                        text.erase(at, 1);
+                    }
+                    break;
+                default:
+                    if (at < text.size()) {
+                        text[at] = bytes[pick(bytes.size())];
+                    }
+                }
+            }
+        }
+        return text;
+    }
+
+private:
+    size_t pick(size_t n)
+    {
+        return std::uniform_int_distribution<size_t>(0, n ? n - 1 : 0)(random_);
+    }
+
+    void space(std::string & text)
+    {
+        static constexpr std::string_view spaces[] = {"", "", "", " ", "\n", "\t ", "\r\n  "};
+        text += spaces[pick(std::size(spaces))];
+    }
+
+    void string(std::string & text)
+    {
+        static constexpr std::string_view pieces[] = {
+            "a", "key", "zinc", " ", "\\\"", "\\\\", "\\/", "\\b\\f\\n\\r\\t", "\\u0041", "\\u00e9",
+            "\\ud83d\\ude00", "\\u20AC", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\\u0000",
+        };
+        text += '"';
+        for (size_t count = pick(6); count --;) {
+            text += pieces[pick(std::size(pieces))];
+        }
+        text += '"';
+    }
+
+    void number(std::string & text)
+    {
+        static constexpr std::string_view numbers[] = {
+            "0", "-0", "1", "-1", "42", "0.5", "-2.25e-3", "1E10", "6.02e+23", "1e400", "-1e-400",
+            "9223372036854775807", "-9223372036854775808", "9223372036854775808", "18446744073709551615",
+            "18446744073709551616", "0.1", "3.141592653589793", "1.7976931348623157e308", "5e-324",
+        };
+        text += numbers[pick(std::size(numbers))];
+    }
+
+    void value(std::string & text, size_t depth)
+    {
+        space(text);
+        size_t kind = pick(depth < 40 ? 8 : 5);
+        switch (kind) {
+        case 0: text += "null"; break;
+        case 1: text += pick(2) ? "true" : "false"; break;
+        case 2: case 3: number(text); break;
+        case 4: string(text); break;
+        case 5: case 6:
+            text += '[';
+            for (size_t count = pick(5), idx = 0; idx < count; ++ idx) {
+                if (idx) {
+                    text += ',';
+                }
+                value(text, depth + 1);
+            }
+            space(text);
+            text += ']';
+            break;
+        default:
+            text += '{';
+            for (size_t count = pick(5), idx = 0; idx < count; ++ idx) {
+                if (idx) {
+                    text += ',';
+                }
+                space(text);
+                string(text);
+                space(text);
+                text += ':';
+                value(text, depth + 1);
+            }
+            space(text);
+            text += '}';
+        }
+        space(text);
+    }
+
+    std::mt19937_64 random_;
+};
+
+// The trees are the same, but for doubles that boost may round one bit apart
+bool same(JSON const& simd, JSON const& boost)
+{
+    if (simd.index() != boost.index()) {
+        return false;
+    }
+    switch (simd.index()) {
+    case JSON::NUMBER: {
+        double a = std::get<double>(simd), b = std::get<double>(boost);
+        return a == b || std::nextafter(a, b) == b;
+    }
+    case JSON::ARRAY:
+        if (simd.array().size() != boost.array().size()) {
+            return false;
+        }
+        for (size_t idx = 0; idx < simd.array().size(); ++ idx) {
+            if (!same(simd.array()[idx], boost.array()[idx])) {
+                return false;
+            }
+        }
+        return true;
+    case JSON::OBJECT:
+        if (simd.object().size() != boost.object().size()) {
+            return false;
+        }
+        for (size_t idx = 0; idx < simd.object().size(); ++ idx) {
+            if (simd.object()[idx].first != boost.object()[idx].first ||
+                !same(simd.object()[idx].second, boost.object()[idx].second)) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        return simd == boost;
+    }
+}
+
+std::string shown(std::optional<JSON::Doc> & doc, std::string const& error)
+{
+    return doc ? std::string((**doc).encode()) : "rejected: " + error;
+}
+
+int main(int argc, char **argv)
+{
+    size_t documents = argc > 1 ? std::stoul(argv[1]) : 200000;
+    unsigned long seed = argc > 2 ? std::stoul(argv[2]) : 1;
+    setenv("ZINC_JSON_BACKEND", "simd", 1);
+
+    Generator generator(seed);
+    size_t accepted = 0, rejected = 0, differences = 0;
+    for (size_t idx = 0; idx < documents; ++ idx) {
+        std::string text = generator.document();
+        std::optional<JSON::Doc> simd, boost;
+        std::string simd_error, boost_error;
+        try {
+            simd = JSON::decode(text);
+        } catch (std::exception const& e) {
+            simd_error = e.what();
+        }
+        try {
+            JSON::Parser parser;
+            parser.write(text);
+            boost = parser.finish();
+        } catch (std::exception const& e) {
+            boost_error = e.what();
+        }
+        if (simd.has_value() != boost.has_value() || (simd && !same(**simd, **boost))) {
+            ++ differences;
+            std::cout << "document " << idx << ": " << JSON(std::string_view(text)).encode() << std::endl;
+            std::cout << "  simd:  " << shown(simd, simd_error) << std::endl;
+            std::cout << "  boost: " << shown(boost, boost_error) << std::endl;
+        } else {
+            ++ (simd ? accepted : rejected);
+        }
+    }
+    std::cout << documents << " documents from seed " << seed << ": " << accepted << " accepted and "
+              << rejected << " rejected alike, " << differences << " different" << std::endl;
+    return differences ? 1 : 0;
+}
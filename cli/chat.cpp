@@ -1,5 +1,8 @@
 #include <zinc/openai.hpp>
 #include <zinc/log.hpp>
+#include <zinc/trace.hpp>
+
+#include "history.hpp"
 
 #include <iostream>
 #include <vector>
@@ -8,6 +11,9 @@ using namespace std;
 using namespace zinc;
 
 int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
+    // the queued log entries are written if the program crashes
+    Log::install_crash_handler();
+
     // Initialize the OpenAI with URL, model, and API key.
     // These values should be replaced
     string_view url = "https://api.sambanova.ai";
@@ -24,9 +30,16 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
 
     vector<OpenAI::RoleContentPair> messages;
     string msg;
+    int first_arg;
+    auto done = history_options(argc, argv, first_arg, [&](string_view role, string_view content) {
+        messages.emplace_back(role, content);
+    });
+    if (done) {
+        return *done;
+    }
 
-    for (int i = 1; i < argc; ++ i) {
-        if (i > 1) msg += " ";
+    for (int i = first_arg; i < argc; ++ i) {
+        if (i > first_arg) msg += " ";
         msg += argv[i];
     }
 
@@ -48,6 +61,7 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
         } else {
             cerr << msg << endl;
         }
+        Trace::Span turn("chat turn");
 
         Log::log(zinc::span<StringViewPair>({
             {"role", "user"},
@@ -1,12 +1,18 @@
+#include <zinc/configuration.hpp>
 #include <zinc/hodgepodge.hpp>
 #include <zinc/http.hpp>
 #include <zinc/openai.hpp>
 #include <zinc/log.hpp>
+#include <zinc/tokenizer.hpp>
+#include <zinc/trace.hpp>
+
+#include "history.hpp"
 
 #include <csignal>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <vector>
 
@@ -133,6 +139,9 @@ std::string perform_replacements(std::string_view message) {
 }
 
 int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
+    // the queued log entries are written if the program crashes
+    Log::install_crash_handler();
+
     std::cerr << "The following will be replaced:" << std::endl;
     std::cerr << "- $(<pathname) will read a file" << std::endl;
     std::cerr << "- $(commands) will capture output from commands" << std::endl;
@@ -161,14 +170,41 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
 
     //vector<OpenAI::RoleContentPair> messages;
     vector<HodgePodge::Message> messages;
+    // DeepSeek-V3 serves a 64k context; leave room for the completion
+    constexpr size_t context_tokens = 64 * 1024;
+    // Tokens are counted exactly if the model's tokenizer.json is in the user config
+    std::optional<Tokenizer> tokenizer;
+    std::string tokenizer_path(Configuration::path_user(zinc::span<std::string_view>({"tokenizers", "DeepSeek-V3.json"})));
+    if (std::filesystem::exists(tokenizer_path)) {
+        tokenizer.emplace(Tokenizer::from_file(tokenizer_path));
+    }
+    HodgePodge::ContextPacker packer(
+        context_tokens - 512, 4, 0, 0.75,
+        tokenizer
+            ? HodgePodge::ContextPacker::TokenCounter([&](std::string_view text) { return tokenizer->count(text); })
+            : HodgePodge::ContextPacker::estimate_tokens
+    );
+    std::vector<KeyJSONPair> params;
     string msg, input;
     int retry_assistant;
 
-    for (int i = 1; i < argc; ++ i) {
+    int first_arg;
+    auto done = history_options(argc, argv, first_arg, [&](std::string_view role, std::string_view content) {
+        messages.emplace_back(HodgePodge::Message{.role=std::string(role), .content=std::string(content)});
+    });
+    if (done) {
+        return *done;
+    }
+
+    for (int i = first_arg; i < argc; ++ i) {
         msg = msg + "$(<" + argv[i] + ") ";
     }
 
-    std::string prompt;
+    // each turn renders only the new messages, unless the packer drops more of the history
+    HodgePodge::IncrementalPrompt prompt(HodgePodge::ChatTemplate::deepseek3());
+    size_t dropped = 0;
+    OpenAI::EscapedPrompt escaped; // kept between turns, so that each escapes only the new suffix
+    size_t reused = 0; // leading bytes of the prompt escaped already
     while ("end of input not reached") {
         cerr << endl << "user: " << flush;
         if (!msg.empty()) {
@@ -188,6 +224,10 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
             if (msg.back() == '\n') {
                 msg.resize(msg.size() - 1);
             }
+        }
+        Trace::Span turn("chatabout turn");
+        {
+            Trace::Span span("chatabout replacements");
             msg = perform_replacements(msg);
         }
 
@@ -199,7 +239,16 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
         messages.emplace_back(HodgePodge::Message{.role="user", .content=move(msg)});
         // it might be nice to terminate the request if more data is found on stdin, append the data, and retry
         // or otherwise provide for the user pasting some data then commenting on it or hitting enter a second time or whatnot
-        prompt = HodgePodge::prompt_deepseek3(messages, "assistant" != messages.back().role);
+        {
+            Trace::Span span("chatabout pack");
+            auto const& packed = packer.pack(messages);
+            if (packer.dropped() != dropped) {
+                dropped = packer.dropped();
+                prompt.reset();
+            }
+            reused = prompt.update(packed, "assistant" != messages.back().role);
+            span.arg("messages", (long)packed.size()).arg("dropped", (long)dropped);
+        }
         msg.clear();
 
         cerr << endl << "assistant: " << flush;
@@ -212,6 +261,7 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
             SIGINT_RAISED = true;
         });
 
+        Trace::Span reply("chatabout reply");
         do {
             ssize_t chunk_start = (ssize_t)msg.size();
             std::string finish_reason;
@@ -219,13 +269,23 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
             retry_assistant = true;
             try {
                 //for (auto&& part : client.chat(messages)) {
-                for (auto&& part : client.complete(prompt + msg)) {
+                params.clear();
+                if (tokenizer) {
+                    // let the completion use whatever context remains
+                    size_t prompt_tokens = tokenizer->count(prompt.prompt()) + tokenizer->count(msg);
+                    if (prompt_tokens < context_tokens) {
+                        params.emplace_back("max_completion_tokens", (long)(context_tokens - prompt_tokens));
+                    }
+                }
+                // the reply so far is continued after the prompt
+                std::string_view prompt_parts[] = {prompt.prompt(), msg};
+                for (auto&& part : client.complete(prompt_parts, escaped, reused, params)) {
                     msg += part;
                     cout << part << flush;
-                    auto fr = part.data.dicty("finish_reason");
-                    finish_data = part.data.encode();
-                    if (fr.truthy()) {
-                        finish_reason = fr.string();
+                    JSON const* fr = part.data.find("finish_reason");
+                    finish_data = part.line; // the server's whole chunk, for a reply that ends unexplained
+                    if (fr && fr->truthy()) {
+                        finish_reason = fr->string();
                         if (finish_reason == "stop") {
                             retry_assistant = false;
                         } else {
@@ -256,12 +316,16 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char **argv) {
                 }*/
             }
 
+            // a retry continues the reply sent so far
+            reused = prompt.prompt().size() + (size_t)chunk_start;
+
             Log::log(zinc::span<StringViewPair>({
                 {"role", "assistant"},
                 {"content", std::string_view(msg.begin() + chunk_start, msg.end())},
                 {"finish_reason", finish_reason.empty() ? finish_data : finish_reason},
             }));
         } while (retry_assistant && !SIGINT_RAISED);
+        reply.end();
         // Restore the default signal handler
         std::signal(SIGINT, SIG_DFL);
 
@@ -8,6 +8,9 @@ using namespace std;
 using namespace zinc;
 
 int main(int argc, char **argv) {
+    // the queued log entries are written if the program crashes
+    Log::install_crash_handler();
+
     // Initialize the OpenAI with URL, model, and API key.
     // These values should be replaced
     string_view url = "https://api.sambanova.ai";
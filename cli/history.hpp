@@ -0,0 +1,58 @@
+#pragma once
+
+#include <zinc/log.hpp>
+
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/*
+ * The options of the chat programs that use the logged history:
+ *   --search words...    print the logged messages with all the words
+ *   --resume[=session]   continue the session, or the last conversation
+ * A resumed session's messages are handed to resume, and the session is
+ * logged to from now on.  Returns the exit status once the program is
+ * done, or none with first_arg at the first argument left.
+ */
+inline std::optional<int> history_options(
+    int argc, char** argv, int & first_arg,
+    std::function<void(std::string_view role, std::string_view content)> const& resume)
+{
+    first_arg = 1;
+    std::string_view option = argc > 1 ? argv[1] : "";
+    if (option == "--search") {
+        zinc::Log::Index index;
+        std::string query;
+        for (int i = 2; i < argc; ++ i) {
+            query = query + argv[i] + " ";
+        }
+        for (auto & entry : index.search(query)) {
+            auto doc = index.read(entry);
+            zinc::JSON const* content = (*doc).find("content");
+            std::cout << entry.session << " " << entry.role << ": ";
+            if (content && content->index() == zinc::JSON::STRING) {
+                std::cout << content->string() << std::endl;
+            } else {
+                std::cout << (*doc).encode() << std::endl;
+            }
+        }
+        return 0;
+    } else if (option.substr(0, 8) == "--resume") {
+        zinc::Log::Index index;
+        std::string session(option.size() > 9 ? option.substr(9) : index.last_conversation());
+        auto messages = index.conversation(session);
+        if (messages.empty()) {
+            std::cerr << "no conversation to resume: " << session << std::endl;
+            return 1;
+        }
+        for (auto & [role, content] : messages) {
+            std::cerr << std::endl << role << ": " << content << std::endl;
+            resume(role, content);
+        }
+        zinc::Log::session(session);
+        first_arg = 2;
+    }
+    return {};
+}
@@ -0,0 +1,35 @@
+#include <zinc/log.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace zinc;
+
+// Prints logs, JSON Lines or CBOR, as JSON Lines: the files given, or all of the project's.
+int main(int argc, char **argv) {
+    vector<string> paths(argv + 1, argv + argc);
+    if (paths.empty()) {
+        paths = Log::files();
+    }
+
+    string line;
+    for (auto&& path : paths) {
+        try {
+            for (auto&& json : Log::read(path)) {
+                line.clear();
+                json.encode(line);
+                line += '\n';
+                cout << line;
+            }
+        } catch (exception const& e) {
+            cout << flush;
+            cerr << path << ": " << e.what() << endl;
+            return 1;
+        }
+    }
+    cout << flush;
+
+    return 0;
+}
@@ -4,7 +4,9 @@
 
 #include <zinc/json.hpp>
 
+#include <functional>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -62,6 +64,150 @@ public:
         std::vector<Message> messages,
         bool add_generation_prompt = false
     );
+
+    /*
+     * A Jinja chat template, such as the chat_template of a model's
+     * tokenizer_config.json, compiled once to a tree of nodes and
+     * rendered straight from the messages without copying them.
+     *
+     * The supported subset is what chat templates use: if/elif/else,
+     * for loops with loop.*, set and namespace(), whitespace control,
+     * and the common tests, filters and string methods.  Templates are
+     * loaded with trim_blocks and lstrip_blocks, as transformers does.
+     *
+     * Variables other than messages, add_generation_prompt, bos_token
+     * and eos_token, such as tools or date_string, are passed as JSON.
+     */
+    class ChatTemplate
+    {
+    public:
+        ChatTemplate(std::string_view source, std::string_view bos_token = {}, std::string_view eos_token = {});
+
+        // Load chat_template, bos_token and eos_token from a tokenizer_config.json
+        static ChatTemplate from_tokenizer_config(std::string_view path);
+
+        ChatTemplate(ChatTemplate&&);
+        ~ChatTemplate();
+
+        // Append the prompt to output
+        void render(
+            std::string & output,
+            std::span<Message const> messages,
+            bool add_generation_prompt = false,
+            std::span<KeyJSONPair const> variables = {}
+        ) const;
+
+        // The prompt, valid until the next call on this thread
+        std::string_view render(
+            std::span<Message const> messages,
+            bool add_generation_prompt = false,
+            std::span<KeyJSONPair const> variables = {}
+        ) const;
+
+        // The templates prompt_deepseek3 and prompt_llama31_hf were written from
+        static ChatTemplate const& deepseek3();
+        static ChatTemplate const& llama31();
+
+    private:
+        void* impl_;
+    };
+
+    /*
+     * Renders a growing conversation with a ChatTemplate, keeping the
+     * prompt of the previous call and rendering only the current turn.
+     *
+     * Each update renders the messages from the last user message already
+     * seen, and checks that their output matches the end of the kept
+     * prompt before appending the rest.  A template whose output is not
+     * append-only fails the check and is rendered in full, so the prompt
+     * is always what the template renders for all the messages.
+     *
+     * Messages passed before are assumed unchanged; call reset() after
+     * editing or dropping any of them.
+     */
+    class IncrementalPrompt
+    {
+    public:
+        IncrementalPrompt(ChatTemplate const& chat_template, std::span<KeyJSONPair const> variables = {});
+
+        // Render messages and return how many leading bytes of prompt() are unchanged since the last call
+        size_t update(std::span<Message const> messages, bool add_generation_prompt = false);
+
+        std::string_view prompt() const { return prompt_; }
+        // The bytes that changed in the last update
+        std::string_view suffix() const { return std::string_view(prompt_).substr(reused_); }
+
+        void reset();
+
+    private:
+        bool extend(std::span<Message const> messages);
+
+        ChatTemplate const& template_;
+        std::span<KeyJSONPair const> variables_;
+        std::string prompt_;
+        size_t committed_; // prompt_ bytes without the generation prompt
+        size_t messages_; // messages rendered into committed bytes
+        size_t reused_;
+        size_t anchor_; // first message rendered into window_
+        std::string window_; // output for the messages from anchor_
+        std::string previous_;
+        std::string scratch_;
+    };
+
+    /*
+     * Trims a growing conversation to a token budget.
+     *
+     * System messages and the most recent turns are always kept. When the
+     * budget is exceeded, the oldest turns are dropped from the front and
+     * replaced by a single system note (or a summary, if a summarizer is
+     * given), and message contents longer than max_message_tokens are
+     * elided in the middle.
+     *
+     * Dropping overshoots down to low_water of the budget, and the set of
+     * dropped turns only grows, so the packed prefix stays byte-identical
+     * across the following turns and provider-side prompt caches still hit.
+     */
+    class ContextPacker
+    {
+    public:
+        using TokenCounter = std::function<size_t(std::string_view)>;
+        using Summarizer = std::function<std::string(std::span<Message const>)>;
+
+        ContextPacker(
+            size_t budget_tokens,
+            size_t keep_recent = 4,
+            size_t max_message_tokens = 0, // 0 means budget_tokens / 4
+            double low_water = 0.75,
+            TokenCounter count_tokens = estimate_tokens,
+            Summarizer summarize = {}
+        );
+
+        std::vector<Message> const& pack(std::span<Message const> messages);
+
+        // Tokens in the last packed result
+        size_t tokens() const { return tokens_; }
+        // Leading non-system messages currently dropped
+        size_t dropped() const { return dropped_; }
+
+        // Rough count of about 4 bytes per token
+        static size_t estimate_tokens(std::string_view text);
+
+    private:
+        size_t message_tokens(Message const& message) const;
+        Message packed_message(Message const& message) const;
+
+        size_t budget_;
+        size_t keep_recent_;
+        size_t max_message_tokens_;
+        double low_water_;
+        TokenCounter count_tokens_;
+        Summarizer summarize_;
+        size_t dropped_;
+        size_t seen_;
+        std::string summary_;
+        std::vector<Message> packed_;
+        size_t tokens_;
+    };
 };
 
 }
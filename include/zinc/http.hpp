@@ -1,5 +1,6 @@
 #pragma once
 
+#include <span>
 #include <string>
 #include <string_view>
 
@@ -19,6 +20,22 @@ public:
         std::span<Header const> headers = {}
     );
 
+    // As request_lines, with a body that is the concatenation of parts, written without joining them
+    static zinc::generator<std::string_view> request_lines_gather(
+        std::string_view method,
+        std::string_view url,
+        std::span<std::string_view const> body,
+        std::span<Header const> headers = {}
+    );
+
+    // Perform an HTTP request (GET or POST) with custom headers and yield the response body in pieces as they are received
+    static zinc::generator<std::string_view> request_chunks(
+        std::string_view method,
+        std::string_view url,
+        std::string_view body = {},
+        std::span<Header const> headers = {}
+    );
+
     // Perform an HTTP request (GET or POST) with custom headers and return the entire response as a string
     static std::string request_string(
         std::string_view method,
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <functional>
 #include <span>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
+#include <vector>
 
 namespace zinc {
 class JSON;
@@ -12,6 +17,12 @@ using _JSON_variant = std::variant<
     bool, long, double, std::string_view,
     std::span<JSON>, std::span<KeyJSONPair>
 >;
+struct _JSON_flag { bool set = false; };
+template <typename Member> struct _JSON_member_class;
+template <typename Class, typename T> struct _JSON_member_class<T Class::*> { using type = Class; };
+template <typename Member> using _JSON_member_class_t = typename _JSON_member_class<Member>::type;
+template <typename T> struct _JSON_is_vector : std::false_type { };
+template <typename T> struct _JSON_is_vector<std::vector<T>> : std::true_type { };
 
 /*
  * The lifetime of parsed JSON objects is managed by the
@@ -19,6 +30,8 @@ using _JSON_variant = std::variant<
  * until the storage for the entire tree can be reused.
  */
 class JSON : public _JSON_variant {
+    _JSON_flag indexed_; // see min_indexed_object_size
+
 public:
     using _JSON_variant::variant;
 
@@ -46,6 +59,8 @@ public:
     bool operator==(JSON const&json) const { return 0==(*this<=>json); }
 
     JSON const& operator[](std::string_view key) const;
+    // The value of the first entry named key, or nullptr if there is none or this is not an object
+    JSON const* find(std::string_view key) const;
     JSON const& operator[](size_t idx) const;
     size_t size() const;
 
@@ -64,7 +79,8 @@ public:
     public:
         // this could instead be a JSON object with a flag
         // or a smart pointer (or both)
-        Doc(Doc&&);
+        Doc(Doc&&) noexcept;
+        Doc& operator=(Doc&&) noexcept;
 
         JSON& operator*() { return *root_; }
 
@@ -72,12 +88,237 @@ public:
 
     private:
         friend class JSON;
+        friend class Parser;
+        friend class Builder;
         Doc(JSON*);
         JSON* root_;
     };
 
-    static Doc decode(std::string_view doc);
-    std::string_view encode() const; /* could we add indentation here please */
+    /*
+     * With reference_input, strings without escapes are views into doc
+     * rather than copies, and doc must outlive the returned Doc.
+     *
+     * Documents are parsed with boost::json, or with a simdjson-style
+     * parser when built with JSON_SIMD or run with ZINC_JSON_BACKEND=simd.
+     * Both build the same tree; pieces passed to Parser::write always
+     * go through boost, which can resume between them.
+     */
+    static Doc decode(std::string_view doc, bool reference_input = false);
+    /*
+     * As decode, verifying the tree under construction each time a
+     * value is stored.  This is quadratic, for tests.
+     */
+    static Doc decode_checked(std::string_view doc, bool reference_input = false);
+    /*
+     * Decode one CBOR (RFC 8949) item, such as a binary log record.
+     * Byte strings become strings, tags are dropped, and undefined and
+     * simple values other than booleans become null.  Map keys must be
+     * text, and strings of indefinite length are not supported.
+     */
+    static Doc decode_cbor(std::string_view cbor, bool reference_input = false);
+
+    /*
+     * Parsed objects with many keys carry a hash index of them, stored
+     * with the entries in the Doc, so lookups by key on configs and tool
+     * schemas do not scan.  Copies of the value share the index; objects
+     * built by hand, and those with duplicate keys, are scanned.
+     */
+    static constexpr size_t min_indexed_object_size = 16;
+
+    /*
+     * Parse state of one's own.  decode() uses a parser per thread;
+     * a Parser lets a caller keep one with a connection or a worker.
+     * Each Doc owns its storage, so docs from any parser may be freed
+     * in any order and on any thread.  A Parser is not itself shared
+     * between threads.
+     */
+    class Parser {
+    public:
+        Parser();
+        /*
+         * Hand each element of a top-level array to on_element as soon
+         * as it is parsed, instead of keeping it in the Doc, so a long
+         * array is never held whole.  The element is valid during the
+         * call, and the Doc's array is empty.
+         */
+        explicit Parser(std::function<void(JSON const&)> on_element);
+        Parser(Parser&&);
+        ~Parser();
+
+        Doc decode(std::string_view doc, bool reference_input = false);
+
+        /*
+         * Parse a document pushed in pieces as they arrive, such as
+         * network reads; a piece need not outlive the call.  finish()
+         * returns the Doc once all of it is written.  A write or finish
+         * that throws abandons the document.
+         */
+        void write(std::string_view chunk);
+        Doc finish();
+
+        /*
+         * Abandon a document partly written, such as when its connection
+         * fails, so that the next write starts a new one.
+         */
+        void reset();
+
+    private:
+        void* impl_;
+    };
+
+    /*
+     * Assemble a document in storage the Doc owns, rather than pointing
+     * spans into vectors that may move.  Containers are opened, filled
+     * and closed in order, as a parser reads them:
+     *
+     *     builder.begin_object().insert("model", model);
+     *     builder.key("messages").begin_array();
+     *     ...
+     *     builder.end().end();
+     *     JSON::Doc doc = builder.finish();
+     *
+     * Strings and containers in inserted values are copied into the doc,
+     * unless built with reference_values, when they are kept as views
+     * and must outlive the Doc.  A Builder keeps its working space
+     * between documents, so one kept per thread or per connection
+     * allocates next to nothing once warm.
+     */
+    class Builder {
+    public:
+        explicit Builder(bool reference_values = false);
+        Builder(Builder&&);
+        ~Builder();
+
+        Builder& begin_array();
+        Builder& begin_object();
+        Builder& end(); // closes the innermost open array or object
+        Builder& key(std::string_view key); // precedes each value in an object
+        Builder& push(JSON const& value);
+        Builder& insert(std::string_view key, JSON const& value) { return this->key(key).push(value); }
+
+        // The single value built, after every container is closed
+        Doc finish();
+
+    private:
+        void* impl_;
+    };
+
+    /*
+     * Read chosen fields of a document straight into structs as it is
+     * parsed, skipping everything else without storing it, for hot
+     * response shapes.  A struct lists its fields in json_fields():
+     *
+     *     struct Delta {
+     *         std::string_view content;
+     *         static constexpr auto json_fields()
+     *         { return std::array{JSON::field<&Delta::content>("content")}; }
+     *     };
+     *
+     * Members may be bool, long, double, std::string_view, another such
+     * struct, or a std::vector of these.  Absent fields, and values of
+     * another type, leave the member as it was; a vector is emptied when
+     * its array begins.
+     */
+    struct Field;
+    struct Binding {
+        Index kind; // OBJECT for a struct, ARRAY for a vector
+        void* (*at)(void* parent, size_t idx); // the member of a struct, or element of a vector
+        void (*resize)(void* vector, size_t size) = nullptr;
+        Binding const* element = nullptr; // of a vector
+        std::span<Field const> fields = {}; // of a struct
+    };
+    struct Field {
+        std::string_view name;
+        Binding binding;
+    };
+
+    template <auto Member>
+    static constexpr Field field(std::string_view name)
+    {
+        return {name, binding_of<std::remove_cvref_t<decltype(std::declval<_JSON_member_class_t<decltype(Member)>>().*Member)>>(
+            [](void* parent, size_t) -> void* { return &(static_cast<_JSON_member_class_t<decltype(Member)>*>(parent)->*Member); })};
+    }
+
+    template <typename T>
+    static constexpr Binding binding_of(void* (*at)(void*, size_t))
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            return {BOOLEAN, at};
+        } else if constexpr (std::is_same_v<T, long>) {
+            return {INTEGER, at};
+        } else if constexpr (std::is_same_v<T, double>) {
+            return {NUMBER, at};
+        } else if constexpr (std::is_same_v<T, std::string_view>) {
+            return {STRING, at};
+        } else if constexpr (_JSON_is_vector<T>::value) {
+            return {ARRAY, at, [](void* vector, size_t size) { static_cast<T*>(vector)->resize(size); }, &element_binding<T>};
+        } else {
+            return {OBJECT, at, nullptr, nullptr, fields_of<T>};
+        }
+    }
+    template <typename Vector>
+    static constexpr Binding element_binding = binding_of<typename Vector::value_type>(
+        [](void* vector, size_t idx) -> void* { return &(*static_cast<Vector*>(vector))[idx]; });
+    template <typename Struct>
+    static constexpr auto fields_of = Struct::json_fields();
+
+    /*
+     * Binds documents to structs.  Strings are views into the document
+     * or, when escaped, into the Binder, valid until its next bind.
+     */
+    class Binder {
+    public:
+        Binder();
+        Binder(Binder&&);
+        ~Binder();
+
+        template <typename Struct>
+        void bind(std::string_view doc, Struct & out)
+        { bind(doc, &out, binding_of<Struct>(nullptr)); }
+
+    private:
+        void bind(std::string_view doc, void* out, Binding const& binding);
+        void* impl_;
+    };
+
+    /*
+     * A JSON Pointer (RFC 6901) such as "/choices/0/delta/content",
+     * compiled once to be looked up in many documents.  A step of "*"
+     * matches every element or member.  Each step remembers where its
+     * key was last found and tries there first, so documents of one
+     * shape are looked up without scanning; of repeated keys, the one
+     * remembered may be matched rather than the first.  A Path may be
+     * shared between threads.
+     */
+    class Path {
+    public:
+        explicit Path(std::string_view pointer);
+        Path(Path&&);
+        ~Path();
+
+        // The first value the path reaches, or nullptr
+        JSON const* find(JSON const& root) const;
+        void for_each(JSON const& root, std::function<void(JSON const&)> const& visit) const;
+
+    private:
+        void* impl_;
+    };
+
+    /*
+     * The text from encode() is valid until the next encode() on the
+     * same thread.  The other forms write to the caller's sink instead:
+     * appended to a string, or handed in pieces of at most
+     * encode_chunk_size bytes to a function such as a socket or log file
+     * write.  With indent >= 0 each element and member goes on its own
+     * line, indented that many spaces per level.
+     */
+    std::string_view encode(int indent = -1) const;
+    void encode(std::string & out, int indent = -1) const;
+    void encode(std::function<void(std::string_view)> const& sink, int indent = -1) const;
+    static constexpr size_t encode_chunk_size = 4096;
+
+private:
+    friend struct KeyIndex;
 };
 
 }
@@ -1,15 +1,187 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <span>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include <zinc/common.hpp>
+#include <zinc/json.hpp>
 
 namespace zinc {
 
 class Log {
 public:
+    /*
+     * JSONL writes one JSON object per line to a .log file.  CBOR writes
+     * each entry to a .cbor file as a map (RFC 8949) of text strings and
+     * a float ts, after its length as 4 bytes little-endian, without
+     * going through an intermediate object.
+     */
+    enum class Format { JSONL, CBOR };
+
+    /*
+     * When the files are synced to storage: never, at flush() and exit,
+     * or after each batch of entries that is written.
+     */
+    enum class Sync { NEVER, FLUSH, BATCH };
+
+    /*
+     * When files are rotated, and which are kept.  The open file is
+     * closed for a new one once it reaches max_size bytes or max_age
+     * seconds.  Closed files are compressed to .gz in the background,
+     * and the oldest are removed while there are more than keep_files,
+     * more than keep_bytes in all, or while older than keep_days.  A
+     * limit of 0 is none, and by default every file is kept, as the
+     * logs are the history that Index searches.
+     *
+     * The defaults may be set in the [log] section of log.ini in the
+     * project or user configuration, read when the first entry is logged.
+     */
+    struct Rotation {
+        size_t max_size = 64 << 20;
+        size_t max_age = 24 * 60 * 60;
+        bool compress = true;
+        size_t keep_files = 0;
+        size_t keep_bytes = 0;
+        size_t keep_days = 0;
+    };
+
+    /*
+     * Log an entry of the fields, a ts and the session.  The entry is formatted on
+     * the calling thread and queued without locking for a writer thread,
+     * which writes queued entries together.  A full queue waits for it.
+     */
     static void log(std::span<StringViewPair const> fields);
+
+    /*
+     * The format of entries logged from now on.  Each format has its
+     * own file for the launch.
+     */
+    static void format(Format format);
+
+    /*
+     * The session of entries logged from now on.  It is named by the
+     * launch time and process unless set, as to resume an earlier one.
+     */
+    static std::string_view session();
+    static void session(std::string_view session);
+
+    /*
+     * The sync policy, Sync::FLUSH by default.
+     */
+    static void sync(Sync sync);
+
+    /*
+     * The rotation from now on, in place of the configured one.
+     */
+    static void rotation(Rotation const& rotation);
+
+    /*
+     * Compress closed files and remove old ones now, as is otherwise
+     * done in the background at launch and after each rotation.  Files
+     * of other processes are left alone while they are being written.
+     */
+    static void tidy();
+
+    /*
+     * Wait until the entries logged so far are written, and synced
+     * unless Sync::NEVER.  This also happens at exit, and for entries
+     * that are queued when the process gets a crash signal once
+     * install_crash_handler() is called.
+     */
+    static void flush();
+
+    /*
+     * Handle SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT by writing the
+     * queued entries before the handlers they replace take over.  This
+     * is for programs to opt into, as a library should not take the
+     * signals from its host.  The handler runs on an alternate stack
+     * for the calling thread, so call it from the main thread.
+     */
+    static void install_crash_handler();
+
+    /*
+     * The log files of the project, oldest first, compressed or not.
+     */
+    static std::vector<std::string> files();
+
+    /*
+     * Read a JSON Lines file such as a log, or a CBOR log by its .cbor
+     * extension, either possibly gzipped as .gz.  The file is mapped, or
+     * inflated, into memory and split into ranges of records that
+     * threads parse at once, each with its own JSON::Parser; threads = 0
+     * uses one per core.  Documents are yielded in file order, or with
+     * ordered = false as their ranges complete.  Each is valid until the
+     * next is yielded.
+     *
+     * A line that is not JSON, or a record that is not CBOR, throws
+     * std::invalid_argument, except a last line without a newline or a
+     * truncated last record, which may still be being written.
+     */
+    static zinc::generator<JSON const&> read(std::string_view path, bool ordered = true, size_t threads = 0);
+
+    /*
+     * An index of the project's logs, to search the content of entries
+     * and find the entries of a session without parsing the files.  It
+     * is kept in the logs directory and brought up to date by parsing
+     * only what was logged since, which is also done in the background
+     * at launch and after each rotation, before files are compressed.
+     *
+     * Entries are listed by file with their offsets, role, ts and
+     * session; entries logged without a session have their file's.
+     * Content is indexed by its words, lowercased where ASCII.
+     */
+    class Index {
+    public:
+        struct Entry {
+            uint32_t file; // of the index
+            uint32_t size; // of the record
+            uint64_t offset; // of the record in the uncompressed file
+            double ts;
+            std::string_view session;
+            std::string_view role;
+        };
+
+        // Loads the index and brings it up to date, or as far as update(stop) gets
+        explicit Index(std::atomic<bool> const* stop = nullptr);
+        Index(Index&&);
+        ~Index();
+
+        /*
+         * Indexes the entries logged since the last update, and saves the
+         * index.  Once stop is set it returns between files, and saves
+         * what was indexed for the next update to go on from.
+         */
+        void update(std::atomic<bool> const* stop = nullptr);
+
+        // The newest entries whose content has every word of the query
+        std::vector<Entry> search(std::string_view query, size_t limit = 20) const;
+
+        // The entries of a session, in order
+        std::vector<Entry> session(std::string_view session) const;
+
+        // The sessions, by their last entry, most recent last
+        std::vector<std::string_view> sessions() const;
+
+        /*
+         * The messages of a session, from its entries with a user or
+         * assistant role and string content.  A reply logged in parts is
+         * one message.
+         */
+        std::vector<StringPair> conversation(std::string_view session);
+
+        // The most recent session with user or assistant entries, or none
+        std::string_view last_conversation() const;
+
+        // The entry as it was logged, read from its file
+        JSON::Doc read(Entry const& entry);
+
+    private:
+        void* impl_;
+    };
 };
 
 } // namespace zinc
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace zinc {
+
+/*
+ * Named counters, gauges and histograms of the library's work, kept
+ * without locking, and written in the Prometheus text exposition format
+ * for a collector to scrape, such as the textfile collector of
+ * node_exporter.
+ *
+ * Metrics are registered by name once, usually into a function-local
+ * static, and live until exit.  If ZINC_METRICS names a file, the
+ * metrics are enabled and written to it at exit.
+ *
+ * Counting is always on, as an update is one relaxed add.  Timing reads
+ * the clock twice, which hot paths such as parsing each line of a stream
+ * should not pay for unasked, so a Timer records nothing unless metrics
+ * are enabled.
+ */
+class Metrics {
+public:
+    // Counters and histograms are split into shards that threads update apart
+    static constexpr size_t shards = 8;
+
+    class Counter {
+    public:
+        void add(uint64_t n = 1)
+        {
+            shards_[shard()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+        uint64_t value() const;
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> value = 0;
+        };
+        Shard shards_[shards];
+    };
+
+    class Gauge {
+    public:
+        void set(int64_t value)
+        {
+            value_.store(value, std::memory_order_relaxed);
+        }
+        void add(int64_t n)
+        {
+            value_.fetch_add(n, std::memory_order_relaxed);
+        }
+        int64_t value() const
+        {
+            return value_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<int64_t> value_ = 0;
+    };
+
+    /*
+     * Counts of values in buckets of about 12% of their size, as in an
+     * HDR histogram: values below 16 have a bucket each, and each power of
+     * two above is split into 8 buckets.
+     */
+    class Histogram {
+    public:
+        static constexpr unsigned sub_bits = 3;
+        static constexpr size_t buckets = (64 - sub_bits + 1) << sub_bits;
+
+        static size_t bucket(uint64_t value)
+        {
+            unsigned exponent = (unsigned)std::bit_width(value);
+            if (exponent <= sub_bits + 1) {
+                return (size_t)value;
+            }
+            unsigned shift = exponent - 1 - sub_bits;
+            return ((size_t)(shift + 1) << sub_bits) + (size_t)((value >> shift) & ((1u << sub_bits) - 1));
+        }
+
+        // The greatest value in the bucket
+        static uint64_t bucket_max(size_t bucket);
+
+        void record(uint64_t value)
+        {
+            auto & shard = shards_[Metrics::shard()];
+            shard.counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+            shard.sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        uint64_t count() const;
+        uint64_t count(size_t bucket) const;
+        uint64_t sum() const;
+
+        // The greatest value of the bucket the quantile falls in, or 0 if empty
+        uint64_t quantile(double q) const;
+
+        // Records the nanoseconds from its construction to its destruction, if metrics are enabled
+        class Timer {
+        public:
+            explicit Timer(Histogram & histogram)
+            : histogram_(histogram), timing_(Metrics::enabled())
+            {
+                if (timing_) {
+                    begin_ = std::chrono::steady_clock::now();
+                }
+            }
+            Timer(Timer const&) = delete;
+            Timer & operator=(Timer const&) = delete;
+            ~Timer()
+            {
+                if (timing_) {
+                    auto elapsed = std::chrono::steady_clock::now() - begin_;
+                    histogram_.record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                }
+            }
+
+        private:
+            Histogram & histogram_;
+            bool timing_;
+            std::chrono::steady_clock::time_point begin_;
+        };
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> counts[buckets] = {};
+            std::atomic<uint64_t> sum = 0;
+        };
+        Shard shards_[shards];
+    };
+
+    static bool enabled()
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Turn timing on or off from now on
+    static void enable(bool enabled = true);
+
+    /*
+     * The metric of the name, registered with the help text if it is
+     * new.  A name registered as another kind of metric throws
+     * std::logic_error.  Names follow Prometheus conventions, such as a
+     * _total suffix for counters and the unit for the rest.
+     */
+    static Counter & counter(std::string_view name, std::string_view help);
+    static Gauge & gauge(std::string_view name, std::string_view help);
+
+    /*
+     * A histogram's values are written multiplied by the unit, such as
+     * 1e-9 to record nanoseconds with Timer as a _seconds metric.
+     */
+    static Histogram & histogram(std::string_view name, std::string_view help, double unit = 1);
+
+    // All the metrics in the text exposition format, by name
+    static std::string text();
+
+    /*
+     * Write text() to the file, replacing it at once so that a scrape
+     * never reads part of it, or throw std::runtime_error.
+     */
+    static void write(std::string_view path);
+
+private:
+    static inline std::atomic<bool> enabled_ = false;
+
+    static size_t shard()
+    {
+        static std::atomic<size_t> next = 0;
+        static thread_local size_t mine = next.fetch_add(1, std::memory_order_relaxed) % shards;
+        return mine;
+    }
+};
+
+} // namespace zinc
@@ -3,6 +3,7 @@
 #include <zinc/common.hpp>
 #include <zinc/json.hpp>
 
+#include <optional>
 #include <span>
 #include <string>
 #include <string_view>
@@ -15,8 +16,61 @@ class OpenAI {
 public:
     using RoleContentPair = StringPair;
 
+    // Token counts of a request, which servers send with its last chunk
+    struct Usage {
+        long prompt_tokens = 0;
+        long completion_tokens = 0;
+        long total_tokens = 0;
+    };
+
     struct StreamPart : public std::string_view {
-        JSON data; // Raw data returned by the server
+        /*
+         * The choice's index and finish_reason, which is null until it
+         * finishes.  Only the fields that are read are parsed, so this is
+         * not the server's whole choice object, as it once was; line has
+         * the chunk's JSON text for any other field.  A part that only
+         * carries usage has no choice, and null data.
+         */
+        JSON data;
+        std::string_view line; // The server's JSON text of the whole chunk
+        std::optional<Usage> usage; // Of the request, on the chunk that has it
+    };
+
+    /**
+     * @brief Embedding vectors for a list of inputs.
+     *
+     * Vectors are rows of one contiguous row-major matrix. Identical
+     * inputs are embedded once and share a row.
+     */
+    struct Embeddings {
+        std::vector<float> matrix; // unique rows, dimensions floats each
+        std::vector<size_t> rows; // input index -> row index in matrix
+        size_t dimensions = 0;
+
+        std::span<float const> operator[](size_t input) const
+        { return {matrix.data() + rows[input] * dimensions, dimensions}; }
+        size_t size() const { return rows.size(); }
+    };
+
+    /**
+     * @brief A prompt's escaped text, kept by the caller between completions.
+     *
+     * Held next to an IncrementalPrompt, it lets each completion escape
+     * only the bytes of its prompt after those the last one shared.
+     */
+    class EscapedPrompt {
+    public:
+        /**
+         * @brief Escape the prompt given in parts, keeping the escaping of
+         * its first reused bytes from the last call.
+         *
+         * Returns the escaped text, valid until the next update.
+         */
+        std::string_view update(std::span<std::string_view const> prompt, size_t reused = 0);
+
+    private:
+        std::string text_;
+        std::vector<std::pair<size_t, size_t>> marks_; // raw and escaped sizes, every few KiB
     };
 
     /**
@@ -55,6 +109,26 @@ public:
         std::span<KeyJSONPair const> params = {}
     ) const;
 
+    /**
+     * @brief Stream a completion of a prompt given in parts.
+     *
+     * The prompt is the concatenation of the parts, such as a rendered
+     * conversation and a partial reply, escaped straight into the request
+     * body rather than joined first.
+     *
+     * The prompt is escaped into the caller's escaped, which keeps it for
+     * the next call; reused is how many leading bytes of this prompt are
+     * the same as the last one's, as IncrementalPrompt::update returns,
+     * and only the bytes after them are escaped again.  The escaped prompt
+     * must not be updated while the completion streams.
+     */
+    zinc::generator<StreamPart const&> complete(
+        std::span<std::string_view const> prompt,
+        EscapedPrompt & escaped,
+        size_t reused = 0,
+        std::span<KeyJSONPair const> params = {}
+    ) const;
+
     /**
      * @brief Stream a chat completion based on a series of messages.
      *
@@ -66,12 +140,32 @@ public:
         std::span<KeyJSONPair const> params = {}
     ) const;
 
+    /**
+     * @brief Embed many inputs via the embeddings endpoint.
+     *
+     * Duplicate inputs are removed, the rest are packed into batches of at
+     * most max_batch_inputs inputs and roughly max_batch_tokens tokens, and
+     * up to max_concurrency batches are requested at once.
+     *
+     * Only "model" is taken from the constructor defaults; pass params to
+     * select a different embedding model or e.g. "dimensions".
+     */
+    Embeddings embed(
+        std::span<std::string_view const> inputs,
+        std::span<KeyJSONPair const> params = {},
+        size_t max_batch_inputs = 256,
+        size_t max_batch_tokens = 8192,
+        size_t max_concurrency = 4
+    ) const;
+
 private:
     std::string const endpoint_completions_;
     std::string const endpoint_chats_;
+    std::string const endpoint_embeddings_;
     std::string const bearer_;
     std::vector<std::pair<std::string_view, std::string_view>> headers_;
     std::vector<std::pair<std::string, JSON>> defaults_;
+
 };
 
 } // namespace zinc
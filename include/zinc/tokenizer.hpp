@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace zinc {
+
+/*
+ * Byte-level BPE tokenizer loaded from a Hugging Face tokenizer.json,
+ * such as those of Llama-3 and DeepSeek-V3.
+ *
+ * Text is split with the Llama-3 / cl100k pre-tokenization rules, each
+ * piece is merged by rank, and the token ids of recent pieces are cached
+ * so that counting repeated text is mostly hash lookups.
+ *
+ * Non-ASCII letters and digits are classified by range rather than with
+ * full Unicode tables, so counts for some scripts may differ slightly
+ * from the reference implementation.
+ */
+class Tokenizer {
+public:
+    /*
+     * Parse the contents of a tokenizer.json, or throw
+     * std::invalid_argument if it is not a byte-level BPE with a token
+     * for each of the 256 bytes.
+     */
+    Tokenizer(std::string_view tokenizer_json);
+
+    /*
+     * Load a tokenizer.json from a path.
+     */
+    static Tokenizer from_file(std::string_view path);
+
+    Tokenizer(Tokenizer&&);
+    ~Tokenizer();
+
+    /*
+     * Token ids for text. Added tokens such as <|eot_id|> are matched
+     * literally when allow_special is set.
+     *
+     * The returned span is valid until the next call on this thread.
+     */
+    std::span<uint32_t const> encode(std::string_view text, bool allow_special = true) const;
+
+    /*
+     * The number of tokens encode() would produce.
+     */
+    size_t count(std::string_view text, bool allow_special = true) const;
+
+    /*
+     * Text for token ids. Valid until the next call on this thread.
+     */
+    std::string_view decode(std::span<uint32_t const> ids) const;
+
+    size_t vocab_size() const;
+
+private:
+    void* impl_;
+};
+
+} // namespace zinc
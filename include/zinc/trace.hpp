@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace zinc {
+
+/*
+ * Spans time the phases of a piece of work, such as building a prompt,
+ * sending it, and streaming the reply, with the thread each ran on and
+ * the span each ran within.  They are written as Chrome trace events, to
+ * view in Perfetto or chrome://tracing.
+ *
+ * Tracing is off unless enabled, or unless ZINC_TRACE names a file, which
+ * the trace is written to at exit.  While it is off, a span only loads a
+ * flag.
+ */
+class Trace {
+public:
+    class Span {
+    public:
+        static constexpr uint64_t inherit = ~(uint64_t)0;
+
+        /*
+         * Begin a span of the name within the parent, by default the
+         * innermost span open on this thread, which this one is until it
+         * ends.  Work handed to another thread can give the id() of the
+         * span that handed it as its parent.
+         */
+        explicit Span(std::string_view name, uint64_t parent = inherit)
+        {
+            if (enabled()) {
+                begin(name, parent);
+            }
+        }
+        Span(Span const&) = delete;
+        Span & operator=(Span const&) = delete;
+        ~Span()
+        {
+            if (id_) {
+                end();
+            }
+        }
+
+        // Values shown with the span
+        Span & arg(std::string_view key, std::string_view value);
+        Span & arg(std::string_view key, long value);
+
+        // End the span before it is destroyed
+        void end();
+
+        // 0 if tracing was off when the span began
+        uint64_t id() const { return id_; }
+
+    private:
+        void begin(std::string_view name, uint64_t parent);
+
+        uint64_t id_ = 0, parent_ = 0;
+        int64_t begin_ = 0; // ns since launch
+        std::string name_, args_;
+    };
+
+    static bool enabled()
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Turn tracing on or off from now on.  Spans that are open when it is
+     * turned off are still recorded when they end.
+     */
+    static void enable(bool enabled = true);
+
+    // Mark an instant within the innermost open span, such as a first token
+    static void mark(std::string_view name)
+    {
+        if (enabled()) {
+            instant(name);
+        }
+    }
+
+    /*
+     * Write the spans and marks that have ended so far as a Chrome trace
+     * JSON object to the file, or throw std::runtime_error.
+     */
+    static void write(std::string_view path);
+
+    // Discard what has been recorded
+    static void clear();
+
+private:
+    static void instant(std::string_view name);
+
+    static inline std::atomic<bool> enabled_ = false;
+};
+
+} // namespace zinc
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <zinc/common.hpp>
+#include <zinc/openai.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zinc {
+
+/*
+ * A small on-disk vector index of chunked project files.
+ *
+ * The index lives under the project's .zinc directory. Files are split into
+ * chunks of whole lines, each chunk is embedded, and the normalized vectors
+ * are kept in one contiguous matrix that is searched by dot product.
+ */
+class VectorIndex {
+public:
+    using Embedder = std::function<OpenAI::Embeddings(std::span<std::string_view const>)>;
+
+    struct Chunk {
+        uint32_t file; // index into files()
+        uint32_t line; // first line, 0-based
+        uint64_t offset; // byte offset in the file
+        uint64_t length; // byte length
+    };
+
+    struct File {
+        std::string path;
+        int64_t mtime;
+        uint64_t hash;
+        size_t first_chunk;
+        size_t chunk_count;
+    };
+
+    struct Match {
+        float score;
+        size_t chunk;
+    };
+
+    /*
+     * Open the index stored at .zinc/index/<name>.bin, or start an empty one.
+     */
+    VectorIndex(std::string_view name = "files");
+
+    /*
+     * Writes the index back if it was modified.  If that fails, the
+     * error is printed to stderr, as the destructor cannot throw; call
+     * save() first to handle it.
+     */
+    ~VectorIndex();
+
+    /*
+     * Bring the entries for paths up to date.
+     *
+     * Files are re-read only if their mtime changed, and re-embedded only if
+     * their content hash changed as well. Indexed files that no longer exist
+     * are dropped. Returns the number of chunks that were embedded.
+     */
+    size_t update(
+        std::span<std::string_view const> paths,
+        Embedder const& embedder,
+        size_t chunk_lines = 40,
+        size_t chunk_bytes = 4096
+    );
+    size_t update(
+        std::span<std::string_view const> paths,
+        OpenAI const& client,
+        std::span<KeyJSONPair const> params = {}
+    );
+
+    /*
+     * Find the k chunks whose vectors have the highest dot product with the
+     * query, best first. The query need not be normalized.
+     */
+    std::span<Match const> search(std::span<float const> query, size_t k) const;
+    std::span<Match const> search(std::string_view query, Embedder const& embedder, size_t k) const;
+
+    /*
+     * Read a chunk's text back from its file.
+     */
+    std::string text(size_t chunk) const;
+
+    std::span<File const> files() const { return files_; }
+    std::span<Chunk const> chunks() const { return chunks_; }
+    std::span<float const> vector(size_t chunk) const
+    { return {matrix_.data() + chunk * dimensions_, dimensions_}; }
+    size_t dimensions() const { return dimensions_; }
+
+    // Write the index back now, or throw std::runtime_error
+    void save();
+
+    /*
+     * Dot product of two float vectors, using AVX2 or NEON when available.
+     */
+    static float dot(float const* a, float const* b, size_t n);
+
+private:
+    void erase_file(size_t file);
+
+    std::string path_;
+    std::vector<File> files_;
+    std::vector<Chunk> chunks_;
+    std::vector<float> matrix_;
+    size_t dimensions_;
+    bool modified_;
+};
+
+} // namespace zinc
@@ -1,4 +1,6 @@
 #include <zinc/diff.hpp>
+#include <zinc/metrics.hpp>
+#include <zinc/trace.hpp>
 
 #include <string_view>
 #include <fstream>
@@ -205,9 +207,20 @@ generator<std::string_view> UnifiedDiffGenerator::generateDiff(
     //std::string line;
     //size_t line_num = 1;  // 1-based line numbers
     std::hash<std::string_view> hasher;
+    static auto & diffs = Metrics::counter("zinc_diffs_total", "Diffs generated");
+    static auto & old_lines = Metrics::counter("zinc_diff_old_lines_total", "Lines of the files diffed");
+    static auto & new_lines_total = Metrics::counter("zinc_diff_new_lines_total", "Lines of the new content diffed");
+    static auto & added_lines = Metrics::counter("zinc_diff_added_lines_total", "New lines found nowhere in the file");
+    static auto & file_lines = Metrics::histogram("zinc_diff_file_lines", "Lines of each file diffed");
+    diffs.add();
+    Trace::Span span("diff");
+    if (span.id()) {
+        span.arg("path", filepath.string());
+    }
 
     // Record file positions and build hash map
     {
+        Trace::Span index_span("diff index");
         std::string line;
         file.seekg(0);
         std::streamoff current_pos = file.tellg();
@@ -227,6 +240,9 @@ generator<std::string_view> UnifiedDiffGenerator::generateDiff(
         }
         line_offsets.push_back((size_t)current_pos);
         file.clear(); // clear failbit from reading at eof so further reads succeed
+        index_span.arg("lines", (long)line_offsets.size() - 1);
+        old_lines.add(line_offsets.size() - 1);
+        file_lines.record(line_offsets.size() - 1);
     }
     
     UnifiedDiffGenerator_ impl(context_lines, line_offsets, file);
@@ -285,7 +301,10 @@ generator<std::string_view> UnifiedDiffGenerator::generateDiff(
     };
     */
 
+    long new_lines = 0;
     for (std::string_view new_line : newContent) {
+        ++ new_lines;
+        new_lines_total.add();
         //bool found = false;
         //size_t line_num = SIZE_MAX;
         //LineLocation matched_loc;
@@ -331,6 +350,7 @@ generator<std::string_view> UnifiedDiffGenerator::generateDiff(
             //++ hunk_new_line;
         } else {
             // Line not found - it's an addition
+            added_lines.add();
             co_yield zinc::ranges::elements_of(impl.added(new_line));
             //startNewHunk(hunk_old_line, hunk_new_line);
             //(ss={}) << '+' << new_line;
@@ -343,6 +363,7 @@ generator<std::string_view> UnifiedDiffGenerator::generateDiff(
 
     // Output remaining lines from original as deletions
     co_yield zinc::ranges::elements_of(impl.deleted_until(line_offsets.size()-1));
+    span.arg("old_lines", (long)line_offsets.size() - 1).arg("new_lines", new_lines);
     //if (hunk_old_line <= line_locations.size()) {
     //    startNewHunk(hunk_old_line, hunk_new_line);
 
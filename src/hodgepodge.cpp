@@ -1,5 +1,6 @@
 #include <zinc/hodgepodge.hpp>
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 
@@ -28,8 +29,8 @@ std::string_view zinc::HodgePodge::prompt_llama31_hf(
 {
     auto & tools = custom_tools;
     static thread_local std::stringstream result;
-    std::string_view system_message;
-    std::string_view first_user_message;
+    std::string system_message;
+    std::string first_user_message;
     result.str({});
 
     auto insert_tojson = [](auto & result, auto & t) {
@@ -373,3 +374,149 @@ std::string_view zinc::HodgePodge::prompt_deepseek3(
     }
     return result.view();
 }
+
+zinc::HodgePodge::ContextPacker::ContextPacker(
+    size_t budget_tokens,
+    size_t keep_recent,
+    size_t max_message_tokens,
+    double low_water,
+    TokenCounter count_tokens,
+    Summarizer summarize
+)
+: budget_(budget_tokens),
+  keep_recent_(keep_recent),
+  max_message_tokens_(max_message_tokens ? max_message_tokens : budget_tokens / 4),
+  low_water_(low_water),
+  count_tokens_(std::move(count_tokens)),
+  summarize_(std::move(summarize)),
+  dropped_(0),
+  seen_(0),
+  tokens_(0)
+{ }
+
+size_t zinc::HodgePodge::ContextPacker::estimate_tokens(std::string_view text)
+{
+    return (text.size() + 3) / 4;
+}
+
+// role markers and separators added by the prompt templates
+static constexpr size_t MESSAGE_OVERHEAD_TOKENS = 4;
+
+size_t zinc::HodgePodge::ContextPacker::message_tokens(Message const& message) const
+{
+    size_t tokens = MESSAGE_OVERHEAD_TOKENS;
+    if (message.content.has_value()) {
+        tokens += count_tokens_(*message.content);
+    }
+    for (auto & tool_call : message.tool_calls) {
+        tokens += count_tokens_(tool_call.function.name) + count_tokens_(tool_call.function.parameters.stringy());
+    }
+    return tokens;
+}
+
+zinc::HodgePodge::Message zinc::HodgePodge::ContextPacker::packed_message(Message const& message) const
+{
+    if (!message.content.has_value()) {
+        return message;
+    }
+    std::string_view content = *message.content;
+    size_t tokens = count_tokens_(content);
+    if (tokens <= max_message_tokens_) {
+        return message;
+    }
+    // keep the head and tail of oversized contents such as pasted files
+    size_t keep = (size_t)((double)content.size() * (double)max_message_tokens_ / (double)tokens);
+    size_t head = keep / 2, tail = content.size() - (keep - head);
+    auto is_continuation = [&](size_t off) { return off < content.size() && (content[off] & 0xc0) == 0x80; };
+    while (head > 0 && is_continuation(head)) -- head;
+    while (is_continuation(tail)) ++ tail;
+    std::stringstream elided;
+    elided << content.substr(0, head)
+           << "\n[... " << (tail - head) << " bytes elided ...]\n"
+           << content.substr(tail);
+    Message result{message.role, elided.str(), message.tool_calls};
+    return result;
+}
+
+std::vector<zinc::HodgePodge::Message> const& zinc::HodgePodge::ContextPacker::pack(std::span<Message const> messages)
+{
+    if (messages.size() < seen_) {
+        // a different conversation
+        dropped_ = 0;
+        summary_.clear();
+    }
+    seen_ = messages.size();
+
+    static thread_local std::vector<Message> packed_messages;
+    static thread_local std::vector<size_t> conversation;
+    static thread_local std::vector<size_t> suffix_tokens;
+    packed_messages.clear();
+    conversation.clear();
+    size_t system_tokens = 0;
+    for (size_t idx = 0; idx < messages.size(); ++ idx) {
+        packed_messages.emplace_back(packed_message(messages[idx]));
+        if (messages[idx].role == "system") {
+            system_tokens += message_tokens(packed_messages.back());
+        } else {
+            conversation.emplace_back(idx);
+        }
+    }
+    suffix_tokens.assign(conversation.size() + 1, 0);
+    for (size_t idx = conversation.size(); idx > 0; -- idx) {
+        suffix_tokens[idx - 1] = suffix_tokens[idx] + message_tokens(packed_messages[conversation[idx - 1]]);
+    }
+
+    size_t note_allowance = summarize_ ? max_message_tokens_ : 16;
+    auto total = [&](size_t dropped) {
+        return system_tokens + suffix_tokens[dropped] + (dropped ? note_allowance : 0);
+    };
+    size_t limit = conversation.size() > keep_recent_ ? conversation.size() - keep_recent_ : 0;
+    dropped_ = std::min(dropped_, limit);
+    if (total(dropped_) > budget_) {
+        size_t previously_dropped = dropped_;
+        size_t target = (size_t)((double)budget_ * low_water_);
+        while (dropped_ < limit && total(dropped_) > target) {
+            ++ dropped_;
+        }
+        // resume on a user turn so the kept history reads naturally
+        while (dropped_ < limit && messages[conversation[dropped_]].role != "user") {
+            ++ dropped_;
+        }
+        if (dropped_ != previously_dropped) {
+            summary_.clear();
+        }
+    }
+    if (dropped_ && summary_.empty()) {
+        if (summarize_) {
+            std::vector<Message> dropped_messages;
+            for (size_t idx = 0; idx < dropped_; ++ idx) {
+                dropped_messages.emplace_back(messages[conversation[idx]]);
+            }
+            summary_ = summarize_(dropped_messages);
+        } else {
+            std::stringstream note;
+            note << "[" << dropped_ << " earlier messages were omitted to fit the context window.]";
+            summary_ = note.str();
+        }
+    }
+
+    packed_.clear();
+    tokens_ = 0;
+    size_t first_kept = dropped_ < conversation.size() ? conversation[dropped_] : messages.size();
+    for (size_t idx = 0; idx < messages.size(); ++ idx) {
+        if (idx == first_kept && dropped_) {
+            packed_.emplace_back(packed_message(Message{.role = "system", .content = summary_}));
+            tokens_ += message_tokens(packed_.back());
+        }
+        if (idx < first_kept && messages[idx].role != "system") {
+            continue;
+        }
+        packed_.emplace_back(std::move(packed_messages[idx]));
+        tokens_ += message_tokens(packed_.back());
+    }
+    if (first_kept == messages.size() && dropped_) {
+        packed_.emplace_back(packed_message(Message{.role = "system", .content = summary_}));
+        tokens_ += message_tokens(packed_.back());
+    }
+    return packed_;
+}
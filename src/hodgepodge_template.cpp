@@ -0,0 +1,2334 @@
+#include <zinc/hodgepodge.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace zinc {
+
+namespace {
+
+using Message = HodgePodge::Message;
+using ToolCall = Message::ToolCall;
+using Function = ToolCall::Function;
+
+constexpr uint32_t NONE = ~(uint32_t)0;
+
+/*
+ * Values are views of the messages, of the JSON variables, of the
+ * template's literals, or of scratch storage kept for one render.
+ */
+struct Value;
+struct Undefined {};
+struct Loop { size_t index0, length; };
+struct Namespace { size_t index; };
+struct List { Value const* data; size_t size; };
+
+using _Value_variant = std::variant<
+    Undefined, std::nullptr_t, bool, long, double, std::string_view,
+    JSON const*, std::span<Message const>, Message const*,
+    std::span<ToolCall const>, ToolCall const*, Function const*,
+    Loop, Namespace, List
+>;
+struct Value : _Value_variant
+{
+    using _Value_variant::variant;
+};
+
+// The index of an alternative, to switch on
+template <typename T, typename... Alternatives>
+constexpr size_t kind_of(std::variant<Alternatives...> const*)
+{
+    size_t idx = 0;
+    ((std::is_same_v<T, Alternatives> ? false : (++ idx, true)) && ...);
+    return idx;
+}
+template <typename T>
+constexpr size_t KIND = kind_of<T>((_Value_variant const*)nullptr);
+
+enum class Op : uint8_t {
+    Literal, Variable, Attribute, Item, Slice, ListLiteral, Call, Method, Filter, Test,
+    Not, And, Or, Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, In, NotIn,
+    Add, Subtract, Multiply, Divide, Modulo, Concat, Negate, Conditional,
+};
+
+enum class FilterId : uint8_t {
+    Trim, Length, ToJson, Join, Items, Reject, Select, RejectAttr, SelectAttr,
+    First, Last, String, Lower, Upper, Default, Safe,
+};
+constexpr std::pair<std::string_view, FilterId> FILTERS[] = {
+    {"trim", FilterId::Trim}, {"length", FilterId::Length}, {"count", FilterId::Length},
+    {"tojson", FilterId::ToJson}, {"join", FilterId::Join}, {"items", FilterId::Items},
+    {"reject", FilterId::Reject}, {"select", FilterId::Select},
+    {"rejectattr", FilterId::RejectAttr}, {"selectattr", FilterId::SelectAttr},
+    {"first", FilterId::First}, {"last", FilterId::Last}, {"string", FilterId::String},
+    {"lower", FilterId::Lower}, {"upper", FilterId::Upper},
+    {"default", FilterId::Default}, {"d", FilterId::Default}, {"safe", FilterId::Safe},
+};
+
+enum class TestId : uint8_t {
+    Defined, Undefined, None, Boolean, True, False, Integer, Float, Number,
+    String, Mapping, Iterable, Sequence, EqualTo, NotEqualTo,
+};
+constexpr std::pair<std::string_view, TestId> TESTS[] = {
+    {"defined", TestId::Defined}, {"undefined", TestId::Undefined}, {"none", TestId::None},
+    {"boolean", TestId::Boolean}, {"true", TestId::True}, {"false", TestId::False},
+    {"integer", TestId::Integer}, {"float", TestId::Float}, {"number", TestId::Number},
+    {"string", TestId::String}, {"mapping", TestId::Mapping}, {"iterable", TestId::Iterable},
+    {"sequence", TestId::Sequence}, {"equalto", TestId::EqualTo}, {"eq", TestId::EqualTo},
+    {"==", TestId::EqualTo}, {"ne", TestId::NotEqualTo}, {"!=", TestId::NotEqualTo},
+};
+
+enum class FunctionId : uint8_t { Namespace, RaiseException, Range, StrftimeNow };
+constexpr std::pair<std::string_view, FunctionId> FUNCTIONS[] = {
+    {"namespace", FunctionId::Namespace}, {"raise_exception", FunctionId::RaiseException},
+    {"range", FunctionId::Range}, {"strftime_now", FunctionId::StrftimeNow},
+};
+
+// Attributes of messages and loops, resolved when compiling
+enum class FieldId : uint8_t {
+    Other, Role, Content, ToolCalls, Type, Function, Name, Arguments,
+    Index, Index0, RevIndex, RevIndex0, First, Last, Length,
+};
+constexpr std::pair<std::string_view, FieldId> FIELDS[] = {
+    {"role", FieldId::Role}, {"content", FieldId::Content}, {"tool_calls", FieldId::ToolCalls},
+    {"type", FieldId::Type}, {"function", FieldId::Function}, {"name", FieldId::Name},
+    {"arguments", FieldId::Arguments}, {"parameters", FieldId::Arguments},
+    {"index", FieldId::Index}, {"index0", FieldId::Index0}, {"revindex", FieldId::RevIndex},
+    {"revindex0", FieldId::RevIndex0}, {"first", FieldId::First}, {"last", FieldId::Last},
+    {"length", FieldId::Length},
+};
+
+FieldId field(std::string_view name)
+{
+    for (auto & [entry, id] : FIELDS) {
+        if (entry == name) {
+            return id;
+        }
+    }
+    return FieldId::Other;
+}
+
+template <typename Id, size_t N>
+Id lookup(std::pair<std::string_view, Id> const (&table)[N], std::string_view name, char const* what)
+{
+    for (auto & [entry, id] : table) {
+        if (entry == name) {
+            return id;
+        }
+    }
+    throw std::runtime_error("chat template uses unsupported " + std::string(what) + " " + std::string(name));
+}
+
+struct Expr
+{
+    Op op;
+    uint8_t id = 0; // FilterId, TestId, FunctionId or FieldId
+    bool negated = false; // is not
+    std::string_view name = {}; // variable, attribute or method
+    uint32_t slot = NONE; // interned name of a variable or attribute
+    Value literal = Undefined{};
+    uint32_t a = NONE, b = NONE, c = NONE;
+    std::vector<uint32_t> args = {};
+    std::vector<std::string_view> keywords = {}; // parallel to args, empty when positional
+};
+
+struct Node;
+struct Branch
+{
+    uint32_t condition; // NONE for else
+    std::vector<Node> body;
+};
+struct Node
+{
+    enum Kind : uint8_t { Text, Output, If, For, Set } kind;
+    std::string_view text = {}; // the text, the assigned variable, or the loop variable
+    std::string_view attribute = {}; // the namespace attribute, or the second loop variable
+    uint32_t slot = NONE, attribute_slot = NONE, loop_slot = NONE; // interned names
+    uint32_t expr = NONE; // output, assigned value, or iterable
+    uint32_t filter = NONE; // for ... if filter
+    std::vector<uint32_t> scoped = {}; // variables a loop restores when it ends
+    std::vector<Branch> branches = {}; // if branches, or the loop body
+    std::vector<Node> otherwise = {}; // for ... else
+};
+
+struct TemplateImpl
+{
+    std::string source;
+    std::string bos_token, eos_token;
+    std::deque<std::string> literals = {};
+    std::vector<Expr> exprs = {};
+    std::vector<Node> nodes = {};
+    // every variable, attribute and keyword name, indexed by slot
+    std::vector<std::string_view> names = {};
+
+    uint32_t slot(std::string_view name) const
+    {
+        for (size_t idx = 0; idx < names.size(); ++ idx) {
+            if (names[idx] == name) {
+                return (uint32_t)idx;
+            }
+        }
+        return NONE;
+    }
+};
+
+/*
+ * Compiler
+ */
+
+struct Token
+{
+    enum Kind { Name, String, Integer, Float, Symbol, End } kind;
+    std::string_view text;
+    long integer = 0;
+    double number = 0;
+};
+
+class Compiler
+{
+public:
+    Compiler(TemplateImpl & impl) : impl_(impl) { }
+
+    void compile()
+    {
+        std::string_view source = impl_.source;
+        // jinja drops a single trailing newline
+        if (source.ends_with('\n')) {
+            source.remove_suffix(source.ends_with("\r\n") ? 2 : 1);
+        }
+        split(source);
+        size_t piece = 0;
+        std::string_view end = block(impl_.nodes, piece);
+        if (!end.empty()) {
+            fail("unexpected {% " + std::string(end) + " %}", pieces_[piece - 1].offset);
+        }
+    }
+
+private:
+    struct Piece
+    {
+        enum Kind { Text, Output, Statement } kind;
+        std::string_view text;
+        size_t offset;
+    };
+
+    [[noreturn]] void fail(std::string const& message, size_t offset)
+    {
+        size_t line = 1;
+        for (size_t idx = 0; idx < offset && idx < impl_.source.size(); ++ idx) {
+            line += impl_.source[idx] == '\n';
+        }
+        throw std::runtime_error("chat template line " + std::to_string(line) + ": " + message);
+    }
+
+    static bool is_space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    // Split the source into text and tags, applying whitespace control
+    void split(std::string_view source)
+    {
+        size_t pos = 0;
+        bool strip_next = false, trim_newline = false;
+        while (pos <= source.size()) {
+            size_t open = pos;
+            while ((open = source.find('{', open)) != std::string_view::npos) {
+                if (open + 1 < source.size() && (source[open + 1] == '{' || source[open + 1] == '%' || source[open + 1] == '#')) {
+                    break;
+                }
+                ++ open;
+            }
+            std::string_view text = source.substr(pos, open == std::string_view::npos ? std::string_view::npos : open - pos);
+            if (strip_next) {
+                while (!text.empty() && is_space(text.front())) text.remove_prefix(1);
+            } else if (trim_newline) {
+                if (text.starts_with("\r\n")) text.remove_prefix(2);
+                else if (text.starts_with('\n')) text.remove_prefix(1);
+            }
+            if (open == std::string_view::npos) {
+                add_text(text, pos);
+                break;
+            }
+
+            char kind = source[open + 1];
+            size_t content = open + 2;
+            char modifier = content < source.size() ? source[content] : 0;
+            if (modifier == '-') {
+                while (!text.empty() && is_space(text.back())) text.remove_suffix(1);
+                ++ content;
+            } else if (modifier == '+') {
+                ++ content;
+            } else if (kind != '{') {
+                // lstrip_blocks: a block alone on its line takes its indentation
+                size_t line = text.find_last_not_of(" \t");
+                size_t start = (size_t)(text.data() - source.data());
+                if (line == std::string_view::npos ? start == 0 || source[start - 1] == '\n' : text[line] == '\n') {
+                    text = text.substr(0, line == std::string_view::npos ? 0 : line + 1);
+                }
+            }
+            add_text(text, pos);
+
+            char closer = kind == '{' ? '}' : kind;
+            size_t close = content;
+            char quote = 0;
+            for (; close + 1 < source.size(); ++ close) {
+                char c = source[close];
+                if (quote) {
+                    if (c == '\\') ++ close;
+                    else if (c == quote) quote = 0;
+                } else if (kind != '#' && (c == '\'' || c == '"')) {
+                    quote = c;
+                } else if (c == closer && source[close + 1] == '}') {
+                    break;
+                }
+            }
+            if (close + 1 >= source.size()) {
+                fail("unterminated tag", open);
+            }
+            size_t content_end = close;
+            strip_next = content_end > content && source[content_end - 1] == '-';
+            if (strip_next) {
+                -- content_end;
+            }
+            trim_newline = kind != '{';
+            if (kind != '#') {
+                pieces_.emplace_back(Piece{
+                    kind == '{' ? Piece::Output : Piece::Statement,
+                    source.substr(content, content_end - content),
+                    content
+                });
+            }
+            pos = close + 2;
+        }
+    }
+
+    void add_text(std::string_view text, size_t offset)
+    {
+        if (!text.empty()) {
+            pieces_.emplace_back(Piece{Piece::Text, text, offset});
+        }
+    }
+
+    // Compile pieces into nodes up to an unmatched statement, whose keyword is returned
+    std::string_view block(std::vector<Node> & nodes, size_t & piece)
+    {
+        while (piece < pieces_.size()) {
+            Piece const& current = pieces_[piece ++];
+            if (current.kind == Piece::Text) {
+                nodes.emplace_back(Node{.kind = Node::Text, .text = current.text});
+                continue;
+            }
+            tokenize(current);
+            if (current.kind == Piece::Output) {
+                nodes.emplace_back(Node{.kind = Node::Output, .expr = expression()});
+                expect_end();
+                continue;
+            }
+            std::string_view keyword = expect_name();
+            if (keyword == "if") {
+                Node node{.kind = Node::If};
+                uint32_t condition = expression();
+                expect_end();
+                while (true) {
+                    node.branches.emplace_back(Branch{condition, {}});
+                    std::string_view end = block(node.branches.back().body, piece);
+                    if (end == "endif") {
+                        break;
+                    } else if (end == "elif") {
+                        condition = expression();
+                    } else if (end == "else") {
+                        condition = NONE;
+                    } else {
+                        fail("{% if %} is missing {% endif %}", current.offset);
+                    }
+                    expect_end();
+                }
+                expect_end();
+                nodes.emplace_back(std::move(node));
+            } else if (keyword == "for") {
+                Node node{.kind = Node::For};
+                node.text = expect_name();
+                node.slot = intern(node.text);
+                if (accept(",")) {
+                    node.attribute = expect_name();
+                    node.attribute_slot = intern(node.attribute);
+                }
+                node.loop_slot = intern("loop");
+                if (expect_name() != "in") {
+                    fail("expected in", current.offset);
+                }
+                node.expr = postfix(primary(), false);
+                // filters bind here as well, but not conditional expressions
+                while (peek_symbol("|")) {
+                    node.expr = postfix(node.expr, true);
+                }
+                if (accept_name("if")) {
+                    node.filter = or_expr();
+                }
+                expect_end();
+                node.branches.emplace_back(Branch{NONE, {}});
+                std::string_view end = block(node.branches.back().body, piece);
+                if (end == "else") {
+                    expect_end();
+                    end = block(node.otherwise, piece);
+                }
+                if (end != "endfor") {
+                    fail("{% for %} is missing {% endfor %}", current.offset);
+                }
+                expect_end();
+                node.scoped = {node.slot, node.loop_slot};
+                if (node.attribute_slot != NONE) {
+                    node.scoped.emplace_back(node.attribute_slot);
+                }
+                assigned(node.branches.front().body, node.scoped);
+                nodes.emplace_back(std::move(node));
+            } else if (keyword == "set") {
+                Node node{.kind = Node::Set};
+                node.text = expect_name();
+                node.slot = intern(node.text);
+                if (accept(".")) {
+                    node.attribute = expect_name();
+                    node.attribute_slot = intern(node.attribute);
+                }
+                if (!accept("=")) {
+                    fail("only {% set name = value %} is supported", current.offset);
+                }
+                node.expr = expression();
+                expect_end();
+                nodes.emplace_back(std::move(node));
+            } else if (keyword == "generation" || keyword == "endgeneration") {
+                // transformers marks assistant output for training masks
+                expect_end();
+            } else if (keyword == "elif" || keyword == "else" || keyword == "endif" || keyword == "endfor") {
+                return keyword;
+            } else {
+                fail("unsupported {% " + std::string(keyword) + " %}", current.offset);
+            }
+        }
+        return {};
+    }
+
+    /*
+     * Expressions
+     */
+
+    void tokenize(Piece const& piece)
+    {
+        tokens_.clear();
+        token_ = 0;
+        offset_ = piece.offset;
+        std::string_view text = piece.text;
+        size_t pos = 0;
+        auto is_name = [](char c, bool first) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!first && c >= '0' && c <= '9');
+        };
+        while (true) {
+            while (pos < text.size() && is_space(text[pos])) ++ pos;
+            if (pos == text.size()) break;
+            char c = text[pos];
+            size_t start = pos;
+            if (is_name(c, true)) {
+                while (pos < text.size() && is_name(text[pos], false)) ++ pos;
+                tokens_.emplace_back(Token{Token::Name, text.substr(start, pos - start)});
+            } else if (c >= '0' && c <= '9') {
+                while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') ++ pos;
+                bool real = pos + 1 < text.size() && text[pos] == '.' && text[pos + 1] >= '0' && text[pos + 1] <= '9';
+                if (real) {
+                    ++ pos;
+                    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') ++ pos;
+                }
+                Token token{real ? Token::Float : Token::Integer, text.substr(start, pos - start)};
+                if (real) {
+                    std::from_chars(token.text.data(), token.text.data() + token.text.size(), token.number);
+                } else {
+                    std::from_chars(token.text.data(), token.text.data() + token.text.size(), token.integer);
+                }
+                tokens_.emplace_back(token);
+            } else if (c == '\'' || c == '"') {
+                std::string & literal = impl_.literals.emplace_back();
+                for (++ pos; pos < text.size() && text[pos] != c; ++ pos) {
+                    if (text[pos] != '\\' || pos + 1 == text.size()) {
+                        literal += text[pos];
+                        continue;
+                    }
+                    switch (text[++ pos]) {
+                    case 'n': literal += '\n'; break;
+                    case 't': literal += '\t'; break;
+                    case 'r': literal += '\r'; break;
+                    case '\\': case '\'': case '"': literal += text[pos]; break;
+                    default: literal += '\\'; literal += text[pos]; break;
+                    }
+                }
+                if (pos == text.size()) {
+                    fail("unterminated string", offset_);
+                }
+                ++ pos;
+                tokens_.emplace_back(Token{Token::String, literal});
+            } else {
+                static constexpr std::string_view pairs[] = {"==", "!=", "<=", ">=", "//"};
+                size_t length = 1;
+                for (auto pair : pairs) {
+                    if (text.substr(pos).starts_with(pair)) {
+                        length = 2;
+                    }
+                }
+                if (std::string_view("()[]{}.,:|+-*/%~<>=!").find(c) == std::string_view::npos) {
+                    fail("unexpected character " + std::string(1, c), offset_);
+                }
+                pos += length;
+                tokens_.emplace_back(Token{Token::Symbol, text.substr(start, length)});
+            }
+        }
+        tokens_.emplace_back(Token{Token::End, {}});
+    }
+
+    Token const& peek(size_t ahead = 0) const
+    {
+        return tokens_[std::min(token_ + ahead, tokens_.size() - 1)];
+    }
+    bool peek_symbol(std::string_view symbol, size_t ahead = 0) const
+    {
+        return peek(ahead).kind == Token::Symbol && peek(ahead).text == symbol;
+    }
+    bool peek_name(std::string_view name, size_t ahead = 0) const
+    {
+        return peek(ahead).kind == Token::Name && peek(ahead).text == name;
+    }
+    bool accept(std::string_view symbol)
+    {
+        return peek_symbol(symbol) && ++ token_;
+    }
+    bool accept_name(std::string_view name)
+    {
+        return peek_name(name) && ++ token_;
+    }
+    void expect(std::string_view symbol)
+    {
+        if (!accept(symbol)) {
+            fail("expected " + std::string(symbol) + " near '" + std::string(peek().text) + "'", offset_);
+        }
+    }
+    std::string_view expect_name()
+    {
+        if (peek().kind != Token::Name) {
+            fail("expected a name near '" + std::string(peek().text) + "'", offset_);
+        }
+        return tokens_[token_ ++].text;
+    }
+    void expect_end()
+    {
+        if (peek().kind != Token::End) {
+            fail("unexpected '" + std::string(peek().text) + "'", offset_);
+        }
+    }
+
+    uint32_t intern(std::string_view name)
+    {
+        uint32_t slot = impl_.slot(name);
+        if (slot == NONE) {
+            impl_.names.emplace_back(name);
+            slot = (uint32_t)(impl_.names.size() - 1);
+        }
+        return slot;
+    }
+
+    // Variables set directly in a loop body, which the loop scopes; nested loops scope their own
+    static void assigned(std::vector<Node> const& nodes, std::vector<uint32_t> & slots)
+    {
+        for (auto & node : nodes) {
+            if (node.kind == Node::Set && node.attribute.empty()) {
+                if (std::find(slots.begin(), slots.end(), node.slot) == slots.end()) {
+                    slots.emplace_back(node.slot);
+                }
+            } else if (node.kind == Node::If) {
+                for (auto & branch : node.branches) {
+                    assigned(branch.body, slots);
+                }
+            }
+        }
+    }
+
+    uint32_t add(Expr expr)
+    {
+        impl_.exprs.emplace_back(std::move(expr));
+        return (uint32_t)(impl_.exprs.size() - 1);
+    }
+    uint32_t binary(Op op, uint32_t a, uint32_t b)
+    {
+        return add(Expr{.op = op, .a = a, .b = b});
+    }
+
+    uint32_t expression()
+    {
+        uint32_t value = or_expr();
+        if (accept_name("if")) {
+            uint32_t condition = or_expr();
+            uint32_t otherwise = accept_name("else") ? expression() : add(Expr{.op = Op::Literal});
+            return add(Expr{.op = Op::Conditional, .a = value, .b = condition, .c = otherwise});
+        }
+        return value;
+    }
+
+    uint32_t or_expr()
+    {
+        uint32_t left = and_expr();
+        while (accept_name("or")) {
+            left = binary(Op::Or, left, and_expr());
+        }
+        return left;
+    }
+
+    uint32_t and_expr()
+    {
+        uint32_t left = not_expr();
+        while (accept_name("and")) {
+            left = binary(Op::And, left, not_expr());
+        }
+        return left;
+    }
+
+    uint32_t not_expr()
+    {
+        if (accept_name("not")) {
+            return add(Expr{.op = Op::Not, .a = not_expr()});
+        }
+        return compare();
+    }
+
+    uint32_t compare()
+    {
+        static constexpr std::pair<std::string_view, Op> operators[] = {
+            {"==", Op::Equal}, {"!=", Op::NotEqual}, {"<", Op::Less},
+            {"<=", Op::LessEqual}, {">", Op::Greater}, {">=", Op::GreaterEqual},
+        };
+        uint32_t left = concat();
+        while (true) {
+            bool matched = false;
+            for (auto & [symbol, op] : operators) {
+                if (accept(symbol)) {
+                    left = binary(op, left, concat());
+                    matched = true;
+                    break;
+                }
+            }
+            if (matched) {
+                continue;
+            } else if (accept_name("in")) {
+                left = binary(Op::In, left, concat());
+            } else if (peek_name("not") && peek_name("in", 1)) {
+                token_ += 2;
+                left = binary(Op::NotIn, left, concat());
+            } else {
+                return left;
+            }
+        }
+    }
+
+    uint32_t concat()
+    {
+        uint32_t left = additive();
+        while (accept("~")) {
+            left = binary(Op::Concat, left, additive());
+        }
+        return left;
+    }
+
+    uint32_t additive()
+    {
+        uint32_t left = multiplicative();
+        while (true) {
+            if (accept("+")) {
+                left = binary(Op::Add, left, multiplicative());
+            } else if (accept("-")) {
+                left = binary(Op::Subtract, left, multiplicative());
+            } else {
+                return left;
+            }
+        }
+    }
+
+    uint32_t multiplicative()
+    {
+        uint32_t left = unary();
+        while (true) {
+            if (accept("*")) {
+                left = binary(Op::Multiply, left, unary());
+            } else if (accept("/") || accept("//")) {
+                left = binary(Op::Divide, left, unary());
+            } else if (accept("%")) {
+                left = binary(Op::Modulo, left, unary());
+            } else {
+                return left;
+            }
+        }
+    }
+
+    uint32_t unary()
+    {
+        if (accept("-")) {
+            return add(Expr{.op = Op::Negate, .a = unary()});
+        }
+        return postfix(primary(), true);
+    }
+
+    uint32_t primary()
+    {
+        Token const& token = peek();
+        ++ token_;
+        switch (token.kind) {
+        case Token::String:
+            return add(Expr{.op = Op::Literal, .literal = token.text});
+        case Token::Integer:
+            return add(Expr{.op = Op::Literal, .literal = token.integer});
+        case Token::Float:
+            return add(Expr{.op = Op::Literal, .literal = token.number});
+        case Token::Name:
+            if (token.text == "true" || token.text == "True") {
+                return add(Expr{.op = Op::Literal, .literal = true});
+            } else if (token.text == "false" || token.text == "False") {
+                return add(Expr{.op = Op::Literal, .literal = false});
+            } else if (token.text == "none" || token.text == "None") {
+                return add(Expr{.op = Op::Literal, .literal = nullptr});
+            } else if (peek_symbol("(")) {
+                Expr call{.op = Op::Call, .id = (uint8_t)lookup(FUNCTIONS, token.text, "function")};
+                arguments(call);
+                return add(std::move(call));
+            }
+            return add(Expr{.op = Op::Variable, .name = token.text, .slot = intern(token.text)});
+        case Token::Symbol:
+            if (token.text == "(") {
+                uint32_t inner = expression();
+                expect(")");
+                return inner;
+            } else if (token.text == "[") {
+                Expr list{.op = Op::ListLiteral};
+                while (!accept("]")) {
+                    list.args.emplace_back(expression());
+                    list.keywords.emplace_back();
+                    if (!peek_symbol("]")) {
+                        expect(",");
+                    }
+                }
+                return add(std::move(list));
+            }
+            [[fallthrough]];
+        default:
+            fail("unexpected '" + std::string(token.text) + "'", offset_);
+        }
+    }
+
+    // Attributes, items, calls, filters and tests following a primary
+    uint32_t postfix(uint32_t expr, bool filters)
+    {
+        while (true) {
+            if (accept(".")) {
+                std::string_view name = expect_name();
+                if (peek_symbol("(")) {
+                    Expr method{.op = Op::Method, .name = name, .a = expr};
+                    arguments(method);
+                    expr = add(std::move(method));
+                } else {
+                    expr = attribute(expr, name);
+                }
+            } else if (accept("[")) {
+                uint32_t start = peek_symbol(":") ? NONE : expression();
+                if (accept(":")) {
+                    uint32_t stop = peek_symbol("]") ? NONE : expression();
+                    expr = add(Expr{.op = Op::Slice, .a = expr, .b = start, .c = stop});
+                } else if (auto key = std::get_if<std::string_view>(&impl_.exprs[start].literal); key && impl_.exprs[start].op == Op::Literal) {
+                    // message['role'] is message.role
+                    expr = attribute(expr, *key);
+                } else {
+                    expr = binary(Op::Item, expr, start);
+                }
+                expect("]");
+            } else if (filters && accept("|")) {
+                Expr filter{.op = Op::Filter, .id = (uint8_t)lookup(FILTERS, expect_name(), "filter"), .a = expr};
+                if (peek_symbol("(")) {
+                    arguments(filter);
+                }
+                expr = add(std::move(filter));
+            } else if (filters && accept_name("is")) {
+                bool negated = accept_name("not");
+                Token const& name = peek();
+                ++ token_;
+                Expr test{.op = Op::Test, .id = (uint8_t)lookup(TESTS, name.text, "test"), .negated = negated, .a = expr};
+                if (peek_symbol("(")) {
+                    arguments(test);
+                } else if (peek().kind == Token::String || peek().kind == Token::Integer || peek().kind == Token::Float) {
+                    test.args.emplace_back(primary());
+                    test.keywords.emplace_back();
+                }
+                expr = add(std::move(test));
+            } else {
+                return expr;
+            }
+        }
+    }
+
+    uint32_t attribute(uint32_t object, std::string_view name)
+    {
+        return add(Expr{.op = Op::Attribute, .id = (uint8_t)field(name), .name = name, .slot = intern(name), .a = object});
+    }
+
+    void arguments(Expr & expr)
+    {
+        expect("(");
+        while (!accept(")")) {
+            std::string_view keyword;
+            if (peek().kind == Token::Name && peek_symbol("=", 1)) {
+                keyword = expect_name();
+                intern(keyword);
+                ++ token_;
+            }
+            expr.args.emplace_back(expression());
+            expr.keywords.emplace_back(keyword);
+            if (!peek_symbol(")")) {
+                expect(",");
+            }
+        }
+    }
+
+    TemplateImpl & impl_;
+    std::vector<Piece> pieces_;
+    std::vector<Token> tokens_;
+    size_t token_ = 0;
+    size_t offset_ = 0;
+};
+
+/*
+ * Renderer
+ */
+
+Value from_json(JSON const& json)
+{
+    switch (json.index()) {
+    case 0: return nullptr;
+    case JSON::BOOLEAN: return std::get<JSON::Bool>(json);
+    case JSON::INTEGER: return std::get<JSON::Integer>(json);
+    case JSON::NUMBER: return std::get<JSON::Number>(json);
+    case JSON::STRING: return json.string();
+    default: return &json;
+    }
+}
+
+bool is_container(JSON const* json, JSON::Index index)
+{
+    return (JSON::Index)json->index() == index;
+}
+
+std::string_view type_name(Value const& value)
+{
+    static constexpr std::string_view names[] = {
+        "undefined", "none", "boolean", "integer", "float", "string",
+        "json", "messages", "message", "tool_calls", "tool_call", "function",
+        "loop", "namespace", "list",
+    };
+    if (auto json = std::get_if<JSON const*>(&value)) {
+        return is_container(*json, JSON::ARRAY) ? "list" : "mapping";
+    }
+    return names[value.index()];
+}
+
+bool is_number(Value const& value)
+{
+    return std::holds_alternative<bool>(value) || std::holds_alternative<long>(value) || std::holds_alternative<double>(value);
+}
+
+double number(Value const& value)
+{
+    if (auto b = std::get_if<bool>(&value)) return *b;
+    if (auto l = std::get_if<long>(&value)) return (double)*l;
+    return std::get<double>(value);
+}
+
+bool truthy(Value const& value)
+{
+    return std::visit([](auto const& v) -> bool {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, Undefined> || std::is_same_v<T, std::nullptr_t>) {
+            return false;
+        } else if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, long> || std::is_same_v<T, double>) {
+            return v != 0;
+        } else if constexpr (std::is_same_v<T, JSON const*>) {
+            return v->size() != 0;
+        } else if constexpr (std::is_same_v<T, List>) {
+            return v.size != 0;
+        } else if constexpr (requires { v.empty(); }) {
+            return !v.empty();
+        } else {
+            return true;
+        }
+    }, (_Value_variant const&)value);
+}
+
+bool equal(Value const& a, Value const& b)
+{
+    // the usual comparison, of a role or type with a literal
+    if (auto a_text = std::get_if<std::string_view>(&a), b_text = std::get_if<std::string_view>(&b); a_text && b_text) {
+        return *a_text == *b_text;
+    }
+    if (is_number(a) && is_number(b)) {
+        if (std::holds_alternative<long>(a) && std::holds_alternative<long>(b)) {
+            return std::get<long>(a) == std::get<long>(b);
+        }
+        return number(a) == number(b);
+    }
+    if (a.index() != b.index()) {
+        return false;
+    }
+    return std::visit([&](auto const& v) -> bool {
+        using T = std::decay_t<decltype(v)>;
+        T const& w = std::get<T>(b);
+        if constexpr (std::is_same_v<T, Undefined> || std::is_same_v<T, std::nullptr_t>) {
+            return true;
+        } else if constexpr (std::is_arithmetic_v<T> || std::is_same_v<T, std::string_view>) {
+            return v == w;
+        } else if constexpr (std::is_same_v<T, JSON const*>) {
+            return *v == *w;
+        } else if constexpr (std::is_same_v<T, List>) {
+            if (v.size != w.size) return false;
+            for (size_t idx = 0; idx < v.size; ++ idx) {
+                if (!equal(v.data[idx], w.data[idx])) return false;
+            }
+            return true;
+        } else if constexpr (std::is_pointer_v<T>) {
+            return v == w;
+        } else if constexpr (std::is_same_v<T, Namespace>) {
+            return v.index == w.index;
+        } else if constexpr (std::is_same_v<T, Loop>) {
+            return v.index0 == w.index0 && v.length == w.length;
+        } else {
+            return v.data() == w.data() && v.size() == w.size();
+        }
+    }, (_Value_variant const&)a);
+}
+
+std::string_view strip(std::string_view text, bool left = true, bool right = true)
+{
+    auto space = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; };
+    while (left && !text.empty() && space(text.front())) text.remove_prefix(1);
+    while (right && !text.empty() && space(text.back())) text.remove_suffix(1);
+    return text;
+}
+
+class Renderer
+{
+public:
+    void reset(TemplateImpl const& impl, std::span<Message const> messages, bool add_generation_prompt, std::span<KeyJSONPair const> variables)
+    {
+        impl_ = &impl;
+        slots_.assign(impl.names.size(), Undefined{});
+        saved_.clear();
+        strings_used_ = lists_used_ = namespaces_used_ = 0;
+        for (auto & [name, value] : variables) {
+            bind(name, from_json(value));
+        }
+        bind("messages", messages);
+        bind("add_generation_prompt", add_generation_prompt);
+        bind("bos_token", std::string_view(impl.bos_token));
+        bind("eos_token", std::string_view(impl.eos_token));
+    }
+
+    void render(std::vector<Node> const& nodes, std::string & out)
+    {
+        for (auto & node : nodes) {
+            switch (node.kind) {
+            case Node::Text:
+                out += node.text;
+                break;
+            case Node::Output:
+                emit(node.expr, out);
+                break;
+            case Node::If:
+                for (auto & branch : node.branches) {
+                    if (branch.condition == NONE || condition(branch.condition)) {
+                        render(branch.body, out);
+                        break;
+                    }
+                }
+                break;
+            case Node::For:
+                render_for(node, out);
+                break;
+            case Node::Set: {
+                Value value = evaluate(node.expr);
+                if (node.attribute_slot == NONE) {
+                    slots_[node.slot] = value;
+                    break;
+                }
+                auto ns = std::get_if<Namespace>(&slots_[node.slot]);
+                if (!ns) {
+                    throw std::runtime_error("chat template cannot set an attribute of " + std::string(node.text));
+                }
+                auto & members = namespaces_[ns->index];
+                auto member = std::find_if(members.begin(), members.end(), [&](Member const& member) {
+                    return member.slot == node.attribute_slot;
+                });
+                if (member != members.end()) {
+                    member->value = value;
+                } else {
+                    members.emplace_back(Member{node.attribute_slot, value});
+                }
+                break;
+            }
+            }
+        }
+    }
+
+private:
+    struct Member
+    {
+        uint32_t slot;
+        Value value;
+    };
+
+    void bind(std::string_view name, Value const& value)
+    {
+        uint32_t slot = impl_->slot(name);
+        if (slot != NONE) {
+            slots_[slot] = value;
+        }
+    }
+
+    std::string & scratch_string()
+    {
+        if (strings_used_ == strings_.size()) {
+            strings_.emplace_back();
+        }
+        std::string & result = strings_[strings_used_ ++];
+        result.clear();
+        return result;
+    }
+
+    std::vector<Value> & scratch_list()
+    {
+        if (lists_used_ == lists_.size()) {
+            lists_.emplace_back();
+        }
+        std::vector<Value> & result = lists_[lists_used_ ++];
+        result.clear();
+        return result;
+    }
+
+    static List list(std::vector<Value> const& values)
+    {
+        return List{values.data(), values.size()};
+    }
+
+    void render_for(Node const& node, std::string & out)
+    {
+        Value iterable = evaluate(node.expr);
+        size_t count = length(iterable);
+        // variables set in the loop are restored when it ends
+        size_t saved = saved_.size();
+        for (uint32_t slot : node.scoped) {
+            saved_.emplace_back(slots_[slot]);
+        }
+
+        // a filtered loop is counted up front so loop.last is right
+        std::vector<Value> * selected = nullptr;
+        if (node.filter != NONE) {
+            selected = &scratch_list();
+            for (size_t idx = 0; idx < count; ++ idx) {
+                bind(node, iterable, idx, Loop{idx, count});
+                if (condition(node.filter)) {
+                    selected->emplace_back((long)idx);
+                }
+            }
+            count = selected->size();
+        }
+        auto messages = std::get_if<std::span<Message const>>(&iterable);
+        auto & body = node.branches.front().body;
+        if (messages && !selected && node.attribute_slot == NONE) {
+            // the common loop over messages
+            Value & message = slots_[node.slot];
+            Value & loop = slots_[node.loop_slot];
+            for (size_t idx = 0; idx < count; ++ idx) {
+                message = &(*messages)[idx];
+                loop = Loop{idx, count};
+                render(body, out);
+            }
+        } else for (size_t idx = 0; idx < count; ++ idx) {
+            size_t element = selected ? (size_t)std::get<long>((*selected)[idx]) : idx;
+            bind(node, iterable, element, Loop{idx, count});
+            render(body, out);
+        }
+        for (size_t idx = 0; idx < node.scoped.size(); ++ idx) {
+            slots_[node.scoped[idx]] = saved_[saved + idx];
+        }
+        saved_.resize(saved);
+        if (count == 0) {
+            render(node.otherwise, out);
+        }
+    }
+
+    void bind(Node const& node, Value const& iterable, size_t idx, Loop loop)
+    {
+        if (node.attribute_slot == NONE) {
+            auto messages = std::get_if<std::span<Message const>>(&iterable);
+            slots_[node.slot] = messages ? Value(&(*messages)[idx]) : element(iterable, idx);
+        } else if (auto json = std::get_if<JSON const*>(&iterable); json && is_container(*json, JSON::OBJECT)) {
+            auto & pair = (*json)->object()[idx];
+            slots_[node.slot] = pair.first;
+            slots_[node.attribute_slot] = from_json(pair.second);
+        } else {
+            Value pair = element(iterable, idx);
+            if (length(pair) != 2) {
+                throw std::runtime_error("chat template cannot unpack a " + std::string(type_name(pair)) + " into two loop variables");
+            }
+            slots_[node.slot] = element(pair, 0);
+            slots_[node.attribute_slot] = element(pair, 1);
+        }
+        slots_[node.loop_slot] = loop;
+    }
+
+    // Append a string concatenation without building the intermediate strings
+    bool emit_strings(uint32_t idx, std::string & out)
+    {
+        Expr const& expr = impl_->exprs[idx];
+        if (expr.op == Op::Concat) {
+            emit(expr.a, out);
+            emit(expr.b, out);
+            return true;
+        } else if (expr.op == Op::Add) {
+            size_t mark = out.size();
+            if (emit_strings(expr.a, out) && emit_strings(expr.b, out)) {
+                return true;
+            }
+            out.resize(mark);
+            return false;
+        } else if (expr.op == Op::Literal) {
+            if (auto text = std::get_if<std::string_view>(&expr.literal)) {
+                out += *text;
+                return true;
+            }
+            return false;
+        } else if (Message const* message = message_field(idx, FieldId::Content); message && message->content) {
+            out += *message->content;
+            return true;
+        }
+        Value value = evaluate(idx);
+        if (auto text = std::get_if<std::string_view>(&value)) {
+            out += *text;
+            return true;
+        } else if (auto json = std::get_if<JSON const*>(&value)) {
+            // structured tool call arguments stand in for their JSON text
+            (*json)->encode(out);
+            return true;
+        }
+        return false;
+    }
+
+    void emit(uint32_t idx, std::string & out)
+    {
+        if (!emit_strings(idx, out)) {
+            write(evaluate(idx), out);
+        }
+    }
+
+    // Python's str()
+    static void write(Value const& value, std::string & out)
+    {
+        std::visit([&](auto const& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, Undefined>) {
+            } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                out += "None";
+            } else if constexpr (std::is_same_v<T, bool>) {
+                out += v ? "True" : "False";
+            } else if constexpr (std::is_same_v<T, long> || std::is_same_v<T, double>) {
+                write_number(v, out);
+            } else if constexpr (std::is_same_v<T, std::string_view>) {
+                out += v;
+            } else if constexpr (std::is_same_v<T, JSON const*>) {
+                v->encode(out);
+            } else if constexpr (std::is_same_v<T, List>) {
+                write_json(value, out, -1, 0);
+            } else {
+                throw std::runtime_error("chat template cannot print a " + std::string(type_name(value)));
+            }
+        }, (_Value_variant const&)value);
+    }
+
+    template <typename Number>
+    static void write_number(Number number, std::string & out)
+    {
+        char buffer[32];
+        auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), number);
+        std::string_view text(buffer, (size_t)(end - buffer));
+        out += text;
+        if (std::is_floating_point_v<Number> && text.find_first_of(".eni") == std::string_view::npos) {
+            out += ".0";
+        }
+    }
+
+    static void write_string_json(std::string_view text, std::string & out)
+    {
+        out += '"';
+        for (char c : text) {
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    static constexpr char hex[] = "0123456789abcdef";
+                    out += "\\u00";
+                    out += hex[(unsigned char)c >> 4];
+                    out += hex[(unsigned char)c & 0xf];
+                } else {
+                    out += c;
+                }
+            }
+        }
+        out += '"';
+    }
+
+    // Python's json.dumps(value, ensure_ascii=False, indent=indent), indent < 0 for none
+    static void write_json(Value const& value, std::string & out, long indent, size_t depth)
+    {
+        auto newline = [&](size_t level) {
+            if (indent >= 0) {
+                out += '\n';
+                out.append((size_t)indent * level, ' ');
+            }
+        };
+        std::string_view separator = indent >= 0 ? "," : ", ";
+        auto sequence = [&](size_t size, auto element) {
+            if (size == 0) {
+                out += "[]";
+                return;
+            }
+            out += '[';
+            for (size_t idx = 0; idx < size; ++ idx) {
+                if (idx) out += separator;
+                newline(depth + 1);
+                element(idx);
+            }
+            newline(depth);
+            out += ']';
+        };
+        auto mapping = [&](std::initializer_list<std::pair<std::string_view, Value>> members) {
+            out += '{';
+            bool first = true;
+            for (auto & [key, member] : members) {
+                if (std::holds_alternative<Undefined>(member)) continue;
+                if (!first) out += separator;
+                first = false;
+                newline(depth + 1);
+                write_string_json(key, out);
+                out += ": ";
+                write_json(member, out, indent, depth + 1);
+            }
+            if (!first) newline(depth);
+            out += '}';
+        };
+        std::visit([&](auto const& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, Undefined> || std::is_same_v<T, std::nullptr_t>) {
+                out += "null";
+            } else if constexpr (std::is_same_v<T, bool>) {
+                out += v ? "true" : "false";
+            } else if constexpr (std::is_same_v<T, long> || std::is_same_v<T, double>) {
+                write_number(v, out);
+            } else if constexpr (std::is_same_v<T, std::string_view>) {
+                write_string_json(v, out);
+            } else if constexpr (std::is_same_v<T, JSON const*>) {
+                if (is_container(v, JSON::ARRAY)) {
+                    sequence(v->size(), [&](size_t idx) { write_json(from_json(v->array()[idx]), out, indent, depth + 1); });
+                } else if (v->size() == 0) {
+                    out += "{}";
+                } else {
+                    out += '{';
+                    for (size_t idx = 0; idx < v->size(); ++ idx) {
+                        if (idx) out += separator;
+                        newline(depth + 1);
+                        write_string_json(v->object()[idx].first, out);
+                        out += ": ";
+                        write_json(from_json(v->object()[idx].second), out, indent, depth + 1);
+                    }
+                    newline(depth);
+                    out += '}';
+                }
+            } else if constexpr (std::is_same_v<T, List>) {
+                sequence(v.size, [&](size_t idx) { write_json(v.data[idx], out, indent, depth + 1); });
+            } else if constexpr (std::is_same_v<T, std::span<Message const>> || std::is_same_v<T, std::span<ToolCall const>>) {
+                sequence(v.size(), [&](size_t idx) { write_json(&v[idx], out, indent, depth + 1); });
+            } else if constexpr (std::is_same_v<T, Message const*>) {
+                mapping({
+                    {"role", std::string_view(v->role)},
+                    {"content", v->content ? Value(std::string_view(*v->content)) : Value(nullptr)},
+                    {"tool_calls", v->tool_calls.empty() ? Value(Undefined{}) : Value(std::span<ToolCall const>(v->tool_calls))},
+                });
+            } else if constexpr (std::is_same_v<T, ToolCall const*>) {
+                mapping({{"type", std::string_view(v->type)}, {"function", &v->function}});
+            } else if constexpr (std::is_same_v<T, Function const*>) {
+                mapping({{"name", std::string_view(v->name)}, {"arguments", from_json(v->parameters)}});
+            } else {
+                throw std::runtime_error("chat template cannot serialize a " + std::string(type_name(value)));
+            }
+        }, (_Value_variant const&)value);
+    }
+
+    static size_t length(Value const& value)
+    {
+        return std::visit([&](auto const& v) -> size_t {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, Undefined>) {
+                return 0;
+            } else if constexpr (std::is_same_v<T, std::string_view>) {
+                size_t codepoints = 0;
+                for (char c : v) {
+                    codepoints += ((unsigned char)c & 0xc0) != 0x80;
+                }
+                return codepoints;
+            } else if constexpr (std::is_same_v<T, JSON const*>) {
+                return v->size();
+            } else if constexpr (std::is_same_v<T, List>) {
+                return v.size;
+            } else if constexpr (std::is_same_v<T, std::span<Message const>> || std::is_same_v<T, std::span<ToolCall const>>) {
+                return v.size();
+            } else {
+                throw std::runtime_error("chat template cannot take the length of a " + std::string(type_name(value)));
+            }
+        }, (_Value_variant const&)value);
+    }
+
+    // The element at idx of an iterable; the keys of mappings
+    static Value element(Value const& value, size_t idx)
+    {
+        return std::visit([&](auto const& v) -> Value {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, JSON const*>) {
+                if (is_container(v, JSON::ARRAY)) {
+                    return from_json(v->array()[idx]);
+                }
+                return v->object()[idx].first;
+            } else if constexpr (std::is_same_v<T, List>) {
+                return v.data[idx];
+            } else if constexpr (std::is_same_v<T, std::span<Message const>> || std::is_same_v<T, std::span<ToolCall const>>) {
+                return &v[idx];
+            } else {
+                throw std::runtime_error("chat template cannot iterate over a " + std::string(type_name(value)));
+            }
+        }, (_Value_variant const&)value);
+    }
+
+    Value attribute(Value const& value, std::string_view name) const
+    {
+        return attribute(value, field(name), name, impl_->slot(name));
+    }
+
+    Value attribute(Value const& value, FieldId id, std::string_view name, uint32_t slot) const
+    {
+        switch (value.index()) {
+        case KIND<Message const*>: {
+            Message const& message = *std::get<Message const*>(value);
+            if (id == FieldId::Role) {
+                return std::string_view(message.role);
+            } else if (id == FieldId::Content) {
+                return message.content ? Value(std::string_view(*message.content)) : Value(nullptr);
+            } else if (id == FieldId::ToolCalls && !message.tool_calls.empty()) {
+                return std::span<ToolCall const>(message.tool_calls);
+            }
+            break;
+        }
+        case KIND<ToolCall const*>: {
+            ToolCall const& call = *std::get<ToolCall const*>(value);
+            if (id == FieldId::Type) {
+                return std::string_view(call.type);
+            } else if (id == FieldId::Function) {
+                return &call.function;
+            }
+            break;
+        }
+        case KIND<Function const*>: {
+            Function const& function = *std::get<Function const*>(value);
+            if (id == FieldId::Name) {
+                return std::string_view(function.name);
+            } else if (id == FieldId::Arguments) {
+                return from_json(function.parameters);
+            }
+            break;
+        }
+        case KIND<JSON const*>: {
+            JSON const& json = *std::get<JSON const*>(value);
+            if (is_container(&json, JSON::OBJECT)) {
+                for (auto & [key, member] : json.object()) {
+                    if (key == name) {
+                        return from_json(member);
+                    }
+                }
+            }
+            break;
+        }
+        case KIND<Namespace>:
+            for (auto & member : namespaces_[std::get<Namespace>(value).index]) {
+                if (member.slot == slot) {
+                    return member.value;
+                }
+            }
+            break;
+        case KIND<Loop>: {
+            Loop const& loop = std::get<Loop>(value);
+            switch (id) {
+            case FieldId::Index: return (long)(loop.index0 + 1);
+            case FieldId::Index0: return (long)loop.index0;
+            case FieldId::RevIndex: return (long)(loop.length - loop.index0);
+            case FieldId::RevIndex0: return (long)(loop.length - loop.index0 - 1);
+            case FieldId::First: return loop.index0 == 0;
+            case FieldId::Last: return loop.index0 + 1 == loop.length;
+            case FieldId::Length: return (long)loop.length;
+            default: break;
+            }
+            break;
+        }
+        case KIND<Undefined>:
+            throw std::runtime_error("chat template reads " + std::string(name) + " of an undefined value");
+        }
+        return Undefined{};
+    }
+
+    static size_t index(Value const& key, size_t size)
+    {
+        if (!std::holds_alternative<long>(key)) {
+            throw std::runtime_error("chat template indexes with a " + std::string(type_name(key)));
+        }
+        long idx = std::get<long>(key);
+        return idx < 0 ? size - (size_t)-idx : (size_t)idx;
+    }
+
+    Value item(Value const& value, Value const& key) const
+    {
+        if (auto name = std::get_if<std::string_view>(&key)) {
+            return attribute(value, *name);
+        }
+        if (auto text = std::get_if<std::string_view>(&value)) {
+            size_t idx = index(key, text->size());
+            return idx < text->size() ? Value(text->substr(idx, 1)) : Value(Undefined{});
+        }
+        size_t size = length(value);
+        size_t idx = index(key, size);
+        return idx < size ? element(value, idx) : Value(Undefined{});
+    }
+
+    Value slice(Value const& value, Value const& start_value, Value const& stop_value)
+    {
+        size_t size = std::holds_alternative<std::string_view>(value) ? std::get<std::string_view>(value).size() : length(value);
+        auto bound = [&](Value const& bound, size_t dflt) {
+            if (std::holds_alternative<Undefined>(bound) || std::holds_alternative<std::nullptr_t>(bound)) {
+                return dflt;
+            }
+            long idx = std::get<long>(bound);
+            if (idx < 0) {
+                return (size_t)-idx > size ? 0 : size - (size_t)-idx;
+            }
+            return std::min((size_t)idx, size);
+        };
+        size_t start = bound(start_value, 0);
+        size_t stop = std::max(start, bound(stop_value, size));
+        if (auto text = std::get_if<std::string_view>(&value)) {
+            return text->substr(start, stop - start);
+        } else if (auto messages = std::get_if<std::span<Message const>>(&value)) {
+            return messages->subspan(start, stop - start);
+        } else if (auto calls = std::get_if<std::span<ToolCall const>>(&value)) {
+            return calls->subspan(start, stop - start);
+        } else if (auto values = std::get_if<List>(&value)) {
+            return List{values->data + start, stop - start};
+        }
+        auto & result = scratch_list();
+        for (size_t idx = start; idx < stop; ++ idx) {
+            result.emplace_back(element(value, idx));
+        }
+        return list(result);
+    }
+
+    bool contains(Value const& haystack, Value const& needle) const
+    {
+        if (auto text = std::get_if<std::string_view>(&haystack)) {
+            auto sub = std::get_if<std::string_view>(&needle);
+            if (!sub) {
+                throw std::runtime_error("chat template looks for a " + std::string(type_name(needle)) + " in a string");
+            }
+            return text->find(*sub) != std::string_view::npos;
+        }
+        if (std::holds_alternative<Undefined>(haystack)) {
+            return false;
+        }
+        bool mapping = std::holds_alternative<Message const*>(haystack) || std::holds_alternative<ToolCall const*>(haystack)
+            || std::holds_alternative<Function const*>(haystack) || std::holds_alternative<Namespace>(haystack)
+            || (std::holds_alternative<JSON const*>(haystack) && is_container(std::get<JSON const*>(haystack), JSON::OBJECT));
+        if (mapping) {
+            auto key = std::get_if<std::string_view>(&needle);
+            return key && !std::holds_alternative<Undefined>(attribute(haystack, *key));
+        }
+        size_t size = length(haystack);
+        for (size_t idx = 0; idx < size; ++ idx) {
+            if (equal(element(haystack, idx), needle)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool test(TestId id, Value const& value, Value const* args, size_t count)
+    {
+        auto json_is = [&](JSON::Index index) {
+            auto json = std::get_if<JSON const*>(&value);
+            return json && is_container(*json, index);
+        };
+        switch (id) {
+        case TestId::Defined: return !std::holds_alternative<Undefined>(value);
+        case TestId::Undefined: return std::holds_alternative<Undefined>(value);
+        case TestId::None: return std::holds_alternative<std::nullptr_t>(value);
+        case TestId::Boolean: return std::holds_alternative<bool>(value);
+        case TestId::True: return std::holds_alternative<bool>(value) && std::get<bool>(value);
+        case TestId::False: return std::holds_alternative<bool>(value) && !std::get<bool>(value);
+        case TestId::Integer: return std::holds_alternative<long>(value);
+        case TestId::Float: return std::holds_alternative<double>(value);
+        case TestId::Number: return is_number(value);
+        case TestId::String: return std::holds_alternative<std::string_view>(value);
+        case TestId::Mapping:
+            return json_is(JSON::OBJECT) || std::holds_alternative<Message const*>(value)
+                || std::holds_alternative<ToolCall const*>(value) || std::holds_alternative<Function const*>(value);
+        case TestId::Iterable:
+        case TestId::Sequence:
+            return std::holds_alternative<std::string_view>(value) || std::holds_alternative<JSON const*>(value)
+                || std::holds_alternative<List>(value) || std::holds_alternative<std::span<Message const>>(value)
+                || std::holds_alternative<std::span<ToolCall const>>(value)
+                || (id == TestId::Iterable && std::holds_alternative<Message const*>(value));
+        case TestId::EqualTo:
+        case TestId::NotEqualTo:
+            if (count != 1) {
+                throw std::runtime_error("chat template test equalto takes one argument");
+            }
+            return equal(value, args[0]) == (id == TestId::EqualTo);
+        }
+        return false;
+    }
+
+    // Evaluate the arguments of a call, filter or test into a small fixed array
+    static constexpr size_t MAX_ARGS = 4;
+    size_t arguments(Expr const& expr, Value (&args)[MAX_ARGS], size_t skip = 0)
+    {
+        if (expr.args.size() - skip > MAX_ARGS) {
+            throw std::runtime_error("chat template passes too many arguments");
+        }
+        for (size_t idx = skip; idx < expr.args.size(); ++ idx) {
+            args[idx - skip] = evaluate(expr.args[idx]);
+        }
+        return expr.args.size() - skip;
+    }
+
+    Value keyword(Expr const& expr, std::string_view name, size_t position)
+    {
+        for (size_t idx = 0; idx < expr.args.size(); ++ idx) {
+            if (expr.keywords[idx] == name || (idx == position && expr.keywords[idx].empty())) {
+                return evaluate(expr.args[idx]);
+            }
+        }
+        return Undefined{};
+    }
+
+    std::string_view stringify(Value const& value)
+    {
+        if (auto text = std::get_if<std::string_view>(&value)) {
+            return *text;
+        }
+        std::string & result = scratch_string();
+        write(value, result);
+        return result;
+    }
+
+    Value filter(Expr const& expr)
+    {
+        Value value = evaluate(expr.a);
+        switch ((FilterId)expr.id) {
+        case FilterId::Trim:
+            return strip(stringify(value));
+        case FilterId::Length:
+            return (long)length(value);
+        case FilterId::ToJson: {
+            Value indent = keyword(expr, "indent", 0);
+            std::string & result = scratch_string();
+            write_json(value, result, std::holds_alternative<long>(indent) ? std::get<long>(indent) : -1, 0);
+            return std::string_view(result);
+        }
+        case FilterId::Join: {
+            Value separator = keyword(expr, "d", 0);
+            std::string_view sep = std::holds_alternative<Undefined>(separator) ? std::string_view() : stringify(separator);
+            std::string & result = scratch_string();
+            size_t size = length(value);
+            for (size_t idx = 0; idx < size; ++ idx) {
+                if (idx) result += sep;
+                write(element(value, idx), result);
+            }
+            return std::string_view(result);
+        }
+        case FilterId::Items:
+            if (std::holds_alternative<Undefined>(value) || (std::holds_alternative<JSON const*>(value) && is_container(std::get<JSON const*>(value), JSON::OBJECT))) {
+                // loops over mappings unpack key, value pairs themselves
+                return value;
+            }
+            throw std::runtime_error("chat template takes items of a " + std::string(type_name(value)));
+        case FilterId::Reject:
+        case FilterId::Select:
+        case FilterId::RejectAttr:
+        case FilterId::SelectAttr: {
+            bool attr = (FilterId)expr.id == FilterId::RejectAttr || (FilterId)expr.id == FilterId::SelectAttr;
+            bool keep = (FilterId)expr.id == FilterId::Select || (FilterId)expr.id == FilterId::SelectAttr;
+            Value args[MAX_ARGS];
+            size_t count = arguments(expr, args);
+            std::string_view name;
+            if (attr) {
+                if (count == 0 || !std::holds_alternative<std::string_view>(args[0])) {
+                    throw std::runtime_error("chat template selectattr and rejectattr take an attribute name");
+                }
+                name = std::get<std::string_view>(args[0]);
+            }
+            size_t test_arg = attr ? 1 : 0;
+            bool has_test = count > test_arg;
+            TestId id = TestId::Defined;
+            if (has_test) {
+                id = lookup(TESTS, stringify(args[test_arg]), "test");
+            }
+            auto & result = scratch_list();
+            size_t size = length(value);
+            for (size_t idx = 0; idx < size; ++ idx) {
+                Value candidate = element(value, idx);
+                Value subject = attr ? attribute(candidate, name) : candidate;
+                bool passed = has_test ? test(id, subject, args + test_arg + 1, count - test_arg - 1) : truthy(subject);
+                if (passed == keep) {
+                    result.emplace_back(candidate);
+                }
+            }
+            return list(result);
+        }
+        case FilterId::First:
+            return length(value) ? element(value, 0) : Value(Undefined{});
+        case FilterId::Last: {
+            size_t size = length(value);
+            return size ? element(value, size - 1) : Value(Undefined{});
+        }
+        case FilterId::String:
+            return stringify(value);
+        case FilterId::Lower:
+        case FilterId::Upper:
+            return change_case(stringify(value), (FilterId)expr.id == FilterId::Upper);
+        case FilterId::Default: {
+            Value args[MAX_ARGS];
+            size_t count = arguments(expr, args);
+            bool replace = std::holds_alternative<Undefined>(value) || (count > 1 && truthy(args[1]) && !truthy(value));
+            return replace ? (count ? args[0] : Value(std::string_view())) : value;
+        }
+        case FilterId::Safe:
+            return value;
+        }
+        return Undefined{};
+    }
+
+    std::string_view change_case(std::string_view text, bool upper)
+    {
+        std::string & result = scratch_string();
+        for (char c : text) {
+            if (upper && c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+            if (!upper && c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+            result += c;
+        }
+        return result;
+    }
+
+    Value call(Expr const& expr)
+    {
+        switch ((FunctionId)expr.id) {
+        case FunctionId::Namespace: {
+            if (namespaces_used_ == namespaces_.size()) {
+                namespaces_.emplace_back();
+            }
+            auto & members = namespaces_[namespaces_used_];
+            members.clear();
+            for (size_t idx = 0; idx < expr.args.size(); ++ idx) {
+                if (!expr.keywords[idx].empty()) {
+                    members.emplace_back(Member{impl_->slot(expr.keywords[idx]), evaluate(expr.args[idx])});
+                }
+            }
+            return Namespace{namespaces_used_ ++};
+        }
+        case FunctionId::RaiseException: {
+            Value args[MAX_ARGS];
+            size_t count = arguments(expr, args);
+            throw std::runtime_error(count ? std::string(stringify(args[0])) : "chat template raised an exception");
+        }
+        case FunctionId::Range: {
+            Value args[MAX_ARGS];
+            size_t count = arguments(expr, args);
+            long start = 0, stop = 0;
+            if (count == 1) {
+                stop = std::get<long>(args[0]);
+            } else if (count == 2) {
+                start = std::get<long>(args[0]);
+                stop = std::get<long>(args[1]);
+            }
+            auto & result = scratch_list();
+            for (long idx = start; idx < stop; ++ idx) {
+                result.emplace_back(idx);
+            }
+            return list(result);
+        }
+        case FunctionId::StrftimeNow: {
+            Value args[MAX_ARGS];
+            size_t count = arguments(expr, args);
+            std::string format(count ? stringify(args[0]) : "%Y-%m-%d");
+            std::time_t now = std::time(nullptr);
+            std::tm local;
+            localtime_r(&now, &local);
+            char buffer[256];
+            size_t size = std::strftime(buffer, sizeof(buffer), format.c_str(), &local);
+            std::string & result = scratch_string();
+            result.assign(buffer, size);
+            return std::string_view(result);
+        }
+        }
+        return Undefined{};
+    }
+
+    Value method(Expr const& expr)
+    {
+        Value object = evaluate(expr.a);
+        Value args[MAX_ARGS];
+        size_t count = arguments(expr, args);
+        std::string_view name = expr.name;
+        if (auto text = std::get_if<std::string_view>(&object)) {
+            if (name == "strip" || name == "lstrip" || name == "rstrip") {
+                bool left = name != "rstrip", right = name != "lstrip";
+                if (count == 0) {
+                    return strip(*text, left, right);
+                }
+                std::string_view chars = stringify(args[0]);
+                std::string_view result = *text;
+                while (left && !result.empty() && chars.find(result.front()) != std::string_view::npos) result.remove_prefix(1);
+                while (right && !result.empty() && chars.find(result.back()) != std::string_view::npos) result.remove_suffix(1);
+                return result;
+            } else if (name == "startswith" && count == 1) {
+                return text->starts_with(stringify(args[0]));
+            } else if (name == "endswith" && count == 1) {
+                return text->ends_with(stringify(args[0]));
+            } else if (name == "upper" || name == "lower") {
+                return change_case(*text, name == "upper");
+            } else if (name == "split") {
+                std::string_view sep = count ? stringify(args[0]) : " ";
+                auto & result = scratch_list();
+                std::string_view rest = *text;
+                size_t found;
+                while (!sep.empty() && (found = rest.find(sep)) != std::string_view::npos) {
+                    result.emplace_back(rest.substr(0, found));
+                    rest.remove_prefix(found + sep.size());
+                }
+                result.emplace_back(rest);
+                return list(result);
+            } else if (name == "replace" && count == 2) {
+                std::string_view from = stringify(args[0]), to = stringify(args[1]);
+                std::string & result = scratch_string();
+                std::string_view rest = *text;
+                size_t found;
+                while (!from.empty() && (found = rest.find(from)) != std::string_view::npos) {
+                    result += rest.substr(0, found);
+                    result += to;
+                    rest.remove_prefix(found + from.size());
+                }
+                result += rest;
+                return std::string_view(result);
+            }
+        } else if (name == "items" && count == 0 && std::holds_alternative<JSON const*>(object)) {
+            return object;
+        } else if (name == "get" && (count == 1 || count == 2)) {
+            Value result = item(object, args[0]);
+            return std::holds_alternative<Undefined>(result) ? (count == 2 ? args[1] : Value(nullptr)) : result;
+        }
+        throw std::runtime_error("chat template calls unsupported method " + std::string(name) + " of a " + std::string(type_name(object)));
+    }
+
+    // The message whose field the expression reads directly, such as message.role
+    Message const* message_field(uint32_t idx, FieldId id) const
+    {
+        Expr const& expr = impl_->exprs[idx];
+        if (expr.op != Op::Attribute || (FieldId)expr.id != id || impl_->exprs[expr.a].op != Op::Variable) {
+            return nullptr;
+        }
+        auto message = std::get_if<Message const*>(&slots_[impl_->exprs[expr.a].slot]);
+        return message ? *message : nullptr;
+    }
+
+    // The truth of an expression, without building the values of the logic, comparisons and tests in it
+    bool condition(uint32_t idx)
+    {
+        Expr const& expr = impl_->exprs[idx];
+        switch (expr.op) {
+        case Op::Not:
+            return !condition(expr.a);
+        case Op::And:
+            return condition(expr.a) && condition(expr.b);
+        case Op::Or:
+            return condition(expr.a) || condition(expr.b);
+        case Op::Equal:
+        case Op::NotEqual: {
+            Expr const& right = impl_->exprs[expr.b];
+            if (Message const* message = message_field(expr.a, FieldId::Role); message && right.op == Op::Literal) {
+                // message['role'] == 'user', which templates test of every message
+                if (auto role = std::get_if<std::string_view>(&right.literal)) {
+                    return (message->role == *role) == (expr.op == Op::Equal);
+                }
+            }
+            Value left = evaluate(expr.a);
+            bool same = right.op == Op::Literal ? equal(left, right.literal) : equal(left, evaluate(expr.b));
+            return same == (expr.op == Op::Equal);
+        }
+        case Op::Test:
+            if (Message const* message = message_field(expr.a, FieldId::Content); message && (TestId)expr.id == TestId::None) {
+                // message['content'] is none
+                return !message->content.has_value() != expr.negated;
+            }
+            if (expr.args.empty()) {
+                return test((TestId)expr.id, evaluate(expr.a), nullptr, 0) != expr.negated;
+            }
+            break;
+        default:
+            break;
+        }
+        return truthy(evaluate(idx));
+    }
+
+    Value evaluate(uint32_t idx)
+    {
+        Expr const& expr = impl_->exprs[idx];
+        switch (expr.op) {
+        case Op::Literal:
+            return expr.literal;
+        case Op::Variable:
+            return slots_[expr.slot];
+        case Op::Attribute:
+            if (impl_->exprs[expr.a].op == Op::Variable) {
+                // such as message.role, read in place
+                return attribute(slots_[impl_->exprs[expr.a].slot], (FieldId)expr.id, expr.name, expr.slot);
+            }
+            return attribute(evaluate(expr.a), (FieldId)expr.id, expr.name, expr.slot);
+        case Op::Item: {
+            Value object = evaluate(expr.a);
+            return item(object, evaluate(expr.b));
+        }
+        case Op::Slice: {
+            Value object = evaluate(expr.a);
+            Value start = expr.b == NONE ? Value(Undefined{}) : evaluate(expr.b);
+            Value stop = expr.c == NONE ? Value(Undefined{}) : evaluate(expr.c);
+            return slice(object, start, stop);
+        }
+        case Op::ListLiteral: {
+            auto & result = scratch_list();
+            for (uint32_t arg : expr.args) {
+                Value value = evaluate(arg);
+                result.emplace_back(value);
+            }
+            return list(result);
+        }
+        case Op::Call:
+            return call(expr);
+        case Op::Method:
+            return method(expr);
+        case Op::Filter:
+            return filter(expr);
+        case Op::Test: {
+            Value value = evaluate(expr.a);
+            Value args[MAX_ARGS];
+            size_t count = arguments(expr, args);
+            return test((TestId)expr.id, value, args, count) != expr.negated;
+        }
+        case Op::Not:
+            return !condition(expr.a);
+        case Op::And: {
+            Value left = evaluate(expr.a);
+            return truthy(left) ? evaluate(expr.b) : left;
+        }
+        case Op::Or: {
+            Value left = evaluate(expr.a);
+            return truthy(left) ? left : evaluate(expr.b);
+        }
+        case Op::Equal:
+        case Op::NotEqual: {
+            Value left = evaluate(expr.a);
+            return equal(left, evaluate(expr.b)) == (expr.op == Op::Equal);
+        }
+        case Op::Less:
+        case Op::LessEqual:
+        case Op::Greater:
+        case Op::GreaterEqual: {
+            Value left = evaluate(expr.a), right = evaluate(expr.b);
+            std::partial_ordering order = std::partial_ordering::unordered;
+            if (is_number(left) && is_number(right)) {
+                order = number(left) <=> number(right);
+            } else if (std::holds_alternative<std::string_view>(left) && std::holds_alternative<std::string_view>(right)) {
+                order = std::get<std::string_view>(left) <=> std::get<std::string_view>(right);
+            } else {
+                throw std::runtime_error("chat template compares a " + std::string(type_name(left)) + " with a " + std::string(type_name(right)));
+            }
+            switch (expr.op) {
+            case Op::Less: return order < 0;
+            case Op::LessEqual: return order <= 0;
+            case Op::Greater: return order > 0;
+            default: return order >= 0;
+            }
+        }
+        case Op::In:
+        case Op::NotIn: {
+            Value needle = evaluate(expr.a);
+            return contains(evaluate(expr.b), needle) == (expr.op == Op::In);
+        }
+        case Op::Add: {
+            std::string & result = scratch_string();
+            if (emit_strings(idx, result)) {
+                return std::string_view(result);
+            }
+            Value left = evaluate(expr.a), right = evaluate(expr.b);
+            if (auto a = std::get_if<List>(&left), b = std::get_if<List>(&right); a && b) {
+                auto & joined = scratch_list();
+                joined.insert(joined.end(), a->data, a->data + a->size);
+                joined.insert(joined.end(), b->data, b->data + b->size);
+                return list(joined);
+            }
+            return arithmetic(expr.op, left, right);
+        }
+        case Op::Subtract:
+        case Op::Multiply:
+        case Op::Divide:
+        case Op::Modulo: {
+            Value left = evaluate(expr.a);
+            return arithmetic(expr.op, left, evaluate(expr.b));
+        }
+        case Op::Concat: {
+            std::string & result = scratch_string();
+            emit_strings(idx, result);
+            return std::string_view(result);
+        }
+        case Op::Negate: {
+            Value value = evaluate(expr.a);
+            if (auto integer = std::get_if<long>(&value)) {
+                return -*integer;
+            }
+            return -number(value);
+        }
+        case Op::Conditional:
+            return condition(expr.b) ? evaluate(expr.a) : evaluate(expr.c);
+        }
+        return Undefined{};
+    }
+
+    static Value arithmetic(Op op, Value const& left, Value const& right)
+    {
+        if (!is_number(left) || !is_number(right)) {
+            throw std::runtime_error("chat template does arithmetic on a " + std::string(type_name(left)) + " and a " + std::string(type_name(right)));
+        }
+        if (std::holds_alternative<long>(left) && std::holds_alternative<long>(right) && op != Op::Divide) {
+            long a = std::get<long>(left), b = std::get<long>(right);
+            switch (op) {
+            case Op::Add: return a + b;
+            case Op::Subtract: return a - b;
+            case Op::Multiply: return a * b;
+            default:
+                if (b == 0) throw std::runtime_error("chat template divides by zero");
+                return ((a % b) + b) % b;
+            }
+        }
+        double a = number(left), b = number(right);
+        switch (op) {
+        case Op::Add: return a + b;
+        case Op::Subtract: return a - b;
+        case Op::Multiply: return a * b;
+        case Op::Divide: return a / b;
+        default: return a - b * std::floor(a / b);
+        }
+    }
+
+    TemplateImpl const* impl_ = nullptr;
+    // variables by interned name, and the outer values of variables scoped by running loops
+    std::vector<Value> slots_;
+    std::vector<Value> saved_;
+    // scratch storage is kept across renders and handed out in order
+    std::deque<std::string> strings_;
+    std::deque<std::vector<Value>> lists_;
+    std::deque<std::vector<Member>> namespaces_;
+    size_t strings_used_ = 0, lists_used_ = 0, namespaces_used_ = 0;
+};
+
+/*
+ * The templates the hand-written renderers in hodgepodge.cpp follow
+ */
+
+constexpr std::string_view DEEPSEEK3_TEMPLATE =
+    "{% if not add_generation_prompt is defined %}"
+    "{% set add_generation_prompt = false %}"
+    "{% endif %}"
+    "{% set ns = namespace(is_first=false, is_tool=false, is_output_first=true, system_prompt='', is_first_sp=true) %}"
+    "{%- for message in messages %}"
+    "{%- if message['role'] == 'system' %}"
+    "{%- if ns.is_first_sp %}"
+    "{% set ns.system_prompt = ns.system_prompt + message['content'] %}"
+    "{% set ns.is_first_sp = false %}"
+    "{%- else %}"
+    "{% set ns.system_prompt = ns.system_prompt + '\n\n' + message['content'] %}"
+    "{%- endif %}"
+    "{%- endif %}"
+    "{%- endfor %}"
+    "{{bos_token}}{{ns.system_prompt}}"
+    "{%- for message in messages %}"
+    "{%- if message['role'] == 'user' %}"
+    "{%- set ns.is_tool = false -%}"
+    "{{'<｜User｜>' + message['content']}}"
+    "{%- endif %}"
+    "{%- if message['role'] == 'assistant' and message['content'] is none %}"
+    "{%- set ns.is_tool = false -%}"
+    "{%- for tool in message['tool_calls']%}"
+    "{%- if not ns.is_first %}"
+    "{{'<｜Assistant｜><｜tool▁calls▁begin｜><｜tool▁call▁begin｜>' + tool['type'] + '<｜tool▁sep｜>' + tool['function']['name'] + '\n' + '```json' + '\n' + tool['function']['arguments'] + '\n' + '```' + '<｜tool▁call▁end｜>'}}"
+    "{%- set ns.is_first = true -%}"
+    "{%- else %}"
+    "{{'\n' + '<｜tool▁call▁begin｜>' + tool['type'] + '<｜tool▁sep｜>' + tool['function']['name'] + '\n' + '```json' + '\n' + tool['function']['arguments'] + '\n' + '```' + '<｜tool▁call▁end｜>'}}"
+    "{{'<｜tool▁calls▁end｜><｜end▁of▁sentence｜>'}}"
+    "{%- endif %}"
+    "{%- endfor %}"
+    "{%- endif %}"
+    "{%- if message['role'] == 'assistant' and message['content'] is not none %}"
+    "{%- if ns.is_tool %}"
+    "{{'<｜tool▁outputs▁end｜>' + message['content'] + '<｜end▁of▁sentence｜>'}}"
+    "{%- set ns.is_tool = false -%}"
+    "{%- else %}"
+    "{{'<｜Assistant｜>' + message['content'] + '<｜end▁of▁sentence｜>'}}"
+    "{%- endif %}"
+    "{%- endif %}"
+    "{%- if message['role'] == 'tool' %}"
+    "{%- set ns.is_tool = true -%}"
+    "{%- if ns.is_output_first %}"
+    "{{'<｜tool▁outputs▁begin｜><｜tool▁output▁begin｜>' + message['content'] + '<｜tool▁output▁end｜>'}}"
+    "{%- set ns.is_output_first = false %}"
+    "{%- else %}"
+    "{{'\n<｜tool▁output▁begin｜>' + message['content'] + '<｜tool▁output▁end｜>'}}"
+    "{%- endif %}"
+    "{%- endif %}"
+    "{%- endfor -%}"
+    "{% if ns.is_tool %}"
+    "{{'<｜tool▁outputs▁end｜>'}}"
+    "{% endif %}"
+    "{% if add_generation_prompt and not ns.is_tool %}"
+    "{{'<｜Assistant｜>'}}"
+    "{% endif %}";
+
+constexpr std::string_view LLAMA31_TEMPLATE =
+    "{%- if custom_tools is defined %}\n"
+    "    {%- set tools = custom_tools %}\n"
+    "{%- endif %}\n"
+    "{%- if not tools_in_user_message is defined %}\n"
+    "    {%- set tools_in_user_message = true %}\n"
+    "{%- endif %}\n"
+    "{%- if not date_string is defined %}\n"
+    "    {%- set date_string = \"26 Jul 2024\" %}\n"
+    "{%- endif %}\n"
+    "{%- if not tools is defined %}\n"
+    "    {%- set tools = none %}\n"
+    "{%- endif %}\n"
+    "{{- bos_token }}\n"
+    "\n"
+    "{#- This block extracts the system message, so we can slot it into the right place. #}\n"
+    "{%- if messages[0]['role'] == 'system' %}\n"
+    "    {%- set system_message = messages[0]['content']|trim %}\n"
+    "    {%- set messages = messages[1:] %}\n"
+    "{%- else %}\n"
+    "    {%- set system_message = \"\" %}\n"
+    "{%- endif %}\n"
+    "\n"
+    "{#- System message + builtin tools #}\n"
+    "{{- \"<|start_header_id|>system<|end_header_id|>\\n\\n\" }}\n"
+    "{%- if builtin_tools is defined or tools is not none %}\n"
+    "    {{- \"Environment: ipython\\n\" }}\n"
+    "{%- endif %}\n"
+    "{%- if builtin_tools is defined %}\n"
+    "    {{- \"Tools: \" + builtin_tools | reject('equalto', 'code_interpreter') | join(\", \") + \"\\n\\n\"}}\n"
+    "{%- endif %}\n"
+    "{{- \"Cutting Knowledge Date: December 2023\\n\" }}\n"
+    "{{- \"Today Date: \" + date_string + \"\\n\\n\" }}\n"
+    "{%- if tools is not none and not tools_in_user_message %}\n"
+    "    {{- \"You have access to the following functions. To call a function, please respond with JSON for a function call.\" }}\n"
+    "    {{- 'Respond in the format {\"name\": function name, \"parameters\": dictionary of argument name and its value}.' }}\n"
+    "    {{- \"Do not use variables.\\n\\n\" }}\n"
+    "    {%- for t in tools %}\n"
+    "        {{- t | tojson(indent=4) }}\n"
+    "        {{- \"\\n\\n\" }}\n"
+    "    {%- endfor %}\n"
+    "{%- endif %}\n"
+    "{{- system_message }}\n"
+    "{{- \"<|eot_id|>\" }}\n"
+    "\n"
+    "{#- Custom tools are passed in a user message with some extra guidance #}\n"
+    "{%- if tools_in_user_message and not tools is none %}\n"
+    "    {#- Extract the first user message so we can plug it in here #}\n"
+    "    {%- if messages | length != 0 %}\n"
+    "        {%- set first_user_message = messages[0]['content']|trim %}\n"
+    "        {%- set messages = messages[1:] %}\n"
+    "    {%- else %}\n"
+    "        {{- raise_exception(\"Cannot put tools in the first user message when there's no first user message!\") }}\n"
+    "{%- endif %}\n"
+    "    {{- '<|start_header_id|>user<|end_header_id|>\\n\\n' -}}\n"
+    "    {{- \"Given the following functions, please respond with a JSON for a function call \" }}\n"
+    "    {{- \"with its proper arguments that best answers the given prompt.\\n\\n\" }}\n"
+    "    {{- 'Respond in the format {\"name\": function name, \"parameters\": dictionary of argument name and its value}.' }}\n"
+    "    {{- \"Do not use variables.\\n\\n\" }}\n"
+    "    {%- for t in tools %}\n"
+    "        {{- t | tojson(indent=4) }}\n"
+    "        {{- \"\\n\\n\" }}\n"
+    "    {%- endfor %}\n"
+    "    {{- first_user_message + \"<|eot_id|>\"}}\n"
+    "{%- endif %}\n"
+    "\n"
+    "{%- for message in messages %}\n"
+    "    {%- if not (message.role == 'ipython' or message.role == 'tool' or 'tool_calls' in message) %}\n"
+    "        {{- '<|start_header_id|>' + message['role'] + '<|end_header_id|>\\n\\n'+ message['content'] | trim + '<|eot_id|>' }}\n"
+    "    {%- elif 'tool_calls' in message %}\n"
+    "        {%- if not message.tool_calls|length == 1 %}\n"
+    "            {{- raise_exception(\"This model only supports single tool-calls at once!\") }}\n"
+    "        {%- endif %}\n"
+    "        {%- set tool_call = message.tool_calls[0].function %}\n"
+    "        {%- if builtin_tools is defined and tool_call.name in builtin_tools %}\n"
+    "            {{- '<|start_header_id|>assistant<|end_header_id|>\\n\\n' -}}\n"
+    "            {{- \"<|python_tag|>\" + tool_call.name + \".call(\" }}\n"
+    "            {%- for arg_name, arg_val in tool_call.arguments | items %}\n"
+    "                {{- arg_name + '=\"' + arg_val + '\"' }}\n"
+    "                {%- if not loop.last %}\n"
+    "                    {{- \", \" }}\n"
+    "                {%- endif %}\n"
+    "                {%- endfor %}\n"
+    "            {{- \")\" }}\n"
+    "        {%- else  %}\n"
+    "            {{- '<|start_header_id|>assistant<|end_header_id|>\\n\\n' -}}\n"
+    "            {{- '{\"name\": \"' + tool_call.name + '\", ' }}\n"
+    "            {{- '\"parameters\": ' }}\n"
+    "            {{- tool_call.arguments | tojson }}\n"
+    "            {{- \"}\" }}\n"
+    "        {%- endif %}\n"
+    "        {%- if builtin_tools is defined %}\n"
+    "            {#- This means we're in ipython mode #}\n"
+    "            {{- \"<|eom_id|>\" }}\n"
+    "        {%- else %}\n"
+    "            {{- \"<|eot_id|>\" }}\n"
+    "        {%- endif %}\n"
+    "    {%- elif message.role == \"tool\" or message.role == \"ipython\" %}\n"
+    "        {{- \"<|start_header_id|>ipython<|end_header_id|>\\n\\n\" }}\n"
+    "        {%- if message.content is mapping or message.content is iterable %}\n"
+    "            {{- message.content | tojson }}\n"
+    "        {%- else %}\n"
+    "            {{- message.content }}\n"
+    "        {%- endif %}\n"
+    "        {{- \"<|eot_id|>\" }}\n"
+    "    {%- endif %}\n"
+    "{%- endfor %}\n"
+    "{%- if add_generation_prompt %}\n"
+    "    {{- '<|start_header_id|>assistant<|end_header_id|>\\n\\n' }}\n"
+    "{%- endif %}\n";
+
+} // namespace
+
+HodgePodge::ChatTemplate::ChatTemplate(std::string_view source, std::string_view bos_token, std::string_view eos_token)
+: impl_(new TemplateImpl{.source = std::string(source), .bos_token = std::string(bos_token), .eos_token = std::string(eos_token)})
+{
+    try {
+        Compiler(*reinterpret_cast<TemplateImpl*>(impl_)).compile();
+    } catch (...) {
+        delete reinterpret_cast<TemplateImpl*>(impl_);
+        throw;
+    }
+}
+
+HodgePodge::ChatTemplate HodgePodge::ChatTemplate::from_tokenizer_config(std::string_view path)
+{
+    std::ifstream file{std::string(path)};
+    if (!file) {
+        throw std::runtime_error("could not open " + std::string(path));
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    JSON::Doc doc = JSON::decode(contents.view(), true);
+    JSON const& config = *doc;
+    // special tokens are either strings or AddedToken objects
+    auto token = [&](std::string_view key) {
+        JSON const& value = config.dicty(key);
+        if (std::holds_alternative<JSON::Object>(value)) {
+            return value["content"].string();
+        }
+        return std::holds_alternative<JSON::String>(value) ? value.string() : std::string_view();
+    };
+    JSON const& chat_template = config["chat_template"];
+    std::string_view source;
+    if (std::holds_alternative<JSON::Array>(chat_template)) {
+        // named templates; take the default one
+        for (auto & named : chat_template.array()) {
+            if (source.empty() || named["name"].string() == "default") {
+                source = named["template"].string();
+            }
+        }
+    } else {
+        source = chat_template.string();
+    }
+    return ChatTemplate(source, token("bos_token"), token("eos_token"));
+}
+
+HodgePodge::ChatTemplate::ChatTemplate(ChatTemplate&& other)
+: impl_(other.impl_)
+{
+    other.impl_ = nullptr;
+}
+
+HodgePodge::ChatTemplate::~ChatTemplate()
+{
+    delete reinterpret_cast<TemplateImpl*>(impl_);
+}
+
+void HodgePodge::ChatTemplate::render(
+    std::string & output,
+    std::span<Message const> messages,
+    bool add_generation_prompt,
+    std::span<KeyJSONPair const> variables
+) const
+{
+    static thread_local Renderer renderer;
+    TemplateImpl const& impl = *reinterpret_cast<TemplateImpl const*>(impl_);
+    renderer.reset(impl, messages, add_generation_prompt, variables);
+    renderer.render(impl.nodes, output);
+}
+
+std::string_view HodgePodge::ChatTemplate::render(
+    std::span<Message const> messages,
+    bool add_generation_prompt,
+    std::span<KeyJSONPair const> variables
+) const
+{
+    static thread_local std::string result;
+    result.clear();
+    render(result, messages, add_generation_prompt, variables);
+    return result;
+}
+
+HodgePodge::ChatTemplate const& HodgePodge::ChatTemplate::deepseek3()
+{
+    static ChatTemplate const compiled(DEEPSEEK3_TEMPLATE, "<｜begin▁of▁sentence｜>", "<｜end▁of▁sentence｜>");
+    return compiled;
+}
+
+HodgePodge::ChatTemplate const& HodgePodge::ChatTemplate::llama31()
+{
+    static ChatTemplate const compiled(LLAMA31_TEMPLATE, "<|begin_of_text|>", "<|eot_id|>");
+    return compiled;
+}
+
+HodgePodge::IncrementalPrompt::IncrementalPrompt(ChatTemplate const& chat_template, std::span<KeyJSONPair const> variables)
+: template_(chat_template),
+  variables_(variables),
+  committed_(0),
+  messages_(0),
+  reused_(0),
+  anchor_(0)
+{ }
+
+void HodgePodge::IncrementalPrompt::reset()
+{
+    prompt_.clear();
+    committed_ = 0;
+    messages_ = 0;
+    reused_ = 0;
+    anchor_ = 0;
+}
+
+bool HodgePodge::IncrementalPrompt::extend(std::span<Message const> messages)
+{
+    if (messages_ == 0 || messages.size() < messages_) {
+        return false;
+    }
+    // start from the last user message already rendered
+    size_t anchor = messages_;
+    do {
+        if (anchor == 0) {
+            return false;
+        }
+        -- anchor;
+    } while (messages[anchor].role != "user");
+    if (anchor == 0) {
+        return false;
+    }
+
+    // the window's output past the header it shares with the prompt must end the prompt
+    window_.clear();
+    template_.render(window_, messages.subspan(anchor, messages_ - anchor), false, variables_);
+    std::string_view committed = std::string_view(prompt_).substr(0, committed_);
+    size_t header = (size_t)(std::mismatch(window_.begin(), window_.end(), committed.begin(), committed.end()).first - window_.begin());
+    if (!committed.ends_with(std::string_view(window_).substr(header))) {
+        return false;
+    }
+
+    // and the window's output with the new messages must extend it
+    scratch_.clear();
+    template_.render(scratch_, messages.subspan(anchor), false, variables_);
+    if (!std::string_view(scratch_).starts_with(window_)) {
+        return false;
+    }
+    prompt_.resize(committed_);
+    prompt_.append(scratch_, window_.size());
+    window_.swap(scratch_);
+    anchor_ = anchor;
+    return true;
+}
+
+size_t HodgePodge::IncrementalPrompt::update(std::span<Message const> messages, bool add_generation_prompt)
+{
+    // compare the last generation prompt, or the whole prompt if rendered again, with the new output
+    previous_.assign(prompt_, committed_);
+    size_t retained = committed_;
+    if (!extend(messages)) {
+        previous_.swap(prompt_);
+        prompt_.clear();
+        template_.render(prompt_, messages, false, variables_);
+        retained = 0;
+        anchor_ = 0;
+    }
+    committed_ = prompt_.size();
+    messages_ = messages.size();
+
+    if (add_generation_prompt) {
+        std::string_view rendered = anchor_ ? std::string_view(window_) : std::string_view(prompt_);
+        scratch_.clear();
+        template_.render(scratch_, messages.subspan(anchor_), true, variables_);
+        if (std::string_view(scratch_).starts_with(rendered)) {
+            prompt_.append(scratch_, rendered.size());
+        } else {
+            // the generation prompt changes earlier output; render it all and start over next time
+            prompt_.clear();
+            template_.render(prompt_, messages, true, variables_);
+            committed_ = 0;
+            messages_ = 0;
+        }
+    }
+
+    reused_ = retained + (size_t)(std::mismatch(
+        previous_.begin(), previous_.end(),
+        prompt_.begin() + (ptrdiff_t)retained, prompt_.end()
+    ).first - previous_.begin());
+    return reused_;
+}
+
+} // namespace zinc
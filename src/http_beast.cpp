@@ -1,4 +1,6 @@
 #include <zinc/http.hpp>
+#include <zinc/metrics.hpp>
+#include <zinc/trace.hpp>
 
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
@@ -33,6 +35,13 @@ struct BackendState {
     net::io_context ioc;
     std::mutex mtx;
     std::unordered_map<std::string, std::variant<beast::tcp_stream, beast::ssl_stream<beast::tcp_stream>>> connection_cache;
+    Metrics::Gauge & cached = Metrics::gauge("zinc_http_connections_cached", "Idle connections kept for reuse");
+    Metrics::Counter & reused = Metrics::counter("zinc_http_connections_reused_total", "Requests sent on a cached connection");
+    Metrics::Counter & opened = Metrics::counter("zinc_http_connections_opened_total", "Connections opened");
+    Metrics::Histogram & connect_time = Metrics::histogram("zinc_http_connect_seconds", "Time to resolve, connect and handshake", 1e-9);
+    Metrics::Counter & requests = Metrics::counter("zinc_http_requests_total", "Requests sent");
+    Metrics::Counter & request_bytes = Metrics::counter("zinc_http_request_body_bytes_total", "Bytes of request bodies sent");
+    Metrics::Counter & response_bytes = Metrics::counter("zinc_http_response_body_bytes_total", "Bytes of response bodies streamed");
     static BackendState& instance()
     {
         static BackendState state;
@@ -97,9 +106,10 @@ struct LoanedConnection
     {
         connect();
     }
-    void request(const std::string_view method, std::string_view body, std::span<HTTP::Header const> headers)
+    void request(const std::string_view method, std::span<std::string_view const> body, std::span<HTTP::Header const> headers)
     {
-        req = http::request<http::string_body>{method == "GET" ? http::verb::get : http::verb::post, url.path, 11};
+        Trace::Span span("http request");
+        req = http::request<http::empty_body>{method == "GET" ? http::verb::get : http::verb::post, url.path, 11};
         req.set(http::field::host, url.host);
         req.set(http::field::user_agent, "zinc-http-client");
         req.set(http::field::connection, "keep-alive");
@@ -107,20 +117,26 @@ struct LoanedConnection
         for (const auto& [key, value] : headers) {
             req.set(key.data(), value.data());
         }
-        if (!body.empty() && req.method() == http::verb::post) {
-            req.body() = body;
+        // the body parts are written after the header as they are, so a long body is never copied
+        body_buffers.clear();
+        if (req.method() == http::verb::post) {
+            size_t content_length = 0;
+            for (auto part : body) {
+                body_buffers.emplace_back(part.data(), part.size());
+                content_length += part.size();
+            }
+            req.content_length(content_length);
+            span.arg("bytes", (long)content_length);
+            BackendState::instance().request_bytes.add(content_length);
         }
-        req.prepare_payload();
-        //if (body.empty() || method == "GET") {
-        http::write(*stream, req);
-        //} else {
-        //    http::serializer<false, http::string_body> sr{req};
-        //    http::write_header(*stream, sr);
-        //    http::write(*stream, sr);
-        //}
+        BackendState::instance().requests.add();
+        http::request_serializer<http::empty_body> sr{req};
+        http::write_header(*stream, sr);
+        net::write(*stream, body_buffers);
     }
-    std::string http_string(std::string_view method, std::string_view req_body, std::span<HTTP::Header const> headers)
+    std::string http_string(std::string_view method, std::span<std::string_view const> req_body, std::span<HTTP::Header const> headers)
     {
+        Trace::Span span("http string");
         http::response<http::dynamic_body> res;
         request(method, req_body, headers);
         try {
@@ -148,8 +164,10 @@ struct LoanedConnection
         }
         return res_body;
     }
-    zinc::generator<std::string_view> http_lines(std::string_view method, std::string_view req_body, std::span<HTTP::Header const> headers)
+    // Send the request and read the response header, reconnecting once if the connection was closed
+    void response_header(std::string_view method, std::span<std::string_view const> req_body, std::span<HTTP::Header const> headers)
     {
+        Trace::Span span("http response header");
         auto& res = res_parser.get();
         auto& res_buffer = res.body();
         request(method, req_body, headers);
@@ -177,7 +195,42 @@ struct LoanedConnection
             throw std::runtime_error(std::string(res.reason()) + beast::buffers_to_string(res.body().data()));
         }
 
+        span.arg("status", (long)res.result_int());
         check_res_parser = true;
+    }
+    zinc::generator<std::string_view> http_chunks(std::string_view method, std::span<std::string_view const> req_body, std::span<HTTP::Header const> headers)
+    {
+        Trace::Span span("http chunks");
+        auto& res_buffer = res_parser.get().body();
+        response_header(method, req_body, headers);
+        long bytes = 0;
+
+        while (!res_parser.is_done()) {
+            size_t bytesRead = http::read_some(*stream, buffer, res_parser);
+            if (res_buffer.size() == 0) {
+                if (bytesRead == 0) {
+                    break;
+                } else {
+                    continue;
+                }
+            }
+
+            bytes += (long)res_buffer.size();
+            BackendState::instance().response_bytes.add(res_buffer.size());
+            co_yield std::string_view((char const*)res_buffer.cdata().data(), res_buffer.size());
+
+            res_buffer.consume(res_buffer.size());
+        }
+
+        span.arg("bytes", bytes);
+        co_return;
+    }
+    zinc::generator<std::string_view> http_lines(std::string_view method, std::span<std::string_view const> req_body, std::span<HTTP::Header const> headers)
+    {
+        Trace::Span span("http lines");
+        auto& res_buffer = res_parser.get().body();
+        response_header(method, req_body, headers);
+        long lines = 0;
 
         while (!res_parser.is_done()) {
             size_t bytesRead = http::read_some(*stream, buffer, res_parser);
@@ -197,20 +250,25 @@ struct LoanedConnection
                     break;
                 }
 
+                ++ lines;
                 co_yield std::string_view(data.data() + start, end - start);
 
                 start = end + 1;
             }
 
             if (start > 0) {
+                BackendState::instance().response_bytes.add(start);
                 res_buffer.consume(start);
             }
         }
 
         if (res_buffer.size() > 0) {
+            ++ lines;
+            BackendState::instance().response_bytes.add(res_buffer.size());
             co_yield std::string_view((char const*)res_buffer.cdata().data(), res_buffer.size());
         }
 
+        span.arg("lines", lines);
         co_return;
     }
     ~LoanedConnection()
@@ -236,6 +294,7 @@ struct LoanedConnection
                 BackendState::instance().connection_cache.erase(it);
             }
             it = BackendState::instance().connection_cache.emplace(key,std::move(static_cast<StreamType&>(*this->stream))).first;
+            BackendState::instance().cached.set((int64_t)BackendState::instance().connection_cache.size());
             if constexpr (std::is_same_v<StreamType, beast::ssl_stream<beast::tcp_stream>>) {
                 StreamType & streamref = std::get<StreamType>(it->second);
                 SSL_CTX_set_ex_data(SSL_get_SSL_CTX(streamref.native_handle()), 1, &socket(streamref));
@@ -246,19 +305,22 @@ struct LoanedConnection
     URL url;
     std::string key;
     std::optional<StreamType> stream;
-    http::request<http::string_body> req;
+    http::request<http::empty_body> req;
+    std::vector<net::const_buffer> body_buffers;
     beast::flat_buffer buffer;
     bool check_res_parser;
     http::response_parser<http::basic_dynamic_body<beast::flat_buffer>> res_parser;
 private:
     void connect()
     {
+        Trace::Span span("http connect");
         net::io_context& ioc = BackendState::instance().ioc;
         {
             std::stringstream ss;
             ss << (url.tls ? "https://" : "http://") << url.host << ":" << url.port;
             key = ss.str();
         }
+        span.arg("url", key);
         // Check if connection is cached
         {
             std::lock_guard<std::mutex> lock(BackendState::instance().mtx);
@@ -270,10 +332,17 @@ private:
                         SSL_CTX_set_ex_data(SSL_get_SSL_CTX(stream->native_handle()), 1, &socket(*stream));
                     }
                     BackendState::instance().connection_cache.erase(it);
-                    if (connected()) { return; }
+                    BackendState::instance().cached.set((int64_t)BackendState::instance().connection_cache.size());
+                    if (connected()) {
+                        span.arg("cached", 1);
+                        BackendState::instance().reused.add();
+                        return;
+                    }
                 }
             }
         }
+        BackendState::instance().opened.add();
+        Metrics::Histogram::Timer timer(BackendState::instance().connect_time);
         auto const results = tcp::resolver(ioc).resolve(url.host, url.port);
         if constexpr (std::is_same_v<StreamType, beast::ssl_stream<beast::tcp_stream>>) { 
             ssl::context ctx{ssl::context::tlsv12_client};
@@ -335,17 +404,33 @@ std::string HTTP::request_string(std::string_view method, std::string_view url_s
     std::string key;
     if (url.tls) {
         LoanedConnection<beast::ssl_stream<beast::tcp_stream>> loan(url);
-        return loan.http_string(method, body, headers);
+        return loan.http_string(method, {&body, 1}, headers);
     } else {
         LoanedConnection<beast::tcp_stream> loan(url);
-        return loan.http_string(method, body, headers);
+        return loan.http_string(method, {&body, 1}, headers);
     }
 }
 
 zinc::generator<std::string_view> HTTP::request_lines(std::string_view method, std::string_view url_str, std::string_view body, std::span<Header const> headers) {
+    co_yield zinc::ranges::elements_of(request_lines_gather(method, url_str, {&body, 1}, headers));
+    co_return;
+}
+
+zinc::generator<std::string_view> HTTP::request_chunks(std::string_view method, std::string_view url_str, std::string_view body, std::span<Header const> headers) {
+    URL url{url_str};
+
+    if (url.tls) {
+        LoanedConnection<beast::ssl_stream<beast::tcp_stream>> loan(url);
+        co_yield zinc::ranges::elements_of(loan.http_chunks(method, {&body, 1}, headers));
+    } else {
+        LoanedConnection<beast::tcp_stream> loan(url);
+        co_yield zinc::ranges::elements_of(loan.http_chunks(method, {&body, 1}, headers));
+    }
+    co_return;
+}
+
+zinc::generator<std::string_view> HTTP::request_lines_gather(std::string_view method, std::string_view url_str, std::span<std::string_view const> body, std::span<Header const> headers) {
     URL url{url_str};
-    std::string key;
-    http::request<http::string_body> req;
 
     if (url.tls) {
         LoanedConnection<beast::ssl_stream<beast::tcp_stream>> loan(url);
@@ -0,0 +1,234 @@
+#include "json_handler.hpp"
+
+#include <zinc/metrics.hpp>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace zinc {
+
+namespace {
+
+/*
+ * Parse events go to the value of the struct or vector that the current
+ * key or array position names, or nowhere: a value with no binding, or
+ * of another type than its binding, is skipped by counting the depth of
+ * its containers, and nothing of it is stored.
+ */
+struct BindHandler
+{
+    static constexpr std::size_t max_object_size = (size_t)-1;
+    static constexpr std::size_t max_array_size = (size_t)-1;
+    static constexpr std::size_t max_key_size = (size_t)-1;
+    static constexpr std::size_t max_string_size = (size_t)-1;
+
+    struct Frame {
+        JSON::Binding const* binding; // of the open struct or vector
+        void* target;
+        size_t count = 0; // elements of a vector so far
+        JSON::Binding const* next = nullptr; // of the value after the last key
+    };
+
+    std::vector<Frame> frames;
+    JSON::Binding const* root = nullptr;
+    void* root_target = nullptr;
+    size_t skipping = 0; // depth within a skipped value
+    std::string_view input;
+    std::string part;
+    Arena arena; // escaped strings
+
+    static bool accepts(JSON::Binding const* binding, JSON::Index kind)
+    {
+        return binding && (binding->kind == kind || (binding->kind == JSON::NUMBER && kind == JSON::INTEGER));
+    }
+
+    /*
+     * The binding and target of the value now beginning, or nullptr to
+     * skip it.  Elements of a bound vector are added as they begin.
+     */
+    JSON::Binding const* next(JSON::Index kind, void*& target)
+    {
+        if (skipping) {
+            return nullptr;
+        } else if (frames.empty()) {
+            target = root_target;
+            return accepts(root, kind) ? root : nullptr;
+        }
+        auto & frame = frames.back();
+        if (frame.binding->kind == JSON::OBJECT) {
+            if (!accepts(frame.next, kind)) {
+                return nullptr;
+            }
+            target = frame.next->at(frame.target, 0);
+            return frame.next;
+        }
+        auto element = frame.binding->element;
+        if (!accepts(element, kind)) {
+            return nullptr;
+        }
+        frame.binding->resize(frame.target, frame.count + 1);
+        target = element->at(frame.target, frame.count ++);
+        return element;
+    }
+
+    bool begin(JSON::Index kind)
+    {
+        void* target;
+        auto binding = next(kind, target);
+        if (binding) {
+            if (kind == JSON::ARRAY) {
+                binding->resize(target, 0);
+            }
+            frames.push_back({binding, target});
+        } else {
+            ++ skipping;
+        }
+        return true;
+    }
+
+    bool end()
+    {
+        if (skipping) {
+            -- skipping;
+        } else {
+            frames.pop_back();
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool scalar(JSON::Index kind, T value)
+    {
+        void* target;
+        if (auto binding = next(kind, target)) {
+            if (binding->kind == JSON::NUMBER) {
+                *(double*)target = (double)value;
+            } else {
+                *(T*)target = value;
+            }
+        }
+        return true;
+    }
+
+    inline bool on_document_begin(boost::json::error_code&) { return true; }
+    inline bool on_document_end(boost::json::error_code&) { return true; }
+    inline bool on_object_begin(boost::json::error_code&) { return begin(JSON::OBJECT); }
+    inline bool on_object_end(std::size_t, boost::json::error_code&) { return end(); }
+    inline bool on_array_begin(boost::json::error_code&) { return begin(JSON::ARRAY); }
+    inline bool on_array_end(std::size_t, boost::json::error_code&) { return end(); }
+
+    inline bool on_key_part(boost::json::string_view s, std::size_t, boost::json::error_code&)
+    {
+        part.append(s.data(), s.size());
+        return true;
+    }
+    inline bool on_key(boost::json::string_view s, std::size_t, boost::json::error_code&)
+    {
+        if (skipping) {
+            part.clear();
+            return true;
+        }
+        std::string_view key(s.data(), s.size());
+        if (!part.empty()) {
+            part.append(s.data(), s.size());
+            key = part;
+        }
+        auto & frame = frames.back();
+        frame.next = nullptr;
+        for (auto & field : frame.binding->fields) {
+            if (field.name == key) {
+                frame.next = &field.binding;
+                break;
+            }
+        }
+        part.clear();
+        return true;
+    }
+
+    inline bool on_string_part(boost::json::string_view s, std::size_t, boost::json::error_code&)
+    {
+        if (!skipping) {
+            part.append(s.data(), s.size());
+        }
+        return true;
+    }
+    inline bool on_string(boost::json::string_view s, std::size_t n, boost::json::error_code&)
+    {
+        void* target;
+        if (next(JSON::STRING, target)) {
+            std::string_view value(s.data(), s.size());
+            bool in_input = value.data() >= input.data() && value.data() + value.size() <= input.data() + input.size();
+            if (!part.empty() || n != s.size() || !in_input) {
+                part.append(s.data(), s.size());
+                char* seat = (char*)arena.allocate(part.size(), 1);
+                std::memcpy(seat, part.data(), part.size());
+                value = {seat, part.size()};
+            }
+            *(std::string_view*)target = value;
+        }
+        part.clear();
+        return true;
+    }
+
+    inline bool on_number_part(boost::json::string_view, boost::json::error_code&) { return true; }
+    inline bool on_int64(std::int64_t i, boost::json::string_view, boost::json::error_code&) { return scalar(JSON::INTEGER, (long)i); }
+    inline bool on_uint64(std::uint64_t u, boost::json::string_view, boost::json::error_code&) { return scalar(JSON::INTEGER, (long)u); }
+    inline bool on_double(double d, boost::json::string_view, boost::json::error_code&) { return scalar(JSON::NUMBER, d); }
+    inline bool on_bool(bool b, boost::json::error_code&) { return scalar(JSON::BOOLEAN, b); }
+    inline bool on_null(boost::json::error_code&)
+    {
+        void* target;
+        next((JSON::Index)NULL, target);
+        return true;
+    }
+    inline bool on_comment_part(boost::json::string_view, boost::json::error_code&) { return true; }
+    inline bool on_comment(boost::json::string_view, boost::json::error_code&) { return true; }
+};
+
+using BindParser = boost::json::basic_parser<BindHandler>;
+
+}
+
+JSON::Binder::Binder()
+: impl_(new BindParser({}))
+{ }
+
+JSON::Binder::Binder(Binder&&binder)
+: impl_(binder.impl_)
+{
+    binder.impl_ = nullptr;
+}
+
+JSON::Binder::~Binder()
+{
+    if (impl_) {
+        Arena::free(((BindParser*)impl_)->handler().arena.release());
+    }
+    delete (BindParser*)impl_;
+}
+
+void JSON::Binder::bind(std::string_view doc, void* out, Binding const& binding)
+{
+    static auto & parsed_bytes = Metrics::counter("zinc_json_parse_bytes_total", "Bytes of JSON parsed");
+    static auto & bind_time = Metrics::histogram("zinc_json_bind_seconds", "Time to bind a JSON document to a struct", 1e-9);
+    parsed_bytes.add(doc.size());
+    Metrics::Histogram::Timer timer(bind_time);
+    auto & parser = *(BindParser*)impl_;
+    auto & handler = parser.handler();
+    parser.reset();
+    handler.frames.clear();
+    handler.skipping = 0;
+    handler.part.clear();
+    Arena::free(handler.arena.release());
+    handler.root = &binding;
+    handler.root_target = out;
+    handler.input = doc;
+    std::error_code ec;
+    parser.write_some(false, doc.data(), doc.size(), ec);
+    handler.input = {};
+    if (ec) { throw std::invalid_argument(ec.message()); }
+}
+
+}
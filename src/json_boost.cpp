@@ -1,14 +1,15 @@
-#include <zinc/json.hpp>
-
-#include <boost/container/devector.hpp>
-#include <boost/json/basic_parser_impl.hpp>
-#define enum public: enum // make serializer public in boost 1.81.0
-#include <boost/json/serializer.hpp>
-#undef enum
-#include <boost/json/impl/serializer.ipp>
-
-#include <map>
-#include <memory>
+#include "json_handler.hpp"
+
+#include <zinc/metrics.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
 //#include <iostream> /*dbg*/
 
 using namespace boost::json;
@@ -17,715 +18,563 @@ namespace zinc {
 
 namespace {
 
-struct ParseHandler
-{
-    static constexpr std::size_t max_object_size = (size_t)-1;
-    static constexpr std::size_t max_array_size = (size_t)-1;
-    static constexpr std::size_t max_key_size = (size_t)-1;
-    static constexpr std::size_t max_string_size = (size_t)-1;
-
-    ///*
-    void dbg_walk(JSON const*json, int depth=0) {
-        static JSON dbgval;
-        dbgval = *json;
-        if (auto*array = std::get_if<std::span<JSON>>(json)) {
-            //if(depth==0)std::cerr << "array "; /*dbg*/
-            assert((void*)&*array->begin() >= (void*)store.begin() && (void*)&*array->end() <= (void*)store.end() && array->end() >= array->begin());
-            for (auto & elem : *array) {
-                dbg_walk(&elem, depth+1);
-            }
-        } else if(auto*dict = std::get_if<std::span<KeyJSONPair>>(json)) {
-            //if(depth==0)std::cerr << "dict "; /*dbg*/
-            assert((void*)&*dict->begin() >= (void*)&*store.begin() && (void*)&*dict->end() <= (void*)&*store.end() && dict->end() >= dict->begin());
-            for (auto & [k,v] : *dict) {
-                assert(k.begin() >= (void*)&*store.begin() && (void*)&*k.end() <= (void*)&*store.end() && k.end() >= k.begin());
-                static std::string string;
-                string = k;
-                dbg_walk(&v, depth+1);
-            }
-        } else if(auto*str = std::get_if<std::string_view>(json)) {
-            assert((!str->size() && str->begin() == nullptr) || ((void*)&*str->begin() >= (void*)&*store.begin() && (void*)&*str->end() <= (void*)&*store.end() && str->end() >= str->begin()));
-            //if(depth==0)std::cerr << "\"" << *str << "\" "; /*dbg*/
-            static std::string string;
-            string = *str;
-        }
-    }
-    //*/
-
-    struct DocImpl : public zinc::JSON {
-        DocImpl(
-            JSON root, ParseHandler* handler,
-            char* store_start, char* store_end,
-            JSON** ptrs_start, JSON** ptrs_end
-        ) : JSON(root), handler(handler),
-            store_start(store_start), store_end(store_end),
-            ptrs_start(ptrs_start), ptrs_end(ptrs_end)
-        { }
-        ParseHandler * handler;
-        char* store_start;
-        char* store_end;
-        JSON** ptrs_start;
-        JSON** ptrs_end;
-    };
-    DocImpl* docimpl;
+/*
+ * Writes a tree as text through a fixed buffer, so the sink is handed
+ * at most JSON::encode_chunk_size bytes at a time.  Strings are escaped
+ * the way boost::json serializes them: quotes, backslashes and control
+ * characters only, with UTF-8 passed through.
+ */
+class Encoder
+{
+    std::function<void(std::string_view)> const& sink_;
+    int indent_;
+    size_t size_ = 0;
+    char buffer_[JSON::encode_chunk_size];
 
-    std::vector<JSON> stack;
-    boost::container::devector<char> store;
-    boost::container::devector<JSON*> ptr_jsons;
-    boost::container::devector<DocImpl*> docs;
-
-    JSON* get() {
-        auto ptr = docimpl;
-        docimpl = nullptr;
-        return ptr;
-    }
-    void abort() {
-        assert(docs.back() == docimpl);
-        store.erase(docimpl->store_start, store.end());
-        ptr_jsons.erase(docimpl->ptrs_start, ptr_jsons.end());
-        docs.pop_back();
-        docimpl = nullptr;
-    }
-    void del(DocImpl& doc) {
-        assert((store.end() == doc.store_end || store.begin() == doc.store_start) && "deallocate jsons in forward or reverse order");
-        assert((ptr_jsons.end() == doc.ptrs_end || ptr_jsons.begin() == doc.ptrs_start) && "deallocate jsons in forward or reverse order");
-        decltype(docs)::iterator doc_it;
-        if (docs.back() == &doc) {
-            doc_it = docs.end() - 1;
-        } else if (docs.front() == &doc) {
-            doc_it = docs.begin();
-        } else {
-            assert(!"deallocate jsons in forward or reverse order");
+public:
+    Encoder(std::function<void(std::string_view)> const& sink, int indent)
+    : sink_(sink), indent_(indent)
+    { }
+
+    void flush()
+    {
+        if (size_) {
+            sink_({buffer_, size_});
+            size_ = 0;
         }
-        assert(doc.store_start >= store.begin() && doc.store_end <= store.end());
-        assert(doc.store_start <= doc.store_end);
-        assert(doc.ptrs_start >= ptr_jsons.begin() && doc.ptrs_end <= ptr_jsons.end());
-        assert(doc.ptrs_start <= doc.ptrs_end);
-        store.erase(doc.store_start, doc.store_end);
-        ptr_jsons.erase(doc.ptrs_start, doc.ptrs_end);
-        docs.erase(doc_it);
     }
-    static void del(JSON* doc_) {
-        DocImpl & doc = *(DocImpl*)doc_;
-        doc.handler->del(doc);
+
+    void put(char c)
+    {
+        if (size_ == sizeof(buffer_)) {
+            flush();
+        }
+        buffer_[size_ ++] = c;
     }
 
-    inline void adjust_store_json_ptrs(JSON*json, ptrdiff_t store_offset)
+    void put(std::string_view text)
     {
-        if (auto span = std::get_if<std::span<JSON>>(json)) {
-            *span = {
-                (JSON*)((char*)span->data() + store_offset),
-                span->size()
-            };
-        } else if (auto span = std::get_if<std::span<KeyJSONPair>>(json)) {
-            *span = {
-                (KeyJSONPair*)((char*)span->data() + store_offset),
-                span->size()
-            };
-            for (auto & [k,_] : *span) {
-                k = {
-                    k.data() + store_offset,
-                    k.size()
-                };
+        while (!text.empty()) {
+            if (size_ == sizeof(buffer_)) {
+                flush();
             }
-        } else if (auto sv = std::get_if<std::string_view>(json)) {
-            *sv = {
-                sv->data() + store_offset,
-                sv->size()
-            };
-            static std::string dbgstr;
-            dbgstr = std::get<std::string_view>(*json);
-        } else {
-            throw std::logic_error("non-pointer json in ptr_jsons");
+            size_t n = std::min(text.size(), sizeof(buffer_) - size_);
+            std::memcpy(buffer_ + size_, text.data(), n);
+            size_ += n;
+            text.remove_prefix(n);
         }
     }
-    inline void adjust_store_pointers(ptrdiff_t store_offset)
+
+    void newline(size_t depth)
     {
-        if (!store_offset) {
-            return;
-        }
-        for (JSON & json : stack) {
-            if (json_is_ptr(json, store_offset)) {
-                adjust_store_json_ptrs(&json, store_offset);
+        if (indent_ >= 0) {
+            put('\n');
+            for (size_t n = depth * (size_t)indent_; n; -- n) {
+                put(' ');
             }
         }
-        for (JSON *& json : ptr_jsons) {
-            json = (JSON*)((char*)json + store_offset);
-            adjust_store_json_ptrs(json, store_offset);
-        }   
-        for (DocImpl*& doc : docs) {
-            doc = (DocImpl*)((char*)doc + store_offset);
-            assert(doc->handler == this);
-            doc->store_start += store_offset;
-            doc->store_end += store_offset;
-            assert(doc->store_start >= store.begin() && doc->store_end <= store.end());
-            assert(doc->store_start <= doc->store_end);
-        }
-        if (docimpl != nullptr) {
-            docimpl = (DocImpl*)((char*)docimpl + store_offset);
-        }
     }
 
-    inline void adjust_ptr_pointers(ptrdiff_t ptrs_offset)
+    void string(std::string_view text)
     {
-        if (!ptrs_offset) {
-            return;
-        }
-        for (DocImpl*& doc : docs) {
-            assert(doc->handler == this);
-            doc->ptrs_start = (JSON**)((char*)doc->ptrs_start + ptrs_offset);
-            doc->ptrs_end = (JSON**)((char*)doc->ptrs_end + ptrs_offset);
-            assert(doc->ptrs_start >= ptr_jsons.begin() && doc->ptrs_end <= ptr_jsons.end());
-            assert(doc->ptrs_start <= doc->ptrs_end);
-        }
-    }
-
-    inline char* reserve(size_t n, size_t a  = 1) {
-        ///*
-        for (auto &json : stack) {
-            dbg_walk(&json);
-        }
-        //*/
-        size_t avail;
-        void* result;
-        result = std::align(a, n, result = store.end(), avail = store.back_free_capacity());
-        if (!result) {
-            size_t min_capacity = n + store.size() + a;
-            size_t new_capacity = std::max(avail + store.size(), 64ul);
-            while (new_capacity < min_capacity) {
-                new_capacity *= 2;
+        static constexpr char hex[] = "0123456789abcdef";
+        put('"');
+        size_t start = 0;
+        for (size_t idx = 0; idx < text.size(); ++ idx) {
+            unsigned char c = (unsigned char)text[idx];
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
             }
-            char* old = store.data();
-            store.reserve_back(new_capacity);
-            adjust_store_pointers(store.data() - old);
-            ///*
-            for (auto &json : stack) {
-                dbg_walk(&json);
+            put(text.substr(start, idx - start));
+            start = idx + 1;
+            switch (c) {
+            case '"': put("\\\""); break;
+            case '\\': put("\\\\"); break;
+            case '\b': put("\\b"); break;
+            case '\f': put("\\f"); break;
+            case '\n': put("\\n"); break;
+            case '\r': put("\\r"); break;
+            case '\t': put("\\t"); break;
+            default:
+                char escape[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                put({escape, sizeof(escape)});
             }
-            //*/
-            result = std::align(a, n, result = store.end(), avail = store.back_free_capacity());
-            assert(result);
-        }
-        if (result > store.end()) {
-            store.resize((size_t)((char*)result - store.begin()));
         }
-        return (char*)result;
+        put(text.substr(start));
+        put('"');
     }
-    inline char* store_chars(std::string_view chars)
+
+    void number(double number)
     {
-        reserve(chars.size());
-        store.insert(store.end(), chars.begin(), chars.end());
-        return store.end() - chars.size();
+        // as boost::json writes values json cannot represent
+        if (std::isnan(number)) {
+            put("null");
+            return;
+        } else if (std::isinf(number)) {
+            put(number < 0 ? "-1e99999" : "1e99999");
+            return;
+        }
+        char text[32];
+        auto end = std::to_chars(text, text + sizeof(text), number).ptr;
+        std::string_view shortest(text, (size_t)(end - text));
+        put(shortest);
+        // stays a number rather than an integer when decoded again
+        if (shortest.find_first_of(".e") == std::string_view::npos) {
+            put(".0");
+        }
     }
-    inline std::string_view& store_key(std::string_view key)
+
+    void value(JSON const& json, size_t depth)
     {
-        //auto seat = (std::string_view*)reserve(sizeof(key));
-        auto dbgcmp1 = store.end(); /* checking reserve is a no-op because key is only used in contiguous spans of pairs */
-        auto dbgcmp2 = store.insert(reserve(sizeof(key), alignof(decltype(key))), (char*)&key, (char*)(&key+1));
-        assert(dbgcmp1 == dbgcmp2);
-        //store.resize_back(store.size() + sizeof(key));
-        //new (seat) std::string_view(key);
-        return *(std::string_view*)(store.end() - sizeof(key));
-    }
-    bool json_is_ptr(JSON const & json, ptrdiff_t store_offset = 0) {
-        if (
-            std::holds_alternative<std::span<JSON>>(json) ||
-            std::holds_alternative<std::span<KeyJSONPair>>(json)
-        ) {
-            return true;
-        } else if (std::string_view const * sv = std::get_if<std::string_view>(&json)) {
-            if (sv->data() >= store.data() - store_offset
-             && sv->data() <= &*store.end() - store_offset) {
-                assert(sv->size() + sv->data() <= &*store.end());
-                return true;
+        switch (json.index()) {
+        case (JSON::Index)NULL:
+            put("null");
+            break;
+        case JSON::BOOLEAN:
+            put(std::get<bool>(json) ? "true" : "false");
+            break;
+        case JSON::INTEGER:
+        {
+            char text[24];
+            auto end = std::to_chars(text, text + sizeof(text), std::get<long>(json)).ptr;
+            put({text, (size_t)(end - text)});
+            break;
+        }
+        case JSON::NUMBER:
+            number(std::get<double>(json));
+            break;
+        case JSON::STRING:
+            string(json.string());
+            break;
+        case JSON::ARRAY:
+        {
+            auto & array = json.array();
+            put('[');
+            for (size_t idx = 0; idx < array.size(); ++ idx) {
+                if (idx) {
+                    put(',');
+                }
+                newline(depth + 1);
+                value(array[idx], depth + 1);
+            }
+            if (!array.empty()) {
+                newline(depth);
             }
+            put(']');
+            break;
         }
-        return false;
-    }
-    void add_ptr_json(JSON* json)
-    {
-        char* old = (char*)ptr_jsons.data();
-        ptr_jsons.push_back(json);
-        if ((char*)ptr_jsons.data() != old) {
-            adjust_ptr_pointers((char*)ptr_jsons.data() - old);
+        case JSON::OBJECT:
+        {
+            auto & object = json.object();
+            put('{');
+            for (size_t idx = 0; idx < object.size(); ++ idx) {
+                if (idx) {
+                    put(',');
+                }
+                newline(depth + 1);
+                string(object[idx].first);
+                put(indent_ >= 0 ? ": " : ":");
+                value(object[idx].second, depth + 1);
+            }
+            if (!object.empty()) {
+                newline(depth);
+            }
+            put('}');
+            break;
         }
-    }
-    inline JSON& store_json(JSON const & json)
-    {
-        bool is_ptr = json_is_ptr(json);
-        ///*
-        dbg_walk(&json);
-        for (auto &json : stack) {
-            dbg_walk(&json);
         }
-        //*/
+    }
+};
 
-        auto seat = (JSON*)reserve(sizeof(JSON), alignof(JSON));
-        dbg_walk(&json);
-        auto dbg = store.begin();
-        store.insert(store.end(), (char*)&json, (char*)(&json + 1));
-        assert(store.begin() == dbg);
-        //store.resize_back(store.size() + sizeof(json));
-        //new (seat) JSON(json);
-        dbg_walk(seat);
+/*
+ * A JSON::Builder keeps the values of its open containers on a stack,
+ * keys among them as strings, the way the parse handler does, and
+ * stores each container in the arena as it is closed.
+ */
+struct BuildState
+{
+    struct Open {
+        size_t start; // of the container's values on the stack
+        bool object;
+    };
 
-        if (is_ptr) {
-            add_ptr_json(seat);
-        }
+    bool reference_values;
+    std::vector<JSON> stack;
+    std::vector<Open> open;
+    Arena arena;
 
-        return *seat;//store.end();
+    ~BuildState()
+    {
+        Arena::free(arena.release());
     }
 
-    inline DocImpl& store_doc()
+    void abort()
     {
-        //std::cerr<<"store_doc start"<<std::endl;
-        assert(nullptr == docimpl);
-        char* storeptr = reserve(sizeof(DocImpl), alignof(DocImpl));
-        JSON** ptrsptr = ptr_jsons.end();
-        docimpl = (DocImpl*)storeptr;
-        docs.push_back(docimpl);
-        store.resize_back(store.size() + sizeof(DocImpl));
-        new (docimpl) DocImpl(
-            nullptr, this,
-            storeptr, storeptr,
-            ptrsptr, ptrsptr
-        );
-        return *docimpl;//store.end();
-    }
-
-    //inline void set_raw(std::string_view raw) {
-    //    JSON & json = stack.back();
-    //    assert(json.raw.empty());
-    //    json.raw = raw;
-    //}
-
-    inline bool on_document_begin(error_code&) {
-        //std::cerr<<"on_document_begin"<<std::endl;
-        store_doc();
-        return true;
-    }
-    inline bool on_document_end(error_code&) {
-        assert(1 == stack.size());
-        assert(docimpl->handler == this);
-        *(JSON*)docimpl = stack.back();
         stack.clear();
-        if (json_is_ptr(*docimpl)) {
-            add_ptr_json(docimpl);
-        }
-        docimpl->store_end = store.end();
-        docimpl->ptrs_end = ptr_jsons.end();
-        return true;
-    }
-    inline bool on_object_begin(error_code&) {
-        //std::cerr<< "ON_OBJECT_BEGIN" << std::endl; /*dbg*/
-        return true;
-    }
-    inline bool on_object_end(std::size_t n, error_code&) {
-        //std::cerr<< "ON_OBJECT_END start" << std::endl; /*dbg*/
-        ///*
-        for (auto &json : stack) {
-            dbg_walk(&json);
-        }
-        //*/
-        auto store_start = (KeyJSONPair*)reserve(sizeof(KeyJSONPair) * n + sizeof(JSON), alignof(KeyJSONPair));
-        auto dbg_store_start = store.begin();
-        auto stack_end = stack.end(), stack_start = stack_end - (ssize_t)n * 2;
-        for (auto it = stack_start; it != stack_end;) {
-            // this shouldn't cause reallocation because reserve was called earlier
-            store_key(std::get<std::string_view>(*it));
-            ++ it;
-            store_json(*it);
-            ++ it;
-        }
-        assert(store.begin() == dbg_store_start);
-        auto store_end = (KeyJSONPair*)&*store.end();
-        assert(store_end == store_start + n);
-        stack.erase(stack_start, stack_end);
-        stack.emplace_back(std::span<KeyJSONPair>(store_start, store_end));
-        //std::cerr<< "ON_OBJECT_END end" << std::endl; /*dbg*/
-        return true;
-    }
-    inline bool on_array_begin(error_code&)
-    {
-        return true;
-    }
-    inline bool on_array_end(std::size_t n, error_code&)
-    {
-        auto store_start = (JSON*)reserve(sizeof(JSON) * n + sizeof(JSON), alignof(JSON));
-        auto stack_end = stack.end(), stack_start = stack_end - (ssize_t)n;
-        for (auto it = stack_start; it != stack_end; ++ it) {
-            store_json(*it);
-        }
-        auto store_end = (JSON*)&*store.end();
-        stack.erase(stack_start, stack_end);
-        stack.emplace_back(std::span<JSON>(store_start, store_end));
-        return true;
-    }
-    /*
-     * boost does not forward the original document ranges to on_key* and
-     * on_part*. rather, it puts the data in a buffer on the stack, and hands
-     * pointers that point into this buffer.
-     */
-    inline bool on_key_part(string_view s, std::size_t, error_code&) {
-        store_chars(s);
-        return true;
-    }
-    inline bool on_key(string_view s, std::size_t n, error_code&) {
-        /* if boost::json were adjusted or if the raw pointer offsets were tracked
-         * then the original data could be referenced directly here.
-         * escaping can possibly be checked for with s.size() != n.
-         */
-        store_chars(s);
-        auto end = store.end(), start = end - n;
-        stack.emplace_back(std::string_view{start, end});
-        return true;
-    }
-    inline bool on_string_part(string_view s, std::size_t, error_code&) {
-        store_chars(s);
-        return true;
-    }
-    inline bool on_string(string_view s, std::size_t n, error_code&) {
-        /* if boost::json were adjusted or if the raw pointer offsets were tracked
-         * then the original data could be referenced directly here.
-         * escaping can possibly be checked for with s.size() != n.
-         */
-        store_chars(s);
-        auto end = store.end(), start = end - n;
-        stack.emplace_back(std::string_view{start, end});
-        return true;
-    }
-    inline bool on_number_part(string_view, error_code&)
-    {
-        return true;
-    }
-    inline bool on_int64(std::int64_t i, string_view, error_code&)
-    {
-        stack.emplace_back((long)i);
-        return true;
-    }
-    inline bool on_uint64(std::uint64_t u, string_view, error_code&)
-    {
-        stack.emplace_back((long)u);
-        return true;
-    }
-    inline bool on_double(double d, string_view, error_code&)
-    {
-        stack.emplace_back(d);
-        return true;
-    }
-    inline bool on_bool(bool b, error_code&)
-    {
-        stack.emplace_back(b);
-        return true;
-    }
-    inline bool on_null(error_code&)
-    {
-        stack.emplace_back(nullptr);
-        return true;
+        open.clear();
+        Arena::free(arena.release());
     }
-    inline bool on_comment_part(string_view, error_code&)
-    {
-        return true;
-    }
-    inline bool on_comment(string_view, error_code&)
-    {
-        return true;
-    }
-};
 
-class Serializer : public boost::json::serializer
-{
-    union
+    // An object expects a key when its stack holds whole pairs
+    bool expects_key() const
     {
-        JSON const* pj_;
-        std::span<KeyJSONPair const> const* po_;
-        std::span<JSON const> const* pa_;
-    };
-    JSON const* jj_ = nullptr;
-    boost::json::value boost_value;
-public:
-
-    bool suspend(
-        state st,
-        std::span<JSON const>::iterator it,
-        std::span<JSON const> const* pa)
-    {
-        st_.push(pa);
-        st_.push(it);
-        st_.push(st);
-        return false;
+        return !open.empty() && open.back().object && (stack.size() - open.back().start) % 2 == 0;
     }
 
-    bool suspend(
-        state st,
-        std::span<KeyJSONPair const>::iterator it,
-        std::span<KeyJSONPair const> const* po)
+    void check_value() const
     {
-        st_.push(po);
-        st_.push(it);
-        st_.push(st);
-        return false;
+        if (open.empty() && !stack.empty()) {
+            throw std::logic_error("json builder: more than one value");
+        } else if (expects_key()) {
+            throw std::logic_error("json builder: value without a key");
+        }
     }
 
-    void reset(JSON const* j) noexcept
+    std::string_view copy(std::string_view chars)
     {
-        //pv_ = j;
-        pj_ = j;
-        fn0_ = (fn_t)&Serializer::write_value<true>;
-        fn1_ = (fn_t)&Serializer::write_value<false>;
-
-        jj_ = j;
-        st_.clear();
-        done_ = false;
+        if (chars.empty()) {
+            return {};
+        }
+        char* seat = (char*)arena.allocate(chars.size(), 1);
+        std::memcpy(seat, chars.data(), chars.size());
+        return {seat, chars.size()};
     }
 
-    template<bool StackEmpty>
-    bool write_array(stream& ss0)
+    JSON copy(JSON const& json)
     {
-        std::span<JSON const> const* pa;
-        local_stream ss(ss0);
-        std::span<JSON const>::iterator it, end;
-        if(StackEmpty || st_.empty())
+        switch (json.index()) {
+        case JSON::STRING:
+            return copy(json.string());
+        case JSON::ARRAY:
         {
-            pa = pa_;
-            it = pa->begin();
-            end = pa->end();
-        } else {
-            state st;
-            st_.pop(st);
-            st_.pop(it);
-            st_.pop(pa);
-            end = pa->end();
-            switch(st)
-            {
-            default:
-            case state::arr1: goto do_arr1;
-            case state::arr2: goto do_arr2;
-            case state::arr3: goto do_arr3;
-            case state::arr4: goto do_arr4;
-                break;
+            auto & array = json.array();
+            auto seat = (JSON*)arena.allocate(sizeof(JSON) * array.size(), alignof(JSON));
+            for (size_t idx = 0; idx < array.size(); ++ idx) {
+                new (seat + idx) JSON(copy(array[idx]));
             }
+            return std::span<JSON>(seat, array.size());
         }
-do_arr1:
-        if(BOOST_JSON_LIKELY(ss))
-            ss.append('[');
-        else
-            return suspend(
-                state::arr1, it, pa);
-        if(it == end)
-            goto do_arr4;
-        for(;;)
-        {
-do_arr2:
-            jj_ = &*it;
-            if(! write_value<StackEmpty>(ss))
-                return suspend(
-                    state::arr2, it, pa);
-            if(BOOST_JSON_UNLIKELY(
-                ++it == end))
-                break;
-do_arr3:
-            if(BOOST_JSON_LIKELY(ss))
-                ss.append(',');
-            else
-                return suspend(
-                    state::arr3, it, pa);
-        }
-do_arr4:
-        if(BOOST_JSON_LIKELY(ss))
-            ss.append(']');
-        else
-            return suspend(
-                state::arr4, it, pa);
-        return true;
-    }
-
-    template<bool StackEmpty>
-    bool write_object(stream& ss0)
-    {
-        std::span<KeyJSONPair const> const* po;
-        local_stream ss(ss0);
-        std::span<KeyJSONPair const>::iterator it, end;
-        if(StackEmpty || st_.empty())
+        case JSON::OBJECT:
         {
-            po = po_;
-            it = po->begin();
-            end = po->end();
-        } else {
-            state st;
-            st_.pop(st);
-            st_.pop(it);
-            st_.pop(po);
-            end = po->end();
-            switch(st)
-            {
-            default:
-            case state::obj1: goto do_obj1;
-            case state::obj2: goto do_obj2;
-            case state::obj3: goto do_obj3;
-            case state::obj4: goto do_obj4;
-            case state::obj5: goto do_obj5;
-            case state::obj6: goto do_obj6;
-                break;
-            }
+            auto & object = json.object();
+            return store_object(object.size(), [&](size_t idx) {
+                return KeyJSONPair(copy(object[idx].first), copy(object[idx].second));
+            });
         }
-do_obj1:
-        if(BOOST_JSON_LIKELY(ss))
-            ss.append('{');
-        else
-            return suspend(
-                state::obj1, it, po);
-        if(BOOST_JSON_UNLIKELY(
-            it == end))
-            goto do_obj6;
-        for(;;)
-        {
-            cs0_ = {
-                it->first.data(),
-                it->first.size() };
-do_obj2:
-            if(BOOST_JSON_UNLIKELY(
-                ! write_string<StackEmpty>(ss)))
-                return suspend(
-                    state::obj2, it, po);
-do_obj3:
-            if(BOOST_JSON_LIKELY(ss))
-                ss.append(':');
-            else
-                return suspend(
-                    state::obj3, it, po);
-do_obj4:
-            jj_ = &it->second;
-            if(BOOST_JSON_UNLIKELY(
-                ! write_value<StackEmpty>(ss)))
-                return suspend(
-                    state::obj4, it, po);
-            ++it;
-            if(BOOST_JSON_UNLIKELY(it == end))
-                break;
-do_obj5:
-            if(BOOST_JSON_UNLIKELY(ss))
-                ss.append(',');
-            else
-                return suspend(
-                    state::obj5, it, po);
-        }
-do_obj6:
-        if(BOOST_JSON_LIKELY(ss))
-        {
-            ss.append('}');
-            return true;
+        default:
+            return json;
         }
-        return suspend(
-            state::obj6, it, po);
     }
 
-    template<bool StackEmpty>
-    bool write_value(stream& ss)
+    template <typename PairAt>
+    JSON store_object(size_t n, PairAt pair_at)
     {
-        auto const& jj(*jj_);
-        if (StackEmpty || st_.empty()) {
-            switch(jj.index()) {
-            default:
-            case JSON::OBJECT:
-                po_ = (std::span<KeyJSONPair const>const*)&jj.object();
-                return write_object<true>(ss);
-            case JSON::ARRAY:
-                pa_ = (std::span<JSON const>const*)&jj.array();
-                return write_array<true>(ss);
-            case JSON::STRING:
-            {
-                auto const& js = std::get<std::string_view>(jj);
-                cs0_ = { js.data(), js.size() };
-                return write_string<true>(ss);
-            }
-            case JSON::INTEGER:
-                boost_value = std::get<long>(jj);
-                jv_ = &boost_value;
-                return write_number<true>(ss);
-            case JSON::NUMBER:
-                boost_value = std::get<double>(jj);
-                jv_ = &boost_value;
-                return write_number<true>(ss);
-            case JSON::BOOLEAN:
-                if (std::get<bool>(jj)) {
-                    if(BOOST_JSON_LIKELY(
-                        ss.remain() >= 4))
-                    {
-                        ss.append("true", 4);
-                        return true;
-                    }
-                    return write_true<true>(ss);
-                } else {
-                    if(BOOST_JSON_LIKELY(
-                        ss.remain() >= 5))
-                    {
-                        ss.append("false", 5);
-                        return true;
-                    }
-                    return write_false<true>(ss);
-                }
-            case (JSON::Index)NULL:
-                if(BOOST_JSON_LIKELY(
-                    ss.remain() >= 4))
-                {
-                    ss.append("null", 4);
-                    return true;
-                }
-                return write_null<true>(ss);
-            }
-        } else {
-            state st;
-            st_.peek(st);
-            switch(st)
-            {
-            default:
-                return serializer::write_value<StackEmpty>(ss);
+        auto seat = (KeyJSONPair*)arena.allocate(sizeof(KeyJSONPair) * n + KeyIndex::bytes(n), alignof(KeyJSONPair));
+        for (size_t idx = 0; idx < n; ++ idx) {
+            new (seat + idx) KeyJSONPair(pair_at(idx));
+        }
+        JSON result = std::span<KeyJSONPair>(seat, n);
+        if (KeyIndex::bytes(n)) {
+            KeyIndex::build(result, result.object());
+        }
+        return result;
+    }
+};
 
-            case state::arr1: case state::arr2:
-            case state::arr3: case state::arr4:
-                return write_array<StackEmpty>(ss);
+template <bool Checked>
+using BoostParser = boost::json::basic_parser<ParseHandler<Checked>>;
 
-            case state::obj1: case state::obj2:
-            case state::obj3: case state::obj4:
-            case state::obj5: case state::obj6:
-                return write_object<StackEmpty>(ss);
-            }
+template <bool Checked>
+JSON* decode_with(BoostParser<Checked> & parser, std::string_view text, bool reference_input)
+{
+    static auto & parsed_bytes = Metrics::counter("zinc_json_parse_bytes_total", "Bytes of JSON parsed");
+    static auto & parse_time = Metrics::histogram("zinc_json_parse_seconds", "Time to parse a JSON document", 1e-9);
+    parsed_bytes.add(text.size());
+    Metrics::Histogram::Timer timer(parse_time);
+    std::error_code ec;
+    if (parser.handler().writing) {
+        parser.handler().abort();
+    }
+    parser.reset();
+    parser.handler().input = reference_input ? text : std::string_view{};
+    parser.handler().arena.expect(text.size());
+    try {
+        if (simd_backend()) {
+            simd_parse(parser.handler(), text);
+        } else {
+            /*size_t parsed_size = */parser.write_some(false, text.data(), text.size(), ec);
+            if (ec) { throw std::invalid_argument(ec.message()); }
         }
+    } catch(...) {
+        parser.handler().input = {};
+        parser.handler().abort();
+        throw;
     }
-};
+    parser.handler().input = {};
+    return parser.handler().get();
+}
 
-thread_local boost::json::basic_parser<ParseHandler> parser({});
+}
 
+JSON::Doc JSON::decode(std::string_view text, bool reference_input)
+{
+    static thread_local BoostParser<false> parser({});
+    return decode_with(parser, text, reference_input);
 }
 
-JSON::Doc JSON::decode(std::string_view text)
+JSON::Doc JSON::decode_checked(std::string_view text, bool reference_input)
 {
+    static thread_local BoostParser<true> parser({});
+    return decode_with(parser, text, reference_input);
+}
+
+JSON::Parser::Parser()
+: impl_(new BoostParser<false>({}))
+{ }
+
+JSON::Parser::Parser(std::function<void(JSON const&)> on_element)
+: Parser()
+{
+    ((BoostParser<false>*)impl_)->handler().on_element = std::move(on_element);
+}
+
+JSON::Parser::Parser(Parser&&parser)
+: impl_(parser.impl_)
+{
+    parser.impl_ = nullptr;
+}
+
+JSON::Parser::~Parser()
+{
+    delete (BoostParser<false>*)impl_;
+}
+
+JSON::Doc JSON::Parser::decode(std::string_view text, bool reference_input)
+{
+    return decode_with(*(BoostParser<false>*)impl_, text, reference_input);
+}
+
+void JSON::Parser::write(std::string_view chunk)
+{
+    static auto & parsed_bytes = Metrics::counter("zinc_json_parse_bytes_total", "Bytes of JSON parsed");
+    parsed_bytes.add(chunk.size());
+    auto & parser = *(BoostParser<false>*)impl_;
+    if (!parser.handler().writing) {
+        parser.reset();
+        parser.handler().writing = true;
+    }
+    std::error_code ec;
+    try {
+        size_t parsed_size = parser.write_some(true, chunk.data(), chunk.size(), ec);
+        if (ec) { throw std::invalid_argument(ec.message()); }
+        if (parsed_size < chunk.size()) { throw std::invalid_argument("data after the end of the document"); }
+    } catch(...) {
+        parser.handler().abort();
+        throw;
+    }
+}
+
+JSON::Doc JSON::Parser::finish()
+{
+    auto & parser = *(BoostParser<false>*)impl_;
+    if (!parser.handler().writing) {
+        parser.reset();
+    }
     std::error_code ec;
-    parser.reset();
     try {
-        /*size_t parsed_size = */parser.write_some(false, text.data(), text.size(), ec);
+        parser.write_some(false, nullptr, 0, ec);
         if (ec) { throw std::invalid_argument(ec.message()); }
     } catch(...) {
         parser.handler().abort();
         throw;
     }
+    parser.handler().writing = false;
     return parser.handler().get();
 }
 
-std::string_view JSON::encode() const
+void JSON::Parser::reset()
+{
+    auto & parser = *(BoostParser<false>*)impl_;
+    if (parser.handler().writing) {
+        parser.handler().abort();
+    }
+}
+
+JSON::Builder::Builder(bool reference_values)
+: impl_(new BuildState{reference_values, {}, {}, {}})
+{ }
+
+JSON::Builder::Builder(Builder&&builder)
+: impl_(builder.impl_)
+{
+    builder.impl_ = nullptr;
+}
+
+JSON::Builder::~Builder()
+{
+    delete (BuildState*)impl_;
+}
+
+JSON::Builder& JSON::Builder::begin_array()
+{
+    auto & state = *(BuildState*)impl_;
+    state.check_value();
+    state.open.push_back({state.stack.size(), false});
+    return *this;
+}
+
+JSON::Builder& JSON::Builder::begin_object()
+{
+    auto & state = *(BuildState*)impl_;
+    state.check_value();
+    state.open.push_back({state.stack.size(), true});
+    return *this;
+}
+
+JSON::Builder& JSON::Builder::end()
+{
+    auto & state = *(BuildState*)impl_;
+    if (state.open.empty()) {
+        throw std::logic_error("json builder: end without an open array or object");
+    }
+    auto [start, object] = state.open.back();
+    auto stack_start = state.stack.begin() + (ssize_t)start, stack_end = state.stack.end();
+    JSON result;
+    if (object) {
+        if (!state.expects_key()) {
+            throw std::logic_error("json builder: key without a value");
+        }
+        result = state.store_object((size_t)(stack_end - stack_start) / 2, [&](size_t idx) {
+            return KeyJSONPair(std::get<std::string_view>(stack_start[(ssize_t)idx * 2]), stack_start[(ssize_t)idx * 2 + 1]);
+        });
+    } else {
+        size_t n = state.stack.size() - start;
+        auto seat = (JSON*)state.arena.allocate(sizeof(JSON) * n, alignof(JSON));
+        std::uninitialized_copy(stack_start, stack_end, seat);
+        result = std::span<JSON>(seat, n);
+    }
+    state.stack.erase(stack_start, stack_end);
+    state.open.pop_back();
+    state.stack.push_back(result);
+    return *this;
+}
+
+JSON::Builder& JSON::Builder::key(std::string_view key)
+{
+    auto & state = *(BuildState*)impl_;
+    if (!state.expects_key()) {
+        throw std::logic_error("json builder: key outside an object or after a key");
+    }
+    state.stack.emplace_back(state.reference_values ? key : state.copy(key));
+    return *this;
+}
+
+JSON::Builder& JSON::Builder::push(JSON const& value)
+{
+    auto & state = *(BuildState*)impl_;
+    state.check_value();
+    state.stack.push_back(state.reference_values ? value : state.copy(value));
+    return *this;
+}
+
+JSON::Doc JSON::Builder::finish()
+{
+    auto & state = *(BuildState*)impl_;
+    if (!state.open.empty() || state.stack.size() != 1) {
+        state.abort();
+        throw std::logic_error("json builder: finished without one complete value");
+    }
+    auto docimpl = new (state.arena.allocate(sizeof(DocImpl), alignof(DocImpl))) DocImpl(state.stack.back());
+    docimpl->blocks = state.arena.release();
+    state.stack.clear();
+    return docimpl;
+}
+
+std::string_view JSON::encode(int indent) const
 {
-    static thread_local Serializer serializer;
     static thread_local std::string storage;
-    serializer.reset(this);
     storage.clear();
-    while (!serializer.done()) {
-        if (storage.capacity() == storage.size()) {
-            storage.reserve(storage.size() * 2);
+    encode(storage, indent);
+    return storage;
+}
+
+void JSON::encode(std::string & out, int indent) const
+{
+    encode([&out](std::string_view chunk) { out.append(chunk); }, indent);
+}
+
+void JSON::encode(std::function<void(std::string_view)> const& sink, int indent) const
+{
+    Encoder encoder(sink, indent);
+    encoder.value(*this, 0);
+    encoder.flush();
+}
+
+namespace {
+
+/*
+ * Objects compare as their entries ordered by key, then by position for
+ * repeated keys.  Up to sorted_entries_max entries are sorted by index
+ * in buffers on the stack; larger objects select each next entry in
+ * turn, which is quadratic but does not allocate.
+ */
+constexpr size_t sorted_entries_max = 64;
+
+bool entry_before(JSON::Object object, size_t a, size_t b)
+{
+    auto cmp = object[a].first <=> object[b].first;
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+// The entry following prev in key order, or the first for prev == size
+size_t next_entry(JSON::Object object, size_t prev)
+{
+    size_t next = object.size();
+    for (size_t idx = 0; idx < object.size(); ++ idx) {
+        if ((prev == object.size() || entry_before(object, prev, idx)) &&
+            (next == object.size() || entry_before(object, idx, next))) {
+            next = idx;
         }
-        storage += serializer.read(&*storage.end(), storage.capacity() - storage.size());
     }
-    return storage;
+    return next;
+}
+
+std::partial_ordering compare_entries(JSON::Object lhs, JSON::Object rhs)
+{
+    auto compare_entry = [&](size_t l, size_t r) -> std::partial_ordering {
+        auto cmp = lhs[l].first <=> rhs[r].first;
+        if (cmp != 0) {
+            return cmp;
+        }
+        return lhs[l].second <=> rhs[r].second;
+    };
+    size_t n = lhs.size();
+    if (n <= sorted_entries_max) {
+        uint32_t lorder[sorted_entries_max], rorder[sorted_entries_max];
+        for (uint32_t idx = 0; idx < n; ++ idx) {
+            lorder[idx] = rorder[idx] = idx;
+        }
+        std::sort(lorder, lorder + n, [&](uint32_t a, uint32_t b) { return entry_before(lhs, a, b); });
+        std::sort(rorder, rorder + n, [&](uint32_t a, uint32_t b) { return entry_before(rhs, a, b); });
+        for (size_t idx = 0; idx < n; ++ idx) {
+            auto cmp = compare_entry(lorder[idx], rorder[idx]);
+            if (cmp != 0) {
+                return cmp;
+            }
+        }
+        return std::partial_ordering::equivalent;
+    }
+    for (size_t step = 0, l = n, r = n; step < n; ++ step) {
+        l = next_entry(lhs, l);
+        r = next_entry(rhs, r);
+        auto cmp = compare_entry(l, r);
+        if (cmp != 0) {
+            return cmp;
+        }
+    }
+    return std::partial_ordering::equivalent;
+}
+
 }
 
 std::partial_ordering JSON::operator<=>(JSON const& json) const
@@ -744,27 +593,34 @@ std::partial_ordering JSON::operator<=>(JSON const& json) const
     } else if (auto span = std::get_if<std::span<JSON>>(this)) {
         auto &lhs = *span;
         auto &rhs = std::get<std::span<JSON>>(json);
-        std::partial_ordering cmp = std::partial_ordering::equivalent;
-        for (size_t idx = 0; 0 == cmp && lhs.size() > idx; ++ idx) {
-            cmp = lhs[idx] <=> rhs[idx];
+        for (size_t idx = 0; idx < lhs.size() && idx < rhs.size(); ++ idx) {
+            auto cmp = lhs[idx] <=> rhs[idx];
+            if (cmp != 0) {
+                return cmp;
+            }
         }
-        return cmp;
+        return lhs.size() <=> rhs.size();
     } else if (auto span = std::get_if<std::span<KeyJSONPair>>(this)) {
-        static thread_local std::map<KeyJSONPair::first_type,KeyJSONPair::second_type> lhs, rhs;
-        auto & rhs_ =std::get<std::span<KeyJSONPair>>(json);
-        lhs.clear(); lhs.insert(span->begin(), span->end());
-        rhs.clear(); rhs.insert(rhs_.begin(), rhs_.end());
+        auto & lhs = *span;
+        auto & rhs = std::get<std::span<KeyJSONPair>>(json);
         if (lhs.size() != rhs.size()) {
             return lhs.size() <=> rhs.size();
         }
-        std::partial_ordering cmp = std::partial_ordering::equivalent;
-        for (auto lit = lhs.begin(), rit = rhs.begin(); lit != lhs.end() && rit != rhs.end(); ++ lit, ++ rit) {
-            auto & [lk, lv] = *lit;
-            auto & [rk, rv] = *rit;
-            cmp = lk <=> rk; if (cmp != 0) break;
-            cmp = lv <=> rv; if (cmp != 0) break;
+        if (indexed_.set && json.indexed_.set) {
+            // neither has repeated keys, so they are equal if every entry is found in the other
+            bool equal = true;
+            for (auto & [key, value] : lhs) {
+                auto other = KeyIndex::find(json, key);
+                if (other == nullptr || !(value == *other)) {
+                    equal = false;
+                    break;
+                }
+            }
+            if (equal) {
+                return std::partial_ordering::equivalent;
+            }
         }
-        return cmp;
+        return compare_entries(lhs, rhs);
     } else {
         return std::partial_ordering::equivalent;
     }
@@ -772,6 +628,12 @@ std::partial_ordering JSON::operator<=>(JSON const& json) const
 
 JSON const& JSON::operator[](std::string_view key) const
 {
+    if (indexed_.set) { // indexed objects have no repeated keys
+        if (auto json = KeyIndex::find(*this, key)) {
+            return *json;
+        }
+        throw std::out_of_range("not found");
+    }
     JSON * result = nullptr;
     for (auto & [k, json] : object()) {
         if (k == key) {
@@ -787,6 +649,23 @@ JSON const& JSON::operator[](std::string_view key) const
     return *result;
 }
 
+JSON const* JSON::find(std::string_view key) const
+{
+    auto object = std::get_if<Object>(this);
+    if (object == nullptr) {
+        return nullptr;
+    }
+    if (indexed_.set) {
+        return KeyIndex::find(*this, key);
+    }
+    for (auto & [k, json] : *object) {
+        if (k == key) {
+            return &json;
+        }
+    }
+    return nullptr;
+}
+
 JSON const& JSON::operator[](size_t idx) const
 {
     return array()[idx];
@@ -829,6 +708,8 @@ bool JSON::truthy() const
     switch (index()) {
     case (Index)NULL:
         return false;
+    case BOOLEAN:
+        return std::get<Bool>(*this);
     case INTEGER:
         return std::get<Integer>(*this);
     case NUMBER:
@@ -848,16 +729,28 @@ JSON::Doc::Doc(JSON*root)
 : root_(root)
 { }
 
-JSON::Doc::Doc(Doc&&doc)
+JSON::Doc::Doc(Doc&&doc) noexcept
 : root_(doc.root_)
 {
     doc.root_ = nullptr;
 }
 
+JSON::Doc& JSON::Doc::operator=(Doc&&doc) noexcept
+{
+    if (this != &doc) {
+        if (root_) {
+            Arena::free(((DocImpl*)root_)->blocks);
+        }
+        root_ = doc.root_;
+        doc.root_ = nullptr;
+    }
+    return *this;
+}
+
 JSON::Doc::~Doc()
 {
     if (root_) {
-        ParseHandler::del(root_);
+        Arena::free(((DocImpl*)root_)->blocks);
     }
 }
 
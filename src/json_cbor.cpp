@@ -0,0 +1,207 @@
+#include <zinc/json.hpp>
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace zinc {
+
+namespace {
+
+/*
+ * Reads items from the front of the input into a Builder, which stores
+ * the tree as it does for any other document.
+ */
+class CBORReader
+{
+public:
+    static constexpr size_t max_depth = 32;
+
+    CBORReader(std::string_view input, JSON::Builder & builder)
+    : input_(input), builder_(builder)
+    { }
+
+    bool empty() const
+    {
+        return input_.empty();
+    }
+
+    void item(size_t depth = 0)
+    {
+        if (depth > max_depth) {
+            throw std::invalid_argument("cbor nested too deeply");
+        }
+        uint8_t initial = byte();
+        unsigned major = initial >> 5, info = initial & 0x1f;
+        if (major == 7) {
+            simple(info);
+            return;
+        }
+        bool indefinite = info == 31 && (major == 4 || major == 5);
+        uint64_t n = indefinite ? 0 : argument(info);
+        if (major <= 1 && n > (uint64_t)LONG_MAX) {
+            throw std::invalid_argument("cbor integer is out of range");
+        }
+        switch (major) {
+        case 0:
+            builder_.push((long)n);
+            break;
+        case 1:
+            builder_.push(-1 - (long)n);
+            break;
+        case 2:
+        case 3:
+            builder_.push(string(n));
+            break;
+        case 4:
+            builder_.begin_array();
+            for (uint64_t idx = 0; indefinite ? !at_break() : idx < n; ++ idx) {
+                item(depth + 1);
+            }
+            builder_.end();
+            break;
+        case 5:
+            builder_.begin_object();
+            for (uint64_t idx = 0; indefinite ? !at_break() : idx < n; ++ idx) {
+                uint8_t key = byte();
+                if (key >> 5 != 3 || (key & 0x1f) == 31) {
+                    throw std::invalid_argument("cbor map key is not a text string");
+                }
+                builder_.key(string(argument(key & 0x1f)));
+                item(depth + 1);
+            }
+            builder_.end();
+            break;
+        case 6:
+            item(depth + 1); // the tagged item, nested so that a run of tags ends
+            break;
+        }
+    }
+
+private:
+    uint8_t byte()
+    {
+        if (input_.empty()) {
+            throw std::invalid_argument("cbor ends within an item");
+        }
+        uint8_t b = (uint8_t)input_.front();
+        input_.remove_prefix(1);
+        return b;
+    }
+
+    uint64_t big_endian(size_t size)
+    {
+        uint64_t n = 0;
+        for (size_t idx = 0; idx < size; ++ idx) {
+            n = (n << 8) | byte();
+        }
+        return n;
+    }
+
+    uint64_t argument(unsigned info)
+    {
+        if (info < 24) {
+            return info;
+        } else if (info < 28) {
+            return big_endian((size_t)1 << (info - 24));
+        }
+        throw std::invalid_argument("cbor item has an invalid or indefinite length");
+    }
+
+    std::string_view string(uint64_t size)
+    {
+        if (size > input_.size()) {
+            throw std::invalid_argument("cbor ends within a string");
+        }
+        std::string_view result = input_.substr(0, (size_t)size);
+        input_.remove_prefix((size_t)size);
+        return result;
+    }
+
+    // Consumes the break that ends an item of indefinite length
+    bool at_break()
+    {
+        if (!input_.empty() && (uint8_t)input_.front() == 0xff) {
+            input_.remove_prefix(1);
+            return true;
+        }
+        return false;
+    }
+
+    void simple(unsigned info)
+    {
+        switch (info) {
+        case 20:
+            builder_.push(false);
+            break;
+        case 21:
+            builder_.push(true);
+            break;
+        case 25:
+        {
+            // half precision
+            auto half = (unsigned)big_endian(2);
+            unsigned exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff;
+            double value = exponent == 0 ? std::ldexp(mantissa, -24)
+                : exponent == 31 ? (mantissa ? NAN : INFINITY)
+                : std::ldexp(mantissa + 1024, (int)exponent - 25);
+            builder_.push(half & 0x8000 ? -value : value);
+            break;
+        }
+        case 26:
+        {
+            auto bits = (uint32_t)big_endian(4);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            builder_.push((double)value);
+            break;
+        }
+        case 27:
+        {
+            uint64_t bits = big_endian(8);
+            double value;
+            std::memcpy(&value, &bits, sizeof(value));
+            builder_.push(value);
+            break;
+        }
+        case 24:
+            byte(); // a simple value of one byte
+            builder_.push(nullptr);
+            break;
+        case 28: case 29: case 30: case 31:
+            throw std::invalid_argument("cbor has a reserved or misplaced simple value");
+        default:
+            builder_.push(nullptr); // null, undefined and unassigned values
+        }
+    }
+
+    std::string_view input_;
+    JSON::Builder & builder_;
+};
+
+}
+
+JSON::Doc JSON::decode_cbor(std::string_view cbor, bool reference_input)
+{
+    static thread_local Builder copying(false), referencing(true);
+    Builder & builder = reference_input ? referencing : copying;
+    CBORReader reader(cbor, builder);
+    try {
+        reader.item();
+        if (!reader.empty()) {
+            throw std::invalid_argument("data after the end of the cbor item");
+        }
+        return builder.finish();
+    } catch (std::invalid_argument const&) {
+        try {
+            builder.finish(); // discards the partial document
+        } catch (std::logic_error const&) {
+        }
+        throw;
+    }
+}
+
+}
@@ -0,0 +1,485 @@
+#pragma once
+
+/*
+ * Building the tree of a parsed document, shared by the decode backends:
+ * the storage of each Doc, the key index of large objects, and the
+ * handler that either parser calls as it reads values.
+ */
+
+#include <zinc/json.hpp>
+
+#include <boost/json/basic_parser_impl.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zinc {
+
+/*
+ * The index of an object is an open-addressing table of entry positions
+ * plus one, laid out right after the entries, sized to a power of two at
+ * least twice the number of entries.
+ */
+struct KeyIndex
+{
+    static size_t slot_count(size_t n)
+    {
+        return std::bit_ceil(n * 2);
+    }
+
+    static size_t bytes(size_t n)
+    {
+        return n < JSON::min_indexed_object_size || n > UINT32_MAX / 2 ? 0 : sizeof(uint32_t) * slot_count(n);
+    }
+
+    // Fill the slots after object and mark json indexed, unless a key repeats
+    static void build(JSON & json, JSON::Object object)
+    {
+        size_t mask = slot_count(object.size()) - 1;
+        uint32_t* slots = (uint32_t*)(object.data() + object.size());
+        std::fill(slots, slots + mask + 1, 0);
+        for (size_t idx = 0; idx < object.size(); ++ idx) {
+            auto key = object[idx].first;
+            size_t slot = std::hash<std::string_view>{}(key) & mask;
+            for (; slots[slot]; slot = (slot + 1) & mask) {
+                if (object[slots[slot] - 1].first == key) {
+                    return;
+                }
+            }
+            slots[slot] = (uint32_t)idx + 1;
+        }
+        json.indexed_.set = true;
+    }
+
+    static JSON const* find(JSON const& json, std::string_view key)
+    {
+        auto & object = json.object();
+        size_t mask = slot_count(object.size()) - 1;
+        uint32_t const* slots = (uint32_t const*)(object.data() + object.size());
+        for (size_t slot = std::hash<std::string_view>{}(key) & mask; slots[slot]; slot = (slot + 1) & mask) {
+            auto & [k, value] = object[slots[slot] - 1];
+            if (k == key) {
+                return &value;
+            }
+        }
+        return nullptr;
+    }
+};
+
+/*
+ * Storage for one document: a chain of blocks that are never moved, so
+ * values can point into earlier blocks while later ones are filled.
+ * Freeing a document returns its blocks; blocks of the usual sizes are
+ * kept in a small cache on the freeing thread for the next document.
+ */
+class Arena
+{
+public:
+    static constexpr size_t block_size = 4096;
+    static constexpr size_t min_block_size = 256;
+
+    struct Block {
+        Block* next;
+        size_t size; // including this header
+    };
+
+    /*
+     * Size the first block for a document of about input_size bytes, so
+     * that small documents, such as the lines of a log, are not each
+     * given a whole block.
+     */
+    void expect(size_t input_size)
+    {
+        if (!blocks_) {
+            next_size_ = std::clamp(std::bit_ceil(input_size * 4 + 128), min_block_size, block_size);
+        }
+    }
+
+    void* allocate(size_t n, size_t a = alignof(std::max_align_t))
+    {
+        size_t avail = (size_t)(end_ - cursor_);
+        void* result = cursor_;
+        if (!std::align(a, n, result, avail)) {
+            size_t min_size = sizeof(Block) + n + a;
+            if (min_size > next_size_ / 2) {
+                // large values get a block of their own behind the current one
+                Block* block = new_block(min_size);
+                if (blocks_) {
+                    block->next = blocks_->next;
+                    blocks_->next = block;
+                } else {
+                    block->next = nullptr;
+                    blocks_ = block;
+                }
+                result = block + 1;
+                avail = min_size - sizeof(Block);
+                return std::align(a, n, result, avail);
+            }
+            Block* block = new_block(next_size_);
+            block->next = blocks_;
+            blocks_ = block;
+            cursor_ = (char*)(block + 1);
+            end_ = (char*)block + block->size;
+            next_size_ = std::min(next_size_ * 2, (size_t)1 << 20);
+            result = cursor_;
+            avail = (size_t)(end_ - cursor_);
+            std::align(a, n, result, avail);
+        }
+        cursor_ = (char*)result + n;
+        return result;
+    }
+
+    bool contains(void const* begin, void const* end) const
+    {
+        for (Block* block = blocks_; block; block = block->next) {
+            if (begin >= (void*)(block + 1) && end <= (void*)((char*)block + block->size)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Hand the blocks over, leaving the arena empty
+    Block* release()
+    {
+        Block* blocks = blocks_;
+        blocks_ = nullptr;
+        cursor_ = end_ = nullptr;
+        next_size_ = block_size;
+        return blocks;
+    }
+
+    static void free(Block* blocks)
+    {
+        while (blocks) {
+            Block* next = blocks->next;
+            size_t cls = size_class(blocks->size);
+            if (cls < size_classes && cache().size[cls] < cache_limit) {
+                blocks->next = cache().blocks[cls];
+                cache().blocks[cls] = blocks;
+                ++ cache().size[cls];
+            } else {
+                ::operator delete(blocks);
+            }
+            blocks = next;
+        }
+    }
+
+private:
+    static constexpr size_t cache_limit = 16; // of each size
+    static constexpr size_t size_classes = std::countr_zero(block_size) - std::countr_zero(min_block_size) + 1;
+
+    // The powers of two from min_block_size to block_size are cached
+    static size_t size_class(size_t size)
+    {
+        if (!std::has_single_bit(size) || size < min_block_size || size > block_size) {
+            return size_classes;
+        }
+        return (size_t)(std::countr_zero(size) - std::countr_zero(min_block_size));
+    }
+
+    struct Cache {
+        Block* blocks[size_classes] = {};
+        size_t size[size_classes] = {};
+        ~Cache()
+        {
+            for (Block* list : blocks) {
+                while (list) {
+                    Block* next = list->next;
+                    ::operator delete(list);
+                    list = next;
+                }
+            }
+        }
+    };
+    static Cache& cache()
+    {
+        static thread_local Cache cache;
+        return cache;
+    }
+
+    static Block* new_block(size_t size)
+    {
+        Block* block;
+        size_t cls = size_class(size);
+        if (cls < size_classes && cache().blocks[cls]) {
+            block = cache().blocks[cls];
+            cache().blocks[cls] = block->next;
+            -- cache().size[cls];
+        } else {
+            block = (Block*)::operator new(size);
+            block->size = size;
+        }
+        return block;
+    }
+
+    Block* blocks_ = nullptr;
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+    size_t next_size_ = block_size;
+};
+
+struct DocImpl : public zinc::JSON {
+    DocImpl(JSON root) : JSON(root), blocks(nullptr) { }
+    Arena::Block* blocks; // the blocks hold the doc itself
+};
+
+/*
+ * Checked parsing walks the whole tree under construction each time a
+ * value is stored, verifying every pointer and touching every string.
+ * This is quadratic and meant for tests; the release handler does none.
+ */
+template <bool Checked>
+struct ParseHandler
+{
+    static constexpr std::size_t max_object_size = (size_t)-1;
+    static constexpr std::size_t max_array_size = (size_t)-1;
+    static constexpr std::size_t max_key_size = (size_t)-1;
+    static constexpr std::size_t max_string_size = (size_t)-1;
+
+    static void check(bool valid, char const* what) {
+        if (!valid) {
+            throw std::logic_error(std::string("json parse check failed: ") + what);
+        }
+    }
+    void dbg_walk(JSON const*json, int depth=0) {
+        static thread_local JSON dbgval;
+        dbgval = *json;
+        if (auto*array = std::get_if<std::span<JSON>>(json)) {
+            //if(depth==0)std::cerr << "array "; /*dbg*/
+            check(array->empty() || arena.contains(array->data(), array->data() + array->size()), "array outside the doc");
+            for (auto & elem : *array) {
+                dbg_walk(&elem, depth+1);
+            }
+        } else if(auto*dict = std::get_if<std::span<KeyJSONPair>>(json)) {
+            //if(depth==0)std::cerr << "dict "; /*dbg*/
+            check(dict->empty() || arena.contains(dict->data(), dict->data() + dict->size()), "object outside the doc");
+            for (auto & [k,v] : *dict) {
+                check(k.empty() || in_input(k) || arena.contains(k.data(), k.data() + k.size()), "key outside the doc");
+                static thread_local std::string string;
+                string = k;
+                dbg_walk(&v, depth+1);
+            }
+        } else if(auto*str = std::get_if<std::string_view>(json)) {
+            check(str->empty() || in_input(*str) || arena.contains(str->data(), str->data() + str->size()), "string outside the doc");
+            //if(depth==0)std::cerr << "\"" << *str << "\" "; /*dbg*/
+            static thread_local std::string string;
+            string = *str;
+        }
+    }
+    inline void dbg_walk_stack() {
+        if constexpr (Checked) {
+            for (auto &json : stack) {
+                dbg_walk(&json);
+            }
+        }
+    }
+
+    DocImpl* docimpl = nullptr;
+
+    std::vector<JSON> stack;
+    size_t depth = 0; // open arrays and objects
+    bool root_array = false;
+    bool writing = false; // a document is being written in pieces
+    std::function<void(JSON const&)> on_element; // takes top-level array elements as they complete
+    std::string_view input; // the document, when strings may refer into it
+    std::string part; // a key or string handed over in parts
+    Arena arena;
+
+    JSON* get() {
+        auto ptr = docimpl;
+        docimpl->blocks = arena.release();
+        docimpl = nullptr;
+        return ptr;
+    }
+    void abort() {
+        stack.clear();
+        part.clear();
+        depth = 0;
+        writing = false;
+        docimpl = nullptr;
+        Arena::free(arena.release());
+    }
+
+    inline char* reserve(size_t n, size_t a = 1) {
+        dbg_walk_stack();
+        return (char*)arena.allocate(n, a);
+    }
+    inline std::string_view store_chars(std::string_view chars)
+    {
+        char* seat = reserve(chars.size());
+        std::copy(chars.begin(), chars.end(), seat);
+        return {seat, chars.size()};
+    }
+
+    /*
+     * A completed top-level array element is handed to on_element and
+     * dropped, and the storage it used is freed for the next one.
+     */
+    inline void completed() {
+        if (depth == 1 && root_array && on_element) {
+            on_element(stack.back());
+            stack.pop_back();
+            Arena::free(arena.release());
+        }
+    }
+
+    inline bool on_document_begin(boost::json::error_code&) {
+        //std::cerr<<"on_document_begin"<<std::endl;
+        assert(nullptr == docimpl);
+        return true;
+    }
+    inline bool on_document_end(boost::json::error_code&) {
+        assert(1 == stack.size());
+        docimpl = new (reserve(sizeof(DocImpl), alignof(DocImpl))) DocImpl(stack.back());
+        if constexpr (Checked) {
+            dbg_walk(docimpl);
+        }
+        stack.clear();
+        return true;
+    }
+    inline bool on_object_begin(boost::json::error_code&) {
+        //std::cerr<< "ON_OBJECT_BEGIN" << std::endl; /*dbg*/
+        if (depth ++ == 0) {
+            root_array = false;
+        }
+        return true;
+    }
+    inline bool on_object_end(std::size_t n, boost::json::error_code&) {
+        //std::cerr<< "ON_OBJECT_END start" << std::endl; /*dbg*/
+        -- depth;
+        auto store_start = (KeyJSONPair*)reserve(sizeof(KeyJSONPair) * n + KeyIndex::bytes(n), alignof(KeyJSONPair));
+        auto stack_end = stack.end(), stack_start = stack_end - (ssize_t)n * 2;
+        auto seat = store_start;
+        for (auto it = stack_start; it != stack_end; it += 2, ++ seat) {
+            new (seat) KeyJSONPair(std::get<std::string_view>(it[0]), it[1]);
+        }
+        stack.erase(stack_start, stack_end);
+        stack.emplace_back(std::span<KeyJSONPair>(store_start, n));
+        if (KeyIndex::bytes(n)) {
+            KeyIndex::build(stack.back(), stack.back().object());
+        }
+        dbg_walk_stack();
+        completed();
+        //std::cerr<< "ON_OBJECT_END end" << std::endl; /*dbg*/
+        return true;
+    }
+    inline bool on_array_begin(boost::json::error_code&)
+    {
+        if (depth ++ == 0) {
+            root_array = true;
+        }
+        return true;
+    }
+    inline bool on_array_end(std::size_t n, boost::json::error_code&)
+    {
+        if (-- depth == 0 && on_element) {
+            n = 0; // the elements were handed over
+        }
+        auto store_start = (JSON*)reserve(sizeof(JSON) * n, alignof(JSON));
+        auto stack_end = stack.end(), stack_start = stack_end - (ssize_t)n;
+        std::uninitialized_copy(stack_start, stack_end, store_start);
+        stack.erase(stack_start, stack_end);
+        stack.emplace_back(std::span<JSON>(store_start, n));
+        completed();
+        return true;
+    }
+    /*
+     * boost hands over escaped strings, and strings split across buffers,
+     * in parts from a buffer of its own, so these are joined and copied;
+     * an unescaped string in one piece is handed over as a range of the
+     * document itself, which can be referenced instead of copied.
+     */
+    inline bool in_input(std::string_view s) const {
+        return s.data() >= input.data() && s.data() + s.size() <= input.data() + input.size();
+    }
+    inline std::string_view store_string(boost::json::string_view s, std::size_t n) {
+        if (part.empty()) {
+            if (s.size() == n && in_input(s)) {
+                return {s.data(), n};
+            }
+            return store_chars(s);
+        }
+        part.append(s.data(), s.size());
+        std::string_view result = store_chars(part);
+        part.clear();
+        return result;
+    }
+    inline bool on_key_part(boost::json::string_view s, std::size_t, boost::json::error_code&) {
+        part.append(s.data(), s.size());
+        return true;
+    }
+    inline bool on_key(boost::json::string_view s, std::size_t n, boost::json::error_code&) {
+        stack.emplace_back(store_string(s, n));
+        return true;
+    }
+    inline bool on_string_part(boost::json::string_view s, std::size_t, boost::json::error_code&) {
+        part.append(s.data(), s.size());
+        return true;
+    }
+    inline bool on_string(boost::json::string_view s, std::size_t n, boost::json::error_code&) {
+        stack.emplace_back(store_string(s, n));
+        completed();
+        return true;
+    }
+    inline bool on_number_part(boost::json::string_view, boost::json::error_code&)
+    {
+        return true;
+    }
+    inline bool on_int64(std::int64_t i, boost::json::string_view, boost::json::error_code&)
+    {
+        stack.emplace_back((long)i);
+        completed();
+        return true;
+    }
+    inline bool on_uint64(std::uint64_t u, boost::json::string_view, boost::json::error_code&)
+    {
+        stack.emplace_back((long)u);
+        completed();
+        return true;
+    }
+    inline bool on_double(double d, boost::json::string_view, boost::json::error_code&)
+    {
+        stack.emplace_back(d);
+        completed();
+        return true;
+    }
+    inline bool on_bool(bool b, boost::json::error_code&)
+    {
+        stack.emplace_back(b);
+        completed();
+        return true;
+    }
+    inline bool on_null(boost::json::error_code&)
+    {
+        stack.emplace_back(nullptr);
+        completed();
+        return true;
+    }
+    inline bool on_comment_part(boost::json::string_view, boost::json::error_code&)
+    {
+        return true;
+    }
+    inline bool on_comment(boost::json::string_view, boost::json::error_code&)
+    {
+        return true;
+    }
+};
+
+/*
+ * The simdjson-style backend in json_simd.cpp.  It reads the whole
+ * document and calls the same handler, so both build identical trees.
+ */
+bool simd_backend();
+template <bool Checked>
+void simd_parse(ParseHandler<Checked> & handler, std::string_view text);
+
+}
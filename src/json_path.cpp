@@ -0,0 +1,150 @@
+#include <zinc/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace zinc {
+
+namespace {
+
+struct Step {
+    std::string key; // unescaped
+    size_t index = (size_t)-1; // the key as an array index, if it is one
+    bool wildcard = false;
+    mutable std::atomic<size_t> hint = 0; // position of the key where it was last found
+};
+
+struct PathImpl {
+    std::vector<Step> steps;
+};
+
+JSON const* member(JSON const& json, Step const& step)
+{
+    auto & object = json.object();
+    size_t hint = step.hint.load(std::memory_order_relaxed);
+    if (hint < object.size() && object[hint].first == step.key) {
+        return &object[hint].second;
+    }
+    JSON const* value = json.find(step.key);
+    if (value) {
+        size_t position = (size_t)((char const*)value - (char const*)&object[0].second) / sizeof(KeyJSONPair);
+        step.hint.store(position, std::memory_order_relaxed);
+    }
+    return value;
+}
+
+// Visits the values the remaining steps reach until visit returns true
+template <typename Visit>
+bool walk(JSON const& json, Step const* step, Step const* end, Visit & visit)
+{
+    if (step == end) {
+        return visit(json);
+    }
+    switch (json.index()) {
+    case JSON::OBJECT:
+        if (step->wildcard) {
+            for (auto & [key, value] : json.object()) {
+                if (walk(value, step + 1, end, visit)) {
+                    return true;
+                }
+            }
+            return false;
+        } else {
+            JSON const* value = member(json, *step);
+            return value && walk(*value, step + 1, end, visit);
+        }
+    case JSON::ARRAY:
+    {
+        auto & array = json.array();
+        if (step->wildcard) {
+            for (auto & element : array) {
+                if (walk(element, step + 1, end, visit)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return step->index < array.size() && walk(array[step->index], step + 1, end, visit);
+    }
+    default:
+        return false;
+    }
+}
+
+}
+
+JSON::Path::Path(std::string_view pointer)
+{
+    if (!pointer.empty() && pointer.front() != '/') {
+        throw std::invalid_argument("json pointer does not begin with /: " + std::string(pointer));
+    }
+    std::vector<std::string> keys;
+    for (size_t start = 0; start < pointer.size();) {
+        size_t end = std::min(pointer.find('/', start + 1), pointer.size());
+        std::string & key = keys.emplace_back();
+        for (size_t idx = start + 1; idx < end; ++ idx) {
+            if (pointer[idx] != '~') {
+                key += pointer[idx];
+            } else if (idx + 1 < end && (pointer[idx + 1] == '0' || pointer[idx + 1] == '1')) {
+                key += pointer[++ idx] == '0' ? '~' : '/';
+            } else {
+                throw std::invalid_argument("json pointer has a ~ not followed by 0 or 1: " + std::string(pointer));
+            }
+        }
+        start = end;
+    }
+    auto impl = new PathImpl{std::vector<Step>(keys.size())};
+    for (size_t idx = 0; idx < keys.size(); ++ idx) {
+        auto & step = impl->steps[idx];
+        step.key = std::move(keys[idx]);
+        step.wildcard = step.key == "*";
+        // indices are digits without leading zeros
+        if (!step.key.empty() && (step.key[0] != '0' || step.key.size() == 1)) {
+            size_t index;
+            auto [ptr, ec] = std::from_chars(step.key.data(), step.key.data() + step.key.size(), index);
+            if (ec == std::errc() && ptr == step.key.data() + step.key.size()) {
+                step.index = index;
+            }
+        }
+    }
+    impl_ = impl;
+}
+
+JSON::Path::Path(Path&&path)
+: impl_(path.impl_)
+{
+    path.impl_ = nullptr;
+}
+
+JSON::Path::~Path()
+{
+    delete (PathImpl*)impl_;
+}
+
+JSON const* JSON::Path::find(JSON const& root) const
+{
+    auto & steps = ((PathImpl*)impl_)->steps;
+    JSON const* found = nullptr;
+    auto visit = [&](JSON const& json) {
+        found = &json;
+        return true;
+    };
+    walk(root, steps.data(), steps.data() + steps.size(), visit);
+    return found;
+}
+
+void JSON::Path::for_each(JSON const& root, std::function<void(JSON const&)> const& visit) const
+{
+    auto & steps = ((PathImpl*)impl_)->steps;
+    auto all = [&](JSON const& json) {
+        visit(json);
+        return false;
+    };
+    walk(root, steps.data(), steps.data() + steps.size(), all);
+}
+
+}
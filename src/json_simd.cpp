@@ -0,0 +1,561 @@
+#include "json_handler.hpp"
+
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace zinc {
+
+namespace {
+
+[[noreturn]] void fail(char const* what)
+{
+    throw std::invalid_argument(std::string("json: ") + what);
+}
+
+/*
+ * Stage one, after simdjson: the input is classified 64 bytes at a time
+ * into bitmasks, from which follow the escaped bytes, the bytes inside
+ * strings, and the structural bytes.  Those are the brackets, colons and
+ * commas outside strings, every unescaped quote, and the first byte of
+ * each number or literal; their positions are all stage two reads.
+ */
+struct Masks
+{
+    uint64_t quote = 0, backslash = 0, op = 0, space = 0, control = 0, high = 0;
+};
+
+#if defined(__SSE2__)
+Masks classify(char const* block)
+{
+    Masks masks;
+    for (int part = 0; part < 4; ++ part) {
+        __m128i bytes = _mm_loadu_si128((__m128i const*)(block + 16 * part));
+        auto bits = [&](__m128i matches) {
+            return (uint64_t)(uint32_t)_mm_movemask_epi8(matches) << (16 * part);
+        };
+        auto equal = [&](__m128i against, char c) {
+            return _mm_cmpeq_epi8(against, _mm_set1_epi8(c));
+        };
+        // '[' and '{', and ']' and '}', differ only in bit 5
+        __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+        masks.quote |= bits(equal(bytes, '"'));
+        masks.backslash |= bits(equal(bytes, '\\'));
+        masks.op |= bits(_mm_or_si128(
+            _mm_or_si128(equal(folded, '{'), equal(folded, '}')),
+            _mm_or_si128(equal(bytes, ':'), equal(bytes, ','))
+        ));
+        masks.space |= bits(_mm_or_si128(
+            _mm_or_si128(equal(bytes, ' '), equal(bytes, '\t')),
+            _mm_or_si128(equal(bytes, '\n'), equal(bytes, '\r'))
+        ));
+        masks.control |= bits(equal(_mm_max_epu8(bytes, _mm_set1_epi8(0x1f)), 0x1f));
+        masks.high |= bits(bytes);
+    }
+    return masks;
+}
+#else
+Masks classify(char const* block)
+{
+    Masks masks;
+    for (size_t idx = 0; idx < 64; ++ idx) {
+        unsigned char c = (unsigned char)block[idx];
+        uint64_t bit = (uint64_t)1 << idx;
+        if (c == '"') masks.quote |= bit;
+        if (c == '\\') masks.backslash |= bit;
+        if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') masks.op |= bit;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') masks.space |= bit;
+        if (c < 0x20) masks.control |= bit;
+        if (c >= 0x80) masks.high |= bit;
+    }
+    return masks;
+}
+#endif
+
+// Each bit set where an odd number of bits at or below it are set
+inline uint64_t prefix_xor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+/*
+ * The bytes following an odd run of backslashes.  Runs starting on odd
+ * bits are found by adding their starts to the backslashes, which clears
+ * each run and carries into the byte after it; carry holds a backslash
+ * escaping the first byte of the next block.
+ */
+inline uint64_t escaped_bytes(uint64_t backslash, uint64_t & carry)
+{
+    constexpr uint64_t even_bits = 0x5555555555555555;
+    backslash &= ~carry;
+    uint64_t follows_escape = backslash << 1 | carry;
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t even_sequences;
+    carry = __builtin_add_overflow(odd_starts, backslash, &even_sequences);
+    return (even_bits ^ (even_sequences << 1)) & follows_escape;
+}
+
+bool valid_utf8(std::string_view text)
+{
+    static constexpr uint32_t min_code_point[] = {0, 0x80, 0x800, 0x10000};
+    auto p = (unsigned char const*)text.data(), end = p + text.size();
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            if (!(word & 0x8080808080808080)) {
+                p += 8;
+                continue;
+            }
+        }
+        unsigned c = *p;
+        if (c < 0x80) {
+            ++ p;
+            continue;
+        }
+        size_t continuations;
+        uint32_t code_point;
+        if ((c & 0xe0) == 0xc0) {
+            continuations = 1; code_point = c & 0x1f;
+        } else if ((c & 0xf0) == 0xe0) {
+            continuations = 2; code_point = c & 0x0f;
+        } else if ((c & 0xf8) == 0xf0) {
+            continuations = 3; code_point = c & 0x07;
+        } else {
+            return false;
+        }
+        if ((size_t)(end - p) <= continuations) {
+            return false;
+        }
+        for (size_t idx = 1; idx <= continuations; ++ idx) {
+            if ((p[idx] & 0xc0) != 0x80) {
+                return false;
+            }
+            code_point = code_point << 6 | (p[idx] & 0x3f);
+        }
+        if (code_point < min_code_point[continuations] || code_point > 0x10ffff ||
+            (code_point >= 0xd800 && code_point <= 0xdfff)) {
+            return false;
+        }
+        p += continuations + 1;
+    }
+    return true;
+}
+
+// Fill index with the positions of the structural bytes and return how many there are
+size_t index_structurals(std::string_view text, std::vector<uint32_t> & index)
+{
+    if (text.size() >= UINT32_MAX) {
+        fail("document too large");
+    }
+    if (index.size() < text.size() + 1) {
+        index.resize(text.size() + 1);
+    }
+    uint32_t* tail = index.data();
+    uint64_t escape_carry = 0, string_carry = 0, scalar_carry = 0;
+    size_t non_ascii_from = std::string_view::npos;
+    char padded[64];
+    for (size_t base = 0; base < text.size(); base += 64) {
+        char const* block = text.data() + base;
+        if (text.size() - base < 64) {
+            std::memset(padded, ' ', sizeof(padded));
+            std::memcpy(padded, block, text.size() - base);
+            block = padded;
+        }
+        Masks masks = classify(block);
+        uint64_t quote = masks.quote & ~escaped_bytes(masks.backslash, escape_carry);
+        // from each opening quote up to, but not including, its closing quote
+        uint64_t in_string = prefix_xor(quote) ^ string_carry;
+        string_carry = (uint64_t)((int64_t)in_string >> 63);
+        if (masks.control & in_string) {
+            fail("control character in string");
+        }
+        if (masks.high && non_ascii_from == std::string_view::npos) {
+            non_ascii_from = base;
+        }
+        uint64_t scalar = ~(masks.op | masks.space | masks.quote | in_string);
+        uint64_t scalar_start = scalar & ~(scalar << 1 | scalar_carry);
+        scalar_carry = scalar >> 63;
+        uint64_t structural = (masks.op & ~in_string) | quote | scalar_start;
+        while (structural) {
+            *tail ++ = (uint32_t)(base + (size_t)std::countr_zero(structural));
+            structural &= structural - 1;
+        }
+    }
+    if (string_carry) {
+        fail("unterminated string");
+    }
+    if (non_ascii_from != std::string_view::npos && !valid_utf8(text.substr(non_ascii_from))) {
+        fail("invalid UTF-8");
+    }
+    return (size_t)(tail - index.data());
+}
+
+uint32_t hex4(std::string_view text, size_t pos)
+{
+    uint32_t value = 0;
+    if (pos + 4 > text.size()) {
+        fail("short unicode escape");
+    }
+    for (size_t idx = pos; idx < pos + 4; ++ idx) {
+        char c = text[idx];
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= (uint32_t)(c - '0');
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            value |= (uint32_t)((c | 0x20) - 'a' + 10);
+        } else {
+            fail("invalid unicode escape");
+        }
+    }
+    return value;
+}
+
+void append_utf8(std::string & out, uint32_t code_point)
+{
+    if (code_point < 0x80) {
+        out += (char)code_point;
+    } else if (code_point < 0x800) {
+        out += (char)(0xc0 | code_point >> 6);
+        out += (char)(0x80 | (code_point & 0x3f));
+    } else if (code_point < 0x10000) {
+        out += (char)(0xe0 | code_point >> 12);
+        out += (char)(0x80 | (code_point >> 6 & 0x3f));
+        out += (char)(0x80 | (code_point & 0x3f));
+    } else {
+        out += (char)(0xf0 | code_point >> 18);
+        out += (char)(0x80 | (code_point >> 12 & 0x3f));
+        out += (char)(0x80 | (code_point >> 6 & 0x3f));
+        out += (char)(0x80 | (code_point & 0x3f));
+    }
+}
+
+// The contents of a string with its escapes decoded into out
+void unescape(std::string_view contents, std::string & out)
+{
+    out.clear();
+    for (size_t pos = 0;;) {
+        size_t backslash = contents.find('\\', pos);
+        out.append(contents.substr(pos, backslash - pos));
+        if (backslash == std::string_view::npos) {
+            return;
+        }
+        pos = backslash + 2;
+        switch (contents[backslash + 1]) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            uint32_t code_point = hex4(contents, pos);
+            pos += 4;
+            if (code_point >= 0xd800 && code_point < 0xdc00) {
+                if (contents.substr(pos, 2) != "\\u") {
+                    fail("unpaired surrogate");
+                }
+                uint32_t low = hex4(contents, pos + 2);
+                if (low < 0xdc00 || low >= 0xe000) {
+                    fail("unpaired surrogate");
+                }
+                code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                pos += 6;
+            } else if (code_point >= 0xdc00 && code_point < 0xe000) {
+                fail("unpaired surrogate");
+            }
+            append_utf8(out, code_point);
+            break;
+        }
+        default:
+            fail("invalid escape");
+        }
+    }
+}
+
+inline bool ends_token(std::string_view text, size_t pos)
+{
+    if (pos == text.size()) {
+        return true;
+    }
+    switch (text[pos]) {
+    case ' ': case '\t': case '\n': case '\r':
+    case ',': case ':': case ']': case '}': case '[': case '{':
+        return true;
+    default:
+        return false;
+    }
+}
+
+// As boost::json::parse_options
+constexpr size_t max_depth = 32;
+
+/*
+ * Stage two walks the structural positions with an explicit stack of
+ * open arrays and objects, validating the grammar and calling the same
+ * handler boost's parser does.  Strings without escapes are handed over
+ * as ranges of the document; numbers are parsed as boost does, to int64
+ * when they fit, then uint64, then double.
+ */
+template <bool Checked>
+class Stage2
+{
+public:
+    Stage2(ParseHandler<Checked> & handler, std::string_view text, uint32_t const* index, size_t count, std::string & unescaped)
+    : handler_(handler), text_(text), at_(index), end_(index + count), unescaped_(unescaped)
+    { }
+
+    void parse(std::vector<std::pair<bool, size_t>> & open)
+    {
+        open.clear();
+        handler_.on_document_begin(ec_);
+        size_t pos;
+    value:
+        pos = next();
+        switch (text_[pos]) {
+        case '{':
+            if (open.size() == max_depth) {
+                fail("document too deep");
+            }
+            handler_.on_object_begin(ec_);
+            open.emplace_back(false, 0);
+            pos = next();
+            if (text_[pos] == '}') {
+                goto close;
+            }
+            goto key;
+        case '[':
+            if (open.size() == max_depth) {
+                fail("document too deep");
+            }
+            handler_.on_array_begin(ec_);
+            open.emplace_back(true, 0);
+            if (at_ != end_ && text_[*at_] == ']') {
+                pos = next();
+                goto close;
+            }
+            goto value;
+        case '"': {
+            auto contents = string(pos);
+            handler_.on_string(contents, contents.size(), ec_);
+            break;
+        }
+        case ']': case '}': case ',': case ':':
+            fail("expected a value");
+        default:
+            scalar(pos);
+        }
+    value_done:
+        if (open.empty()) {
+            if (at_ != end_) {
+                fail("data after the end of the document");
+            }
+            handler_.on_document_end(ec_);
+            return;
+        }
+        ++ open.back().second;
+        pos = next();
+        if (text_[pos] == ',') {
+            if (open.back().first) {
+                goto value;
+            }
+            pos = next();
+            goto key;
+        }
+    close:
+        if (text_[pos] != (open.back().first ? ']' : '}')) {
+            fail("expected ',' or the end of an array or object");
+        }
+        if (open.back().first) {
+            handler_.on_array_end(open.back().second, ec_);
+        } else {
+            handler_.on_object_end(open.back().second, ec_);
+        }
+        open.pop_back();
+        goto value_done;
+    key:
+        if (text_[pos] != '"') {
+            fail("expected a key");
+        }
+        {
+            auto contents = string(pos);
+            handler_.on_key(contents, contents.size(), ec_);
+        }
+        if (text_[next()] != ':') {
+            fail("expected ':'");
+        }
+        goto value;
+    }
+
+private:
+    size_t next()
+    {
+        if (at_ == end_) {
+            fail("unexpected end of document");
+        }
+        return *at_ ++;
+    }
+
+    // The contents of the string opening at pos; the next structural is its closing quote
+    boost::json::string_view string(size_t pos)
+    {
+        size_t close = next();
+        assert(text_[close] == '"');
+        std::string_view contents = text_.substr(pos + 1, close - pos - 1);
+        if (std::memchr(contents.data(), '\\', contents.size()) == nullptr) {
+            return {contents.data(), contents.size()};
+        }
+        unescape(contents, unescaped_);
+        return {unescaped_.data(), unescaped_.size()};
+    }
+
+    void literal(size_t pos, std::string_view word)
+    {
+        if (text_.compare(pos, word.size(), word) != 0 || !ends_token(text_, pos + word.size())) {
+            fail("invalid literal");
+        }
+    }
+
+    void scalar(size_t pos)
+    {
+        switch (text_[pos]) {
+        case 't':
+            literal(pos, "true");
+            handler_.on_bool(true, ec_);
+            return;
+        case 'f':
+            literal(pos, "false");
+            handler_.on_bool(false, ec_);
+            return;
+        case 'n':
+            literal(pos, "null");
+            handler_.on_null(ec_);
+            return;
+        }
+        auto digit = [&](size_t at) { return at < text_.size() && text_[at] >= '0' && text_[at] <= '9'; };
+        size_t end = pos;
+        bool negative = text_[end] == '-', integral = true;
+        if (negative) {
+            ++ end;
+        }
+        size_t digits = end;
+        if (!digit(end)) {
+            fail("invalid number");
+        }
+        if (text_[end] == '0') {
+            ++ end;
+        } else {
+            while (digit(end)) ++ end;
+        }
+        if (end < text_.size() && text_[end] == '.') {
+            integral = false;
+            ++ end;
+            if (!digit(end)) {
+                fail("invalid number");
+            }
+            while (digit(end)) ++ end;
+        }
+        if (end < text_.size() && (text_[end] | 0x20) == 'e') {
+            integral = false;
+            ++ end;
+            if (end < text_.size() && (text_[end] == '+' || text_[end] == '-')) {
+                ++ end;
+            }
+            if (!digit(end)) {
+                fail("invalid number");
+            }
+            while (digit(end)) ++ end;
+        }
+        if (!ends_token(text_, end)) {
+            fail("invalid number");
+        }
+        boost::json::string_view token(text_.data() + pos, end - pos);
+        if (integral) {
+            uint64_t value = 0;
+            bool overflow = false;
+            for (size_t at = digits; at < end; ++ at) {
+                overflow = overflow
+                    || __builtin_mul_overflow(value, 10, &value)
+                    || __builtin_add_overflow(value, (uint64_t)(text_[at] - '0'), &value);
+            }
+            if (!overflow) {
+                if (!negative && value <= (uint64_t)std::numeric_limits<int64_t>::max()) {
+                    handler_.on_int64((int64_t)value, token, ec_);
+                    return;
+                } else if (!negative) {
+                    handler_.on_uint64(value, token, ec_);
+                    return;
+                } else if (value <= (uint64_t)std::numeric_limits<int64_t>::max() + 1) {
+                    handler_.on_int64((int64_t)(0 - value), token, ec_);
+                    return;
+                }
+            }
+        }
+        double value;
+        auto [ptr, ec] = std::from_chars(text_.data() + pos, text_.data() + end, value);
+        if (ec == std::errc::result_out_of_range) {
+            // too large or too small for a double; strtod rounds to infinity or zero
+            value = std::strtod(std::string(text_.substr(pos, end - pos)).c_str(), nullptr);
+        } else if (ec != std::errc() || ptr != text_.data() + end) {
+            fail("invalid number");
+        }
+        handler_.on_double(value, token, ec_);
+    }
+
+    ParseHandler<Checked> & handler_;
+    std::string_view text_;
+    uint32_t const* at_;
+    uint32_t const* end_;
+    boost::json::error_code ec_;
+    std::string & unescaped_; // the last string with escapes, which the handler copies
+};
+
+}
+
+bool simd_backend()
+{
+    static bool const simd = [] {
+        char const* backend = std::getenv("ZINC_JSON_BACKEND");
+        if (backend == nullptr || *backend == 0) {
+#ifdef ZINC_JSON_SIMD
+            return true;
+#else
+            return false;
+#endif
+        }
+        std::string_view name = backend;
+        if (name != "simd" && name != "boost") {
+            throw std::invalid_argument("ZINC_JSON_BACKEND must be boost or simd");
+        }
+        return name == "simd";
+    }();
+    return simd;
+}
+
+template <bool Checked>
+void simd_parse(ParseHandler<Checked> & handler, std::string_view text)
+{
+    static thread_local std::vector<uint32_t> index;
+    static thread_local std::vector<std::pair<bool, size_t>> open; // is an array, values so far
+    static thread_local std::string unescaped;
+    size_t count = index_structurals(text, index);
+    Stage2<Checked>(handler, text, index.data(), count, unescaped).parse(open);
+}
+
+template void simd_parse<false>(ParseHandler<false> &, std::string_view);
+template void simd_parse<true>(ParseHandler<true> &, std::string_view);
+
+}
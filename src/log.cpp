@@ -1,11 +1,37 @@
 #include <zinc/log.hpp>
 #include <zinc/configuration.hpp>
-#include <boost/json.hpp>
 
+#include "log_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
 #include <chrono>
-#include <fstream>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
 #include <iomanip>
+#include <iterator>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
 
 namespace zinc {
 
@@ -23,32 +49,913 @@ static std::tm & launch_time()
     return launch_tm;
 }
 
-void Log::log(std::span<StringViewPair const> fields)
+std::string inflate_log(std::string const& path)
+{
+    gzFile gz = gzopen(path.c_str(), "rb");
+    if (!gz) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    std::string text;
+    for (;;) {
+        size_t size = text.size();
+        size_t more = std::clamp(size, (size_t)1 << 16, (size_t)1 << 30);
+        text.resize(size + more);
+        int read = gzread(gz, text.data() + size, (unsigned)more);
+        if (read < 0) {
+            int error;
+            std::string message = path + ": " + gzerror(gz, &error);
+            gzclose(gz);
+            throw std::invalid_argument(message);
+        }
+        text.resize(size + (size_t)read);
+        if (read == 0) {
+            break;
+        }
+    }
+    gzclose(gz);
+    return text;
+}
+
+bool is_log_name(std::string_view name)
+{
+    for (std::string_view suffix : {".log", ".cbor", ".log.gz", ".cbor.gz"}) {
+        if (name.ends_with(suffix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_log_closed(std::string const& path)
+{
+    if (path.ends_with(".gz")) {
+        return true;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool closed = flock(fd, LOCK_EX | LOCK_NB) == 0;
+    ::close(fd);
+    return closed;
+}
+
+namespace {
+
+// Replaces a closed log file with a gzip file of it, returning false if it is not closed
+bool compress(std::string const& path)
 {
-    static struct LogStream : public std::ofstream
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(fd);
+        return false;
+    }
+    std::string temporary = path + ".gz.tmp";
+    try {
+        MappedFile file(path);
+        gzFile gz = gzopen(temporary.c_str(), "wb");
+        if (!gz) {
+            throw std::system_error(errno, std::generic_category(), temporary);
+        }
+        bool ok = true;
+        for (std::string_view text = file.text(); ok && !text.empty();) {
+            auto size = std::min(text.size(), (size_t)1 << 30);
+            ok = gzwrite(gz, text.data(), (unsigned)size) == (int)size;
+            text.remove_prefix(size);
+        }
+        ok = gzclose(gz) == Z_OK && ok;
+        if (!ok) {
+            throw std::runtime_error("could not compress " + path);
+        }
+        // aged by when it was last written
+        std::filesystem::last_write_time(temporary, std::filesystem::last_write_time(path));
+        std::filesystem::rename(temporary, path + ".gz");
+        std::filesystem::remove(path);
+    } catch (...) {
+        ::close(fd);
+        std::filesystem::remove(temporary);
+        throw;
+    }
+    ::close(fd);
+    return true;
+}
+
+// The rotation of the [log] section of log.ini, if there is one
+Log::Rotation configured_rotation()
+{
+    Log::Rotation rotation;
+    try {
+        Configuration config(zinc::span<std::string_view>({"log.ini"}));
+        auto setting = [&](std::string_view key, size_t & value) {
+            std::string & text = config[zinc::span<std::string_view>({"log", key})];
+            std::from_chars(text.data(), text.data() + text.size(), value);
+        };
+        setting("max_size", rotation.max_size);
+        setting("max_age", rotation.max_age);
+        setting("keep_files", rotation.keep_files);
+        setting("keep_days", rotation.keep_days);
+        setting("keep_bytes", rotation.keep_bytes);
+        std::string & compress = config[zinc::span<std::string_view>({"log", "compress"})];
+        if (!compress.empty()) {
+            rotation.compress = compress == "true" || compress == "yes" || compress == "1";
+        }
+    } catch (std::exception const&) {
+        // without a configuration, the defaults
+    }
+    return rotation;
+}
+
+// Compresses closed files and removes the oldest past the limits, until stop is set
+void tidy_files(Log::Rotation const& rotation, std::atomic<bool> const* stop = nullptr)
+{
+    // one at a time in the process; other processes skip files being compressed
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    try {
+        Log::Index index(stop); // brought up to date while the files are uncompressed
+    } catch (std::exception const&) {
+        // caught up by the next
+    }
+    auto stopped = [&]{ return stop && stop->load(); }; // a pass cut short is finished by the next
+    if (stopped()) {
+        return;
+    }
+    auto paths = Log::files();
+    bool limited = rotation.keep_files || rotation.keep_bytes || rotation.keep_days;
+    if (rotation.compress) {
+        for (auto & path : paths) {
+            if (stopped()) {
+                return;
+            }
+            if (!path.ends_with(".gz") && compress(path)) {
+                path += ".gz";
+            }
+        }
+    }
+
+    if (!limited) {
+        return;
+    }
+
+    struct Kept {
+        std::string path;
+        size_t size;
+        std::filesystem::file_time_type time;
+    };
+    std::vector<Kept> kept;
+    size_t total = 0;
+    for (auto & path : paths) {
+        std::error_code ec;
+        auto size = (size_t)std::filesystem::file_size(path, ec);
+        auto time = std::filesystem::last_write_time(path, ec);
+        if (!ec) {
+            kept.push_back({path, size, time});
+            total += size;
+        }
+    }
+    auto oldest = std::filesystem::file_time_type::clock::now() - std::chrono::days((long)rotation.keep_days);
+    size_t count = kept.size();
+    for (auto & file : kept) {
+        bool expired = (rotation.keep_files && count > rotation.keep_files) ||
+            (rotation.keep_bytes && total > rotation.keep_bytes) ||
+            (rotation.keep_days && file.time < oldest);
+        if (expired && is_log_closed(file.path) && std::filesystem::remove(file.path)) {
+            -- count;
+            total -= file.size;
+        }
+    }
+}
+
+void on_crash(int signal, siginfo_t* info, void* context);
+
+/*
+ * Entries are formatted on the logging thread and handed through a
+ * bounded ring of slots to a writer thread, which writes each run of
+ * them with one writev.  The ring is Vyukov's bounded queue: a slot's
+ * sequence says whether it is free for the entry at a position of the
+ * ring or holds it, so logging threads claim positions with a CAS and
+ * never lock.  Slots keep their strings, which are swapped with the
+ * logging thread's, so once warm no entry allocates.
+ */
+class Logger
+{
+public:
+    static constexpr size_t capacity = 1024; // slots, a power of two
+    static constexpr size_t max_batch = 256; // entries per writev
+    static constexpr int crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+    std::atomic<Log::Format> format = Log::Format::JSONL;
+    std::atomic<Log::Sync> sync = Log::Sync::FLUSH;
+    std::atomic<std::string const*> session; // one of sessions_
+
+    static Logger & instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger()
+    : rotation_(configured_rotation())
     {
-        LogStream()
+        for (size_t idx = 0; idx < capacity; ++ idx) {
+            slots_[idx].sequence.store(idx, std::memory_order_relaxed);
+        }
+        std::stringstream session_ss;
+        session_ss << std::put_time(&launch_time(), "%FT%TZ") << '-' << getpid();
+        session.store(&sessions_.emplace_back(session_ss.str()));
+        writer_ = std::thread([this]{ work(); });
+        tidier_ = std::thread([this]{ tidy(); });
+    }
+
+    /*
+     * Handles the crash signals on an alternate stack of the calling
+     * thread, which a stack overflow leaves room on, unless the thread
+     * has one.  Only the first call installs them.
+     */
+    void install_crash_handler()
+    {
+        static std::once_flag installed;
+        std::call_once(installed, [this]{
+            stack_t current = {};
+            if (sigaltstack(nullptr, &current) == 0 && (current.ss_flags & SS_DISABLE)) {
+                static std::vector<char> alternate(std::max((size_t)SIGSTKSZ, (size_t)64 << 10));
+                stack_t stack = {};
+                stack.ss_sp = alternate.data();
+                stack.ss_size = alternate.size();
+                sigaltstack(&stack, nullptr);
+            }
+            crashing_logger.store(this);
+            struct sigaction action = {};
+            action.sa_sigaction = on_crash;
+            action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+            sigemptyset(&action.sa_mask);
+            for (size_t idx = 0; idx < std::size(crash_signals); ++ idx) {
+                sigaction(crash_signals[idx], &action, &previous_actions[idx]);
+            }
+        });
+    }
+
+    // Writes what was logged, then syncs the files unless Sync::NEVER
+    ~Logger()
+    {
+        crashing_logger.store(nullptr);
+        stopping_.store(true);
+        wake();
+        writer_.join();
         {
+            // the tidier is waiting, or will see stopping_
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        tidy_changed_.notify_one();
+        tidier_.join();
+        for (auto & fd : fds_) {
+            if (fd >= 0) {
+                if (sync.load() != Log::Sync::NEVER) {
+                    fdatasync(fd);
+                }
+                ::close(fd);
+            }
+        }
+    }
+
+    // Takes the contents of record, leaving it with a spent record's storage
+    void push(Log::Format format, std::string & record)
+    {
+        std::call_once(opened_[(size_t)format], [&]{ open(format, true); });
+        uint64_t position = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[position & (capacity - 1)];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence == position) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (sequence < position) {
+                // full until the writer catches up
+                std::this_thread::yield();
+                position = head_.load(std::memory_order_relaxed);
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->format = format;
+        std::swap(slot->record, record);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        wake();
+    }
+
+    // Entries keep views of every session that was set
+    void set_session(std::string_view session)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        this->session.store(&sessions_.emplace_back(session));
+    }
+
+    Log::Rotation rotation()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return rotation_;
+    }
+
+    void rotation(Log::Rotation const& rotation)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rotation_ = rotation;
+            tidy_requested_ = true;
+        }
+        tidy_changed_.notify_one();
+    }
+
+    // Waits until everything logged so far is written and synced
+    void flush()
+    {
+        uint64_t target = head_.load(std::memory_order_acquire);
+        uint64_t requested = flush_to_.load();
+        while (requested < target && !flush_to_.compare_exchange_weak(requested, target)) { }
+        wake();
+        for (uint64_t synced; (synced = synced_.load(std::memory_order_acquire)) < target;) {
+            synced_.wait(synced, std::memory_order_acquire);
+        }
+    }
+
+    /*
+     * Writes the entries the writer has not yet, from a signal handler:
+     * nothing here locks or allocates.  The writer stops at its next
+     * batch, and the entries of one it is in the middle of may be
+     * written twice.
+     */
+    void crash_flush()
+    {
+        crashed_.store(true);
+        for (uint64_t position = written_.load(std::memory_order_acquire);; ++ position) {
+            Slot & slot = slots_[position & (capacity - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+                break;
+            }
+            iovec iov = {slot.record.data(), slot.record.size()};
+            write_all(fds_[(size_t)slot.format], &iov, 1);
+        }
+        for (auto & fd : fds_) {
+            if (fd >= 0 && sync.load() != Log::Sync::NEVER) {
+                fdatasync(fd);
+            }
+        }
+    }
+
+    static inline std::atomic<Logger*> crashing_logger = nullptr;
+    static inline struct sigaction previous_actions[std::size(crash_signals)];
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        Log::Format format;
+        std::string record;
+    };
+
+    // Opens the file of the launch, or a new one named by the time
+    void open(Log::Format format, bool at_launch)
+    {
+        std::tm time = launch_time();
+        if (!at_launch) {
+            std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            localtime_r(&now, &time);
+        }
+        std::string path;
+        int fd = -1;
+        for (size_t count = 0;; ++ count) {
             std::stringstream logfn_ss;
-            logfn_ss << std::put_time(&launch_time(), "%FT%TZ.log");
-            open(Configuration::path_local(zinc::span<std::string_view>({
+            logfn_ss << std::put_time(&time, "%FT%TZ");
+            if (count) {
+                logfn_ss << '_' << count; // after the first of the second
+            }
+            logfn_ss << (format == Log::Format::CBOR ? ".cbor" : ".log");
+            path = Configuration::path_local(zinc::span<std::string_view>({
                 "logs",
                 logfn_ss.str()
-            })).begin());
+            }));
+            if (!at_launch && (std::filesystem::exists(path) || std::filesystem::exists(path + ".gz"))) {
+                continue;
+            }
+            // a file that cannot be opened is not logged to
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                break;
+            }
+            flock(fd, LOCK_SH); // see is_log_closed()
+            // another process's tidier may have compressed and unlinked it before it was locked
+            struct stat opened, named;
+            if (fstat(fd, &opened) != 0 || (opened.st_nlink > 0 && ::stat(path.c_str(), &named) == 0
+                    && named.st_dev == opened.st_dev && named.st_ino == opened.st_ino)) {
+                break;
+            }
+            ::close(fd);
+            fd = -1;
+            at_launch = false; // a new name, rather than the compressed one again
+        }
+        struct stat st;
+        sizes_[(size_t)format] = fd >= 0 && fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+        opened_at_[(size_t)format] = std::chrono::steady_clock::now();
+        fds_[(size_t)format] = fd;
+    }
+
+    // Moves on to a new file once the open one is full or old enough
+    void rotate(Log::Format format)
+    {
+        auto rotation = this->rotation();
+        size_t idx = (size_t)format;
+        bool due = (rotation.max_size && sizes_[idx] >= rotation.max_size) ||
+            (rotation.max_age && std::chrono::steady_clock::now() - opened_at_[idx] >= std::chrono::seconds(rotation.max_age));
+        int fd = fds_[idx];
+        if (!due || fd < 0) {
+            return;
+        }
+        try {
+            open(format, false);
+        } catch (std::exception const&) {
+            fds_[idx] = fd; // keeps the full one
+            opened_at_[idx] = std::chrono::steady_clock::now();
+            return;
+        }
+        if (sync.load() != Log::Sync::NEVER) {
+            fdatasync(fd);
+        }
+        ::close(fd);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tidy_requested_ = true;
+        }
+        tidy_changed_.notify_one();
+    }
+
+    // Compresses closed files and removes old ones when asked, in the background
+    void tidy()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            tidy_changed_.wait(lock, [&]{ return tidy_requested_ || stopping_.load(); });
+            if (stopping_.load()) {
+                return;
+            }
+            tidy_requested_ = false;
+            auto rotation = rotation_;
+            lock.unlock();
+            try {
+                tidy_files(rotation, &stopping_);
+            } catch (std::exception const&) {
+                // tried again after the next rotation
+            }
+            lock.lock();
+        }
+    }
+
+    void wake()
+    {
+        wakes_.fetch_add(1, std::memory_order_release);
+        wakes_.notify_one();
+    }
+
+    static void write_all(int fd, iovec* iov, size_t count)
+    {
+        while (fd >= 0 && count) {
+            ssize_t size = ::writev(fd, iov, (int)count);
+            if (size < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return; // the entries are lost
+            }
+            // past what was written
+            auto written = (size_t)size;
+            for (; count && written >= iov->iov_len; ++ iov, -- count) {
+                written -= iov->iov_len;
+            }
+            if (count) {
+                iov->iov_base = (char*)iov->iov_base + written;
+                iov->iov_len -= written;
+            }
+        }
+    }
+
+    // Writes the published entries in runs of the same format
+    void drain()
+    {
+        uint64_t position = written_.load(std::memory_order_relaxed);
+        iovec iov[max_batch];
+        while (!crashed_.load(std::memory_order_relaxed)) {
+            size_t count = 0;
+            Log::Format format = Log::Format::JSONL;
+            for (; count < max_batch; ++ count) {
+                Slot & slot = slots_[(position + count) & (capacity - 1)];
+                if (slot.sequence.load(std::memory_order_acquire) != position + count + 1 ||
+                    (count && slot.format != format)) {
+                    break;
+                }
+                format = slot.format;
+                iov[count] = {slot.record.data(), slot.record.size()};
+            }
+            if (!count) {
+                return;
+            }
+            rotate(format);
+            for (size_t idx = 0; idx < count; ++ idx) {
+                sizes_[(size_t)format] += iov[idx].iov_len;
+            }
+            write_all(fds_[(size_t)format], iov, count);
+            if (sync.load(std::memory_order_relaxed) == Log::Sync::BATCH) {
+                fdatasync(fds_[(size_t)format]);
+            }
+            for (size_t idx = 0; idx < count; ++ idx) {
+                slots_[(position + idx) & (capacity - 1)].sequence.store(position + idx + capacity, std::memory_order_release);
+            }
+            position += count;
+            written_.store(position, std::memory_order_release);
+        }
+    }
+
+    void work()
+    {
+        for (;;) {
+            uint64_t wakes = wakes_.load(std::memory_order_acquire);
+            drain();
+            uint64_t written = written_.load(std::memory_order_relaxed);
+            if (flush_to_.load() > synced_.load(std::memory_order_relaxed) && written >= flush_to_.load()) {
+                if (sync.load() != Log::Sync::NEVER) {
+                    for (auto & fd : fds_) {
+                        if (fd >= 0) {
+                            fdatasync(fd);
+                        }
+                    }
+                }
+                synced_.store(written, std::memory_order_release);
+                synced_.notify_all();
+            }
+            if (stopping_.load() && written == head_.load()) {
+                return;
+            }
+            wakes_.wait(wakes, std::memory_order_acquire);
+        }
+    }
+
+    Slot slots_[capacity];
+    alignas(64) std::atomic<uint64_t> head_ = 0; // the next position to claim
+    alignas(64) std::atomic<uint64_t> wakes_ = 0; // changed to wake the writer
+    std::atomic<uint64_t> written_ = 0; // entries before this are written
+    std::atomic<uint64_t> flush_to_ = 0; // to be synced for flush()
+    std::atomic<uint64_t> synced_ = 0;
+    std::atomic<bool> stopping_ = false;
+    std::atomic<bool> crashed_ = false;
+    std::atomic<int> fds_[2] = {-1, -1};
+    std::once_flag opened_[2];
+    size_t sizes_[2] = {}; // of the open files
+    std::chrono::steady_clock::time_point opened_at_[2];
+    std::thread writer_;
+
+    std::mutex mutex_; // for the following
+    std::deque<std::string> sessions_;
+    Log::Rotation rotation_;
+    bool tidy_requested_ = true; // at launch
+    std::condition_variable tidy_changed_;
+    std::thread tidier_;
+};
+
+void on_crash(int signal, siginfo_t* info, void*)
+{
+    if (Logger* logger = Logger::crashing_logger.exchange(nullptr)) {
+        logger->crash_flush();
+    }
+    // the previous handler takes it from here
+    for (size_t idx = 0; idx < std::size(Logger::crash_signals); ++ idx) {
+        if (Logger::crash_signals[idx] == signal) {
+            sigaction(signal, &Logger::previous_actions[idx], nullptr);
         }
-    } logf;
-    boost::json::object obj;
+    }
+    if (info->si_code <= 0) {
+        raise(signal); // sent rather than a fault, which recurs on return
+    }
+}
 
+// The initial byte and argument of a CBOR item, in the shortest form
+void cbor_head(std::string & out, uint8_t major, uint64_t n)
+{
+    major = (uint8_t)(major << 5);
+    if (n < 24) {
+        out += (char)(major | n);
+        return;
+    }
+    size_t size = n <= 0xff ? 1 : n <= 0xffff ? 2 : n <= 0xffffffff ? 4 : 8;
+    out += (char)(major | (24 + std::countr_zero(size)));
+    for (size_t idx = size; idx --;) {
+        out += (char)(n >> (idx * 8));
+    }
+}
+
+}
+
+void Log::log(std::span<StringViewPair const> fields)
+{
     auto now = std::chrono::system_clock::now();
     auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+    double ts = (double)now_ms / 1000.0;
 
-    for (auto&& [key, value] : fields) {
-        obj[key] = value;
+    auto & logger = Logger::instance();
+    Format format = logger.format.load(std::memory_order_relaxed);
+    std::string_view session = *logger.session.load(std::memory_order_acquire);
+    static thread_local std::string record;
+    record.clear();
+    if (format == Format::CBOR) {
+        // a map of the fields, ts and session, after its length
+        record.assign(4, 0);
+        cbor_head(record, 5, fields.size() + 2);
+        for (auto&& [key, value] : fields) {
+            cbor_head(record, 3, key.size());
+            record += key;
+            cbor_head(record, 3, value.size());
+            record += value;
+        }
+        cbor_head(record, 3, 2);
+        record += "ts";
+        record += (char)0xfb;
+        uint64_t bits;
+        std::memcpy(&bits, &ts, sizeof(bits));
+        for (size_t idx = 8; idx --;) {
+            record += (char)(bits >> (idx * 8));
+        }
+        cbor_head(record, 3, 7);
+        record += "session";
+        cbor_head(record, 3, session.size());
+        record += session;
+        auto size = (uint32_t)(record.size() - 4);
+        for (size_t idx = 0; idx < 4; ++ idx) {
+            record[idx] = (char)(size >> (idx * 8));
+        }
+    } else {
+        static thread_local JSON::Builder builder(true);
+        builder.begin_object();
+        for (auto&& [key, value] : fields) {
+            builder.insert(key, value);
+        }
+        builder.insert("ts", ts).insert("session", session).end();
+        (*builder.finish()).encode(record);
+        record += '\n';
     }
+    logger.push(format, record);
+}
 
-    obj["ts"] = (double)now_ms / 1000.0;
+void Log::format(Format format)
+{
+    Logger::instance().format.store(format);
+}
 
-    logf << obj << std::endl;
+std::string_view Log::session()
+{
+    return *Logger::instance().session.load();
+}
+
+void Log::session(std::string_view session)
+{
+    Logger::instance().set_session(session);
+}
+
+void Log::sync(Sync sync)
+{
+    Logger::instance().sync.store(sync);
+}
+
+void Log::flush()
+{
+    Logger::instance().flush();
+}
+
+void Log::install_crash_handler()
+{
+    Logger::instance().install_crash_handler();
+}
+
+void Log::rotation(Rotation const& rotation)
+{
+    Logger::instance().rotation(rotation);
+}
+
+void Log::tidy()
+{
+    tidy_files(Logger::instance().rotation());
+}
+
+std::vector<std::string> Log::files()
+{
+    std::vector<std::string> paths;
+    std::filesystem::path dir(Configuration::path_local(zinc::span<std::string_view>({"logs"})));
+    if (std::filesystem::exists(dir)) {
+        for (auto & entry : std::filesystem::directory_iterator(dir)) {
+            if (entry.is_regular_file() && is_log_name(entry.path().filename().string())) {
+                paths.emplace_back(entry.path().string());
+            }
+        }
+    }
+    // the names are launch and rotation times
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+namespace {
+
+/*
+ * Ranges of whole records, lines or length-prefixed CBOR items, are
+ * handed to the threads in file order.  Only a window of ranges past
+ * the last one the reader has finished may be parsed ahead, so a large
+ * file is never held parsed whole.
+ */
+class RecordReader
+{
+public:
+    static constexpr size_t range_size = 64 * 1024;
+    static constexpr size_t ranges_per_thread = 4; // the window
+
+    struct Range {
+        std::string_view text;
+        std::vector<JSON::Doc> docs;
+        std::exception_ptr error;
+    };
+
+    LogText file;
+    std::vector<Range> ranges;
+    std::vector<bool> done;
+    std::deque<size_t> completed; // unordered, as threads finished them
+
+    RecordReader(std::string_view path, bool ordered, size_t threads)
+    : file(std::string(path)), ordered_(ordered), cbor_(path.ends_with(".cbor") || path.ends_with(".cbor.gz"))
+    {
+        std::string_view text = file.text();
+        for (size_t start = 0; start < text.size();) {
+            size_t end;
+            if (cbor_) {
+                end = start;
+                while (end < start + range_size && end < text.size()) {
+                    size_t record = end + 4 + log_record_size(text.substr(end));
+                    // a torn final record is left with the last range
+                    end = record <= text.size() ? record : text.size();
+                }
+            } else {
+                end = text.find('\n', std::min(start + range_size, text.size() - 1));
+                end = end == std::string_view::npos ? text.size() : end + 1;
+            }
+            ranges.push_back({text.substr(start, end - start), {}, {}});
+            start = end;
+        }
+        done.resize(ranges.size());
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        threads = std::min(threads, ranges.size());
+        window_ = threads * ranges_per_thread;
+        for (size_t idx = 0; idx < threads; ++ idx) {
+            threads_.emplace_back([this]{ work(); });
+        }
+    }
+
+    ~RecordReader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        changed_.notify_all();
+        for (auto & thread : threads_) {
+            thread.join();
+        }
+    }
+
+    // The next range to read from, waiting until it is parsed
+    Range & next()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t idx;
+        if (ordered_) {
+            idx = taken_;
+            changed_.wait(lock, [&]{ return done[idx]; });
+        } else {
+            changed_.wait(lock, [&]{ return !completed.empty(); });
+            idx = completed.front();
+            completed.pop_front();
+        }
+        ++ taken_;
+        return ranges[idx];
+    }
+
+    // Frees the documents of a range that has been read
+    void finished(Range & range)
+    {
+        range.docs = std::vector<JSON::Doc>();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++ finished_;
+        }
+        changed_.notify_all();
+    }
+
+private:
+    void work()
+    {
+        JSON::Parser parser;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            changed_.wait(lock, [&]{ return stopping_ || next_ == ranges.size() || next_ < finished_ + window_; });
+            if (stopping_ || next_ == ranges.size()) {
+                return;
+            }
+            size_t idx = next_ ++;
+            lock.unlock();
+            if (cbor_) {
+                parse_cbor(ranges[idx], idx + 1 == ranges.size());
+            } else {
+                parse(parser, ranges[idx], idx + 1 == ranges.size());
+            }
+            lock.lock();
+            done[idx] = true;
+            if (!ordered_) {
+                completed.push_back(idx);
+            }
+            changed_.notify_all();
+        }
+    }
+
+    static void parse(JSON::Parser & parser, Range & range, bool last)
+    {
+        try {
+            std::string_view text = range.text;
+            while (!text.empty()) {
+                size_t end = text.find('\n');
+                std::string_view line = text.substr(0, end);
+                text = end == std::string_view::npos ? std::string_view{} : text.substr(end + 1);
+                if (trim(line).empty()) {
+                    continue;
+                }
+                try {
+                    // the mapping outlives the documents
+                    range.docs.push_back(parser.decode(line, true));
+                } catch (std::invalid_argument const&) {
+                    if (!(last && end == std::string_view::npos)) {
+                        throw;
+                    }
+                }
+            }
+        } catch (...) {
+            range.error = std::current_exception();
+        }
+    }
+
+    static void parse_cbor(Range & range, bool last)
+    {
+        try {
+            std::string_view text = range.text;
+            while (!text.empty()) {
+                size_t size = log_record_size(text);
+                if (text.size() < 4 || size > text.size() - 4) {
+                    if (last) {
+                        break;
+                    }
+                    throw std::invalid_argument("cbor log record is truncated");
+                }
+                range.docs.push_back(JSON::decode_cbor(text.substr(4, size), true));
+                text.remove_prefix(4 + size);
+            }
+        } catch (...) {
+            range.error = std::current_exception();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<std::thread> threads_;
+    bool ordered_;
+    bool cbor_;
+    size_t window_ = 0;
+    size_t next_ = 0; // the range the next thread takes
+    size_t taken_ = 0; // ranges the reader has taken
+    size_t finished_ = 0; // ranges the reader is done with
+    bool stopping_ = false;
+};
+
+}
+
+zinc::generator<JSON const&> Log::read(std::string_view path, bool ordered, size_t threads)
+{
+    RecordReader reader(path, ordered, threads);
+    for (size_t count = 0; count < reader.ranges.size(); ++ count) {
+        auto & range = reader.next();
+        if (range.error) {
+            std::rethrow_exception(range.error);
+        }
+        for (auto & doc : range.docs) {
+            co_yield *doc;
+        }
+        reader.finished(range);
+    }
 }
 
 static struct EnsureLaunchTimeCreated
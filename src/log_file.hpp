@@ -0,0 +1,123 @@
+#pragma once
+
+/*
+ * Reading the files of the log, shared by Log and Log::Index: files
+ * are JSON Lines or length-prefixed CBOR records, either possibly
+ * gzipped once closed.
+ */
+
+#include <zinc/log.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace zinc {
+
+// A file mapped into memory for reading
+class MappedFile
+{
+public:
+    MappedFile(std::string_view path)
+    {
+        std::string name(path);
+        int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), name);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), name);
+        }
+        size_ = (size_t)st.st_size;
+        if (size_) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            int error = errno;
+            ::close(fd);
+            if (data == MAP_FAILED) {
+                throw std::system_error(error, std::generic_category(), name);
+            }
+            madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = (char const*)data;
+        } else {
+            ::close(fd);
+        }
+    }
+
+    ~MappedFile()
+    {
+        if (size_) {
+            munmap((void*)data_, size_);
+        }
+    }
+
+    std::string_view text() const
+    {
+        return {data_, size_};
+    }
+
+private:
+    char const* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// The contents of a gzip file
+std::string inflate_log(std::string const& path);
+
+// Whether a file name is that of a log file, compressed or not
+bool is_log_name(std::string_view name);
+
+/*
+ * Whether a log file is no longer being written.  Each writer holds a
+ * shared lock on the file it has open, in whichever process.
+ */
+bool is_log_closed(std::string const& path);
+
+// The uncompressed text of a log file, mapped or inflated
+class LogText
+{
+public:
+    LogText(std::string const& path)
+    {
+        if (path.ends_with(".gz")) {
+            inflated_ = inflate_log(path);
+            text_ = inflated_;
+        } else {
+            text_ = file_.emplace(path).text();
+        }
+    }
+
+    std::string_view text() const
+    {
+        return text_;
+    }
+
+private:
+    std::optional<MappedFile> file_;
+    std::string inflated_;
+    std::string_view text_;
+};
+
+// The little-endian length that precedes each CBOR record, or past the end if torn
+inline size_t log_record_size(std::string_view text)
+{
+    if (text.size() < 4) {
+        return text.size();
+    }
+    size_t size = 0;
+    for (size_t idx = 4; idx --;) {
+        size = (size << 8) | (uint8_t)text[idx];
+    }
+    return size;
+}
+
+} // namespace zinc
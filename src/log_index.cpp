@@ -0,0 +1,558 @@
+#include <zinc/log.hpp>
+#include <zinc/configuration.hpp>
+
+#include "log_file.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/file.h>
+
+namespace zinc {
+
+namespace {
+
+constexpr std::string_view index_magic = "zinc log index 1\n";
+constexpr size_t max_word_size = 64; // longer runs are not words anyone searches for
+
+struct IndexedFile {
+    std::string name; // without .gz
+    uint64_t indexed = 0; // bytes of it that are indexed
+    bool complete = false; // closed and indexed to its end
+};
+
+// An entry as it is kept, with its session and role interned
+struct IndexedEntry {
+    uint32_t file;
+    uint32_t size;
+    uint64_t offset;
+    double ts;
+    uint32_t session;
+    uint32_t role;
+};
+
+// Calls visit with each word: a run of ASCII letters and digits, lowercased, and bytes past ASCII
+template <typename Visit>
+void for_each_word(std::string_view text, Visit && visit)
+{
+    std::string word;
+    for (size_t idx = 0; idx <= text.size(); ++ idx) {
+        auto c = idx < text.size() ? (unsigned char)text[idx] : (unsigned char)' ';
+        if (c >= 0x80 || std::isalnum(c)) {
+            word += (char)std::tolower(c);
+        } else if (!word.empty()) {
+            if (word.size() <= max_word_size) {
+                visit(word);
+            }
+            word.clear();
+        }
+    }
+}
+
+// Reads the saved index, in native byte order
+class Cursor
+{
+public:
+    Cursor(std::string_view data)
+    : data_(data)
+    { }
+
+    std::string_view bytes(size_t size)
+    {
+        if (size > data_.size()) {
+            throw std::runtime_error("log index is truncated");
+        }
+        auto result = data_.substr(0, size);
+        data_.remove_prefix(size);
+        return result;
+    }
+
+    template <typename T>
+    T get()
+    {
+        T value;
+        std::memcpy(&value, bytes(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    std::string_view string()
+    {
+        return bytes(get<uint32_t>());
+    }
+
+private:
+    std::string_view data_;
+};
+
+template <typename T>
+void put(std::string & out, T value)
+{
+    out.append((char const*)&value, sizeof(T));
+}
+
+void put_string(std::string & out, std::string_view string)
+{
+    put(out, (uint32_t)string.size());
+    out += string;
+}
+
+struct IndexImpl
+{
+    std::vector<IndexedFile> files;
+    std::deque<std::string> strings; // sessions and roles
+    std::unordered_map<std::string_view, uint32_t> string_ids;
+    std::vector<IndexedEntry> entries;
+    std::unordered_map<std::string, std::vector<uint32_t>> postings; // entries by word, in order
+
+    std::string read_name; // of the file last read from
+    std::optional<LogText> read_text;
+
+    void clear()
+    {
+        files.clear();
+        strings.clear();
+        string_ids.clear();
+        entries.clear();
+        postings.clear();
+    }
+
+    uint32_t intern(std::string_view string)
+    {
+        auto it = string_ids.find(string);
+        if (it != string_ids.end()) {
+            return it->second;
+        }
+        auto id = (uint32_t)strings.size();
+        string_ids.emplace(strings.emplace_back(string), id);
+        return id;
+    }
+
+    Log::Index::Entry entry(uint32_t id) const
+    {
+        auto & entry = entries[id];
+        return {entry.file, entry.size, entry.offset, entry.ts, strings[entry.session], strings[entry.role]};
+    }
+
+    void load(std::string_view data)
+    {
+        Cursor cursor(data);
+        if (cursor.bytes(index_magic.size()) != index_magic) {
+            throw std::runtime_error("not a log index");
+        }
+        files.resize(cursor.get<uint32_t>());
+        for (auto & file : files) {
+            file.name = cursor.string();
+            file.indexed = cursor.get<uint64_t>();
+            file.complete = cursor.get<uint8_t>();
+        }
+        for (auto count = cursor.get<uint32_t>(); count --;) {
+            intern(cursor.string());
+        }
+        entries.resize(cursor.get<uint32_t>());
+        auto bytes = cursor.bytes(entries.size() * sizeof(IndexedEntry));
+        std::memcpy(entries.data(), bytes.data(), bytes.size());
+        for (auto count = cursor.get<uint32_t>(); count --;) {
+            auto & list = postings[std::string(cursor.string())];
+            list.resize(cursor.get<uint32_t>());
+            bytes = cursor.bytes(list.size() * sizeof(uint32_t));
+            std::memcpy(list.data(), bytes.data(), bytes.size());
+        }
+        for (auto & entry : entries) {
+            if (entry.file >= files.size() || entry.session >= strings.size() || entry.role >= strings.size()) {
+                throw std::runtime_error("log index is inconsistent");
+            }
+        }
+    }
+
+    std::string save() const
+    {
+        std::string out(index_magic);
+        put(out, (uint32_t)files.size());
+        for (auto & file : files) {
+            put_string(out, file.name);
+            put(out, file.indexed);
+            put(out, (uint8_t)file.complete);
+        }
+        put(out, (uint32_t)strings.size());
+        for (auto & string : strings) {
+            put_string(out, string);
+        }
+        put(out, (uint32_t)entries.size());
+        out.append((char const*)entries.data(), entries.size() * sizeof(IndexedEntry));
+        put(out, (uint32_t)postings.size());
+        for (auto & [word, list] : postings) {
+            put_string(out, word);
+            put(out, (uint32_t)list.size());
+            out.append((char const*)list.data(), list.size() * sizeof(uint32_t));
+        }
+        return out;
+    }
+
+    void add(uint32_t file, uint64_t offset, uint32_t size, JSON const& json)
+    {
+        if (json.index() != JSON::OBJECT) {
+            return;
+        }
+        auto & name = files[file].name;
+        auto string = [&](std::string_view key) {
+            JSON const* value = json.find(key);
+            return value && value->index() == JSON::STRING ? value->string() : std::string_view{};
+        };
+        JSON const* ts = json.find("ts");
+        std::string_view session = string("session");
+        if (session.empty()) {
+            // a file's session is the launch that it is named by
+            session = std::string_view(name).substr(0, name.find_first_of("._"));
+        }
+        auto id = (uint32_t)entries.size();
+        entries.push_back({
+            file, size, offset,
+            !ts ? 0 : ts->index() == JSON::NUMBER ? std::get<double>(*ts) : ts->index() == JSON::INTEGER ? (double)std::get<long>(*ts) : 0,
+            intern(session),
+            intern(string("role"))
+        });
+        std::string_view content = string("content");
+        if (!content.empty()) {
+            for_each_word(content, [&](std::string const& word) {
+                auto & list = postings[word];
+                if (list.empty() || list.back() != id) {
+                    list.push_back(id);
+                }
+            });
+        }
+    }
+
+    // Indexes what was logged to each file past what is indexed, returning whether any was
+    bool scan(std::atomic<bool> const* stop)
+    {
+        bool changed = false;
+        std::unordered_map<std::string, uint32_t> file_ids;
+        for (uint32_t id = 0; id < files.size(); ++ id) {
+            file_ids.emplace(files[id].name, id);
+        }
+        std::vector<bool> present(files.size());
+        JSON::Parser parser;
+        bool stopped = false;
+        for (auto path : Log::files()) {
+            if (stop && stop->load()) {
+                stopped = true; // the files left are neither indexed nor forgotten
+                break;
+            }
+            std::string name = std::filesystem::path(path).filename().string();
+            if (name.ends_with(".gz")) {
+                name.resize(name.size() - 3);
+            }
+            auto it = file_ids.find(name);
+            auto id = it != file_ids.end() ? it->second : (uint32_t)files.size();
+            if (id == files.size()) {
+                files.push_back({name});
+                file_ids.emplace(name, id);
+                present.push_back(true);
+                changed = true;
+            }
+            present[id] = true;
+            if (files[id].complete) {
+                continue;
+            }
+            // closed before it is read, so nothing is written past what is read
+            bool closed = is_log_closed(path);
+            std::optional<LogText> log;
+            try {
+                log.emplace(path);
+            } catch (std::system_error const&) {
+                // compressed by another process since it was listed, or removed
+                if (path.ends_with(".gz") || !std::filesystem::exists(path + ".gz")) {
+                    continue;
+                }
+                path += ".gz";
+                closed = true;
+                try {
+                    log.emplace(path);
+                } catch (std::system_error const&) {
+                    continue; // removed since
+                }
+            }
+            std::string_view text = log->text();
+            bool cbor = name.ends_with(".cbor");
+            size_t position = std::min((size_t)files[id].indexed, text.size());
+            while (position < text.size()) {
+                size_t offset;
+                std::string_view record;
+                if (cbor) {
+                    size_t size = log_record_size(text.substr(position));
+                    if (text.size() - position < 4 || size > text.size() - position - 4) {
+                        break; // still being written
+                    }
+                    offset = position + 4;
+                    record = text.substr(offset, size);
+                } else {
+                    size_t end = text.find('\n', position);
+                    if (end == std::string_view::npos) {
+                        break;
+                    }
+                    offset = position;
+                    record = text.substr(offset, end - offset);
+                }
+                position = offset + record.size() + !cbor;
+                try {
+                    JSON::Doc doc = cbor ? JSON::decode_cbor(record, true) : parser.decode(record, true);
+                    add(id, offset, (uint32_t)record.size(), *doc);
+                } catch (std::invalid_argument const&) {
+                    // not an entry
+                }
+            }
+            bool complete = closed && position == text.size();
+            changed = changed || position != files[id].indexed || complete != files[id].complete;
+            files[id].indexed = position;
+            files[id].complete = complete;
+        }
+        if (!stopped && std::find(present.begin(), present.end(), false) != present.end()) {
+            remove_files(present);
+            changed = true;
+        }
+        return changed;
+    }
+
+    // Forgets the files that are no longer there, renumbering the rest
+    void remove_files(std::vector<bool> const& present)
+    {
+        std::vector<uint32_t> file_ids(files.size()), entry_ids(entries.size(), UINT32_MAX);
+        uint32_t kept = 0;
+        for (uint32_t id = 0; id < files.size(); ++ id) {
+            if (present[id]) {
+                file_ids[id] = kept;
+                if (kept != id) {
+                    files[kept] = std::move(files[id]);
+                }
+                ++ kept;
+            }
+        }
+        files.resize(kept);
+        kept = 0;
+        for (uint32_t id = 0; id < entries.size(); ++ id) {
+            if (present[entries[id].file]) {
+                entry_ids[id] = kept;
+                entries[kept] = entries[id];
+                entries[kept ++].file = file_ids[entries[id].file];
+            }
+        }
+        entries.resize(kept);
+        for (auto it = postings.begin(); it != postings.end();) {
+            auto & list = it->second;
+            size_t size = 0;
+            for (auto id : list) {
+                if (entry_ids[id] != UINT32_MAX) {
+                    list[size ++] = entry_ids[id];
+                }
+            }
+            list.resize(size);
+            it = list.empty() ? postings.erase(it) : std::next(it);
+        }
+    }
+};
+
+}
+
+Log::Index::Index(std::atomic<bool> const* stop)
+: impl_(new IndexImpl)
+{
+    update(stop);
+}
+
+Log::Index::Index(Index&&index)
+: impl_(index.impl_)
+{
+    index.impl_ = nullptr;
+}
+
+Log::Index::~Index()
+{
+    delete (IndexImpl*)impl_;
+}
+
+void Log::Index::update(std::atomic<bool> const* stop)
+{
+    auto & impl = *(IndexImpl*)impl_;
+    std::string path(Configuration::path_local(zinc::span<std::string_view>({"logs", "index"})));
+    std::string lock_path = path + ".lock";
+    // one process at a time, starting from what the last one saved
+    int lock = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0) {
+        throw std::system_error(errno, std::generic_category(), lock_path);
+    }
+    flock(lock, LOCK_EX);
+    try {
+        impl.clear();
+        if (std::filesystem::exists(path)) {
+            try {
+                impl.load(MappedFile(path).text());
+            } catch (std::runtime_error const&) {
+                impl.clear(); // rebuilt
+            }
+        }
+        if (impl.scan(stop)) {
+            std::string temporary = path + ".tmp";
+            std::string data = impl.save();
+            std::ofstream(temporary, std::ios::binary).write(data.data(), (std::streamsize)data.size());
+            std::filesystem::rename(temporary, path);
+        }
+    } catch (...) {
+        ::close(lock);
+        throw;
+    }
+    ::close(lock);
+}
+
+std::vector<Log::Index::Entry> Log::Index::search(std::string_view query, size_t limit) const
+{
+    auto & impl = *(IndexImpl*)impl_;
+    std::vector<std::vector<uint32_t> const*> lists;
+    bool missing = false;
+    for_each_word(query, [&](std::string const& word) {
+        auto it = impl.postings.find(word);
+        if (it == impl.postings.end()) {
+            missing = true;
+        } else {
+            lists.push_back(&it->second);
+        }
+    });
+    if (missing || lists.empty()) {
+        return {};
+    }
+    // the entries of the shortest list that are in every other
+    std::sort(lists.begin(), lists.end(), [](auto a, auto b) { return a->size() < b->size(); });
+    std::vector<uint32_t> found;
+    for (auto id : *lists[0]) {
+        bool everywhere = true;
+        for (size_t idx = 1; everywhere && idx < lists.size(); ++ idx) {
+            everywhere = std::binary_search(lists[idx]->begin(), lists[idx]->end(), id);
+        }
+        if (everywhere) {
+            found.push_back(id);
+        }
+    }
+    // entries logged within the clock's resolution keep the order they were indexed in
+    auto newest = [&](uint32_t a, uint32_t b) {
+        return impl.entries[a].ts != impl.entries[b].ts ? impl.entries[a].ts > impl.entries[b].ts : a > b;
+    };
+    limit = std::min(limit, found.size());
+    std::partial_sort(found.begin(), found.begin() + (ssize_t)limit, found.end(), newest);
+    std::vector<Entry> result;
+    for (size_t idx = 0; idx < limit; ++ idx) {
+        result.push_back(impl.entry(found[idx]));
+    }
+    return result;
+}
+
+std::vector<Log::Index::Entry> Log::Index::session(std::string_view session) const
+{
+    auto & impl = *(IndexImpl*)impl_;
+    std::vector<Entry> result;
+    auto it = impl.string_ids.find(session);
+    if (it == impl.string_ids.end()) {
+        return result;
+    }
+    for (uint32_t id = 0; id < impl.entries.size(); ++ id) {
+        if (impl.entries[id].session == it->second) {
+            result.push_back(impl.entry(id));
+        }
+    }
+    // a resumed session spans launches
+    std::stable_sort(result.begin(), result.end(), [](Entry const& a, Entry const& b) { return a.ts < b.ts; });
+    return result;
+}
+
+std::vector<std::string_view> Log::Index::sessions() const
+{
+    auto & impl = *(IndexImpl*)impl_;
+    std::unordered_map<uint32_t, double> last;
+    for (auto & entry : impl.entries) {
+        auto & ts = last[entry.session];
+        ts = std::max(ts, entry.ts);
+    }
+    std::vector<std::pair<double, uint32_t>> order;
+    for (auto [session, ts] : last) {
+        order.emplace_back(ts, session);
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<std::string_view> result;
+    for (auto [ts, session] : order) {
+        result.push_back(impl.strings[session]);
+    }
+    return result;
+}
+
+std::vector<StringPair> Log::Index::conversation(std::string_view session)
+{
+    std::vector<StringPair> messages;
+    for (auto & entry : this->session(session)) {
+        if (entry.role != "user" && entry.role != "assistant") {
+            continue;
+        }
+        auto doc = read(entry);
+        JSON const* content = (*doc).find("content");
+        if (!content || content->index() != JSON::STRING) {
+            continue;
+        }
+        if (!messages.empty() && messages.back().first == entry.role) {
+            messages.back().second += content->string();
+        } else {
+            messages.emplace_back(entry.role, content->string());
+        }
+    }
+    return messages;
+}
+
+std::string_view Log::Index::last_conversation() const
+{
+    auto & impl = *(IndexImpl*)impl_;
+    uint32_t session = 0;
+    double last = 0;
+    bool found = false;
+    for (auto & entry : impl.entries) {
+        std::string_view role = impl.strings[entry.role];
+        if ((role == "user" || role == "assistant") && (!found || entry.ts >= last)) {
+            session = entry.session;
+            last = entry.ts;
+            found = true;
+        }
+    }
+    return found ? std::string_view(impl.strings[session]) : std::string_view();
+}
+
+JSON::Doc Log::Index::read(Entry const& entry)
+{
+    auto & impl = *(IndexImpl*)impl_;
+    if (entry.file >= impl.files.size()) {
+        throw std::out_of_range("log index has no such file");
+    }
+    auto & name = impl.files[entry.file].name;
+    // an open file is read again once it has grown past what was read
+    if (impl.read_name != name || !impl.read_text || entry.offset + entry.size > impl.read_text->text().size()) {
+        std::string path(Configuration::path_local(zinc::span<std::string_view>({"logs", name})));
+        if (!std::filesystem::exists(path)) {
+            path += ".gz";
+        }
+        impl.read_text.reset();
+        impl.read_text.emplace(path);
+        impl.read_name = name;
+    }
+    std::string_view text = impl.read_text->text();
+    if (entry.offset + entry.size > text.size()) {
+        throw std::out_of_range("log index entry is past the end of " + name);
+    }
+    std::string_view record = text.substr(entry.offset, entry.size);
+    return name.ends_with(".cbor") ? JSON::decode_cbor(record) : JSON::decode(record);
+}
+
+}
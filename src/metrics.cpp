@@ -0,0 +1,242 @@
+#include <zinc/metrics.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <variant>
+
+namespace zinc {
+
+namespace {
+
+struct Metric {
+    std::string help;
+    double unit;
+    std::variant<std::unique_ptr<Metrics::Counter>, std::unique_ptr<Metrics::Gauge>, std::unique_ptr<Metrics::Histogram>> value;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, Metric, std::less<>> metrics;
+    std::string path; // written at exit
+
+    static Registry & instance()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    ~Registry()
+    {
+        if (!path.empty()) {
+            try {
+                write(path);
+            } catch (std::exception const&) {
+            }
+        }
+    }
+
+    template <typename Kind>
+    Kind & find(std::string_view name, std::string_view help, double unit = 1)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = metrics.find(name);
+        if (it == metrics.end()) {
+            it = metrics.emplace(std::string(name), Metric{std::string(help), unit, std::make_unique<Kind>()}).first;
+        }
+        auto value = std::get_if<std::unique_ptr<Kind>>(&it->second.value);
+        if (!value) {
+            throw std::logic_error("metric registered as another kind: " + std::string(name));
+        }
+        return **value;
+    }
+
+    std::string text();
+    void write(std::string_view path);
+};
+
+struct MetricsFromEnvironment
+{
+    MetricsFromEnvironment()
+    {
+        char const* path = std::getenv("ZINC_METRICS");
+        if (path && *path) {
+            Registry::instance().path = path;
+            Metrics::enable();
+        }
+    }
+} metrics_from_environment;
+
+// Help text escapes backslashes and newlines
+std::string escape_help(std::string_view help)
+{
+    std::string escaped;
+    for (char c : help) {
+        if (c == '\\') {
+            escaped += "\\\\";
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+}
+
+uint64_t Metrics::Counter::value() const
+{
+    uint64_t total = 0;
+    for (auto & shard : shards_) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Metrics::Histogram::bucket_max(size_t bucket)
+{
+    if (bucket < ((size_t)2 << sub_bits)) {
+        return bucket;
+    }
+    unsigned shift = (unsigned)(bucket >> sub_bits) - 1;
+    uint64_t lowest = (((uint64_t)1 << sub_bits) + (bucket & ((1u << sub_bits) - 1))) << shift;
+    return lowest + (((uint64_t)1 << shift) - 1);
+}
+
+uint64_t Metrics::Histogram::count() const
+{
+    uint64_t total = 0;
+    for (size_t idx = 0; idx < buckets; ++ idx) {
+        total += count(idx);
+    }
+    return total;
+}
+
+uint64_t Metrics::Histogram::count(size_t bucket) const
+{
+    uint64_t total = 0;
+    for (auto & shard : shards_) {
+        total += shard.counts[bucket].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Metrics::Histogram::sum() const
+{
+    uint64_t total = 0;
+    for (auto & shard : shards_) {
+        total += shard.sum.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Metrics::Histogram::quantile(double q) const
+{
+    uint64_t counts[buckets], total = 0;
+    for (size_t idx = 0; idx < buckets; ++ idx) {
+        counts[idx] = count(idx);
+        total += counts[idx];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // the rank of the quantile, from 1 to total
+    auto rank = (uint64_t)(q * (double)total + 0.5);
+    rank = std::min(std::max(rank, (uint64_t)1), total);
+    uint64_t seen = 0;
+    for (size_t idx = 0; idx < buckets; ++ idx) {
+        seen += counts[idx];
+        if (seen >= rank) {
+            return bucket_max(idx);
+        }
+    }
+    return bucket_max(buckets - 1);
+}
+
+void Metrics::enable(bool enabled)
+{
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+Metrics::Counter & Metrics::counter(std::string_view name, std::string_view help)
+{
+    return Registry::instance().find<Counter>(name, help);
+}
+
+Metrics::Gauge & Metrics::gauge(std::string_view name, std::string_view help)
+{
+    return Registry::instance().find<Gauge>(name, help);
+}
+
+Metrics::Histogram & Metrics::histogram(std::string_view name, std::string_view help, double unit)
+{
+    return Registry::instance().find<Histogram>(name, help, unit);
+}
+
+std::string Registry::text()
+{
+    std::ostringstream out;
+    out.precision(12); // enough for the buckets, short of the noise of scaling by the unit
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto & [name, metric] : metrics) {
+        out << "# HELP " << name << " " << escape_help(metric.help) << "\n";
+        if (auto counter = std::get_if<std::unique_ptr<Metrics::Counter>>(&metric.value)) {
+            out << "# TYPE " << name << " counter\n";
+            out << name << " " << (*counter)->value() << "\n";
+        } else if (auto gauge = std::get_if<std::unique_ptr<Metrics::Gauge>>(&metric.value)) {
+            out << "# TYPE " << name << " gauge\n";
+            out << name << " " << (*gauge)->value() << "\n";
+        } else {
+            auto & histogram = *std::get<std::unique_ptr<Metrics::Histogram>>(metric.value);
+            out << "# TYPE " << name << " histogram\n";
+            // buckets are cumulative, and end at each power of two, so every scrape has the same bounds
+            constexpr size_t per_power = (size_t)1 << Metrics::Histogram::sub_bits;
+            uint64_t cumulative = 0;
+            for (size_t idx = 0; idx < Metrics::Histogram::buckets; ++ idx) {
+                cumulative += histogram.count(idx);
+                if ((idx + 1) % per_power == 0 && idx + 1 < Metrics::Histogram::buckets) {
+                    out << name << "_bucket{le=\"" << (double)Metrics::Histogram::bucket_max(idx) * metric.unit << "\"} " << cumulative << "\n";
+                }
+            }
+            out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+            out << name << "_sum " << (double)histogram.sum() * metric.unit << "\n";
+            out << name << "_count " << cumulative << "\n";
+        }
+    }
+    return out.str();
+}
+
+void Registry::write(std::string_view path)
+{
+    std::string out = text();
+    std::string temp_path = std::string(path) + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), (std::streamsize)out.size());
+        if (!file.flush()) {
+            throw std::runtime_error("failed to write metrics " + temp_path);
+        }
+    }
+    if (std::rename(temp_path.c_str(), std::string(path).c_str()) != 0) {
+        throw std::runtime_error("failed to write metrics " + std::string(path));
+    }
+}
+
+std::string Metrics::text()
+{
+    return Registry::instance().text();
+}
+
+void Metrics::write(std::string_view path)
+{
+    Registry::instance().write(path);
+}
+
+} // namespace zinc
@@ -1,11 +1,18 @@
 #include <zinc/http.hpp>
 #include <zinc/openai.hpp>
+#include <zinc/trace.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstring>
+#include <future>
+#include <mutex>
 #include <stdexcept>
 #include <string_view>
+#include <system_error>
 #include <unordered_map>
+#include <vector>
 
 #include <iostream>
 
@@ -31,12 +38,66 @@ static void validate_params(
     }
 }
 
+namespace {
+
+// The fields read from each streamed chunk; everything else is skipped as it is parsed
+struct ChunkDelta {
+    std::string_view content;
+    static constexpr auto json_fields()
+    { return std::array{JSON::field<&ChunkDelta::content>("content")}; }
+};
+struct ChunkChoice {
+    long index = 0;
+    std::string_view text; // completions
+    ChunkDelta delta; // chat completions
+    std::string_view finish_reason;
+    static constexpr auto json_fields()
+    {
+        return std::array{
+            JSON::field<&ChunkChoice::index>("index"),
+            JSON::field<&ChunkChoice::text>("text"),
+            JSON::field<&ChunkChoice::delta>("delta"),
+            JSON::field<&ChunkChoice::finish_reason>("finish_reason"),
+        };
+    }
+};
+struct ChunkUsage {
+    long prompt_tokens = -1, completion_tokens = -1, total_tokens = -1; // -1 when absent or null
+    static constexpr auto json_fields()
+    {
+        return std::array{
+            JSON::field<&ChunkUsage::prompt_tokens>("prompt_tokens"),
+            JSON::field<&ChunkUsage::completion_tokens>("completion_tokens"),
+            JSON::field<&ChunkUsage::total_tokens>("total_tokens"),
+        };
+    }
+};
+struct Chunk {
+    std::vector<ChunkChoice> choices;
+    ChunkUsage usage;
+    std::string_view object, message, type; // of errors
+    static constexpr auto json_fields()
+    {
+        return std::array{
+            JSON::field<&Chunk::choices>("choices"),
+            JSON::field<&Chunk::usage>("usage"),
+            JSON::field<&Chunk::object>("object"),
+            JSON::field<&Chunk::message>("message"),
+            JSON::field<&Chunk::type>("Type"),
+        };
+    }
+};
+
+}
+
 // Helper function to process response lines
 static zinc::generator<std::span<OpenAI::StreamPart>> process_response_lines(zinc::generator<std::string_view> & response_lines) {
 
-    static thread_local std::vector<std::vector<std::pair<std::string_view, JSON>>> jsonvalues_list;
-    //static thread_local std::vector<std::unordered_map<std::string_view, OpenAI::JSONValue>> jsonvalues_list;
-    static thread_local std::vector<OpenAI::StreamPart> streamparts;
+    std::vector<OpenAI::StreamPart> streamparts; // in the frame, as a completion's parts outlive the start of another
+    JSON::Binder binder;
+    JSON::Builder builder(true);
+    Chunk chunk;
+    bool first = true;
 
     for (auto line : response_lines) {
         if (line.empty() || line == "\n") continue; // Skip empty lines
@@ -46,90 +107,50 @@ static zinc::generator<std::span<OpenAI::StreamPart>> process_response_lines(zin
         if (line == "[DONE]") continue;//break; // End of stream
 
         if (line.front() == '{') { // JSON object
-            JSON::Doc doc = JSON::decode(line);
-            JSON::Array choices;
-            try {
-                choices = (*doc)["choices"].array();
-            } catch (std::out_of_range&) {
-                if ((*doc)["object"] == JSON("error")) {
-                    // got this from targon, could be forwarded from vllm
-                    // "{\"message\":\"Failed mid-generation, please retry\",\"object\":\"error\",\"Type\":\"InternalServerError\",\"code\":500}"
-                    auto msg = (*doc)["message"].string();
-                    if (msg.find("please retry") != decltype(msg)::npos || (*doc)["Type"].string() == "APITimeoutError") {
-                        throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again));
-                    }
-                    throw std::runtime_error(std::string(msg));
+            chunk.choices.clear();
+            chunk.usage = {};
+            chunk.object = chunk.message = chunk.type = {};
+            binder.bind(line, chunk); // the line outlives the parts yielded from it
+            if (chunk.object == "error") {
+                // got this from targon, could be forwarded from vllm
+                // "{\"message\":\"Failed mid-generation, please retry\",\"object\":\"error\",\"Type\":\"InternalServerError\",\"code\":500}"
+                if (chunk.message.find("please retry") != std::string_view::npos || chunk.type == "APITimeoutError") {
+                    throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again));
                 }
+                throw std::runtime_error(std::string(chunk.message));
+            }
+            // each part's data is its choice's index and finish_reason, and its line the raw chunk
+            builder.begin_array();
+            for (auto & choice : chunk.choices) {
+                builder.begin_object().insert("index", choice.index);
+                builder.insert("finish_reason", choice.finish_reason.empty() ? JSON() : JSON(choice.finish_reason)).end();
             }
-            if (choices.size() > jsonvalues_list.size()) {
-                jsonvalues_list.resize(choices.size());
+            JSON::Doc data = builder.end().finish();
+            std::optional<OpenAI::Usage> usage;
+            if (chunk.usage.total_tokens >= 0) {
+                usage = OpenAI::Usage{
+                    std::max(chunk.usage.prompt_tokens, 0L),
+                    std::max(chunk.usage.completion_tokens, 0L),
+                    chunk.usage.total_tokens,
+                };
             }
-            //static std::string dbg;
-            //dbg = choices[0]["delta"]["content"].string();
             streamparts.clear();
-            for (size_t idx = 0; idx < choices.size(); ++ idx) {
-                std::string_view text;
-                auto & choice = choices[idx].object();
-                auto & jsonvalues = jsonvalues_list[idx];
-                jsonvalues.clear();//resize(choice.size());
-                //int key_idx = -1;
-                for (const auto& [key, value] : choice) {
-                    if (value.index() == JSON::STRING && key == "text") {
-                        text = value.string();
-                    } else if (value.index() == JSON::OBJECT && key == "delta") {
-                        text = value["content"].string();
-                    }
-#if 0
-                    JSON val;
-                    //++ key_idx;
-                    switch (value.index()) {
-                    case JSON::STRING:
-                        //val = value.get_string();
-                        if (key == "text") {
-                            text = value.string();//std::get<std::string_view>(val);
-                        }
-                        break;
-                    /*
-                    case json::kind::double_:
-                        val = value.get_double(); break;
-                    case json::kind::int64:
-                        val = value.get_int64(); break;
-                    case json::kind::uint64:
-                        val = static_cast<long>(value.get_uint64()); break;
-                    case json::kind::bool_:
-                        val = value.get_bool(); break;
-                    case json::kind::null:
-                        val = nullptr; break;
-                    //case json::kind::array:
-                    //    val = value.get_
-                    //    */
-                    case JSON::OBJECT:
-/*                        if (key == "delta") {
-                            val = value.at("content").get_string();
-                            //jsonvalues["delta.content"] = val;
-                            jsonvalues.emplace_back("delta.content", val);*/
-                            //jsonvalues[key_idx].first = "delta.content";
-                            //jsonvalues[key_idx].second = val;
-                            text = value["content"].string();
-                            break;
-/*                            continue;
-                        } else {
-                            throw std::runtime_error("unexpected json value type");
-                        }
-                        */
-                    /*
-                    default:
-                        throw std::runtime_error("unexpected json value type");
-                    */
-                    }
-                    //jsonvalues[key] = val;
-                    jsonvalues.emplace_back(key, val);
-                    //jsonvalues[key_idx].first = key;
-                    //jsonvalues[key_idx].second = val;
-#endif
-                }
-                /*streamparts.emplace_back(text).data = jsonvalues;*/
-                streamparts.emplace_back(text).data = choice;
+            for (size_t idx = 0; idx < chunk.choices.size(); ++ idx) {
+                auto & choice = chunk.choices[idx];
+                auto & part = streamparts.emplace_back(choice.text.empty() ? choice.delta.content : choice.text);
+                part.data = (*data)[idx];
+                part.line = line;
+                part.usage = usage;
+            }
+            if (streamparts.empty() && usage) {
+                // usage may come in a last chunk of its own, without choices
+                auto & part = streamparts.emplace_back();
+                part.line = line;
+                part.usage = usage;
+            }
+            if (first) {
+                Trace::mark("openai first token");
+                first = false;
             }
             co_yield streamparts;
 
@@ -151,6 +172,7 @@ OpenAI::OpenAI(
     std::span<KeyJSONPair const> defaults)
 : endpoint_completions_(std::string(url) + "/v1/completions"),
   endpoint_chats_(std::string(url) + "/v1/chat/completions"),
+  endpoint_embeddings_(std::string(url) + "/v1/embeddings"),
   bearer_("Bearer " + std::string(key)),
   headers_{
     {"Authorization", bearer_},
@@ -175,10 +197,50 @@ OpenAI::OpenAI(
 
 OpenAI::~OpenAI() = default;
 
+std::string_view OpenAI::EscapedPrompt::update(std::span<std::string_view const> prompt, size_t reused)
+{
+    // the escaping is kept up to the last mark within the reused bytes, and the rest escaped in pieces
+    constexpr size_t piece_size = 4096;
+    while (!marks_.empty() && marks_.back().first > reused) {
+        marks_.pop_back();
+    }
+    size_t from = marks_.empty() ? 0 : marks_.back().first;
+    text_.resize(marks_.empty() ? 0 : marks_.back().second);
+    size_t offset = 0;
+    for (auto part : prompt) {
+        for (size_t start = from > offset ? from - offset : 0, end; start < part.size(); start = end) {
+            // pieces end between characters, not within one's UTF-8 bytes
+            end = std::min(start + piece_size, part.size());
+            while (end < part.size() && (part[end] & 0xc0) == 0x80 && end > start + 1) {
+                -- end;
+            }
+            std::string_view quoted = JSON(part.substr(start, end - start)).encode();
+            text_.append(quoted.substr(1, quoted.size() - 2));
+            marks_.emplace_back(offset + end, text_.size());
+        }
+        offset += part.size();
+    }
+    return text_;
+}
+
 zinc::generator<OpenAI::StreamPart const&> OpenAI::complete(
     std::string_view prompt,
     std::span<KeyJSONPair const> params
 ) const {
+    EscapedPrompt escaped;
+    for (auto const& part : complete(std::span<std::string_view const>(&prompt, 1), escaped, 0, params)) {
+        co_yield part;
+    }
+    co_return;
+}
+
+zinc::generator<OpenAI::StreamPart const&> OpenAI::complete(
+    std::span<std::string_view const> prompt,
+    EscapedPrompt & escaped,
+    size_t reused,
+    std::span<KeyJSONPair const> params
+) const {
+    Trace::Span prompt_span("openai prompt");
     static thread_local std::unordered_map<std::string_view, JSON> combined_params;
     combined_params.clear();
     for (const auto& [k, v] : defaults_) {
@@ -191,17 +253,25 @@ zinc::generator<OpenAI::StreamPart const&> OpenAI::complete(
     // Validate parameters
     validate_params(combined_params);
 
-    // Build request body
-    static std::vector<KeyJSONPair> paramsvec;
-    paramsvec.clear();
+    // Build request body, whose parts the request reads as long as this completion streams
+    static thread_local JSON::Builder builder(true);
+    builder.begin_object();
     for (const auto& [key, value] : combined_params) {
-        paramsvec.emplace_back(key, value);
+        builder.insert(key, value);
     }
-    paramsvec.emplace_back("prompt", prompt);
-    std::string_view body = JSON(paramsvec).encode();
+    std::string head;
+    (*builder.end().finish()).encode(head);
+    head.back() = ',';
+    head += "\"prompt\":\"";
+
+    std::string_view text = escaped.update(prompt, reused);
+    std::string_view body[] = {head, text, "\"}"};
+    prompt_span.arg("bytes", (long)(head.size() + text.size())).arg("reused", (long)reused);
+    prompt_span.end();
 
     // Perform request
-    auto response_lines = HTTP::request_lines("POST", endpoint_completions_, body, headers_);
+    Trace::Span span("openai complete");
+    auto response_lines = HTTP::request_lines_gather("POST", endpoint_completions_, body, headers_);
 
     // Process response lines
     for (auto const& streamparts : process_response_lines(response_lines)) {
@@ -216,6 +286,7 @@ zinc::generator<OpenAI::StreamPart const&> OpenAI::chat(
     std::span<RoleContentPair const> messages,
     std::span<KeyJSONPair const> params
 ) const {
+    Trace::Span prompt_span("openai prompt");
     static thread_local std::unordered_map<std::string_view, JSON> combined_params;
     combined_params.clear();
     for (const auto& [k, v] : defaults_) {
@@ -230,32 +301,28 @@ zinc::generator<OpenAI::StreamPart const&> OpenAI::chat(
     validate_params(combined_params);
 
     // Build request body
-    static std::vector<KeyJSONPair> paramsvec;
-    static std::vector<JSON> messagesvec;
-    static std::vector<KeyJSONPair> messagesvec_inner;
-    paramsvec.clear();
-    messagesvec.clear();
-    messagesvec_inner.clear();
-    messagesvec_inner.reserve(messages.size() * 2);
+    static thread_local JSON::Builder builder(true);
+    builder.begin_object();
     for (const auto& [key, value] : combined_params) {
-        paramsvec.emplace_back(key, value);
+        builder.insert(key, value);
     }
+    builder.key("messages").begin_array();
     for (const auto& [role, content] : messages) {
-        auto start = messagesvec_inner.end();
-        messagesvec_inner.emplace_back("role", role);
-        messagesvec_inner.emplace_back("content", content);
-        messagesvec.emplace_back(std::span(start, messagesvec_inner.end()));
+        builder.begin_object().insert("role", role).insert("content", content).end();
     }
-    paramsvec.emplace_back("messages", messagesvec);
-    std::string_view body = JSON(paramsvec).encode();
+    JSON::Doc request = builder.end().end().finish();
+    std::string_view body = (*request).encode();
+    prompt_span.arg("messages", (long)messages.size()).arg("bytes", (long)body.size());
+    prompt_span.end();
 
     // Perform request
+    Trace::Span span("openai chat");
     auto response_lines = HTTP::request_lines("POST", endpoint_chats_, body, headers_);
 
     // Process response lines
     for (auto const& streamparts : process_response_lines(response_lines)) {
         if (streamparts.size() > 1) throw std::runtime_error("server returned more than 1 completion");
-        if (streamparts.size() > 0 && streamparts[0].size() > 0) {
+        if (streamparts.size() > 0 && (streamparts[0].size() > 0 || streamparts[0].usage)) {
             co_yield streamparts[0];
         }
     }
@@ -263,4 +330,143 @@ zinc::generator<OpenAI::StreamPart const&> OpenAI::chat(
     co_return;
 }
 
+OpenAI::Embeddings OpenAI::embed(
+    std::span<std::string_view const> inputs,
+    std::span<KeyJSONPair const> params,
+    size_t max_batch_inputs,
+    size_t max_batch_tokens,
+    size_t max_concurrency
+) const {
+    Embeddings result;
+
+    // Deduplicate inputs, assigning each distinct string a row
+    std::unordered_map<std::string_view, size_t> unique_rows;
+    std::vector<std::string_view> uniques;
+    result.rows.reserve(inputs.size());
+    for (auto input : inputs) {
+        auto [it, inserted] = unique_rows.emplace(input, uniques.size());
+        if (inserted) {
+            uniques.emplace_back(input);
+        }
+        result.rows.emplace_back(it->second);
+    }
+    if (uniques.empty()) {
+        return result;
+    }
+
+    // Pack rows into batches, estimating 4 bytes per token
+    std::vector<std::pair<size_t, size_t>> batches; // [first row, end row)
+    size_t batch_tokens = 0;
+    for (size_t row = 0; row < uniques.size(); ++ row) {
+        size_t tokens = uniques[row].size() / 4 + 1;
+        if (batches.empty()
+            || batches.back().second - batches.back().first >= max_batch_inputs
+            || (batch_tokens + tokens > max_batch_tokens && batch_tokens > 0)
+        ) {
+            batches.emplace_back(row, row);
+            batch_tokens = 0;
+        }
+        ++ batches.back().second;
+        batch_tokens += tokens;
+    }
+
+    std::vector<KeyJSONPair> paramsvec;
+    for (const auto& [k, v] : defaults_) {
+        if (k == "model") {
+            paramsvec.emplace_back(k, v);
+        }
+    }
+    for (const auto& [k, v] : params) {
+        if (k == "input") {
+            throw std::invalid_argument("Input provided twice.");
+        }
+        auto it = std::find_if(paramsvec.begin(), paramsvec.end(), [&](auto & kv){ return kv.first == k; });
+        if (it != paramsvec.end()) {
+            it->second = v;
+        } else {
+            paramsvec.emplace_back(k, v);
+        }
+    }
+    paramsvec.emplace_back("encoding_format", "float");
+
+    std::mutex matrix_mtx;
+    // items of one response share a shape, so the paths find their keys where they were last
+    static JSON::Path const index_path("/index"), embedding_path("/embedding");
+    std::atomic<size_t> next_batch = 0;
+    Trace::Span span("openai embed");
+    span.arg("inputs", (long)uniques.size()).arg("batches", (long)batches.size());
+    auto worker = [&]() {
+        std::vector<KeyJSONPair> bodyvec(paramsvec);
+        std::vector<JSON> inputvec;
+        JSON::Parser parser;
+        for (size_t batch; (batch = next_batch++) < batches.size();) {
+            auto [first_row, end_row] = batches[batch];
+            Trace::Span batch_span("openai embed batch", span.id());
+            batch_span.arg("inputs", (long)(end_row - first_row));
+            inputvec.assign(uniques.begin() + (ssize_t)first_row, uniques.begin() + (ssize_t)end_row);
+            bodyvec.resize(paramsvec.size());
+            bodyvec.emplace_back("input", inputvec);
+            std::string_view body = JSON(bodyvec).encode();
+
+            // parse the response as it arrives rather than after buffering all of it
+            for (auto chunk : HTTP::request_chunks("POST", endpoint_embeddings_, body, headers_)) {
+                parser.write(chunk);
+            }
+            JSON::Doc doc = parser.finish();
+            auto & data = (*doc)["data"].array();
+            if (data.size() != end_row - first_row) {
+                throw std::runtime_error("server returned a mismatching number of embeddings");
+            }
+
+            std::lock_guard<std::mutex> lock(matrix_mtx);
+            for (size_t idx = 0; idx < data.size(); ++ idx) {
+                auto & item = data[idx];
+                JSON const* index = index_path.find(item);
+                size_t row = first_row + (size_t)(index ? std::get<JSON::Integer>(*index) : (long)idx);
+                if (row >= end_row) {
+                    throw std::runtime_error("server returned an out-of-range embedding index");
+                }
+                JSON const* found = embedding_path.find(item);
+                if (!found) {
+                    throw std::runtime_error("server returned an item without an embedding");
+                }
+                auto & embedding = found->array();
+                if (result.dimensions == 0) {
+                    result.dimensions = embedding.size();
+                    result.matrix.resize(uniques.size() * result.dimensions);
+                } else if (embedding.size() != result.dimensions) {
+                    throw std::runtime_error("server returned embeddings of mismatching dimensions");
+                }
+                float * out = &result.matrix[row * result.dimensions];
+                for (auto & value : embedding) {
+                    *out++ = value.index() == JSON::INTEGER
+                        ? (float)std::get<JSON::Integer>(value)
+                        : (float)std::get<JSON::Number>(value);
+                }
+            }
+        }
+    };
+
+    // Request batches concurrently; the calling thread is one of the workers
+    std::vector<std::future<void>> workers;
+    size_t nworkers = std::min(std::max(max_concurrency, (size_t)1), batches.size());
+    for (size_t idx = 1; idx < nworkers; ++ idx) {
+        workers.emplace_back(std::async(std::launch::async, worker));
+    }
+    try {
+        worker();
+    } catch (...) {
+        next_batch = batches.size();
+        for (auto & w : workers) {
+            w.wait();
+        }
+        throw;
+    }
+    for (auto & w : workers) {
+        w.get();
+    }
+
+    return result;
+}
+
 } // namespace zinc
@@ -1,3 +1,4 @@
+#include <zinc/metrics.hpp>
 #include <zinc/python.hpp>
 
 #include <Python.h>
@@ -26,6 +27,14 @@ void interpreter()
 
 std::string_view zinc::Python::execute(const std::string_view script)
 {
+    static auto & executions = Metrics::counter("zinc_python_executions_total", "Python scripts executed");
+    static auto & script_bytes = Metrics::counter("zinc_python_script_bytes_total", "Bytes of Python scripts executed");
+    static auto & output_bytes = Metrics::counter("zinc_python_output_bytes_total", "Bytes of output from Python scripts");
+    static auto & execute_time = Metrics::histogram("zinc_python_execute_seconds", "Time to execute a Python script", 1e-9);
+    executions.add();
+    script_bytes.add(script.size());
+    Metrics::Histogram::Timer timer(execute_time);
+
     // Initialize Python interpreter
     interpreter();
 
@@ -60,5 +69,6 @@ std::string_view zinc::Python::execute(const std::string_view script)
     //Py_DECREF(pyGlobals);
     Py_DECREF(pyResult);
 
+    output_bytes.add((size_t)output_size);
     return {output, (size_t)output_size};
 }
@@ -1,3 +1,4 @@
+#include <zinc/metrics.hpp>
 #include <zinc/python.hpp>
 
 #include <iostream>
@@ -7,6 +8,14 @@
 #include <cstdlib>
 
 std::string_view zinc::Python::execute(std::string_view script) {
+    static auto & executions = Metrics::counter("zinc_python_executions_total", "Python scripts executed");
+    static auto & script_bytes = Metrics::counter("zinc_python_script_bytes_total", "Bytes of Python scripts executed");
+    static auto & output_bytes = Metrics::counter("zinc_python_output_bytes_total", "Bytes of output from Python scripts");
+    static auto & execute_time = Metrics::histogram("zinc_python_execute_seconds", "Time to execute a Python script", 1e-9);
+    executions.add();
+    script_bytes.add(script.size());
+    Metrics::Histogram::Timer timer(execute_time);
+
     // Create a temporary file to hold the Python script
     std::string tmpFile = "tmp.py";
     FILE* fp = fopen(tmpFile.c_str(), "w");
@@ -29,6 +38,7 @@ std::string_view zinc::Python::execute(std::string_view script) {
         output += buffer;
     }
     pclose(pipe);
+    output_bytes.add(output.size());
 
     // Remove the temporary file
     remove(tmpFile.c_str());
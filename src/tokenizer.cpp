@@ -0,0 +1,563 @@
+#include <zinc/tokenizer.hpp>
+#include <zinc/json.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zinc {
+
+namespace {
+
+/*
+ * GPT-2 byte-level BPE stores bytes as printable codepoints:
+ * printable latin-1 bytes map to themselves, the rest to 256 and up.
+ */
+struct ByteUnicode
+{
+    ByteUnicode()
+    {
+        uint32_t n = 0;
+        for (uint32_t b = 0; b < 256; ++ b) {
+            bool printable = (b >= '!' && b <= '~') || (b >= 0xa1 && b <= 0xac) || (b >= 0xae && b <= 0xff);
+            byte_to_codepoint[b] = printable ? b : 256 + n++;
+        }
+        for (uint32_t b = 0; b < 256; ++ b) {
+            codepoint_to_byte[byte_to_codepoint[b]] = (uint8_t)b;
+        }
+    }
+    uint32_t byte_to_codepoint[256];
+    uint8_t codepoint_to_byte[512] = {};
+
+    static ByteUnicode const& instance()
+    {
+        static ByteUnicode const table;
+        return table;
+    }
+};
+
+// Decode one UTF-8 codepoint, treating invalid bytes as latin-1
+uint32_t next_codepoint(std::string_view text, size_t & pos)
+{
+    auto byte = [&](size_t off) { return (uint32_t)(unsigned char)text[off]; };
+    uint32_t c = byte(pos);
+    size_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 1;
+    if (len > 1 && pos + len <= text.size()) {
+        uint32_t cp = c & (0x7fu >> len);
+        bool valid = true;
+        for (size_t i = 1; i < len; ++ i) {
+            valid = valid && (byte(pos + i) & 0xc0) == 0x80;
+            cp = (cp << 6) | (byte(pos + i) & 0x3f);
+        }
+        if (valid) {
+            pos += len;
+            return cp;
+        }
+    }
+    pos += 1;
+    return c;
+}
+
+bool is_space(uint32_t cp)
+{
+    return cp == ' ' || (cp >= '\t' && cp <= '\r') || cp == 0x85 || cp == 0xa0
+        || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200a)
+        || cp == 0x2028 || cp == 0x2029 || cp == 0x202f || cp == 0x205f || cp == 0x3000;
+}
+
+bool is_number(uint32_t cp)
+{
+    return (cp >= '0' && cp <= '9')
+        || cp == 0xb2 || cp == 0xb3 || cp == 0xb9 || (cp >= 0xbc && cp <= 0xbe)
+        || (cp >= 0x660 && cp <= 0x669) || (cp >= 0x2070 && cp <= 0x2079)
+        || (cp >= 0x2080 && cp <= 0x2089) || (cp >= 0x2150 && cp <= 0x218b)
+        || (cp >= 0x2460 && cp <= 0x249b) || (cp >= 0xff10 && cp <= 0xff19);
+}
+
+bool is_letter(uint32_t cp)
+{
+    if (cp < 0x80) {
+        return (cp | 0x20) >= 'a' && (cp | 0x20) <= 'z';
+    }
+    if (cp < 0xc0) {
+        return cp == 0xaa || cp == 0xb5 || cp == 0xba;
+    }
+    if (cp == 0xd7 || cp == 0xf7 || is_space(cp) || is_number(cp)) {
+        return false;
+    }
+    // punctuation and symbol blocks
+    return !((cp >= 0x2000 && cp <= 0x2bff)
+          || (cp >= 0x2e00 && cp <= 0x2e7f)
+          || (cp >= 0x3000 && cp <= 0x303f)
+          || (cp >= 0xfe30 && cp <= 0xfe4f)
+          || (cp >= 0xff00 && cp <= 0xff0f)
+          || (cp >= 0xff1a && cp <= 0xff20)
+          || (cp >= 0xff3b && cp <= 0xff40)
+          || (cp >= 0xff5b && cp <= 0xff65)
+          || (cp >= 0x1f000 && cp <= 0x1faff));
+}
+
+/*
+ * Split text like the pattern
+ *   (?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}
+ *   | ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+
+ */
+template <typename Callback>
+void pretokenize(std::string_view text, Callback && callback)
+{
+    size_t pos = 0;
+    auto peek = [&](size_t at, size_t & after) {
+        after = at;
+        return at < text.size() ? next_codepoint(text, after) : (uint32_t)-1;
+    };
+    auto is_newline = [](uint32_t cp) { return cp == '\r' || cp == '\n'; };
+    auto is_other = [](uint32_t cp) { return cp != (uint32_t)-1 && !is_space(cp) && !is_letter(cp) && !is_number(cp); };
+    while (pos < text.size()) {
+        size_t start = pos, next, after;
+        uint32_t cp = peek(pos, next);
+
+        // contractions
+        if (cp == '\'' && next < text.size()) {
+            char c1 = (char)(text[next] | 0x20);
+            char c2 = next + 1 < text.size() ? (char)(text[next + 1] | 0x20) : 0;
+            size_t len = 0;
+            if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd') {
+                len = 2;
+            } else if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l')) {
+                len = 3;
+            }
+            if (len) {
+                pos += len;
+                callback(text.substr(start, len));
+                continue;
+            }
+        }
+
+        // letters, with one optional leading non-letter non-digit
+        {
+            size_t letters = next;
+            bool prefixed = !is_letter(cp) && !is_number(cp) && !is_newline(cp);
+            if (prefixed) {
+                letters = is_letter(peek(next, after)) ? next : std::string_view::npos;
+            } else if (!is_letter(cp)) {
+                letters = std::string_view::npos;
+            } else {
+                letters = start;
+            }
+            if (letters != std::string_view::npos) {
+                pos = letters;
+                while (pos < text.size() && is_letter(peek(pos, after))) {
+                    pos = after;
+                }
+                callback(text.substr(start, pos - start));
+                continue;
+            }
+        }
+
+        // up to three digits
+        if (is_number(cp)) {
+            pos = next;
+            for (int count = 1; count < 3 && pos < text.size() && is_number(peek(pos, after)); ++ count) {
+                pos = after;
+            }
+            callback(text.substr(start, pos - start));
+            continue;
+        }
+
+        // punctuation, with one optional leading space and trailing newlines
+        {
+            size_t punct = cp == ' ' ? next : start;
+            if (is_other(peek(punct, after))) {
+                pos = after;
+                while (is_other(peek(pos, after))) {
+                    pos = after;
+                }
+                while (pos < text.size() && is_newline((uint32_t)text[pos])) {
+                    ++ pos;
+                }
+                callback(text.substr(start, pos - start));
+                continue;
+            }
+        }
+
+        // whitespace
+        size_t last_newline_end = std::string_view::npos, last_start = start;
+        pos = start;
+        while (pos < text.size()) {
+            uint32_t ws = peek(pos, after);
+            if (!is_space(ws)) {
+                break;
+            }
+            if (is_newline(ws)) {
+                last_newline_end = after;
+            }
+            last_start = pos;
+            pos = after;
+        }
+        if (last_newline_end != std::string_view::npos) {
+            pos = last_newline_end;
+        } else if (pos < text.size() && last_start > start) {
+            // leave the final space to prefix the following word
+            pos = last_start;
+        }
+        callback(text.substr(start, pos - start));
+    }
+}
+
+struct MergeTable
+{
+    struct Entry {
+        uint64_t pair; // left << 32 | right, 0 when empty
+        uint32_t rank;
+        uint32_t merged;
+    };
+    std::vector<Entry> entries;
+    uint64_t mask = 0;
+
+    static uint64_t key(uint32_t left, uint32_t right)
+    {
+        return ((uint64_t)left << 32 | right) + 1;
+    }
+    static uint64_t hash(uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    void reserve(size_t count)
+    {
+        size_t capacity = 16;
+        while (capacity < count * 2) {
+            capacity *= 2;
+        }
+        entries.assign(capacity, Entry{0, 0, 0});
+        mask = capacity - 1;
+    }
+    void insert(uint32_t left, uint32_t right, uint32_t rank, uint32_t merged)
+    {
+        uint64_t k = key(left, right);
+        for (uint64_t slot = hash(k) & mask;; slot = (slot + 1) & mask) {
+            if (entries[slot].pair == 0) {
+                entries[slot] = {k, rank, merged};
+                return;
+            } else if (entries[slot].pair == k) {
+                return; // keep the lowest rank
+            }
+        }
+    }
+    Entry const* find(uint32_t left, uint32_t right) const
+    {
+        uint64_t k = key(left, right);
+        for (uint64_t slot = hash(k) & mask;; slot = (slot + 1) & mask) {
+            if (entries[slot].pair == k) {
+                return &entries[slot];
+            } else if (entries[slot].pair == 0) {
+                return nullptr;
+            }
+        }
+    }
+};
+
+class TokenizerImpl
+{
+public:
+    TokenizerImpl(std::string_view tokenizer_json)
+    {
+        JSON::Doc doc = JSON::decode(tokenizer_json, true);
+        auto & model = (*doc)["model"];
+        if (model.dicty("type", "BPE").string() != "BPE") {
+            throw std::invalid_argument("only BPE tokenizers are supported");
+        }
+        ignore_merges_ = model.dicty("ignore_merges", false).truthy();
+
+        for (auto & [token, id] : model["vocab"].object()) {
+            add_token(unmap(token), (uint32_t)std::get<JSON::Integer>(id));
+        }
+        JSON no_added_tokens = JSON::Array{};
+        for (auto & added : (*doc).dicty("added_tokens", no_added_tokens).array()) {
+            std::string_view content = added["content"].string();
+            uint32_t id = (uint32_t)std::get<JSON::Integer>(added["id"]);
+            add_token(std::string(content), id);
+            if (!content.empty()) {
+                specials_.emplace_back(std::string(content), id);
+            }
+        }
+        std::sort(specials_.begin(), specials_.end(), [](auto & a, auto & b) {
+            return a.first.size() > b.first.size();
+        });
+        for (auto & [content, id] : specials_) {
+            special_first_bytes_[(unsigned char)content[0]] = true;
+        }
+
+        // every piece is merged up from its bytes, so each must be a token, or counts would fall short
+        for (size_t b = 0; b < 256; ++ b) {
+            auto it = vocab_.find(std::string(1, (char)b));
+            if (it == vocab_.end()) {
+                throw std::invalid_argument("byte-level vocabulary lacks byte " + std::to_string(b));
+            }
+            byte_ids_[b] = it->second;
+        }
+
+        auto & merges = model["merges"].array();
+        merges_.reserve(merges.size());
+        std::string left, right;
+        for (size_t rank = 0; rank < merges.size(); ++ rank) {
+            auto & merge = merges[rank];
+            if (merge.index() == JSON::ARRAY) {
+                left = unmap(merge[0].string());
+                right = unmap(merge[1].string());
+            } else {
+                std::string_view pair = merge.string();
+                size_t space = pair.find(' ', 1);
+                if (space == std::string_view::npos) {
+                    throw std::invalid_argument("malformed merge");
+                }
+                left = unmap(pair.substr(0, space));
+                right = unmap(pair.substr(space + 1));
+            }
+            auto l = vocab_.find(left), r = vocab_.find(right), m = vocab_.find(left + right);
+            if (l == vocab_.end() || r == vocab_.end() || m == vocab_.end()) {
+                continue;
+            }
+            merges_.insert(l->second, r->second, (uint32_t)rank, m->second);
+        }
+    }
+
+    void encode(std::string_view text, bool allow_special, std::vector<uint32_t> & ids) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        size_t plain_start = 0;
+        if (allow_special && !specials_.empty()) {
+            for (size_t pos = 0; pos < text.size(); ++ pos) {
+                if (!special_first_bytes_[(unsigned char)text[pos]]) {
+                    continue;
+                }
+                for (auto & [content, id] : specials_) {
+                    if (text.substr(pos, content.size()) == content) {
+                        encode_plain(text.substr(plain_start, pos - plain_start), ids);
+                        ids.emplace_back(id);
+                        pos += content.size() - 1;
+                        plain_start = pos + 1;
+                        break;
+                    }
+                }
+            }
+        }
+        encode_plain(text.substr(plain_start), ids);
+    }
+
+    size_t count(std::string_view text, bool allow_special) const
+    {
+        static thread_local std::vector<uint32_t> ids;
+        ids.clear();
+        encode(text, allow_special, ids);
+        return ids.size();
+    }
+
+    void decode(std::span<uint32_t const> ids, std::string & text) const
+    {
+        for (auto id : ids) {
+            if (id < id_tokens_.size()) {
+                text += id_tokens_[id];
+            }
+        }
+    }
+
+    size_t vocab_size() const
+    {
+        return id_tokens_.size();
+    }
+
+private:
+    static constexpr uint32_t NONE = (uint32_t)-1;
+    static constexpr size_t CACHE_LIMIT = 1 << 16;
+
+    void add_token(std::string bytes, uint32_t id)
+    {
+        if (id >= id_tokens_.size()) {
+            id_tokens_.resize(id + 1);
+        }
+        id_tokens_[id] = bytes;
+        vocab_.emplace(std::move(bytes), id);
+    }
+
+    // Map a vocabulary string back from printable codepoints to bytes
+    static std::string unmap(std::string_view token)
+    {
+        auto & table = ByteUnicode::instance();
+        std::string bytes;
+        for (size_t pos = 0; pos < token.size();) {
+            size_t start = pos;
+            uint32_t cp = next_codepoint(token, pos);
+            if (cp < 512 && table.byte_to_codepoint[table.codepoint_to_byte[cp]] == cp) {
+                bytes += (char)table.codepoint_to_byte[cp];
+            } else {
+                bytes += token.substr(start, pos - start);
+            }
+        }
+        return bytes;
+    }
+
+    void encode_plain(std::string_view text, std::vector<uint32_t> & ids) const
+    {
+        pretokenize(text, [&](std::string_view piece) {
+            cache_key_ = piece;
+            auto it = cache_.find(cache_key_);
+            if (it == cache_.end()) {
+                if (cache_ids_.size() > CACHE_LIMIT * 4) {
+                    cache_.clear();
+                    cache_ids_.clear();
+                }
+                size_t offset = cache_ids_.size();
+                merge(piece, cache_ids_);
+                it = cache_.emplace(cache_key_, std::make_pair((uint32_t)offset, (uint32_t)(cache_ids_.size() - offset))).first;
+            }
+            auto [offset, length] = it->second;
+            ids.insert(ids.end(), cache_ids_.begin() + offset, cache_ids_.begin() + offset + length);
+        });
+    }
+
+    // Apply merges to one piece in rank order
+    void merge(std::string_view piece, std::vector<uint32_t> & ids) const
+    {
+        if (ignore_merges_) {
+            auto it = vocab_.find(cache_key_);
+            if (it != vocab_.end()) {
+                ids.emplace_back(it->second);
+                return;
+            }
+        }
+
+        struct Symbol {
+            uint32_t id;
+            uint32_t prev, next;
+        };
+        struct Candidate {
+            uint32_t rank, pos, left, right;
+            bool operator>(Candidate const& other) const
+            { return rank != other.rank ? rank > other.rank : pos > other.pos; }
+        };
+        static thread_local std::vector<Symbol> symbols;
+        static thread_local std::vector<Candidate> heap;
+        symbols.clear();
+        heap.clear();
+        for (size_t idx = 0; idx < piece.size(); ++ idx) {
+            symbols.emplace_back(Symbol{byte_ids_[(unsigned char)piece[idx]], (uint32_t)idx - 1, (uint32_t)idx + 1});
+        }
+        uint32_t end = (uint32_t)symbols.size();
+
+        auto consider = [&](uint32_t left) {
+            if (left == NONE || left >= end || symbols[left].next >= end) {
+                return;
+            }
+            uint32_t right = symbols[left].next;
+            auto merge = merges_.find(symbols[left].id, symbols[right].id);
+            if (merge) {
+                heap.emplace_back(Candidate{merge->rank, left, symbols[left].id, symbols[right].id});
+                std::push_heap(heap.begin(), heap.end(), std::greater<>());
+            }
+        };
+        for (uint32_t idx = 0; idx + 1 < end; ++ idx) {
+            consider(idx);
+        }
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+            Candidate candidate = heap.back();
+            heap.pop_back();
+            Symbol & left = symbols[candidate.pos];
+            if (left.id != candidate.left || left.next >= end || symbols[left.next].id != candidate.right) {
+                continue; // stale
+            }
+            Symbol & right = symbols[left.next];
+            left.id = merges_.find(candidate.left, candidate.right)->merged;
+            left.next = right.next;
+            if (right.next < end) {
+                symbols[right.next].prev = candidate.pos;
+            }
+            right.id = NONE;
+            consider(left.prev);
+            consider(candidate.pos);
+        }
+        for (uint32_t idx = 0; idx < end; idx = symbols[idx].next) {
+            if (symbols[idx].id != NONE) {
+                ids.emplace_back(symbols[idx].id);
+            }
+        }
+    }
+
+    bool ignore_merges_;
+    std::unordered_map<std::string, uint32_t> vocab_;
+    std::vector<std::string> id_tokens_;
+    std::vector<std::pair<std::string, uint32_t>> specials_;
+    bool special_first_bytes_[256] = {};
+    uint32_t byte_ids_[256];
+    MergeTable merges_;
+
+    mutable std::mutex mtx_;
+    mutable std::string cache_key_;
+    mutable std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> cache_;
+    mutable std::vector<uint32_t> cache_ids_;
+};
+
+} // namespace
+
+Tokenizer::Tokenizer(std::string_view tokenizer_json)
+: impl_(reinterpret_cast<void*>(new TokenizerImpl(tokenizer_json)))
+{ }
+
+Tokenizer Tokenizer::from_file(std::string_view path)
+{
+    std::ifstream file{std::string(path)};
+    if (!file) {
+        throw std::runtime_error("could not open " + std::string(path));
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return Tokenizer(contents.view());
+}
+
+Tokenizer::Tokenizer(Tokenizer&& other)
+: impl_(other.impl_)
+{
+    other.impl_ = nullptr;
+}
+
+Tokenizer::~Tokenizer()
+{
+    delete reinterpret_cast<TokenizerImpl*>(impl_);
+}
+
+std::span<uint32_t const> Tokenizer::encode(std::string_view text, bool allow_special) const
+{
+    static thread_local std::vector<uint32_t> ids;
+    ids.clear();
+    reinterpret_cast<TokenizerImpl*>(impl_)->encode(text, allow_special, ids);
+    return ids;
+}
+
+size_t Tokenizer::count(std::string_view text, bool allow_special) const
+{
+    return reinterpret_cast<TokenizerImpl*>(impl_)->count(text, allow_special);
+}
+
+std::string_view Tokenizer::decode(std::span<uint32_t const> ids) const
+{
+    static thread_local std::string text;
+    text.clear();
+    reinterpret_cast<TokenizerImpl*>(impl_)->decode(ids, text);
+    return text;
+}
+
+size_t Tokenizer::vocab_size() const
+{
+    return reinterpret_cast<TokenizerImpl*>(impl_)->vocab_size();
+}
+
+} // namespace zinc
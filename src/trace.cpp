@@ -0,0 +1,226 @@
+#include <zinc/trace.hpp>
+#include <zinc/json.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace zinc {
+
+namespace {
+
+struct Event {
+    char phase; // X for a span, i for a mark
+    uint64_t id, parent;
+    int64_t begin, duration; // ns since launch
+    std::string name, args;
+};
+
+// The events of one thread, kept after it exits
+struct ThreadEvents {
+    uint32_t tid = (uint32_t)gettid();
+    std::mutex mutex; // only contended while writing
+    std::vector<Event> events;
+};
+
+/*
+ * Events are recorded by each thread into its own list, and gathered
+ * from all of them when written.
+ */
+struct Recorder {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadEvents>> threads;
+    std::atomic<uint64_t> next_id = 1;
+    std::chrono::steady_clock::time_point launch = std::chrono::steady_clock::now();
+    std::string path; // written at exit
+
+    static Recorder & instance()
+    {
+        static Recorder recorder;
+        return recorder;
+    }
+
+    ~Recorder()
+    {
+        if (!path.empty()) {
+            try {
+                write(path);
+            } catch (std::exception const&) {
+            }
+        }
+    }
+
+    int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - launch).count();
+    }
+
+    ThreadEvents & events()
+    {
+        static thread_local std::shared_ptr<ThreadEvents> mine = [this]{
+            auto events = std::make_shared<ThreadEvents>();
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(events);
+            return events;
+        }();
+        return *mine;
+    }
+
+    void record(Event && event)
+    {
+        auto & mine = events();
+        std::lock_guard<std::mutex> lock(mine.mutex);
+        mine.events.push_back(std::move(event));
+    }
+
+    void write(std::string_view path);
+};
+
+// The innermost span open on each thread
+thread_local uint64_t current = 0;
+
+struct TraceFromEnvironment
+{
+    TraceFromEnvironment()
+    {
+        char const* path = std::getenv("ZINC_TRACE");
+        if (path && *path) {
+            Recorder::instance().path = path;
+            Trace::enable();
+        }
+    }
+} trace_from_environment;
+
+// Microseconds with a fraction, as trace events are timed
+void append_us(std::string & out, int64_t ns)
+{
+    out += std::to_string(ns / 1000);
+    out += '.';
+    auto fraction = std::to_string(ns % 1000);
+    out.append(3 - fraction.size(), '0');
+    out += fraction;
+}
+
+}
+
+void Trace::enable(bool enabled)
+{
+    Recorder::instance(); // constructed before, so destroyed after, what it records
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Trace::Span::begin(std::string_view name, uint64_t parent)
+{
+    auto & recorder = Recorder::instance();
+    id_ = recorder.next_id.fetch_add(1, std::memory_order_relaxed);
+    parent_ = parent == inherit ? current : parent;
+    name_ = name;
+    begin_ = recorder.now();
+    current = id_;
+}
+
+Trace::Span & Trace::Span::arg(std::string_view key, std::string_view value)
+{
+    if (id_) {
+        JSON(key).encode(args_ += ',');
+        JSON(value).encode(args_ += ':');
+    }
+    return *this;
+}
+
+Trace::Span & Trace::Span::arg(std::string_view key, long value)
+{
+    if (id_) {
+        JSON(key).encode(args_ += ',');
+        (args_ += ':') += std::to_string(value);
+    }
+    return *this;
+}
+
+void Trace::Span::end()
+{
+    if (!id_) {
+        return;
+    }
+    auto & recorder = Recorder::instance();
+    // spans in coroutines may end out of order, leaving the innermost as it is
+    if (current == id_) {
+        current = parent_;
+    }
+    recorder.record({'X', id_, parent_, begin_, recorder.now() - begin_, std::move(name_), std::move(args_)});
+    id_ = 0;
+}
+
+void Trace::instant(std::string_view name)
+{
+    auto & recorder = Recorder::instance();
+    uint64_t id = recorder.next_id.fetch_add(1, std::memory_order_relaxed);
+    recorder.record({'i', id, current, recorder.now(), 0, std::string(name), {}});
+}
+
+void Recorder::write(std::string_view path)
+{
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    std::string pid = std::to_string(getpid());
+    bool first = true;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto & thread : threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        for (auto & event : thread->events) {
+            out += first ? "\n" : ",\n";
+            first = false;
+            JSON(event.name).encode(out += "{\"name\":");
+            out += ",\"cat\":\"zinc\",\"ph\":\"";
+            out += event.phase;
+            out += "\",\"ts\":";
+            append_us(out, event.begin);
+            if (event.phase == 'X') {
+                out += ",\"dur\":";
+                append_us(out, event.duration);
+            } else {
+                out += ",\"s\":\"t\"";
+            }
+            ((out += ",\"pid\":") += pid) += ",\"tid\":";
+            out += std::to_string(thread->tid);
+            ((out += ",\"args\":{\"id\":") += std::to_string(event.id)) += ",\"parent\":";
+            ((out += std::to_string(event.parent)) += event.args) += "}}";
+        }
+    }
+    out += "\n]}\n";
+    std::string temp_path = std::string(path) + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), (std::streamsize)out.size());
+        if (!file.flush()) {
+            throw std::runtime_error("failed to write trace " + temp_path);
+        }
+    }
+    if (std::rename(temp_path.c_str(), std::string(path).c_str()) != 0) {
+        throw std::runtime_error("failed to write trace " + std::string(path));
+    }
+}
+
+void Trace::write(std::string_view path)
+{
+    Recorder::instance().write(path);
+}
+
+void Trace::clear()
+{
+    auto & recorder = Recorder::instance();
+    std::lock_guard<std::mutex> lock(recorder.mutex);
+    for (auto & thread : recorder.threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        thread->events.clear();
+    }
+}
+
+} // namespace zinc
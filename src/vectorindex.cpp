@@ -0,0 +1,411 @@
+#include <zinc/vectorindex.hpp>
+#include <zinc/configuration.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace zinc {
+
+namespace {
+
+constexpr char MAGIC[4] = {'Z', 'V', 'I', 1};
+
+using DotFn = float(*)(float const*, float const*, size_t);
+
+float dot_scalar(float const* a, float const* b, size_t n)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i+1] * b[i+1];
+        s2 += a[i+2] * b[i+2];
+        s3 += a[i+3] * b[i+3];
+    }
+    for (; i < n; ++ i) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+float dot_avx2(float const* a, float const* b, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    if (i + 8 <= n) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        i += 8;
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    float result = _mm_cvtss_f32(sum);
+    for (; i < n; ++ i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+float dot_neon(float const* a, float const* b, size_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float result = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++ i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+#endif
+
+DotFn select_dot()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return dot_avx2;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    return dot_neon;
+#endif
+    return dot_scalar;
+}
+
+// FNV-1a, stable across runs so it can be stored on disk
+uint64_t content_hash(std::string_view data)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : data) {
+        hash ^= (unsigned char)c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int64_t file_mtime(fs::path const& path)
+{
+    return (int64_t)fs::last_write_time(path).time_since_epoch().count();
+}
+
+template <typename T>
+void write_pod(std::ostream & out, T const& value)
+{
+    out.write((char const*)&value, sizeof(value));
+}
+
+template <typename T>
+void read_pod(std::istream & in, T & value)
+{
+    in.read((char*)&value, sizeof(value));
+}
+
+void normalize(float * vec, size_t n)
+{
+    float norm = std::sqrt(VectorIndex::dot(vec, vec, n));
+    if (norm > 0) {
+        for (size_t i = 0; i < n; ++ i) {
+            vec[i] /= norm;
+        }
+    }
+}
+
+}
+
+float VectorIndex::dot(float const* a, float const* b, size_t n)
+{
+    static DotFn const fn = select_dot();
+    return fn(a, b, n);
+}
+
+VectorIndex::VectorIndex(std::string_view name)
+: path_(Configuration::path_local(zinc::span<std::string_view>({"index", std::string(name) + ".bin"}))),
+  dimensions_(0),
+  modified_(false)
+{
+    std::ifstream in(path_, std::ios::binary);
+    if (!in) {
+        return;
+    }
+    char magic[sizeof(MAGIC)];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error(path_ + " is not a vector index");
+    }
+    uint64_t dimensions, nfiles, nchunks;
+    read_pod(in, dimensions);
+    read_pod(in, nfiles);
+    read_pod(in, nchunks);
+    dimensions_ = dimensions;
+    files_.resize(nfiles);
+    for (auto & file : files_) {
+        uint64_t path_size, first_chunk, chunk_count;
+        read_pod(in, path_size);
+        file.path.resize(path_size);
+        in.read(file.path.data(), (std::streamsize)path_size);
+        read_pod(in, file.mtime);
+        read_pod(in, file.hash);
+        read_pod(in, first_chunk);
+        read_pod(in, chunk_count);
+        file.first_chunk = first_chunk;
+        file.chunk_count = chunk_count;
+    }
+    chunks_.resize(nchunks);
+    in.read((char*)chunks_.data(), (std::streamsize)(chunks_.size() * sizeof(Chunk)));
+    matrix_.resize(nchunks * dimensions_);
+    in.read((char*)matrix_.data(), (std::streamsize)(matrix_.size() * sizeof(float)));
+    if (!in) {
+        throw std::runtime_error(path_ + " is truncated");
+    }
+}
+
+VectorIndex::~VectorIndex()
+{
+    if (modified_) {
+        try {
+            save();
+        } catch (std::exception const& e) {
+            // a destructor cannot throw, so the changes are only reported lost
+            std::cerr << "vector index not saved: " << e.what() << std::endl;
+        }
+    }
+}
+
+void VectorIndex::save()
+{
+    std::string tmp = path_ + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(MAGIC, sizeof(MAGIC));
+        write_pod(out, (uint64_t)dimensions_);
+        write_pod(out, (uint64_t)files_.size());
+        write_pod(out, (uint64_t)chunks_.size());
+        for (auto & file : files_) {
+            write_pod(out, (uint64_t)file.path.size());
+            out.write(file.path.data(), (std::streamsize)file.path.size());
+            write_pod(out, file.mtime);
+            write_pod(out, file.hash);
+            write_pod(out, (uint64_t)file.first_chunk);
+            write_pod(out, (uint64_t)file.chunk_count);
+        }
+        out.write((char const*)chunks_.data(), (std::streamsize)(chunks_.size() * sizeof(Chunk)));
+        out.write((char const*)matrix_.data(), (std::streamsize)(matrix_.size() * sizeof(float)));
+        if (!out) {
+            throw std::runtime_error("failed to write " + tmp);
+        }
+    }
+    fs::rename(tmp, path_);
+    modified_ = false;
+}
+
+void VectorIndex::erase_file(size_t file)
+{
+    auto & erased = files_[file];
+    auto chunk_start = chunks_.begin() + (ssize_t)erased.first_chunk;
+    chunks_.erase(chunk_start, chunk_start + (ssize_t)erased.chunk_count);
+    auto row_start = matrix_.begin() + (ssize_t)(erased.first_chunk * dimensions_);
+    matrix_.erase(row_start, row_start + (ssize_t)(erased.chunk_count * dimensions_));
+    for (auto & chunk : chunks_) {
+        if (chunk.file > file) {
+            -- chunk.file;
+        }
+    }
+    for (auto & other : files_) {
+        if (other.first_chunk > erased.first_chunk) {
+            other.first_chunk -= erased.chunk_count;
+        }
+    }
+    files_.erase(files_.begin() + (ssize_t)file);
+    modified_ = true;
+}
+
+size_t VectorIndex::update(
+    std::span<std::string_view const> paths,
+    Embedder const& embedder,
+    size_t chunk_lines,
+    size_t chunk_bytes
+) {
+    // Files that have gone away or changed are dropped, but only once the new chunks are embedded
+    std::vector<size_t> dropped;
+    for (size_t file = 0; file < files_.size(); ++ file) {
+        if (!fs::exists(files_[file].path)) {
+            dropped.push_back(file);
+        }
+    }
+
+    struct Pending {
+        std::string path;
+        std::string content;
+        int64_t mtime;
+        uint64_t hash;
+    };
+    std::vector<Pending> pending;
+    for (auto path_ : paths) {
+        fs::path path = fs::path(path_).lexically_normal();
+        if (!fs::is_regular_file(path)) {
+            continue;
+        }
+        if (std::any_of(pending.begin(), pending.end(), [&](Pending const& file){ return file.path == path.native(); })) {
+            continue;
+        }
+        auto found = std::find_if(files_.begin(), files_.end(), [&](File const& file){ return file.path == path.native(); });
+        int64_t mtime = file_mtime(path);
+        if (found != files_.end() && found->mtime == mtime) {
+            continue;
+        }
+        std::stringstream content;
+        content << std::ifstream(path, std::ios::binary).rdbuf();
+        uint64_t hash = content_hash(content.view());
+        if (found != files_.end()) {
+            if (found->hash == hash) {
+                found->mtime = mtime;
+                modified_ = true;
+                continue;
+            }
+            dropped.push_back((size_t)(found - files_.begin()));
+        }
+        pending.emplace_back(path.native(), std::move(content).str(), mtime, hash);
+    }
+
+    // Split into chunks of whole lines, numbered from the first new file and chunk
+    std::vector<File> new_files;
+    std::vector<Chunk> new_chunks;
+    std::vector<std::string_view> texts;
+    for (auto & file : pending) {
+        File & entry = new_files.emplace_back(File{
+            std::move(file.path), file.mtime, file.hash, new_chunks.size(), 0
+        });
+        std::string_view content = file.content;
+        size_t offset = 0, line = 0;
+        while (offset < content.size()) {
+            size_t end = offset, lines = 0;
+            while (end < content.size() && lines < chunk_lines && (end == offset || end - offset < chunk_bytes)) {
+                size_t eol = content.find('\n', end);
+                end = (eol == std::string_view::npos) ? content.size() : eol + 1;
+                ++ lines;
+            }
+            new_chunks.emplace_back(Chunk{(uint32_t)(new_files.size() - 1), (uint32_t)line, offset, end - offset});
+            texts.emplace_back(content.substr(offset, end - offset));
+            ++ entry.chunk_count;
+            offset = end;
+            line += lines;
+        }
+    }
+
+    // Embed before touching the index, so a failed request leaves it intact
+    OpenAI::Embeddings embeddings;
+    if (!texts.empty()) {
+        embeddings = embedder(texts);
+        if (embeddings.size() != texts.size()) {
+            throw std::runtime_error("embedder returned a mismatching number of vectors");
+        }
+        if (dimensions_ != 0 && dimensions_ != embeddings.dimensions) {
+            throw std::runtime_error("embedder dimensions differ from the index");
+        }
+        dimensions_ = embeddings.dimensions;
+    }
+
+    std::sort(dropped.begin(), dropped.end());
+    for (size_t idx = dropped.size(); idx > 0; -- idx) {
+        erase_file(dropped[idx - 1]);
+    }
+    if (new_files.empty()) {
+        return 0;
+    }
+
+    size_t first_new_chunk = chunks_.size(), first_new_file = files_.size();
+    for (auto & file : new_files) {
+        file.first_chunk += first_new_chunk;
+    }
+    for (auto & chunk : new_chunks) {
+        chunk.file += (uint32_t)first_new_file;
+    }
+    std::move(new_files.begin(), new_files.end(), std::back_inserter(files_));
+    chunks_.insert(chunks_.end(), new_chunks.begin(), new_chunks.end());
+    matrix_.resize(chunks_.size() * dimensions_);
+    for (size_t idx = 0; idx < texts.size(); ++ idx) {
+        float * row = &matrix_[(first_new_chunk + idx) * dimensions_];
+        auto vec = embeddings[idx];
+        std::copy(vec.begin(), vec.end(), row);
+        normalize(row, dimensions_);
+    }
+    modified_ = true;
+    return texts.size();
+}
+
+size_t VectorIndex::update(
+    std::span<std::string_view const> paths,
+    OpenAI const& client,
+    std::span<KeyJSONPair const> params
+) {
+    return update(paths, [&](std::span<std::string_view const> texts) {
+        return client.embed(texts, params);
+    });
+}
+
+std::span<VectorIndex::Match const> VectorIndex::search(std::span<float const> query, size_t k) const
+{
+    static thread_local std::vector<Match> heap;
+    heap.clear();
+    if (query.size() != dimensions_ || k == 0) {
+        return heap;
+    }
+    auto better = [](Match const& a, Match const& b) { return a.score > b.score; };
+    for (size_t chunk = 0; chunk < chunks_.size(); ++ chunk) {
+        float score = dot(query.data(), &matrix_[chunk * dimensions_], dimensions_);
+        if (heap.size() < k) {
+            heap.emplace_back(Match{score, chunk});
+            std::push_heap(heap.begin(), heap.end(), better);
+        } else if (score > heap.front().score) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = Match{score, chunk};
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
+
+std::span<VectorIndex::Match const> VectorIndex::search(std::string_view query, Embedder const& embedder, size_t k) const
+{
+    OpenAI::Embeddings embeddings = embedder(zinc::span<std::string_view const>({query}));
+    return search(embeddings[0], k);
+}
+
+std::string VectorIndex::text(size_t chunk) const
+{
+    auto & entry = chunks_[chunk];
+    std::string result(entry.length, '\0');
+    std::ifstream in(files_[entry.file].path, std::ios::binary);
+    in.seekg((std::streamoff)entry.offset);
+    in.read(result.data(), (std::streamsize)result.size());
+    result.resize((size_t)in.gcount());
+    return result;
+}
+
+} // namespace zinc
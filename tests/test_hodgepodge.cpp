@@ -0,0 +1,214 @@
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#include <zinc/hodgepodge.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace zinc;
+
+using Message = HodgePodge::Message;
+
+std::vector<Message> conversation(size_t turns, size_t content_size)
+{
+    std::vector<Message> messages;
+    messages.emplace_back(Message{.role = "system", .content = "You are terse."});
+    for (size_t turn = 0; turn < turns; ++ turn) {
+        messages.emplace_back(Message{.role = "user", .content = std::string(content_size, 'u')});
+        messages.emplace_back(Message{.role = "assistant", .content = std::string(content_size, 'a')});
+    }
+    return messages;
+}
+
+BOOST_AUTO_TEST_SUITE(HodgePodgeTest)
+
+BOOST_AUTO_TEST_CASE(pack_under_budget_is_unchanged)
+{
+    auto messages = conversation(3, 40);
+    HodgePodge::ContextPacker packer(1000);
+    auto & packed = packer.pack(messages);
+    BOOST_REQUIRE_EQUAL(packed.size(), messages.size());
+    BOOST_TEST(packer.dropped() == 0);
+    for (size_t idx = 0; idx < packed.size(); ++ idx) {
+        BOOST_TEST(*packed[idx].content == *messages[idx].content);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pack_drops_oldest_turns_and_keeps_system)
+{
+    auto messages = conversation(20, 400); // about 100 tokens each
+    HodgePodge::ContextPacker packer(1000, 4);
+    auto & packed = packer.pack(messages);
+    BOOST_TEST(packer.tokens() <= 1000);
+    BOOST_TEST(packer.dropped() > 0);
+    BOOST_TEST(packed[0].role == "system");
+    BOOST_TEST(*packed[0].content == "You are terse.");
+    BOOST_TEST(packed[1].role == "system"); // note standing in for dropped turns
+    BOOST_TEST(packed[2].role == "user");
+    BOOST_TEST(*packed.back().content == *messages.back().content);
+}
+
+BOOST_AUTO_TEST_CASE(pack_keeps_a_stable_prefix)
+{
+    auto messages = conversation(20, 400);
+    HodgePodge::ContextPacker packer(1000, 4);
+    packer.pack(messages);
+    size_t dropped = packer.dropped();
+
+    // the next turn fits in the slack left by the low water mark
+    messages.emplace_back(Message{.role = "user", .content = std::string(40, 'u')});
+    packer.pack(messages);
+    BOOST_TEST(packer.dropped() == dropped);
+    BOOST_TEST(packer.tokens() <= 1000);
+}
+
+BOOST_AUTO_TEST_CASE(pack_elides_oversized_messages)
+{
+    std::vector<Message> messages{
+        Message{.role = "user", .content = "head" + std::string(4000, 'x') + "tail"},
+    };
+    HodgePodge::ContextPacker packer(1000, 4, 100);
+    auto & packed = packer.pack(messages);
+    BOOST_REQUIRE_EQUAL(packed.size(), 1);
+    auto & content = *packed[0].content;
+    BOOST_TEST(content.size() < 600);
+    BOOST_TEST(content.starts_with("head"));
+    BOOST_TEST(content.ends_with("tail"));
+    BOOST_TEST(content.find("bytes elided") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(pack_uses_summarizer)
+{
+    auto messages = conversation(20, 400);
+    size_t summarized = 0;
+    HodgePodge::ContextPacker packer(1000, 4, 0, 0.75, HodgePodge::ContextPacker::estimate_tokens,
+        [&](std::span<Message const> dropped) {
+            summarized = dropped.size();
+            return std::string("summary");
+        });
+    auto & packed = packer.pack(messages);
+    BOOST_TEST(summarized == packer.dropped());
+    BOOST_TEST(*packed[1].content == "summary");
+}
+
+BOOST_AUTO_TEST_CASE(chat_template_matches_deepseek3)
+{
+    JSON::Doc arguments = JSON::decode(R"({"city":"Paris"})");
+    auto messages = conversation(2, 10);
+    messages.emplace_back(Message{.role = "user", .content = "What is the weather?"});
+    messages.emplace_back(Message{.role = "assistant", .content = {}, .tool_calls = {
+        {.type = "function", .function = {.name = "weather", .parameters = *arguments}},
+    }});
+    messages.emplace_back(Message{.role = "tool", .content = "sunny"});
+    messages.emplace_back(Message{.role = "assistant", .content = "It is sunny."});
+    messages.emplace_back(Message{.role = "user", .content = "Thanks"});
+
+    auto & compiled = HodgePodge::ChatTemplate::deepseek3();
+    BOOST_TEST(compiled.render(messages, true) == HodgePodge::prompt_deepseek3(messages, true));
+    BOOST_TEST(compiled.render(messages, false) == HodgePodge::prompt_deepseek3(messages, false));
+}
+
+BOOST_AUTO_TEST_CASE(chat_template_matches_llama31)
+{
+    auto messages = conversation(3, 10);
+    *messages[1].content = "  padded  ";
+    JSON builtin_tools[] = {"code_interpreter", "brave_search", "wolfram_alpha"};
+    std::vector<KeyJSONPair> variables{
+        {"builtin_tools", JSON::Array(builtin_tools)},
+        {"date_string", "26 Jul 2024"},
+    };
+    auto & compiled = HodgePodge::ChatTemplate::llama31();
+    BOOST_TEST(compiled.render(messages, true, variables) == HodgePodge::prompt_llama31_hf(messages, true));
+}
+
+BOOST_AUTO_TEST_CASE(chat_template_language)
+{
+    HodgePodge::ChatTemplate compiled(
+        "{%- set ns = namespace(count=0) %}\n"
+        "{%- for message in messages if message.role != 'system' %}\n"
+        "    {%- set ns.count = ns.count + 1 %}\n"
+        "    {{- loop.index }}:{{ message.role | upper }}:{{ message.content | trim }}\n"
+        "    {%- if not loop.last %},{% endif %}\n"
+        "{%- endfor %}\n"
+        "{{- ' ' ~ ns.count }}"
+        "{{- ' ' + (names | reject('equalto', 'b') | join('/')) }}"
+        "{{- ' ' + messages[-1].content[1:3] }}"
+        "{{- ' ' + ('yes' if 'a' in names else 'no') }}"
+        "{{- ' ' + (config | tojson) }}"
+        "{%- for key, value in config | items %} {{ key }}={{ value }}{% endfor %}"
+        "{%- if missing is defined %} defined{% elif missing is none %} none{% else %} undefined{% endif %}"
+        "{{ eos_token }}",
+        "<s>", "</s>"
+    );
+    JSON names[] = {"a", "b", "c"};
+    JSON::Doc config = JSON::decode(R"({"x":1,"y":[true,null]})");
+    std::vector<KeyJSONPair> variables{
+        {"names", JSON::Array(names)},
+        {"config", *config},
+    };
+    std::vector<Message> messages{
+        Message{.role = "system", .content = "ignored"},
+        Message{.role = "user", .content = " hi "},
+        Message{.role = "assistant", .content = "hello"},
+    };
+    BOOST_TEST(compiled.render(messages, false, variables) ==
+        "1:USER:hi,2:ASSISTANT:hello 2 a/c el yes {\"x\": 1, \"y\": [true, null]} x=1 y=[true,null] undefined</s>");
+
+    // rendering appends to a caller's buffer
+    std::string output = "prefix:";
+    compiled.render(output, messages, false, variables);
+    BOOST_TEST(output.starts_with("prefix:1:USER"));
+}
+
+BOOST_AUTO_TEST_CASE(chat_template_errors)
+{
+    BOOST_CHECK_THROW(HodgePodge::ChatTemplate("{{ x | frobnicate }}"), std::runtime_error);
+    BOOST_CHECK_THROW(HodgePodge::ChatTemplate("{% if x %}unterminated"), std::runtime_error);
+    HodgePodge::ChatTemplate raising("{{ raise_exception('no tools') }}");
+    BOOST_CHECK_THROW(raising.render(std::vector<Message>{}), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(incremental_prompt_appends_each_turn)
+{
+    JSON::Doc arguments = JSON::decode(R"({"city":"Paris"})");
+    auto history = conversation(2, 10);
+    history.emplace_back(Message{.role = "user", .content = "What is the weather?"});
+    history.emplace_back(Message{.role = "assistant", .content = {}, .tool_calls = {
+        {.type = "function", .function = {.name = "weather", .parameters = *arguments}},
+    }});
+    history.emplace_back(Message{.role = "tool", .content = "sunny"});
+    history.emplace_back(Message{.role = "assistant", .content = "It is sunny."});
+    history.emplace_back(Message{.role = "user", .content = "Thanks"});
+    history.emplace_back(Message{.role = "assistant", .content = "You're welcome."});
+
+    for (auto * chat_template : {&HodgePodge::ChatTemplate::deepseek3(), &HodgePodge::ChatTemplate::llama31()}) {
+        HodgePodge::IncrementalPrompt incremental(*chat_template);
+        std::string sent;
+        for (size_t count = 1; count <= history.size(); ++ count) {
+            std::span<Message const> messages(history.data(), count);
+            bool add_generation_prompt = "assistant" != messages.back().role;
+            size_t reused = incremental.update(messages, add_generation_prompt);
+            BOOST_TEST(incremental.prompt() == chat_template->render(messages, add_generation_prompt));
+            BOOST_TEST(incremental.prompt().substr(0, reused) == std::string_view(sent).substr(0, reused));
+            if (count > 2 && messages.back().role == "assistant" && messages.back().content) {
+                // the generation prompt was kept and the reply appended after it
+                BOOST_TEST(reused == sent.size());
+            }
+            sent = std::string(incremental.prompt().substr(0, reused)) + std::string(incremental.suffix());
+        }
+    }
+
+    // a template that rewrites earlier output is rendered in full
+    HodgePodge::ChatTemplate counted("{{ messages|length }}:{% for message in messages %}{{ message.content }};{% endfor %}");
+    HodgePodge::IncrementalPrompt incremental(counted);
+    for (size_t count = 1; count <= history.size(); ++ count) {
+        std::span<Message const> messages(history.data(), count);
+        size_t reused = incremental.update(messages);
+        BOOST_TEST(incremental.prompt() == counted.render(messages));
+        BOOST_TEST(reused <= incremental.prompt().find(':')); // the count is rendered again
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,9 +1,16 @@
 #define BOOST_TEST_MODULE JSONTest
 #include <boost/test/unit_test.hpp>
 #include <zinc/json.hpp>
+#include <array>
+#include <climits>
+#include <cmath>
 #include <string_view>
+#include <optional>
 #include <span>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace zinc;
 
@@ -37,12 +44,14 @@ BOOST_AUTO_TEST_CASE(test_boolean_types) {
         JSON& root = *doc;
         BOOST_TEST(std::holds_alternative<bool>(root));
         BOOST_TEST(std::get<bool>(root) == true);
+        BOOST_TEST(root.truthy());
     }
     {
         JSON::Doc doc = JSON::decode("false");
         JSON& root = *doc;
         BOOST_TEST(std::holds_alternative<bool>(root));
         BOOST_TEST(std::get<bool>(root) == false);
+        BOOST_TEST(!root.truthy());
     }
 }
 
@@ -160,3 +169,567 @@ BOOST_AUTO_TEST_CASE(test_deeply_nested_structures) {
     BOOST_TEST(std::holds_alternative<long>(level3));
     BOOST_TEST(std::get<long>(level3) == 42);
 }
+
+BOOST_AUTO_TEST_CASE(test_reference_input) {
+    const std::string input = R"({"plain":"value","escaped":"a\nb"})";
+    JSON::Doc doc = JSON::decode(input, true);
+    JSON& root = *doc;
+    auto in_input = [&](std::string_view s) {
+        return s.data() >= input.data() && s.data() + s.size() <= input.data() + input.size();
+    };
+
+    // unescaped keys and strings are views into the input
+    BOOST_TEST(in_input(root.object()[0].first));
+    BOOST_TEST(in_input(root["plain"].string()));
+    BOOST_TEST(root["plain"].string() == "value");
+    // escaped strings are decoded copies
+    BOOST_TEST(!in_input(root["escaped"].string()));
+    BOOST_TEST(root["escaped"].string() == "a\nb");
+
+    JSON::Doc copied = JSON::decode(input);
+    BOOST_TEST(!in_input((*copied)["plain"].string()));
+}
+
+BOOST_AUTO_TEST_CASE(test_docs_outlive_later_parses) {
+    // docs are freed in any order, and stay valid while many later ones are parsed
+    std::vector<std::optional<JSON::Doc>> docs;
+    for (long idx = 0; idx < 64; ++ idx) {
+        docs.emplace_back(JSON::decode(R"({"index":)" + std::to_string(idx) + R"(,"padding":")" + std::string(200, 'x') + R"("})"));
+    }
+    for (size_t idx = 1; idx < docs.size(); idx += 2) {
+        docs[idx].reset();
+        JSON::decode("null");
+    }
+    for (size_t idx = 0; idx < docs.size(); idx += 2) {
+        BOOST_TEST(std::get<long>((**docs[idx])["index"]) == (long)idx);
+        BOOST_TEST((**docs[idx])["padding"].size() == 200);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_large_document) {
+    // spans many arena blocks, with strings larger than a block
+    std::string input = "[";
+    for (size_t idx = 0; idx < 10000; ++ idx) {
+        input += R"({"key":")" + std::string(idx % 97 == 0 ? 10000 : 8, 'k') + R"(","value":[)" + std::to_string(idx) + "]},";
+    }
+    input.back() = ']';
+    JSON::Doc doc = JSON::decode(input);
+    auto & array = (*doc).array();
+    BOOST_REQUIRE_EQUAL(array.size(), 10000);
+    for (size_t idx = 0; idx < array.size(); ++ idx) {
+        BOOST_TEST(array[idx]["key"].size() == (idx % 97 == 0 ? 10000 : 8));
+        BOOST_TEST(std::get<long>(array[idx]["value"][0]) == (long)idx);
+    }
+    BOOST_TEST(JSON(array).encode() == input);
+}
+
+BOOST_AUTO_TEST_CASE(test_checked_decode) {
+    // the checked parser verifies every pointer as the tree is built
+    std::string input = R"({"arr":[1,{"nested":"a\u0020b"}],"obj":{},"text":")" + std::string(5000, 't') + R"("})";
+    for (bool reference_input : {false, true}) {
+        JSON::Doc checked = JSON::decode_checked(input, reference_input);
+        JSON::Doc released = JSON::decode(input, reference_input);
+        BOOST_TEST((*checked).encode() == std::string((*released).encode()));
+        BOOST_TEST((*checked)["arr"][1]["nested"].string() == "a b");
+    }
+    BOOST_CHECK_THROW(JSON::decode_checked("[1,"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_parsers) {
+    // threads parse at once, with decode() and with parsers of their own,
+    // and hand their docs to the main thread, which frees them out of order
+    constexpr size_t thread_count = 4, docs_per_thread = 200;
+    std::vector<std::vector<JSON::Doc>> docs(thread_count);
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < thread_count; ++ thread) {
+        threads.emplace_back([thread, &docs] {
+            JSON::Parser parser;
+            for (size_t idx = 0; idx < docs_per_thread; ++ idx) {
+                std::string input = R"({"thread":)" + std::to_string(thread) + R"(,"index":)" + std::to_string(idx)
+                    + R"(,"text":")" + std::string(idx * 7 % 300, 'x') + R"("})";
+                docs[thread].push_back(idx % 2 ? parser.decode(input) : JSON::decode(input));
+            }
+        });
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    for (size_t thread = 0; thread < thread_count; ++ thread) {
+        for (size_t idx = docs_per_thread; idx -- > 0; ) {
+            auto & root = *docs[(thread + idx) % thread_count][idx];
+            BOOST_TEST(std::get<long>(root["thread"]) == (long)((thread + idx) % thread_count));
+            BOOST_TEST(std::get<long>(root["index"]) == (long)idx);
+            BOOST_TEST(root["text"].size() == idx * 7 % 300);
+            docs[(thread + idx) % thread_count][idx] = JSON::decode("null");
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_parser_recovers_from_errors) {
+    JSON::Parser parser;
+    BOOST_CHECK_THROW(parser.decode(R"({"a":[1,2)"), std::invalid_argument);
+    JSON::Doc doc = parser.decode(R"({"a":[1,2]})");
+    BOOST_TEST((*doc)["a"].size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_find) {
+    JSON::Doc doc = JSON::decode(R"({"a":1,"b":null,"a":2})");
+    BOOST_REQUIRE((*doc).find("a") != nullptr);
+    BOOST_TEST(std::get<long>(*(*doc).find("a")) == 1);
+    BOOST_TEST((*doc).find("b") != nullptr);
+    BOOST_TEST((*doc).find("c") == nullptr);
+    BOOST_CHECK_THROW((*doc)["a"], std::out_of_range);
+    BOOST_TEST((*doc)["b"].find("a") == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(test_indexed_objects) {
+    // objects from the parser with many keys are looked up through an index
+    for (size_t size : {JSON::min_indexed_object_size - 1, JSON::min_indexed_object_size, (size_t)1000}) {
+        std::string input = "{";
+        for (size_t idx = 0; idx < size; ++ idx) {
+            input += "\"key" + std::to_string(idx) + "\":" + std::to_string(idx) + ",";
+        }
+        input += R"("nested":{"inner":[1,2]}})";
+        JSON::Doc doc = JSON::decode_checked(input);
+        JSON const& root = *doc;
+        for (size_t idx = 0; idx < size; ++ idx) {
+            std::string key = "key" + std::to_string(idx);
+            BOOST_TEST(std::get<long>(root[key]) == (long)idx);
+            BOOST_TEST(root.find(key) == &root[key]);
+        }
+        BOOST_TEST(root.find("key") == nullptr);
+        BOOST_TEST(root.find("missing") == nullptr);
+        BOOST_CHECK_THROW(root["missing"], std::out_of_range);
+        BOOST_TEST(root.encode() == input);
+
+        // copies share the index, hand-built objects are scanned
+        JSON copy = root;
+        BOOST_TEST(copy.find("nested") == root.find("nested"));
+        std::vector<KeyJSONPair> pairs(root.object().begin(), root.object().end());
+        JSON built = std::span<KeyJSONPair>(pairs);
+        BOOST_TEST(std::get<long>(built["key0"]) == 0);
+        BOOST_TEST((built == root));
+    }
+
+    // repeated keys are found first to last, and still throw with operator[]
+    std::string input = "{";
+    for (size_t idx = 0; idx < 40; ++ idx) {
+        input += "\"key" + std::to_string(idx % 30) + "\":" + std::to_string(idx) + ",";
+    }
+    input.back() = '}';
+    JSON::Doc doc = JSON::decode(input);
+    BOOST_TEST(std::get<long>(*(*doc).find("key5")) == 5);
+    BOOST_CHECK_THROW((*doc)["key5"], std::out_of_range);
+    BOOST_TEST(std::get<long>((*doc)["key20"]) == 20);
+}
+
+BOOST_AUTO_TEST_CASE(test_compare_nested_objects) {
+    // key order does not matter, at any depth
+    JSON::Doc a = JSON::decode(R"({"x":{"p":1,"q":{"r":[1,{"s":2,"t":3}]}},"y":[{"u":null,"v":true}]})");
+    JSON::Doc b = JSON::decode(R"({"y":[{"v":true,"u":null}],"x":{"q":{"r":[1,{"t":3,"s":2}]},"p":1}})");
+    JSON::Doc c = JSON::decode(R"({"y":[{"v":true,"u":null}],"x":{"q":{"r":[1,{"t":4,"s":2}]},"p":1}})");
+    BOOST_TEST((*a == *b));
+    BOOST_TEST(((*a <=> *c) == std::partial_ordering::less));
+    BOOST_TEST(((*c <=> *a) == std::partial_ordering::greater));
+
+    // arrays compare element by element, then by length
+    BOOST_TEST(((*JSON::decode("[1,2]") <=> *JSON::decode("[1,2,0]")) == std::partial_ordering::less));
+    BOOST_TEST(((*JSON::decode("[1,3]") <=> *JSON::decode("[1,2,0]")) == std::partial_ordering::greater));
+    BOOST_TEST(((*JSON::decode(R"({"a":1})") <=> *JSON::decode(R"({"a":"1"})")) == std::partial_ordering::unordered));
+
+    // objects past the stack buffer, indexed by the parser or built by hand
+    for (size_t size : {(size_t)10, (size_t)100}) {
+        std::string forward = "{", backward = "{", changed = "{";
+        for (size_t idx = 0; idx < size; ++ idx) {
+            forward += "\"k" + std::to_string(idx) + "\":{\"v\":" + std::to_string(idx) + "},";
+            backward += "\"k" + std::to_string(size - 1 - idx) + "\":{\"v\":" + std::to_string(size - 1 - idx) + "},";
+            changed += "\"k" + std::to_string(idx) + "\":{\"v\":" + std::to_string(idx == size / 2 ? 0 : idx) + "},";
+        }
+        forward.back() = backward.back() = changed.back() = '}';
+        JSON::Doc f = JSON::decode(forward), b = JSON::decode(backward), c = JSON::decode(changed);
+        std::vector<KeyJSONPair> pairs((*b).object().begin(), (*b).object().end());
+        JSON built = std::span<KeyJSONPair>(pairs);
+        BOOST_TEST((*f == *b));
+        BOOST_TEST((*f == built));
+        BOOST_TEST(((*f <=> *c) == std::partial_ordering::greater));
+        BOOST_TEST(((built <=> *c) == std::partial_ordering::greater));
+    }
+
+    // repeated keys compare in order of position
+    BOOST_TEST((*JSON::decode(R"({"a":1,"b":0,"a":2})") == *JSON::decode(R"({"b":0,"a":1,"a":2})")));
+    BOOST_TEST(!(*JSON::decode(R"({"a":1,"b":0,"a":2})") == *JSON::decode(R"({"b":0,"a":2,"a":1})")));
+}
+
+BOOST_AUTO_TEST_CASE(test_parser_write_in_pieces) {
+    std::string input = R"({"data":[{"index":0,"embedding":[0.5,-1]},{"index":1,"embedding":[2,3.25]}],"note":"a\"b","n":null})";
+    JSON::Parser parser;
+    for (size_t piece : {(size_t)1, (size_t)3, (size_t)7, input.size()}) {
+        for (size_t start = 0; start < input.size(); start += piece) {
+            // each piece is gone once written
+            std::string chunk = input.substr(start, piece);
+            parser.write(chunk);
+            chunk.assign(chunk.size(), '#');
+        }
+        JSON::Doc doc = parser.finish();
+        BOOST_TEST((*doc).encode() == std::string(JSON::decode(input).operator*().encode()));
+        BOOST_TEST((*doc)["note"].string() == "a\"b");
+    }
+
+    // errors surface from write or finish, and the parser starts over afterwards
+    parser.write(R"({"a":[1,)");
+    BOOST_CHECK_THROW(parser.finish(), std::invalid_argument);
+    parser.write("[1,");
+    BOOST_CHECK_THROW(parser.write("}"), std::invalid_argument);
+    parser.write("[true]");
+    BOOST_TEST(std::get<bool>((*parser.finish())[0]) == true);
+    // decode between documents does not disturb them
+    parser.write("[1,");
+    BOOST_TEST((*parser.decode("2")).index() == JSON::INTEGER);
+    parser.write("[3]");
+    BOOST_TEST(std::get<long>((*parser.finish())[0]) == 3);
+
+    // a document abandoned part way, as when its connection fails, is not continued
+    parser.write(R"({"data":[{"index":0,"embed)");
+    parser.reset();
+    parser.write("[4,");
+    parser.write("5]");
+    BOOST_TEST((*parser.finish()).encode() == "[4,5]");
+    parser.reset(); // with no document begun
+    parser.write("6");
+    BOOST_TEST(std::get<long>(*parser.finish()) == 6);
+}
+
+BOOST_AUTO_TEST_CASE(test_parser_array_elements) {
+    std::vector<std::string> seen;
+    JSON::Parser parser([&](JSON const& element) {
+        seen.emplace_back(element.encode());
+    });
+    std::string input = R"([{"id":1,"tags":["x","y"]},[2,[3]],"four",5,null,{}])";
+    for (size_t start = 0; start < input.size(); start += 5) {
+        parser.write(input.substr(start, 5));
+    }
+    JSON::Doc doc = parser.finish();
+    BOOST_TEST((*doc).array().empty());
+    BOOST_TEST(seen == std::vector<std::string>({R"({"id":1,"tags":["x","y"]})", "[2,[3]]", R"("four")", "5", "null", "{}"}));
+
+    // only elements of a top-level array are handed over
+    seen.clear();
+    JSON::Doc object = parser.decode(R"({"items":[1,2]})");
+    BOOST_TEST(seen.empty());
+    BOOST_TEST((*object)["items"].size() == 2);
+
+    // many elements, each freed once handed over
+    seen.clear();
+    parser.write("[");
+    for (size_t idx = 0; idx < 5000; ++ idx) {
+        parser.write((idx ? "," : "") + std::string(R"({"text":")") + std::string(100, 'z') + R"("})");
+    }
+    parser.write("]");
+    parser.finish();
+    BOOST_TEST(seen.size() == 5000);
+
+    // an array abandoned part way hands over no more, and the next starts afresh
+    parser.write("[1,[2,");
+    parser.reset();
+    seen.clear();
+    parser.write("[7]");
+    BOOST_TEST((*parser.finish()).array().empty());
+    BOOST_TEST(seen == std::vector<std::string>({"7"}));
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_to_sink) {
+    std::string input = R"({"a":[1,2.5,-0.0,3.0,"q\"\\\n\u0001"],"b":{},"c":[],"d":{"e":null,"f":true}})";
+    JSON::Doc doc = JSON::decode(input);
+    BOOST_TEST((*doc).encode() == input);
+    BOOST_TEST((*doc).encode(2) ==
+        "{\n"
+        "  \"a\": [\n"
+        "    1,\n"
+        "    2.5,\n"
+        "    -0.0,\n"
+        "    3.0,\n"
+        "    \"q\\\"\\\\\\n\\u0001\"\n"
+        "  ],\n"
+        "  \"b\": {},\n"
+        "  \"c\": [],\n"
+        "  \"d\": {\n"
+        "    \"e\": null,\n"
+        "    \"f\": true\n"
+        "  }\n"
+        "}");
+    BOOST_TEST(JSON(1.0e300).encode() == "1e+300");
+    BOOST_TEST(((*JSON::decode((*doc).encode(0))) == *doc));
+
+    // a string sink is appended to, a function sink gets bounded pieces
+    std::string out = "prefix";
+    (*doc).encode(out);
+    BOOST_TEST(out == "prefix" + input);
+
+    std::string big = "[";
+    for (size_t idx = 0; idx < 3000; ++ idx) {
+        big += (idx ? "," : "") + std::string(R"({"text":")") + std::string(idx % 7, 'x') + R"("})";
+    }
+    big += "]";
+    JSON::Doc bigdoc = JSON::decode(big);
+    std::string pieces;
+    size_t calls = 0;
+    (*bigdoc).encode([&](std::string_view chunk) {
+        BOOST_TEST(chunk.size() <= JSON::encode_chunk_size);
+        BOOST_TEST(!chunk.empty());
+        pieces += chunk;
+        ++ calls;
+    });
+    BOOST_TEST(pieces == big);
+    BOOST_TEST(calls == (big.size() + JSON::encode_chunk_size - 1) / JSON::encode_chunk_size);
+}
+
+BOOST_AUTO_TEST_CASE(test_builder) {
+    JSON::Doc parsed = JSON::decode(R"({"type":"object","required":["path"]})");
+    JSON::Builder builder;
+    for (int round = 0; round < 2; ++ round) {
+        std::string role = "user", text = "hello \"there\"";
+        builder.begin_object().insert("model", "m").insert("temperature", 0.5).insert("schema", *parsed);
+        builder.key("messages").begin_array();
+        for (int idx = 0; idx < 3; ++ idx) {
+            builder.begin_object().insert("role", role).insert("content", text).end();
+        }
+        builder.end().key("stream").push(true).end();
+        JSON::Doc doc = builder.finish();
+        // the values were copied, so the originals may change
+        role = "xxxx";
+        text.assign(100, 'x');
+        BOOST_TEST((*doc).encode() == R"({"model":"m","temperature":0.5,"schema":{"type":"object","required":["path"]},"messages":[)"
+            R"({"role":"user","content":"hello \"there\""},{"role":"user","content":"hello \"there\""},{"role":"user","content":"hello \"there\""}],"stream":true})");
+        BOOST_TEST((*doc)["messages"][2]["role"].string() == "user");
+    }
+
+    // large objects are indexed as parsed ones are
+    builder.begin_object();
+    for (size_t idx = 0; idx < 40; ++ idx) {
+        builder.insert("key" + std::to_string(idx), (long)idx);
+    }
+    JSON::Doc large = builder.end().finish();
+    BOOST_TEST(std::get<long>(*(*large).find("key39")) == 39);
+    BOOST_TEST(((*large) == (*JSON::decode((*large).encode()))));
+
+    BOOST_CHECK_THROW(builder.end(), std::logic_error);
+    BOOST_CHECK_THROW(builder.key("k"), std::logic_error);
+    builder.begin_object();
+    BOOST_CHECK_THROW(builder.push(1L), std::logic_error);
+    builder.key("k");
+    BOOST_CHECK_THROW(builder.key("k"), std::logic_error);
+    BOOST_CHECK_THROW(builder.end(), std::logic_error);
+    BOOST_CHECK_THROW(builder.finish(), std::logic_error);
+    // the builder starts over after a failed finish
+    BOOST_TEST(((*builder.push(nullptr).finish()) == JSON(nullptr)));
+    builder.push(1L);
+    BOOST_CHECK_THROW(builder.push(2L), std::logic_error);
+    BOOST_TEST(std::get<long>(*builder.finish()) == 1);
+
+    // referenced values are stored as they are
+    JSON::Builder referencing(true);
+    std::string content = "abc";
+    JSON::Doc doc = referencing.begin_array().push(content).push(*parsed).end().finish();
+    BOOST_TEST((*doc)[0].string().data() == content.data());
+    BOOST_TEST((*doc)[1].object().data() == (*parsed).object().data());
+}
+
+struct BoundUsage {
+    long total = 0;
+    double cost = 0;
+    static constexpr auto json_fields()
+    { return std::array{JSON::field<&BoundUsage::total>("total"), JSON::field<&BoundUsage::cost>("cost")}; }
+};
+struct BoundChoice {
+    std::string_view text;
+    bool done = false;
+    std::vector<long> ids;
+    static constexpr auto json_fields()
+    {
+        return std::array{
+            JSON::field<&BoundChoice::text>("text"),
+            JSON::field<&BoundChoice::done>("done"),
+            JSON::field<&BoundChoice::ids>("ids"),
+        };
+    }
+};
+struct BoundChunk {
+    std::vector<BoundChoice> choices;
+    BoundUsage usage;
+    std::string_view note = "unset";
+    static constexpr auto json_fields()
+    {
+        return std::array{
+            JSON::field<&BoundChunk::choices>("choices"),
+            JSON::field<&BoundChunk::usage>("usage"),
+            JSON::field<&BoundChunk::note>("note"),
+        };
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_bind) {
+    JSON::Binder binder;
+    BoundChunk chunk;
+    // unknown subtrees are skipped, integers convert to numbers, other mismatched types are skipped
+    std::string input = R"({"id":"x","skip":{"choices":[{"text":"no"}],"deep":[[{}],[]]},)"
+        R"("choices":[{"text":"plain","done":false,"ids":[1,2,3],"extra":{"text":"no"}},)"
+        R"({"text":"esc\"aped\n","done":true,"ids":[4,"five",6]},)"
+        R"({"text":null,"done":"yes","ids":{}}],"usage":{"total":12,"cost":3},"note":7})";
+    binder.bind(input, chunk);
+    BOOST_REQUIRE_EQUAL(chunk.choices.size(), 3);
+    BOOST_TEST(chunk.choices[0].text == "plain");
+    std::less_equal<char const*> before;
+    BOOST_TEST((before(input.data(), chunk.choices[0].text.data()) && before(chunk.choices[0].text.data(), &input.back()))); // a view into the input
+    BOOST_TEST(chunk.choices[0].done == false);
+    BOOST_TEST(chunk.choices[0].ids == std::vector<long>({1, 2, 3}));
+    BOOST_TEST(chunk.choices[1].text == "esc\"aped\n");
+    BOOST_TEST(chunk.choices[1].done == true);
+    BOOST_TEST(chunk.choices[1].ids == std::vector<long>({4, 6}));
+    BOOST_TEST(chunk.choices[2].text.empty());
+    BOOST_TEST(chunk.choices[2].done == false);
+    BOOST_TEST(chunk.choices[2].ids.empty());
+    BOOST_TEST(chunk.usage.total == 12);
+    BOOST_TEST(chunk.usage.cost == 3.0);
+    BOOST_TEST(chunk.note == "unset");
+
+    // a vector is emptied when its array begins, absent fields are left alone
+    binder.bind(R"({"choices":[{"text":"again"}]})", chunk);
+    BOOST_REQUIRE_EQUAL(chunk.choices.size(), 1);
+    BOOST_TEST(chunk.choices[0].text == "again");
+    BOOST_TEST(chunk.usage.total == 12);
+    binder.bind(R"([{"choices":[]}])", chunk);
+    BOOST_TEST(chunk.choices.size() == 1);
+
+    BOOST_CHECK_THROW(binder.bind(R"({"choices":[)", chunk), std::invalid_argument);
+    binder.bind(R"({"choices":[],"note":"after"})", chunk);
+    BOOST_TEST(chunk.choices.empty());
+    BOOST_TEST(chunk.note == "after");
+}
+
+BOOST_AUTO_TEST_CASE(test_path) {
+    JSON::Doc doc = JSON::decode(R"({"choices":[{"index":0,"delta":{"content":"a"}},{"index":1,"delta":{"content":"b"}}],)"
+        R"("a/b":{"m~n":1},"":{"":2},"0":"zero","07":"seven"})");
+    auto & root = *doc;
+    BOOST_TEST(JSON::Path("/choices/1/delta/content").find(root)->string() == "b");
+    BOOST_TEST(JSON::Path("").find(root) == &root);
+    BOOST_TEST(std::get<long>(*JSON::Path("/a~1b/m~0n").find(root)) == 1);
+    BOOST_TEST(std::get<long>(*JSON::Path("//").find(root)) == 2);
+    BOOST_TEST(JSON::Path("/0").find(root)->string() == "zero");
+    BOOST_TEST(JSON::Path("/07").find(root)->string() == "seven");
+    for (auto missing : {"/choices/2", "/choices/01/index", "/choices/x", "/nothing", "/0/0", "/choices/-"}) {
+        BOOST_TEST(JSON::Path(missing).find(root) == nullptr);
+    }
+
+    std::string contents;
+    JSON::Path("/choices/*/delta/content").for_each(root, [&](JSON const& json) { contents += json.string(); });
+    BOOST_TEST(contents == "ab");
+    size_t members = 0;
+    JSON::Path("/*").for_each(root, [&](JSON const&) { ++ members; });
+    BOOST_TEST(members == 5);
+    BOOST_TEST(JSON::Path("/*/1/index").find(root) == &root["choices"][1]["index"]);
+
+    // the remembered key position is only a hint
+    JSON::Path content("/delta/content");
+    for (auto input : {R"({"delta":{"role":"x","content":"1"}})", R"({"delta":{"content":"2"}})", R"({"delta":{"a":0,"b":0,"content":"3"}})", R"({"delta":{"role":"x"}})"}) {
+        JSON::Doc chunk = JSON::decode(input);
+        BOOST_TEST(content.find(*chunk) == (*chunk)["delta"].find("content"));
+    }
+
+    for (auto invalid : {"choices", "/a~", "/a~2"}) {
+        BOOST_CHECK_THROW(JSON::Path{invalid}, std::invalid_argument);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_cbor) {
+    auto bytes = [](std::initializer_list<unsigned> list) {
+        std::string result;
+        for (auto b : list) {
+            result += (char)b;
+        }
+        return result;
+    };
+    // {"a": [1, -500, 1.5, "xy", h'00ff', true, null], "b": {}, "c": 4294967296}
+    std::string cbor = bytes({0xa3, 0x61, 'a', 0x87, 0x01, 0x39, 0x01, 0xf3, 0xf9, 0x3e, 0x00, 0x62, 'x', 'y', 0x42, 0x00, 0xff, 0xf5, 0xf6,
+        0x61, 'b', 0xa0, 0x61, 'c', 0x1b, 0, 0, 0, 1, 0, 0, 0, 0});
+    JSON::Doc doc = JSON::decode_cbor(cbor);
+    auto & a = (*doc)["a"];
+    BOOST_TEST(a.size() == 7);
+    BOOST_TEST(std::get<long>(a[0]) == 1);
+    BOOST_TEST(std::get<long>(a[1]) == -500);
+    BOOST_TEST(std::get<double>(a[2]) == 1.5);
+    BOOST_TEST(a[3].string() == "xy");
+    BOOST_TEST(a[4].string() == std::string("\0\xff", 2));
+    BOOST_TEST(std::get<bool>(a[5]) == true);
+    BOOST_TEST(a[6].index() == (JSON::Index)NULL);
+    BOOST_TEST((*doc)["b"].object().size() == 0);
+    BOOST_TEST(std::get<long>((*doc)["c"]) == 4294967296l);
+    BOOST_TEST((*doc).encode() == "{\"a\":[1,-500,1.5,\"xy\",\"\\u0000\xff\",true,null],\"b\":{},\"c\":4294967296}");
+
+    // indefinite containers, a tag, and floats of each width
+    doc = JSON::decode_cbor(bytes({0x9f, 0xbf, 0x61, 'k', 0xc1, 0x1a, 0x5f, 0x5e, 0x10, 0x00, 0xff,
+        0xf9, 0xfc, 0x00, 0xfa, 0x3f, 0xc0, 0x00, 0x00, 0xfb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a, 0xf9, 0x00, 0x01, 0xff}));
+    BOOST_TEST(std::get<long>((*doc)[0]["k"]) == 1600000000);
+    BOOST_TEST(std::isinf(std::get<double>((*doc)[1])));
+    BOOST_TEST(std::get<double>((*doc)[1]) < 0);
+    BOOST_TEST(std::get<double>((*doc)[2]) == 1.5);
+    BOOST_TEST(std::get<double>((*doc)[3]) == 0.1);
+    BOOST_TEST(std::get<double>((*doc)[4]) == std::ldexp(1.0, -24));
+
+    // strings may refer to the input
+    std::string text = bytes({0x63, 'a', 'b', 'c'});
+    JSON::Doc referencing = JSON::decode_cbor(text, true);
+    BOOST_TEST(((*referencing).string().data() == text.data() + 1));
+    JSON::Doc copying = JSON::decode_cbor(text);
+    BOOST_TEST(((*copying).string().data() != text.data() + 1));
+
+    for (auto invalid : {
+        bytes({}), bytes({0x82, 0x01}), bytes({0x63, 'a'}), bytes({0x01, 0x02}), bytes({0xa1, 0x01, 0x02}),
+        bytes({0x1c}), bytes({0x5f, 0x41, 'a', 0xff}), bytes({0xf8}), bytes({0xfc}), bytes({0x9f, 0x01})
+    }) {
+        BOOST_CHECK_THROW(JSON::decode_cbor(invalid), std::invalid_argument);
+    }
+    std::string deep(100, (char)0x81);
+    deep += (char)0x01;
+    BOOST_CHECK_THROW(JSON::decode_cbor(deep), std::invalid_argument);
+    std::string tags(100000, (char)0xc0);
+    tags += (char)0x01;
+    BOOST_CHECK_THROW(JSON::decode_cbor(tags), std::invalid_argument);
+    BOOST_TEST(std::get<long>(*JSON::decode_cbor(bytes({0x01}))) == 1);
+
+    // integers beyond a long are rejected rather than wrapped
+    BOOST_TEST(std::get<long>(*JSON::decode_cbor(bytes({0x1b, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}))) == LONG_MAX);
+    BOOST_TEST(std::get<long>(*JSON::decode_cbor(bytes({0x3b, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}))) == LONG_MIN);
+    BOOST_CHECK_THROW(JSON::decode_cbor(bytes({0x1b, 0x80, 0, 0, 0, 0, 0, 0, 0})), std::invalid_argument);
+    BOOST_CHECK_THROW(JSON::decode_cbor(bytes({0x3b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff})), std::invalid_argument);
+}
+
+// The cases below exercise the block scanning of the simd backend; ctest runs every test under both backends
+BOOST_AUTO_TEST_CASE(test_escapes_across_blocks) {
+    // runs of backslashes and escaped quotes ending on each side of the 64-byte block boundaries
+    for (size_t offset = 50; offset < 140; ++ offset) {
+        for (size_t backslashes = 1; backslashes <= 4; ++ backslashes) {
+            std::string expected = std::string(backslashes / 2, '\\') + (backslashes % 2 ? "\"" : "") + "]";
+            std::string input = "[" + std::string(offset, ' ') + "\"" + std::string(backslashes, '\\') + (backslashes % 2 ? "\"" : "") + "]\",{\"k\":1}]";
+            JSON::Doc doc = JSON::decode(input);
+            BOOST_TEST((*doc)[0].string() == expected);
+            BOOST_TEST(std::get<long>((*doc)[1]["k"]) == 1);
+        }
+    }
+    std::string padded = std::string(61, ' ') + R"(["\u00e9\ud83d\ude00\/\b\f\n\r\t",true,-0.25e2,null])";
+    JSON::Doc doc = JSON::decode(padded);
+    BOOST_TEST((*doc)[0].string() == "\u00e9\U0001F600/\b\f\n\r\t");
+    BOOST_TEST(std::get<bool>((*doc)[1]) == true);
+    BOOST_TEST(std::get<double>((*doc)[2]) == -25.0);
+    BOOST_TEST((*doc)[0].size() == 12);
+}
+
+BOOST_AUTO_TEST_CASE(test_rejects_invalid_documents) {
+    for (std::string_view input : {
+        "", " ", "[1,]", "[1 2]", R"({"a" 1})", R"({"a":1,})", "[1] x", "01", "1.", "-", "1e", "tru", "nulls",
+        "\"unterminated", "[\"a\\\"]", "\"\\x\"", "\"\\ud800\"", "\"\\u12\"", "\"tab\there\"", "\"\xff\"", "\"\xc3\"",
+        "{\"a\":}", "[}", "{]", ":", ","
+    }) {
+        BOOST_CHECK_THROW(JSON::decode(input), std::invalid_argument);
+    }
+    BOOST_TEST((*JSON::decode(" \"\xc3\xa9\" ")).string() == "\xc3\xa9");
+}
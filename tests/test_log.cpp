@@ -1,12 +1,30 @@
 #define BOOST_TEST_MAIN
 #include <boost/test/unit_test.hpp>
 #include <zinc/log.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <set>
+#include <stdexcept>
+#include <string>
 #include <thread>
 
 namespace fs = std::filesystem;
 
+// The file being logged to; closed files of earlier runs may be compressed
+static fs::path current_log()
+{
+    std::string path;
+    for (auto & file : zinc::Log::files()) {
+        if (file.ends_with(".log")) {
+            path = file;
+        }
+    }
+    return path;
+}
+
 BOOST_AUTO_TEST_SUITE(LogTest)
 
 BOOST_AUTO_TEST_CASE(log_file_creation)
@@ -53,7 +71,7 @@ BOOST_AUTO_TEST_CASE(log_file_name)
 
     // Check that the log file name is in the correct format
     fs::path logs_dir = zinc_dir / "logs";
-    fs::path log_file = fs::directory_iterator(logs_dir)->path();
+    fs::path log_file = current_log();
     std::string log_file_name = log_file.filename().string();
     BOOST_CHECK(log_file_name.size() == 24); // YYYY-MM-DDTHHMMSSZ.log
     BOOST_CHECK(log_file_name.substr(0, 4).find_first_not_of("0123456789") == std::string::npos); // Year
@@ -88,10 +106,11 @@ BOOST_AUTO_TEST_CASE(log_file_contents)
     zinc::Log::log(zinc::span<zinc::StringViewPair>({
         {"key", "value"}
     }));
+    zinc::Log::flush();
 
     // Check that the log file contains the expected contents
     fs::path logs_dir = zinc_dir / "logs";
-    fs::path log_file = fs::directory_iterator(logs_dir)->path();
+    fs::path log_file = current_log();
     std::ifstream log_stream(log_file);
     std::string log_contents((std::istreambuf_iterator<char>(log_stream)), std::istreambuf_iterator<char>());
     BOOST_CHECK(log_contents.find("\"key\":\"value\"") != std::string::npos);
@@ -116,10 +135,11 @@ BOOST_AUTO_TEST_CASE(log_multiple_fields)
         {"key1", "value1"},
         {"key2", "value2"}
     }));
+    zinc::Log::flush();
 
     // Check that the log file contains the expected contents
     fs::path logs_dir = zinc_dir / "logs";
-    fs::path log_file = fs::directory_iterator(logs_dir)->path();
+    fs::path log_file = current_log();
     std::ifstream log_stream(log_file);
     std::string log_contents((std::istreambuf_iterator<char>(log_stream)), std::istreambuf_iterator<char>());
     BOOST_CHECK(log_contents.find("\"key1\":\"value1\"") != std::string::npos);
@@ -127,4 +147,328 @@ BOOST_AUTO_TEST_CASE(log_multiple_fields)
     BOOST_CHECK(log_contents.find("\"ts\":") != std::string::npos);
 }
 
+BOOST_AUTO_TEST_CASE(log_read_lines)
+{
+    fs::path temp_dir = fs::temp_directory_path() / "zinc-test";
+    fs::create_directory(temp_dir);
+    fs::path path = temp_dir / "lines.jsonl";
+    {
+        // enough lines for many ranges, some long
+        std::ofstream out(path);
+        for (size_t idx = 0; idx < 20000; ++ idx) {
+            out << R"({"n":)" << idx << R"(,"text":")" << std::string(idx % 1000 == 0 ? 100000 : idx % 50, 'x') << "\"}\n";
+            if (idx % 777 == 0) {
+                out << "\n";
+            }
+        }
+        out << R"({"n":20000,"tor)";
+    }
+    for (size_t threads : {size_t(1), size_t(3), size_t(0)}) {
+        size_t expected = 0;
+        for (auto & json : zinc::Log::read(path.string(), true, threads)) {
+            BOOST_REQUIRE(std::get<long>(json["n"]) == (long)expected);
+            ++ expected;
+        }
+        BOOST_TEST(expected == 20000);
+
+        std::set<long> seen;
+        for (auto & json : zinc::Log::read(path.string(), false, threads)) {
+            seen.insert(std::get<long>(json["n"]));
+        }
+        BOOST_TEST(seen.size() == 20000);
+        BOOST_TEST(*seen.rbegin() == 19999);
+    }
+
+    // stopping early stops the threads
+    size_t count = 0;
+    for (auto & json : zinc::Log::read(path.string())) {
+        if (++ count == 10) {
+            BOOST_TEST(std::get<long>(json["n"]) == 9);
+            break;
+        }
+    }
+
+    {
+        std::ofstream out(path);
+        out << "{\"n\":0}\nnot json\n{\"n\":1}\n";
+    }
+    auto read_all = [&]{ for (auto & json : zinc::Log::read(path.string())) { (void)json; } };
+    BOOST_CHECK_THROW(read_all(), std::invalid_argument);
+    std::ofstream(path).close();
+    read_all();
+    BOOST_CHECK_THROW(zinc::Log::read((temp_dir / "missing.jsonl").string()), std::system_error);
+    fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(log_files_are_read_back)
+{
+    fs::path temp_dir = fs::temp_directory_path() / "zinc-test";
+    fs::create_directory(temp_dir);
+    fs::create_directory(temp_dir / ".zinc");
+    fs::current_path(temp_dir);
+
+    zinc::Log::log(zinc::span<zinc::StringViewPair>({
+        {"key", "read back"}
+    }));
+    zinc::Log::flush();
+
+    bool found = false;
+    for (auto & json : zinc::Log::read(current_log().string())) {
+        found = found || json.dicty("key").stringy() == "read back";
+    }
+    BOOST_TEST(found);
+}
+
+BOOST_AUTO_TEST_CASE(log_from_threads)
+{
+    fs::path temp_dir = fs::temp_directory_path() / "zinc-test";
+    fs::create_directory(temp_dir);
+    fs::create_directory(temp_dir / ".zinc");
+    fs::current_path(temp_dir);
+
+    // more entries than the queue holds, from several threads
+    constexpr size_t threads = 4, entries = 5000;
+    zinc::Log::sync(zinc::Log::Sync::BATCH);
+    std::vector<std::thread> loggers;
+    for (size_t thread = 0; thread < threads; ++ thread) {
+        loggers.emplace_back([thread]{
+            std::string name = "thread" + std::to_string(thread);
+            for (size_t idx = 0; idx < entries; ++ idx) {
+                std::string n = std::to_string(idx);
+                zinc::Log::log(zinc::span<zinc::StringViewPair>({
+                    {"thread", name},
+                    {"n", n}
+                }));
+            }
+        });
+    }
+    for (auto & logger : loggers) {
+        logger.join();
+    }
+    zinc::Log::flush();
+    zinc::Log::sync(zinc::Log::Sync::FLUSH);
+
+    std::vector<long> next(threads, 0);
+    for (auto & json : zinc::Log::read(current_log().string())) {
+        auto name = json.dicty("thread").stringy();
+        if (!name.starts_with("thread")) {
+            continue;
+        }
+        size_t thread = (size_t)(name.back() - '0');
+        // each thread's entries are in its order
+        BOOST_REQUIRE(json.dicty("n").stringy() == std::to_string(next[thread]));
+        ++ next[thread];
+    }
+    for (auto n : next) {
+        BOOST_TEST(n == (long)entries);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(log_rotation)
+{
+    fs::path temp_dir = fs::temp_directory_path() / "zinc-test";
+    fs::create_directory(temp_dir);
+    fs::create_directory(temp_dir / ".zinc");
+    fs::current_path(temp_dir);
+    fs::path logs_dir = temp_dir / ".zinc" / "logs";
+
+    zinc::Log::Rotation rotation;
+    rotation.max_size = 32 * 1024;
+    rotation.compress = false;
+    zinc::Log::rotation(rotation);
+    auto before = zinc::Log::files();
+    std::string first = current_log().string();
+    std::string run = std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+    constexpr size_t entries = 2000;
+    for (size_t idx = 0; idx < entries; ++ idx) {
+        std::string n = std::to_string(idx);
+        zinc::Log::log(zinc::span<zinc::StringViewPair>({
+            {"run", run},
+            {"n", n}
+        }));
+    }
+    zinc::Log::flush();
+
+    // the entries are spread over files, which are compressed once closed
+    rotation.compress = true;
+    zinc::Log::rotation(rotation);
+    zinc::Log::tidy();
+    size_t files = 0, compressed = 0;
+    long expected = 0;
+    for (auto & file : zinc::Log::files()) {
+        if (std::find(before.begin(), before.end(), file) != before.end() && file != first) {
+            continue; // from before
+        }
+        bool has_run = false;
+        for (auto & json : zinc::Log::read(file)) {
+            if (json.dicty("run").stringy() == run) {
+                BOOST_REQUIRE(json.dicty("n").stringy() == std::to_string(expected));
+                ++ expected;
+                has_run = true;
+            }
+        }
+        if (has_run) {
+            ++ files;
+            compressed += file.ends_with(".gz");
+        }
+    }
+    BOOST_TEST(expected == (long)entries);
+    BOOST_TEST(files > 2);
+    BOOST_TEST(compressed == files - 1);
+
+    // closed files of other launches are compressed, and old ones removed
+    fs::path other = logs_dir / "2000-01-01T00:00:00Z.log";
+    fs::path old = logs_dir / "1999-01-01T00:00:00Z.cbor";
+    std::ofstream(other) << "{\"other\":true}\n";
+    std::ofstream(old) << "";
+    fs::last_write_time(old, fs::file_time_type::clock::now() - std::chrono::days(31));
+    zinc::Log::tidy();
+    BOOST_TEST(fs::exists(old.string() + ".gz")); // kept without a limit
+    rotation.keep_days = 30;
+    zinc::Log::rotation(rotation);
+    zinc::Log::tidy();
+    BOOST_TEST(!fs::exists(other));
+    BOOST_TEST(!fs::exists(old));
+    BOOST_TEST(!fs::exists(old.string() + ".gz"));
+    BOOST_REQUIRE(fs::exists(other.string() + ".gz"));
+    size_t count = 0;
+    for (auto & json : zinc::Log::read(other.string() + ".gz")) {
+        BOOST_TEST(std::get<bool>(json["other"]));
+        ++ count;
+    }
+    BOOST_TEST(count == 1);
+    fs::remove(other.string() + ".gz");
+
+    zinc::Log::rotation(zinc::Log::Rotation());
+}
+
+BOOST_AUTO_TEST_CASE(log_index)
+{
+    fs::path temp_dir = fs::temp_directory_path() / "zinc-test";
+    fs::create_directory(temp_dir);
+    fs::create_directory(temp_dir / ".zinc");
+    fs::current_path(temp_dir);
+
+    std::string session(zinc::Log::session());
+    std::string word = "w" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+    std::string question = "Where is the " + word + " kept?";
+    std::string answer = "The " + word + " is KEPT in the index.";
+    zinc::Log::log(zinc::span<zinc::StringViewPair>({
+        {"role", "user"},
+        {"content", question}
+    }));
+    zinc::Log::log(zinc::span<zinc::StringViewPair>({
+        {"role", "assistant"},
+        {"content", answer}
+    }));
+    zinc::Log::flush();
+
+    zinc::Log::Index index;
+    auto found = index.search(word);
+    BOOST_REQUIRE(found.size() == 2);
+    BOOST_TEST(found[0].role == "assistant"); // newest first
+    BOOST_TEST(found[0].session == session);
+    BOOST_TEST((*index.read(found[0]))["content"].string() == answer);
+    BOOST_TEST((*index.read(found[1]))["content"].string() == question);
+    found = index.search(word + " kept INDEX");
+    BOOST_REQUIRE(found.size() == 1);
+    BOOST_TEST(found[0].role == "assistant");
+    BOOST_TEST(index.search(word + " missing").empty());
+    BOOST_TEST(index.search("").empty());
+
+    auto entries = index.session(session);
+    BOOST_REQUIRE(entries.size() >= 2);
+    BOOST_TEST(entries[entries.size() - 2].role == "user");
+    BOOST_TEST(entries.back().role == "assistant");
+    BOOST_TEST(index.sessions().back() == session);
+
+    // resuming a session, found by an index loaded from the saved one
+    std::string resumed = "resumed " + word;
+    zinc::Log::session(resumed);
+    zinc::Log::log(zinc::span<zinc::StringViewPair>({
+        {"role", "user"},
+        {"content", "and once more, " + word}
+    }));
+    zinc::Log::flush();
+    zinc::Log::session(session);
+    BOOST_TEST(index.session(resumed).empty());
+    // an update that is stopped indexes nothing more, and forgets nothing
+    std::atomic<bool> stop = true;
+    index.update(&stop);
+    BOOST_TEST(index.session(resumed).empty());
+    BOOST_TEST(index.search(word).size() == 2);
+    index.update();
+    BOOST_TEST(index.search(word).size() == 3);
+    zinc::Log::Index loaded;
+    entries = loaded.session(resumed);
+    BOOST_REQUIRE(entries.size() == 1);
+    BOOST_TEST((*loaded.read(entries[0]))["content"].string() == "and once more, " + word);
+    BOOST_TEST(loaded.search(word).size() == 3);
+
+    // the last conversation passes over sessions without one
+    zinc::Log::session("completions " + word);
+    zinc::Log::log(zinc::span<zinc::StringViewPair>({
+        {"prompt", "once upon a time"},
+        {"completion", "there was " + word}
+    }));
+    zinc::Log::flush();
+    zinc::Log::session(session);
+    loaded.update();
+    BOOST_TEST(loaded.last_conversation() == resumed);
+    auto messages = loaded.conversation(resumed);
+    BOOST_REQUIRE(messages.size() == 1);
+    BOOST_TEST(messages[0].first == "user");
+    BOOST_TEST(messages[0].second == "and once more, " + word);
+    BOOST_TEST(loaded.conversation("completions " + word).empty());
+}
+
+BOOST_AUTO_TEST_CASE(log_cbor_records)
+{
+    fs::path temp_dir = fs::temp_directory_path() / "zinc-test";
+    fs::create_directory(temp_dir);
+    fs::create_directory(temp_dir / ".zinc");
+    fs::current_path(temp_dir);
+
+    zinc::Log::format(zinc::Log::Format::CBOR);
+    std::string long_value(70000, 'v');
+    for (size_t idx = 0; idx < 3000; ++ idx) {
+        std::string n = std::to_string(idx);
+        zinc::Log::log(zinc::span<zinc::StringViewPair>({
+            {"n", n},
+            {"value", idx % 1000 == 0 ? std::string_view(long_value) : "\"quoted\"\n"}
+        }));
+    }
+    zinc::Log::flush();
+    zinc::Log::format(zinc::Log::Format::JSONL);
+
+    auto files = zinc::Log::files();
+    std::string cbor;
+    for (auto & file : files) {
+        if (file.ends_with(".cbor")) {
+            cbor = file;
+        }
+    }
+    BOOST_REQUIRE(!cbor.empty());
+    size_t count = 0;
+    for (auto & json : zinc::Log::read(cbor)) {
+        BOOST_REQUIRE(json.dicty("n").stringy() == std::to_string(count));
+        BOOST_TEST(json.dicty("value").stringy().size() == (count % 1000 == 0 ? long_value.size() : 9));
+        BOOST_TEST(std::get<double>(json["ts"]) > 1.6e9);
+        ++ count;
+    }
+    BOOST_TEST(count == 3000);
+
+    // a record still being written is left out
+    fs::path torn = temp_dir / "torn.cbor";
+    fs::copy_file(cbor, torn, fs::copy_options::overwrite_existing);
+    fs::resize_file(torn, fs::file_size(torn) - 3);
+    count = 0;
+    for (auto & json : zinc::Log::read(torn.string(), false, 2)) {
+        (void)json;
+        ++ count;
+    }
+    BOOST_TEST(count == 2999);
+    fs::remove(torn);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
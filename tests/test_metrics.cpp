@@ -0,0 +1,138 @@
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+#include <zinc/metrics.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+BOOST_AUTO_TEST_SUITE(MetricsTest)
+
+BOOST_AUTO_TEST_CASE(metrics_counter_and_gauge)
+{
+    auto & counter = zinc::Metrics::counter("test_events_total", "Events\nof the test");
+    BOOST_TEST(&zinc::Metrics::counter("test_events_total", "") == &counter);
+    BOOST_CHECK_THROW(zinc::Metrics::gauge("test_events_total", ""), std::logic_error);
+
+    std::vector<std::thread> threads;
+    for (int idx = 0; idx < 4; ++ idx) {
+        threads.emplace_back([&]{
+            for (int count = 0; count < 10000; ++ count) {
+                counter.add();
+            }
+        });
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    counter.add(5);
+    BOOST_TEST(counter.value() == 40005u);
+
+    auto & gauge = zinc::Metrics::gauge("test_level", "Level of the test");
+    gauge.set(7);
+    gauge.add(-10);
+    BOOST_TEST(gauge.value() == -3);
+
+    std::string text = zinc::Metrics::text();
+    BOOST_TEST(text.find("# HELP test_events_total Events\\nof the test\n# TYPE test_events_total counter\ntest_events_total 40005\n") != std::string::npos);
+    BOOST_TEST(text.find("# TYPE test_level gauge\ntest_level -3\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_histogram_buckets)
+{
+    using Histogram = zinc::Metrics::Histogram;
+    size_t last = 0;
+    for (uint64_t value : {0ul, 1ul, 15ul, 16ul, 17ul, 100ul, 1000ul, 123456789ul, ~0ul >> 1, ~0ul}) {
+        size_t bucket = Histogram::bucket(value);
+        BOOST_TEST(bucket < Histogram::buckets);
+        BOOST_TEST(bucket >= last);
+        last = bucket;
+        // each bucket holds the values up to its max, within 1/8 of it
+        BOOST_TEST(Histogram::bucket_max(bucket) >= value);
+        BOOST_TEST(Histogram::bucket_max(bucket) - value <= value / 8);
+        BOOST_TEST(Histogram::bucket(Histogram::bucket_max(bucket)) == bucket);
+        if (bucket) {
+            BOOST_TEST(Histogram::bucket(Histogram::bucket_max(bucket - 1) + 1) == bucket);
+        }
+    }
+    BOOST_TEST(Histogram::bucket(~0ul) == Histogram::buckets - 1);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_histogram)
+{
+    auto & histogram = zinc::Metrics::histogram("test_duration_seconds", "Durations of the test", 1e-3);
+    BOOST_TEST(histogram.quantile(0.5) == 0u);
+    std::vector<std::thread> threads;
+    for (int idx = 0; idx < 4; ++ idx) {
+        threads.emplace_back([&]{
+            for (uint64_t value = 1; value <= 1000; ++ value) {
+                histogram.record(value);
+            }
+        });
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    BOOST_TEST(histogram.count() == 4000u);
+    BOOST_TEST(histogram.sum() == 4u * 500500u);
+    BOOST_TEST(histogram.quantile(0) == 1u);
+    BOOST_TEST(histogram.quantile(0.5) >= 500u);
+    BOOST_TEST(histogram.quantile(0.5) <= 500u + 500u / 8);
+    BOOST_TEST(histogram.quantile(0.99) >= 990u);
+    BOOST_TEST(histogram.quantile(1) >= 1000u);
+    // timers record only while metrics are enabled
+    zinc::Metrics::enable(false);
+    {
+        zinc::Metrics::Histogram::Timer timer(histogram);
+    }
+    BOOST_TEST(histogram.count() == 4000u);
+
+    std::string text = zinc::Metrics::text();
+    BOOST_TEST(text.find("# TYPE test_duration_seconds histogram\n") != std::string::npos);
+    BOOST_TEST(text.find("test_duration_seconds_bucket{le=\"0.007\"} 28\n") != std::string::npos);
+    BOOST_TEST(text.find("test_duration_seconds_bucket{le=\"1.023\"} 4000\n") != std::string::npos);
+
+    zinc::Metrics::enable();
+    {
+        zinc::Metrics::Histogram::Timer timer(histogram);
+    }
+    BOOST_TEST(histogram.count() == 4001u);
+    text = zinc::Metrics::text();
+    BOOST_TEST(text.find("test_duration_seconds_bucket{le=\"+Inf\"} 4001\n") != std::string::npos);
+    BOOST_TEST(text.find("test_duration_seconds_count 4001\n") != std::string::npos);
+
+    fs::path path = fs::temp_directory_path() / "zinc-test-metrics.prom";
+    zinc::Metrics::write(path.string());
+    std::stringstream written;
+    written << std::ifstream(path).rdbuf();
+    fs::remove(path);
+    BOOST_TEST(written.str().find("test_duration_seconds_count") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_histogram_bounds)
+{
+    // the bounds are the same whatever was recorded, empty buckets and all
+    auto & histogram = zinc::Metrics::histogram("test_bounds", "Bounds of the test");
+    auto bounds = [] {
+        std::string text = zinc::Metrics::text(), bounds;
+        for (size_t at = text.find("test_bounds_bucket{le=\""); at != std::string::npos; at = text.find("test_bounds_bucket{le=\"", at + 1)) {
+            bounds += text.substr(at, text.find('}', at) - at) + "\n";
+        }
+        return bounds;
+    };
+    std::string empty = bounds();
+    BOOST_TEST(empty.find("{le=\"7\"") != std::string::npos);
+    BOOST_TEST(empty.find("{le=\"15\"") != std::string::npos);
+    BOOST_TEST(empty.find("{le=\"+Inf\"") != std::string::npos);
+    histogram.record(100);
+    histogram.record(123456789);
+    BOOST_TEST(bounds() == empty);
+    BOOST_TEST(zinc::Metrics::text().find("test_bounds_bucket{le=\"127\"} 1\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -50,6 +50,28 @@ void test_chat(OpenAI& client) {
     }
 }
 
+void test_embed(OpenAI& client) {
+    auto inputs = std::to_array<std::string_view>({
+        "The quick brown fox",
+        "jumps over the lazy dog",
+        "The quick brown fox"
+    });
+
+    auto embeddings = client.embed(inputs, span<KeyJSONPair>({
+        {"model", "E5-Mistral-7B-Instruct"}
+    }), 2);
+
+    std::cout << "Embedding dimensions: " << embeddings.dimensions << std::endl;
+
+    if (embeddings.size() != inputs.size() || embeddings.dimensions == 0) {
+        std::cerr << "Test failed: Embeddings missing rows or dimensions." << std::endl;
+    } else if (embeddings.matrix.size() != 2 * embeddings.dimensions || embeddings[0].data() != embeddings[2].data()) {
+        std::cerr << "Test failed: Duplicate inputs were not deduplicated." << std::endl;
+    } else {
+        std::cout << "Embeddings test passed." << std::endl;
+    }
+}
+
 int main() {
     // Initialize the OpenAI with URL, model, and API key.
     // These values should be replaced
@@ -65,6 +87,7 @@ int main() {
     // Run the tests
     test_completion(client);
     test_chat(client);
+    test_embed(client);
 
     return 0;
 }
@@ -0,0 +1,123 @@
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#include <zinc/tokenizer.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace zinc;
+
+// A tiny byte-level vocabulary; "Ġ" is the printable stand-in for a space
+const std::string_view tiny_tokenizer_json = R"({
+    "added_tokens": [{"id": 100, "content": "<|eot|>", "special": true}],
+    "model": {
+        "type": "BPE",
+        "ignore_merges": false,
+        "vocab": {
+            "h": 0, "e": 1, "l": 2, "o": 3, "Ġ": 4, "w": 5, "r": 6, "d": 7, "!": 8, "1": 9,
+            "he": 10, "ll": 11, "hell": 12, "hello": 13,
+            "Ġw": 14, "or": 15, "Ġwor": 16, "Ġworl": 17, "Ġworld": 18,
+            "11": 19
+        },
+        "merges": [
+            "h e", "l l", "he ll", "hell o",
+            ["Ġ", "w"], "o r", "Ġw or", "Ġwor l", "Ġworl d",
+            "1 1"
+        ]
+    }
+})";
+
+// The vocabulary with a token for each byte it lacks, numbered from 200, as a real one has
+std::string with_all_bytes(std::string_view json)
+{
+    std::string bytes;
+    uint32_t id = 200, unprintable = 256;
+    for (uint32_t b = 0; b < 256; ++ b) {
+        // the printable stand-in of the byte, as GPT-2 maps them
+        bool printable = (b >= '!' && b <= '~') || (b >= 0xa1 && b <= 0xac) || (b >= 0xae && b <= 0xff);
+        uint32_t cp = printable ? b : unprintable ++;
+        std::string token;
+        if (cp < 0x80) {
+            token = b == '"' || b == '\\' ? std::string("\\") + (char)b : std::string(1, (char)b);
+        } else {
+            token = {(char)(0xc0 | (cp >> 6)), (char)(0x80 | (cp & 0x3f))};
+        }
+        if (json.find("\"" + token + "\":") == std::string_view::npos) {
+            bytes += ", \"" + token + "\": " + std::to_string(id ++);
+        }
+    }
+    std::string full(json);
+    full.insert(full.find("\"11\": 19") + 8, bytes);
+    return full;
+}
+
+const std::string tokenizer_json = with_all_bytes(tiny_tokenizer_json);
+
+std::vector<uint32_t> ids(std::span<uint32_t const> span)
+{
+    return {span.begin(), span.end()};
+}
+
+BOOST_AUTO_TEST_SUITE(TokenizerTest)
+
+BOOST_AUTO_TEST_CASE(encode_merges_by_rank)
+{
+    Tokenizer tokenizer(tokenizer_json);
+    BOOST_TEST(tokenizer.vocab_size() == 446u);
+    BOOST_TEST(ids(tokenizer.encode("hello world")) == std::vector<uint32_t>({13, 18}));
+    BOOST_TEST(ids(tokenizer.encode("hello")) == std::vector<uint32_t>({13}));
+    BOOST_TEST(ids(tokenizer.encode("hel")) == std::vector<uint32_t>({10, 2}));
+}
+
+BOOST_AUTO_TEST_CASE(pretokenization)
+{
+    Tokenizer tokenizer(tokenizer_json);
+    // the space before the last word stays attached to it
+    BOOST_TEST(ids(tokenizer.encode("hello  world")) == std::vector<uint32_t>({13, 4, 18}));
+    // punctuation is split from words
+    BOOST_TEST(ids(tokenizer.encode("hello!")) == std::vector<uint32_t>({13, 8}));
+    // numbers are split into runs of at most three digits
+    BOOST_TEST(ids(tokenizer.encode("1111")) == std::vector<uint32_t>({19, 9, 9}));
+}
+
+BOOST_AUTO_TEST_CASE(special_tokens)
+{
+    Tokenizer tokenizer(tokenizer_json);
+    BOOST_TEST(ids(tokenizer.encode("hello<|eot|>")).back() == 100);
+    BOOST_TEST(tokenizer.count("hello world<|eot|>") == 3);
+    // without them, each byte the merges leave is a token: "<|" "e" "o" "t" "|>"
+    BOOST_TEST(tokenizer.count("<|eot|>", false) == 7);
+    BOOST_TEST(ids(tokenizer.encode("<|eot|>", false)).size() == 7);
+}
+
+BOOST_AUTO_TEST_CASE(every_byte_is_a_token)
+{
+    // a vocabulary lacking bytes would drop them and count too few
+    BOOST_CHECK_THROW(Tokenizer{tiny_tokenizer_json}, std::invalid_argument);
+    Tokenizer tokenizer(tokenizer_json);
+    BOOST_TEST(tokenizer.count("\x01\xff~ \n") == 5);
+    std::string text = "caf\xc3\xa9 \t{\"x\"}";
+    auto encoded = ids(tokenizer.encode(text));
+    BOOST_TEST(encoded.size() == tokenizer.count(text));
+    BOOST_TEST(tokenizer.decode(encoded) == text);
+}
+
+BOOST_AUTO_TEST_CASE(decode_roundtrip)
+{
+    Tokenizer tokenizer(tokenizer_json);
+    std::string text = "hello world<|eot|>hello";
+    auto encoded = ids(tokenizer.encode(text));
+    BOOST_TEST(tokenizer.decode(encoded) == text);
+}
+
+BOOST_AUTO_TEST_CASE(cached_counts_repeat)
+{
+    Tokenizer tokenizer(tokenizer_json);
+    size_t first = tokenizer.count("hello world hello world");
+    BOOST_TEST(first == 5); // " hello" has no merge for its leading space
+    BOOST_TEST(tokenizer.count("hello world hello world") == first);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
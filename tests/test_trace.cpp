@@ -0,0 +1,103 @@
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+#include <zinc/json.hpp>
+#include <zinc/trace.hpp>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// The events written, by name
+struct Written {
+    zinc::JSON::Doc doc;
+    std::map<std::string_view, zinc::JSON const*> events;
+    size_t size() const { return events.size(); }
+    bool empty() const { return events.empty(); }
+    zinc::JSON const& operator[](std::string_view name) const { return *events.at(name); }
+};
+
+static Written written_events()
+{
+    fs::path path = fs::temp_directory_path() / "zinc-test-trace.json";
+    zinc::Trace::write(path.string());
+    std::stringstream text;
+    text << std::ifstream(path).rdbuf();
+    fs::remove(path);
+    Written written{zinc::JSON::decode(text.str()), {}};
+    for (auto & event : (*written.doc)["traceEvents"].array()) {
+        written.events.emplace(event["name"].string(), &event);
+    }
+    return written;
+}
+
+BOOST_AUTO_TEST_SUITE(TraceTest)
+
+BOOST_AUTO_TEST_CASE(trace_disabled)
+{
+    zinc::Trace::enable(false);
+    zinc::Trace::clear();
+    {
+        zinc::Trace::Span span("off");
+        span.arg("key", "value");
+        BOOST_TEST(span.id() == 0u);
+        zinc::Trace::mark("off mark");
+    }
+    BOOST_TEST(written_events().empty());
+}
+
+BOOST_AUTO_TEST_CASE(trace_spans)
+{
+    zinc::Trace::enable();
+    zinc::Trace::clear();
+    uint64_t outer_id, inner_id;
+    {
+        zinc::Trace::Span outer("outer");
+        outer_id = outer.id();
+        BOOST_TEST(outer_id != 0u);
+        {
+            zinc::Trace::Span inner("inner");
+            inner_id = inner.id();
+            inner.arg("text", "a \"quoted\" value").arg("count", 3);
+            zinc::Trace::mark("mark");
+        }
+        std::thread([&]{
+            zinc::Trace::Span handed("handed", outer_id);
+            zinc::Trace::Span nested("nested");
+        }).join();
+        zinc::Trace::Span early("early");
+        early.end();
+        zinc::Trace::Span after("after");
+    }
+    zinc::Trace::enable(false);
+
+    auto events = written_events();
+    BOOST_REQUIRE(events.size() == 7);
+    auto & outer = events["outer"], & inner = events["inner"];
+    BOOST_TEST(outer["ph"].string() == "X");
+    BOOST_TEST(std::get<long>(outer["args"]["id"]) == (long)outer_id);
+    BOOST_TEST(std::get<long>(outer["args"]["parent"]) == 0);
+    BOOST_TEST(std::get<long>(inner["args"]["parent"]) == (long)outer_id);
+    BOOST_TEST(inner["args"]["text"].string() == "a \"quoted\" value");
+    BOOST_TEST(std::get<long>(inner["args"]["count"]) == 3);
+    BOOST_TEST(events["mark"]["ph"].string() == "i");
+    BOOST_TEST(std::get<long>(events["mark"]["args"]["parent"]) == (long)inner_id);
+    BOOST_TEST(std::get<long>(events["handed"]["args"]["parent"]) == (long)outer_id);
+    BOOST_TEST(std::get<long>(events["nested"]["args"]["parent"]) == std::get<long>(events["handed"]["args"]["id"]));
+    BOOST_TEST(std::get<long>(events["handed"]["tid"]) != std::get<long>(outer["tid"]));
+    // an ended span is no longer the parent
+    BOOST_TEST(std::get<long>(events["after"]["args"]["parent"]) == (long)outer_id);
+
+    // spans lie within their parents
+    auto begin = [](zinc::JSON const& event) { return std::get<double>(event["ts"]); };
+    auto end = [&](zinc::JSON const& event) { return begin(event) + std::get<double>(event["dur"]); };
+    BOOST_TEST(begin(inner) >= begin(outer));
+    BOOST_TEST(end(inner) <= end(outer));
+    BOOST_TEST(begin(events["mark"]) >= begin(inner));
+    BOOST_TEST(begin(events["mark"]) <= end(inner));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
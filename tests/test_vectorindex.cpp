@@ -0,0 +1,179 @@
+#define BOOST_TEST_MAIN
+#include <boost/test/unit_test.hpp>
+
+#include <zinc/configuration.hpp>
+#include <zinc/vectorindex.hpp>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+using namespace zinc;
+
+// Embeds text as a histogram of its letters, standing in for a server
+OpenAI::Embeddings letter_embedder(std::span<std::string_view const> texts, size_t & calls)
+{
+    OpenAI::Embeddings result;
+    result.dimensions = 26;
+    result.matrix.resize(texts.size() * 26);
+    for (size_t idx = 0; idx < texts.size(); ++ idx) {
+        for (char c : texts[idx]) {
+            if (c >= 'a' && c <= 'z') {
+                result.matrix[idx * 26 + (size_t)(c - 'a')] += 1;
+            }
+        }
+        result.rows.emplace_back(idx);
+    }
+    calls += texts.size();
+    return result;
+}
+
+struct ProjectDirectory {
+    ProjectDirectory() {
+        std::ostringstream oss;
+        oss << "zinc-test-vectorindex-" << getpid();
+        path = fs::temp_directory_path() / oss.str();
+        fs::create_directories(path / ".zinc");
+        fs::current_path(path);
+    }
+    ~ProjectDirectory() {
+        fs::current_path(fs::temp_directory_path());
+        fs::remove_all(path);
+    }
+    fs::path path;
+};
+
+BOOST_AUTO_TEST_SUITE(VectorIndexTest)
+
+BOOST_AUTO_TEST_CASE(dot_product)
+{
+    std::vector<float> a(37), b(37);
+    float expected = 0;
+    for (size_t i = 0; i < a.size(); ++ i) {
+        a[i] = (float)i * 0.5f;
+        b[i] = 2.0f - (float)i;
+        expected += a[i] * b[i];
+    }
+    BOOST_TEST(VectorIndex::dot(a.data(), b.data(), a.size()) == expected, boost::test_tools::tolerance(1e-4f));
+}
+
+BOOST_AUTO_TEST_CASE(search_update_and_reload)
+{
+    ProjectDirectory project;
+    size_t calls = 0;
+    auto embedder = [&](std::span<std::string_view const> texts) { return letter_embedder(texts, calls); };
+
+    std::ofstream("aaa.txt") << "aaaa\naaab\n";
+    std::ofstream("zzz.txt") << "zzzz\nzzzy\n";
+    auto paths = std::to_array<std::string_view>({"aaa.txt", "zzz.txt"});
+
+    {
+        VectorIndex index;
+        BOOST_TEST(index.update(paths, embedder, 1) == 4);
+        BOOST_TEST(index.files().size() == 2);
+        BOOST_TEST(index.chunks().size() == 4);
+
+        auto matches = index.search("zzz", embedder, 2);
+        BOOST_REQUIRE_EQUAL(matches.size(), 2);
+        BOOST_TEST(matches[0].score >= matches[1].score);
+        BOOST_TEST(index.text(matches[0].chunk) == "zzzz\n");
+        BOOST_TEST(index.files()[index.chunks()[matches[1].chunk].file].path == "zzz.txt");
+
+        // unchanged files are not re-embedded
+        calls = 0;
+        BOOST_TEST(index.update(paths, embedder, 1) == 0);
+        BOOST_TEST(calls == 0);
+    }
+
+    // the index persists across instances and only changed files are embedded
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::ofstream("aaa.txt") << "bbbb\n";
+    {
+        VectorIndex index;
+        BOOST_TEST(index.chunks().size() == 4);
+        BOOST_TEST(index.update(paths, embedder, 1) == 1);
+        BOOST_TEST(index.chunks().size() == 3);
+        auto matches = index.search("bb", embedder, 1);
+        BOOST_REQUIRE_EQUAL(matches.size(), 1);
+        BOOST_TEST(index.text(matches[0].chunk) == "bbbb\n");
+    }
+
+    // removed files are dropped
+    fs::remove("zzz.txt");
+    {
+        VectorIndex index;
+        index.update({}, embedder);
+        BOOST_TEST(index.files().size() == 1);
+        BOOST_TEST(index.chunks().size() == 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(unsaved_changes)
+{
+    ProjectDirectory project;
+    size_t calls = 0;
+    auto embedder = [&](std::span<std::string_view const> texts) { return letter_embedder(texts, calls); };
+
+    std::ofstream("aaa.txt") << "aaaa\n";
+    auto paths = std::to_array<std::string_view>({"aaa.txt"});
+    {
+        VectorIndex index;
+        BOOST_TEST(index.update(paths, embedder, 1) == 1);
+        // the index can no longer be written where it was opened
+        fs::remove_all(".zinc/index");
+        std::ofstream(".zinc/index") << "";
+        BOOST_CHECK_THROW(index.save(), std::runtime_error);
+        // and the destructor reports it rather than throwing
+    }
+}
+
+BOOST_AUTO_TEST_CASE(failed_embedding)
+{
+    ProjectDirectory project;
+    size_t calls = 0;
+    auto embedder = [&](std::span<std::string_view const> texts) { return letter_embedder(texts, calls); };
+    auto failing = [](std::span<std::string_view const>) -> OpenAI::Embeddings {
+        throw std::runtime_error("embedding server unreachable");
+    };
+
+    std::ofstream("aaa.txt") << "aaaa\naaab\n";
+    std::ofstream("mmm.txt") << "mmmm\n";
+    std::ofstream("zzz.txt") << "zzzz\n";
+    auto paths = std::to_array<std::string_view>({"aaa.txt", "mmm.txt", "zzz.txt"});
+    {
+        VectorIndex index;
+        BOOST_TEST(index.update(paths, embedder, 1) == 4);
+    }
+
+    // a changed file and a removed one are kept while the embedder fails
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::ofstream("aaa.txt") << "bbbb\n";
+    fs::remove("zzz.txt");
+    {
+        VectorIndex index;
+        BOOST_CHECK_THROW(index.update(paths, failing, 1), std::runtime_error);
+        BOOST_TEST(index.files().size() == 3);
+        BOOST_TEST(index.chunks().size() == 4);
+    }
+    {
+        VectorIndex index;
+        BOOST_TEST(index.files().size() == 3);
+        BOOST_TEST(index.chunks().size() == 4);
+
+        // and dropped once it succeeds, with the new chunks numbered after the files that are left
+        BOOST_TEST(index.update(paths, embedder, 1) == 1);
+        BOOST_TEST(index.files().size() == 2);
+        BOOST_REQUIRE_EQUAL(index.chunks().size(), 2);
+        BOOST_TEST(index.files()[index.chunks()[0].file].path == "mmm.txt");
+        BOOST_TEST(index.files()[index.chunks()[1].file].path == "aaa.txt");
+        BOOST_TEST(index.files()[1].first_chunk == 1u);
+        auto matches = index.search("bb", embedder, 1);
+        BOOST_REQUIRE_EQUAL(matches.size(), 1);
+        BOOST_TEST(index.text(matches[0].chunk) == "bbbb\n");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()